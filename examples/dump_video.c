@@ -143,6 +143,40 @@ static int queue_page(ogg_page *page, ogg_stream_state *to, int daala_p) {
   return 0;
 }
 
+/*Reads the seek index in the file name.
+  Return: The number of entries, with the entries in *points, or a negative
+   value on failure.*/
+static int read_seek_index(const char *name, daala_seek_point **points) {
+  FILE *f;
+  unsigned char *buf;
+  size_t buf_sz;
+  size_t nread;
+  int npoints;
+  f = fopen(name, "rb");
+  if (f == NULL) return -1;
+  buf = NULL;
+  buf_sz = 0;
+  nread = 0;
+  do {
+    buf_sz += 4096;
+    buf = (unsigned char *)realloc(buf, buf_sz);
+    if (buf == NULL) break;
+    nread += fread(buf + nread, 1, buf_sz - nread, f);
+  }
+  while (nread == buf_sz);
+  fclose(f);
+  if (buf == NULL) return -1;
+  npoints = daala_seek_index_unpack(NULL, 0, buf, nread);
+  *points = NULL;
+  if (npoints > 0) {
+    *points = (daala_seek_point *)malloc(npoints*sizeof(**points));
+    if (*points == NULL) npoints = -1;
+    else daala_seek_index_unpack(*points, npoints, buf, nread);
+  }
+  free(buf);
+  return npoints;
+}
+
 static void usage(void) {
   fprintf(stderr,
    "Usage: dumpvid [options] [<file.ogv>] [-o outfile.y4m]\n"
@@ -153,6 +187,11 @@ static void usage(void) {
    "                            decompressed data is sent to stdout.\n"
    "  -r --raw                  Output raw YUV with no framing instead\n"
    "                            of YUV4MPEG2 (the default).\n"
+   "  -s --start <n>            Skip the frames before frame <n>,\n"
+   "                            counting from 0.\n"
+   "  -i --index <file>         Seek index made by daalaindex, used\n"
+   "                            to start decoding at the last\n"
+   "                            keyframe before --start.\n"
    "     --version              Displays version information.\n");
   exit(EXIT_FAILURE);
 }
@@ -176,10 +215,12 @@ int main(int argc, char *argv[]) {
   daala_setup_info *ds;
   daala_dec_ctx *dd;
   daala_image img;
-  const char *optstring = "o:r";
+  const char *optstring = "o:rs:i:";
   struct option options [] = {
    { "output", required_argument, NULL, 'o' },
    { "raw", no_argument, NULL, 'r' }, /*Disable YUV4MPEG2 headers:*/
+   { "start", required_argument, NULL, 's' },
+   { "index", required_argument, NULL, 'i' },
    { "version", no_argument, NULL, 0},
    { NULL, 0, NULL, 0 }
   };
@@ -191,6 +232,12 @@ int main(int argc, char *argv[]) {
   /* single frame video buffering */
   int videobuf_ready = 0;
   int raw = 0;
+  /*The first frame to output, and the number of the next one decoded.*/
+  ogg_int64_t start_frame = 0;
+  ogg_int64_t frame_number = 0;
+  const char *index_name = NULL;
+  /*The number of packets to drop after seeking.*/
+  int skip_packets = 0;
   FILE *outfile = NULL;
   ogg_int32_t pic_width = 0;
   ogg_int32_t pic_height = 0;
@@ -228,6 +275,18 @@ int main(int argc, char *argv[]) {
         raw = 1;
         break;
       }
+      case 's': {
+        start_frame = atol(optarg);
+        if (start_frame < 0) {
+          fprintf(stderr, "Invalid start frame: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      }
+      case 'i': {
+        index_name = optarg;
+        break;
+      }
       case 0: {
         if (strcmp(options[long_option_index].name, "version") == 0) {
           version();
@@ -414,6 +473,33 @@ int main(int argc, char *argv[]) {
      pull data when any one of them stalls.*/
 
   stateflag = 0; /* playback has not begun */
+  if (daala_p && start_frame > 0 && index_name != NULL) {
+    daala_seek_point *points;
+    int npoints;
+    int pointi;
+    npoints = read_seek_index(index_name, &points);
+    if (npoints < 0) {
+      fprintf(stderr, "Unable to read the seek index '%s'.\n", index_name);
+      exit(1);
+    }
+    pointi = daala_seek_index_find(points, npoints, start_frame);
+    if (pointi >= 0) {
+      if (points[pointi].offset > LONG_MAX
+       || fseek(infile, (long)points[pointi].offset, SEEK_SET) != 0) {
+        fprintf(stderr, "Unable to seek in the input file.\n");
+        exit(1);
+      }
+      /*Drop everything read so far and start over at the keyframe.*/
+      ogg_sync_reset(&oy);
+      ogg_stream_reset(&to);
+      skip_packets = points[pointi].skip;
+      frame_number = points[pointi].frame;
+      daala_decode_ctl(dd, OD_DECCTL_RESTART_AT_KEYFRAME, NULL, 0);
+      fprintf(stderr, "Starting at keyframe %ld, offset %ld\n",
+       (long)frame_number, (long)points[pointi].offset);
+    }
+    free(points);
+  }
   /* queue any remaining pages from data we buffered but that did not
       contain headers */
   while (ogg_sync_pageout(&oy, &og) > 0) {
@@ -422,6 +508,10 @@ int main(int argc, char *argv[]) {
   while (!got_sigint) {
     while (daala_p && !videobuf_ready) {
       if (ogg_stream_packetout(&to, &op) > 0) {
+        if (skip_packets > 0) {
+          skip_packets--;
+          continue;
+        }
         ogg_to_daala_packet(&dp, &op);
         if (daala_decode_packet_in(dd, &dp) >= 0) {
           videobuf_ready = 1;
@@ -440,13 +530,13 @@ int main(int argc, char *argv[]) {
     }
     /* dumpvideo frame, and get new one */
     else if (outfile && daala_decode_img_out(dd, &img)) {
-      video_write(outfile, &img, raw);
+      if (frame_number++ >= start_frame) video_write(outfile, &img, raw);
     }
     videobuf_ready = 0;
   }
   /*Flush the output frame buffer of decoder.*/
   while (!got_sigint && daala_decode_img_out(dd, &img)) {
-    video_write(outfile, &img, raw);
+    if (frame_number++ >= start_frame) video_write(outfile, &img, raw);
   }
   /* end of decoder loop -- close everything */
   if (daala_p) {
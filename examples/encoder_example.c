@@ -558,10 +558,14 @@ static const struct option OPTIONS[] = {
   { "no-dering", no_argument, NULL, 0 },
   { "fpr", no_argument, NULL, 0 },
   { "no-fpr", no_argument, NULL, 0 },
+  { "screen-content", optional_argument, NULL, 0 },
+  { "deadline", required_argument, NULL, 0 },
+  { "chunk-rows", required_argument, NULL, 0 },
   { "qm", required_argument, NULL, 0 },
   { "mv-res-min", required_argument, NULL, 0 },
   { "mv-level-min", required_argument, NULL, 0 },
   { "mv-level-max", required_argument, NULL, 0 },
+  { "stream-version", required_argument, NULL, 0 },
   { "version", no_argument, NULL, 0},
   { NULL, 0, NULL, 0 }
 };
@@ -623,6 +627,20 @@ static void usage(void) {
    "                                 postprocessing filter.\n"
    "     --[no-]fpr                  Disable (default) or enable full \n"
    "                                 precision references.\n"
+   "     --screen-content[=<n>]      Tune for screen content: detect exact\n"
+   "                                 block copies and skip their residual.\n"
+   "                                 2 => also skip blocks whose input is\n"
+   "                                 unchanged, which is faster but keeps\n"
+   "                                 their coding error.\n"
+   "     --deadline <n>              Target encoding time per frame in\n"
+   "                                 microseconds. The complexity is lowered\n"
+   "                                 as needed to meet it. 0 => no deadline\n"
+   "                                 (default).\n"
+   "     --chunk-rows <n>            Output each frame as several packets of\n"
+   "                                 <n> superblock rows each, for low\n"
+   "                                 latency streaming. 0 => one packet per\n"
+   "                                 frame (default). Needs\n"
+   "                                 --stream-version 3.\n"
    "     --qm <n>                    Select quantization matrix\n"
    "                                 0 => flat, 1 => hvs (default)\n"
    "     --mv-res-min <n>            Minimum motion vectors resolution for the\n"
@@ -633,6 +651,11 @@ static void usage(void) {
    "                                 0 (default) and 6.\n"
    "     --mv-level-max <n>          Maximum motion vectors level between\n"
    "                                 0 and 6 (default).\n"
+   "     --stream-version <n>        Minor bitstream version to produce.\n"
+   "                                 0 => original (default), 1 => PVQ\n"
+   "                                 codewords coded as runs, 2 => packed\n"
+   "                                 frame headers, 3 => frames split into\n"
+   "                                 packets.\n"
    "     --version                   Displays version information.\n"
    " encoder_example accepts only uncompressed YUV4MPEG2 video.\n\n");
   exit(1);
@@ -683,6 +706,10 @@ int main(int argc, char **argv) {
   int current_frame_no;
   int output_provided;
   int b_frames;
+  int screen_content;
+  int deadline;
+  int chunk_rows;
+  int stream_version;
   char default_filename[1024];
   clock_t t0;
   clock_t t1;
@@ -722,6 +749,10 @@ int main(int argc, char **argv) {
   mv_level_max = 6;
   output_provided = 0;
   b_frames = 0;
+  screen_content = 0;
+  deadline = 0;
+  chunk_rows = 0;
+  stream_version = OD_STREAM_VERSION_MINOR_BASE;
   while ((c = getopt_long(argc, argv, OPTSTRING, OPTIONS, &loi)) != EOF) {
     switch (c) {
       case 'o': {
@@ -845,6 +876,27 @@ int main(int argc, char **argv) {
         else if (strcmp(OPTIONS[loi].name, "no-fpr") == 0) {
           use_fpr = 0;
         }
+        else if (strcmp(OPTIONS[loi].name, "screen-content") == 0) {
+          screen_content = optarg != NULL ? atoi(optarg) : 1;
+          if (screen_content < 1 || screen_content > 2) {
+            fprintf(stderr, "Illegal value for --screen-content\n");
+            exit(1);
+          }
+        }
+        else if (strcmp(OPTIONS[loi].name, "deadline") == 0) {
+          deadline = atoi(optarg);
+          if (deadline < 0) {
+            fprintf(stderr, "Illegal value for --deadline\n");
+            exit(1);
+          }
+        }
+        else if (strcmp(OPTIONS[loi].name, "chunk-rows") == 0) {
+          chunk_rows = atoi(optarg);
+          if (chunk_rows < 0) {
+            fprintf(stderr, "Illegal value for --chunk-rows\n");
+            exit(1);
+          }
+        }
         else if (strcmp(OPTIONS[loi].name, "mv-res-min") == 0) {
           mv_res_min = atoi(optarg);
           if (mv_res_min < 0 || mv_res_min > 2) {
@@ -883,6 +935,14 @@ int main(int argc, char **argv) {
             exit(1);
           }
         }
+        else if (strcmp(OPTIONS[loi].name, "stream-version") == 0) {
+          stream_version = atoi(optarg);
+          if (stream_version < OD_STREAM_VERSION_MINOR_BASE
+           || stream_version > OD_STREAM_VERSION_MINOR_CHUNKS) {
+            fprintf(stderr, "Illegal value for --stream-version\n");
+            exit(1);
+          }
+        }
         else if (strcmp(OPTIONS[loi].name, "version") == 0) {
           version();
         }
@@ -928,6 +988,7 @@ int main(int argc, char **argv) {
     serial = rand();
   }
   daala_info_init(&di);
+  di.version_minor = stream_version;
   di.pic_width = avin.video_pic_w;
   di.pic_height = avin.video_pic_h;
   switch (avin.video_depth) {
@@ -994,6 +1055,15 @@ int main(int argc, char **argv) {
   daala_encode_ctl(dd, OD_SET_MV_LEVEL_MIN, &mv_level_min, sizeof(mv_level_min));
   daala_encode_ctl(dd, OD_SET_MV_LEVEL_MAX, &mv_level_max, sizeof(mv_level_max));
   daala_encode_ctl(dd, OD_SET_B_FRAMES, &b_frames, sizeof(b_frames));
+  daala_encode_ctl(dd, OD_SET_SCREEN_CONTENT, &screen_content,
+   sizeof(screen_content));
+  daala_encode_ctl(dd, OD_SET_DEADLINE, &deadline, sizeof(deadline));
+  if (daala_encode_ctl(dd, OD_SET_CHUNK_ROWS, &chunk_rows,
+   sizeof(chunk_rows)) != OD_SUCCESS) {
+    fprintf(stderr, "--chunk-rows requires --stream-version %i or later.\n",
+     OD_STREAM_VERSION_MINOR_CHUNKS);
+    exit(1);
+  }
   if (video_r > 0) {
     /*Account for the Ogg page overhead.
       This is 1 byte per 255 for lacing values, plus 26 bytes per 4096
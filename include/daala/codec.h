@@ -200,9 +200,34 @@ struct daala_plane_info {
 #define OD_BITDEPTH_MODE_12 (3)
 /*@}*/
 
+/**\name Stream versions
+ * The minor versions of the bitstream that this library can encode and
+ *  decode.
+ * daala_info_init() selects #OD_STREAM_VERSION_MINOR_BASE.
+ * Set daala_info::version_minor to a later version before creating an
+ *  encoder to use the coding tools it adds.
+ * Each version includes the tools of the versions before it.*/
+/*@{*/
+/**The original bitstream.*/
+#define OD_STREAM_VERSION_MINOR_BASE (0)
+/**Codes each PVQ codeword as runs of zeros and magnitudes with 16-ary
+ * adaptive symbols instead of recursive splits.*/
+#define OD_STREAM_VERSION_MINOR_PVQ_RUNS (1)
+/**Packs the flags of each frame header into a single run of raw bits.*/
+#define OD_STREAM_VERSION_MINOR_PACKED_HEADER (2)
+/**Lets a frame be split into several packets (see #OD_SET_CHUNK_ROWS).
+ * The packets after the first start with the same packet type and keyframe
+ *  bits as a frame header, both 0, followed by a flag that sets them apart
+ *  from the start of an inter frame.*/
+#define OD_STREAM_VERSION_MINOR_CHUNKS (3)
+/*@}*/
+
 /** Configuration parameters for a codec instance. */
 struct daala_info {
+  /** The bitstream version.
+   *  The decoder rejects streams with a version newer than it supports.*/
   unsigned char version_major;
+  /** One of the OD_STREAM_VERSION_MINOR_* values. */
   unsigned char version_minor;
   unsigned char version_sub;
   /** pic_width,_height form a region of interest to encode */
@@ -44,9 +44,164 @@ extern "C" {
  *              same format as the decoder output images. */
 #define OD_DECCTL_SET_MC_IMG       (7007)
 #define OD_DECCTL_GET_ACCOUNTING   (7009)
+/** Enable or disable bit accounting.
+ * Only available when the library was built with accounting support.
+ * \param[in]  <tt>int</tt>: One of #OD_ACCOUNTING_DISABLED,
+ *              #OD_ACCOUNTING_SYMBOLS or #OD_ACCOUNTING_TOTALS. */
 #define OD_DECCTL_SET_ACCOUNTING_ENABLED (7011)
 #define OD_DECCTL_SET_DERING_BUFFER (7013)
+/** Select low-memory decoding.
+ * In low-memory mode, the motion-compensation and deringing working buffers
+ *  only hold the superblock rows currently being reconstructed instead of the
+ *  whole frame.
+ * The decoded output is identical.
+ * \param[in]  <tt>int</tt>: Non-zero to enable low-memory mode, or 0 to
+ *              return to full-frame buffers. */
+#define OD_DECCTL_SET_LOW_MEMORY (7015)
+/** Report how much memory the decoder is using.
+ * \param[out] <tt>od_dec_memory_footprint</tt>: Filled in with the sizes of
+ *              the decoder's allocations. */
+#define OD_DECCTL_GET_MEMORY_FOOTPRINT (7017)
+/** Reconstruct frames directly into application-supplied buffers.
+ * Each frame is decoded into a buffer obtained from the
+ *  daala_frame_buffer_funcs get callback and is used both as a reference
+ *  frame and, without a copy, as the image returned by
+ *  daala_decode_img_out().
+ * The decoder holds a buffer while it is a reference frame, while it is
+ *  waiting in the reorder queue, and until the next call to
+ *  daala_decode_packet_in() or daala_decode_img_out() after it was output.
+ * The release callback is called once none of these apply; an application
+ *  that wants to keep displaying the frame after that point keeps its own
+ *  reference (e.g., a count in <tt>priv</tt>) and must not reuse the memory
+ *  until it drops it.
+ * This must be set before the first packet is decoded.
+ * \param[in]  <tt>daala_frame_buffer_funcs</tt>: The callbacks.
+ * \retval OD_EIMPL if the stream uses full-precision references, whose
+ *                   format differs from that of the output images. */
+#define OD_DECCTL_SET_FRAME_BUFFER_FUNCS (7019)
+/** Get the application buffer backing the image most recently returned by
+ *  daala_decode_img_out().
+ * \param[out] <tt>daala_frame_buffer</tt>: The buffer, as it was filled in by
+ *              the get callback.
+ * \retval OD_EINVAL if no application buffers are in use or no image has
+ *                   been returned since the last packet. */
+#define OD_DECCTL_GET_FRAME_BUFFER (7021)
+/** Get the bit totals of the frame being decoded, by symbol class and by
+ *  superblock.
+ * The totals cover every packet of the frame decoded so far.
+ * \param[out] <tt>od_accounting_totals</tt>: The totals.
+ *              The arrays it points to belong to the decoder and are
+ *              overwritten by the next frame.
+ * \retval OD_EINVAL if accounting is not enabled. */
+#define OD_DECCTL_GET_ACCOUNTING_TOTALS (7023)
+/** Drop all decoding state so decoding can resume at a keyframe, e.g., after
+ *  seeking.
+ * Frames not yet retrieved are discarded, but all settings and the buffers
+ *  set with the other controls are kept.
+ * daala_decode_packet_in() then rejects packets with #OD_EBADPACKET until the
+ *  first packet of a keyframe, including the remaining packets of a frame
+ *  that started earlier, and silently drops the B-frames (with all their
+ *  packets) that follow it but are displayed before it, since they cannot be
+ *  decoded.
+ * The next image returned by daala_decode_img_out() is the keyframe.
+ * \param[in] <tt>NULL</tt>: No parameter. */
+#define OD_DECCTL_RESTART_AT_KEYFRAME (7025)
 
+/** An application-supplied frame buffer.
+ * See #OD_DECCTL_SET_FRAME_BUFFER_FUNCS. */
+typedef struct {
+  /** The start of the buffer, which must be 32-byte aligned. */
+  unsigned char *data;
+  /** The size of the buffer in bytes. */
+  size_t size;
+  /** Application-private data, passed back to the release callback. */
+  void *priv;
+} daala_frame_buffer;
+
+/** Allocates a frame buffer.
+ * \param ctx  The <tt>ctx</tt> member of #daala_frame_buffer_funcs.
+ * \param size The minimum number of bytes needed.
+ *             This is the same for every frame of a stream.
+ * \param[out] fb Filled in with the buffer.
+ *                Its contents need not be initialized.
+ * \return 0 on success, or a negative value on failure. */
+typedef int (*daala_get_frame_buffer_func)(void *ctx, size_t size,
+ daala_frame_buffer *fb);
+
+/** Returns a frame buffer to the application once the decoder no longer
+ *  needs it.
+ * \param ctx The <tt>ctx</tt> member of #daala_frame_buffer_funcs.
+ * \param fb  The buffer, as filled in by the get callback. */
+typedef void (*daala_release_frame_buffer_func)(void *ctx,
+ daala_frame_buffer *fb);
+
+/** The frame buffer callbacks set with
+ *  #OD_DECCTL_SET_FRAME_BUFFER_FUNCS. */
+typedef struct {
+  daala_get_frame_buffer_func get;
+  daala_release_frame_buffer_func release;
+  /** Passed to both callbacks. */
+  void *ctx;
+} daala_frame_buffer_funcs;
+
+/** Decoder memory use, in bytes, as reported by
+ *  #OD_DECCTL_GET_MEMORY_FOOTPRINT. */
+typedef struct {
+  /** The reference frames, including their padding, and the MC scratch
+      buffers. */
+  size_t reference_frames;
+  /** The per-plane transform-domain working buffers. */
+  size_t working_buffers;
+  /** Per-block side information: block sizes, skip flags, motion vectors
+      and deringing levels.
+      The quantization matrices are shared by all decoders and not
+      counted. */
+  size_t side_info;
+  /** The sum of the above and the decoder context itself. */
+  size_t total;
+} od_dec_memory_footprint;
+
+/** The header of a video frame, as returned by daala_decode_frame_header(). */
+typedef struct {
+  /** Whether the frame is a keyframe. */
+  int is_keyframe;
+  /** Whether the frame is a B-frame, which no other frame refers to. */
+  int is_b_frame;
+  /** The display number of the frame, modulo 16.
+      Frames are coded out of display order when B-frames are used. */
+  int frame_number;
+  /** The number of packets the frame is coded in (see
+      #OD_SET_CHUNK_ROWS), starting with this one. */
+  int npackets;
+} daala_frame_header;
+
+/** An entry in a keyframe seek index.
+ * See daala_seek_index_pack(). */
+typedef struct {
+  /** The display number of the keyframe, counting from 0 at the start of
+      the stream. */
+  int64_t frame;
+  /** The byte offset in the file of the Ogg page on which the first packet
+      of the keyframe starts. */
+  int64_t offset;
+  /** The number of video packets that start on that page before the
+      keyframe. */
+  int skip;
+} daala_seek_point;
+
+
+/**\name Accounting modes
+ * Values for #OD_DECCTL_SET_ACCOUNTING_ENABLED.*/
+/*@{*/
+/** No accounting. */
+#define OD_ACCOUNTING_DISABLED (0)
+/** Record every symbol for #OD_DECCTL_GET_ACCOUNTING, and keep the totals. */
+#define OD_ACCOUNTING_SYMBOLS (1)
+/** Only keep the totals for #OD_DECCTL_GET_ACCOUNTING_TOTALS.
+ * This does no allocation or lookup per symbol and is cheap enough to leave
+ *  on. */
+#define OD_ACCOUNTING_TOTALS (2)
+/*@}*/
 
 #define OD_ACCT_FRAME (10)
 #define OD_ACCT_MV (11)
@@ -89,6 +244,32 @@ typedef struct {
   od_accounting_dict dict;
 } od_accounting;
 
+/** Bit totals for one frame, as returned by
+ *  #OD_DECCTL_GET_ACCOUNTING_TOTALS.
+ * All sizes are in units of 1/8 bit. */
+typedef struct {
+  /** The number of symbol classes. */
+  int nclasses;
+  /** The name of each class, the same as in #od_accounting_dict. */
+  const char *const *class_names;
+  /** The bits spent on each class. */
+  const uint32_t *class_bits_q3;
+  /** The number of superblocks in each row. */
+  int nhsb;
+  /** The number of superblock rows. */
+  int nvsb;
+  /** The bits spent in each superblock, in raster order.
+      Coefficient symbols count towards the superblock containing their
+       block, and motion vector symbols towards the one containing their grid
+       point. */
+  const uint32_t *sb_bits_q3;
+  /** The bits spent on frame-level symbols (#OD_ACCT_FRAME), which do not
+      belong to any superblock. */
+  uint32_t frame_bits_q3;
+  /** The bits spent on all symbols. */
+  uint32_t total_bits_q3;
+} od_accounting_totals;
+
 
 /**\name Decoder state
    The following data structures are opaque, and their contents are not
@@ -164,6 +345,31 @@ int daala_decode_header_in(daala_info *info,
  * \retval NULL If the decoding parameters were invalid.*/
 daala_dec_ctx *daala_decode_create(const daala_info *info,
  const daala_setup_info *setup);
+/**Re-targets an existing decoder instance at a new stream, reusing all of
+ *  its storage.
+ * This is much cheaper than daala_decode_free() followed by
+ *  daala_decode_create().
+ * The new stream must have the same planes, bit depth and reference
+ *  precision, and a frame no larger than the stream \a dec was created for.
+ * Any frames not yet retrieved are discarded and any application frame
+ *  buffers are released.
+ * Settings made with #OD_DECCTL_SET_LOW_MEMORY and
+ *  #OD_DECCTL_SET_FRAME_BUFFER_FUNCS are kept, but the buffers set with the
+ *  other <tt>OD_DECCTL_SET_*</tt> controls are sized for the old frame and
+ *  must be set again.
+ * \param dec A #daala_dec_ctx handle.
+ * \param info A #daala_info struct filled via daala_decode_header_in().
+ * \param setup A #daala_setup_info handle returned via
+ *               daala_decode_header_in().
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a dec or \a info was <tt>NULL</tt>.
+ * \retval OD_EINVAL The new stream does not fit in \a dec.
+ *                    \a dec is left unchanged.
+ * \retval OD_EVERSION The new stream uses a bitstream version not decodable
+ *                     with this version of <tt>libdaaladec</tt>.
+ *                     \a dec is left unchanged.*/
+int daala_decode_reset(daala_dec_ctx *dec, const daala_info *info,
+ const daala_setup_info *setup);
 /**Releases all storage used for the decoder setup information.
  * This should be called after you no longer want to create any decoders for
  *  a stream whose headers you have parsed with daala_decode_header_in().
@@ -184,6 +390,14 @@ int daala_decode_ctl(daala_dec_ctx *dec,
  * \param dec A #daala_dec_ctx handle.*/
 void daala_decode_free(daala_dec_ctx *dec);
 /**Retrieves decoded video data frames.
+ * A frame the encoder split into several packets of superblock rows (see
+ *  #OD_SET_CHUNK_ROWS) is decoded as each of its packets comes in, and only
+ *  becomes available from daala_decode_img_out() once its last packet has
+ *  been submitted.
+ * Its packets must be submitted in order: if one is missing, the rest of the
+ *  frame is discarded, and its later packets are rejected with
+ *  #OD_EBADPACKET.
+ * The first packet of the next frame is decoded as usual.
  * \param dec A #daala_dec_ctx handle.*/
 int daala_decode_packet_in(daala_dec_ctx *dec, const daala_packet *dp);
 /**Outputs the next available decoded image frame.
@@ -196,6 +410,75 @@ int daala_decode_packet_in(daala_dec_ctx *dec, const daala_packet *dp);
  *            unchanged.
  * \retval OD_EFAULT One of \a dec or \a img was <tt>NULL</tt>.*/
 int daala_decode_img_out(daala_dec_ctx *dec, daala_image *img);
+/**Reads the header of a video frame without decoding it.
+ * This needs no decoder instance, so a file can be scanned for keyframes
+ *  cheaply.
+ * \param info A #daala_info struct filled via daala_decode_header_in().
+ * \param dp   The first packet of a frame.
+ *             When a frame is coded in several packets, the others must be
+ *              skipped, using the <tt>npackets</tt> member of \a hdr.
+ * \param[out] hdr Filled in with the frame header.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT One of \a info, \a dp, or \a hdr was <tt>NULL</tt>.
+ * \retval OD_EBADPACKET \a dp does not start a video frame.*/
+int daala_decode_frame_header(const daala_info *info, const daala_packet *dp,
+ daala_frame_header *hdr);
+
+/*@}*/
+
+/**\name Functions for seeking
+ * A seek index lists the keyframes of a stream with the position of their
+ *  packets in the file.
+ * It is built by scanning the file once, e.g., with the
+ *  <tt>daalaindex</tt> tool, and stored alongside it.
+ * To start playback at a given frame, a player:
+ * - Finds the last keyframe at or before the frame with
+ *    daala_seek_index_find().
+ * - Seeks to the <tt>offset</tt> of that entry, resets its Ogg sync and stream
+ *    state, and discards the first <tt>skip</tt> packets it reads.
+ * - Calls daala_decode_ctl() with #OD_DECCTL_RESTART_AT_KEYFRAME, then decodes
+ *    forward, discarding the images before the one it wants.
+ *   The images come out numbered from the <tt>frame</tt> of the entry.
+ **/
+/*@{*/
+
+/**Serializes a seek index.
+ * \param buf    The buffer to store the index in, or <tt>NULL</tt> to only
+ *               compute its size.
+ * \param buf_sz The size of \a buf in bytes.
+ * \param points The entries, in increasing order of both <tt>frame</tt> and
+ *               <tt>offset</tt>.
+ * \param npoints The number of entries.
+ * \return The size of the serialized index in bytes.
+ *         If this is larger than \a buf_sz, nothing was stored.
+ * \retval OD_EFAULT \a points was <tt>NULL</tt> and \a npoints was not 0.
+ * \retval OD_EINVAL The entries were out of order or had a negative
+ *                   member.*/
+int daala_seek_index_pack(unsigned char *buf, size_t buf_sz,
+ const daala_seek_point *points, int npoints);
+/**Reads a seek index serialized with daala_seek_index_pack().
+ * \param[out] points Filled in with the entries, or <tt>NULL</tt> to only
+ *                    count them.
+ * \param npoints_max The number of entries \a points can hold.
+ *                    If the index has more, only this many are stored.
+ * \param buf    The serialized index.
+ * \param buf_sz The size of \a buf in bytes.
+ * \return The number of entries in the index.
+ * \retval OD_EFAULT \a buf was <tt>NULL</tt>.
+ * \retval OD_ENOTFORMAT \a buf does not hold a Daala seek index.
+ * \retval OD_EVERSION The index is in a format version not readable with
+ *                     this version of <tt>libdaaladec</tt>.
+ * \retval OD_EBADHEADER The index is truncated or corrupt.*/
+int daala_seek_index_unpack(daala_seek_point *points, int npoints_max,
+ const unsigned char *buf, size_t buf_sz);
+/**Finds the entry to start decoding from to reach a given frame.
+ * \param points The entries of a seek index.
+ * \param npoints The number of entries.
+ * \param frame  The display number of the frame wanted.
+ * \return The index of the last entry whose <tt>frame</tt> is not after
+ *          \a frame, or -1 if there is none.*/
+int daala_seek_index_find(const daala_seek_point *points, int npoints,
+ int64_t frame);
 
 /*@}*/
 
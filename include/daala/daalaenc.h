@@ -73,6 +73,24 @@ typedef struct daala_enc_ctx daala_enc_ctx;
  * \return The initialized #daala_enc_ctx handle.
  * \retval NULL if the encoding parameters were invalid.*/
 daala_enc_ctx *daala_encode_create(const daala_info *info);
+/**Re-targets an existing encoder instance at a new stream, reusing all of
+ *  its storage.
+ * This is much cheaper than daala_encode_free() followed by
+ *  daala_encode_create().
+ * The encoder is left as daala_encode_create() would leave it: all
+ *  parameters set with daala_encode_ctl() return to their defaults, any
+ *  frames not yet encoded are discarded, and the headers must be written
+ *  again with daala_encode_flush_header().
+ * The new stream must have the same planes, bit depth and reference
+ *  precision, and a frame no larger than the stream \a enc was created for.
+ * \param enc A #daala_enc_ctx handle.
+ * \param info A #daala_info struct filled with the desired encoding
+ *              parameters.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT \a enc or \a info was <tt>NULL</tt>.
+ * \retval OD_EINVAL The new stream does not fit in \a enc.
+ *                   \a enc is left unchanged.*/
+int daala_encode_reset(daala_enc_ctx *enc, const daala_info *info);
 /**Encoder control function.
  * This is used to provide advanced control of the encoding process.
  * \param enc A #daala_enc_ctx handle.
@@ -119,9 +137,11 @@ int daala_encode_img_in(daala_enc_ctx *enc, daala_image *img, int duration);
  *  encoded packets, until it returns 0.
  * The encoder will not buffer these packets as subsequent frames are
  *  compressed, so a failure to do so will result in lost video data.
- * \note Current the encoder operates in a one-frame-in, one-packet-out
+ * \note By default the encoder operates in a one-frame-in, one-packet-out
  *        manner.
- *       However, this may be changed in the future.
+ *       With #OD_SET_CHUNK_ROWS, each frame is output as several packets,
+ *        and each call encodes only as much of the frame as the packet it
+ *        returns.
  * \param enc A #daala_enc_ctx handle.
  *             This ensures that a proper EOS flag is set on the last packet.
  * \param dp A <tt>daala_packet</tt> structure to fill.
@@ -351,8 +371,298 @@ void daala_encode_free(daala_enc_ctx *enc);
  *                        data.
  * \retval OD_EIMPL       Not supported by this implementation.*/
 #define OD_2PASS_IN 4120
+/**Enables or disables the per-stage profiling counters.
+ * Profiling is disabled by default.
+ * When disabled, the cost of the instrumentation is a single well-predicted
+ *  branch per stage, so it is safe to leave compiled into production builds.
+ * Enabling profiling resets all of the counters to zero.
+ * \see OD_GET_PROFILE
+ * \param[in] buf <tt>int</tt>: 0 to disable profiling, a non-zero value
+ *                 otherwise.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(int)</tt>.*/
+#define OD_SET_PROFILING 4122
+/**Retrieves the cumulative per-stage profiling counters.
+ * The counters accumulate from the last time profiling was enabled with
+ *  #OD_SET_PROFILING.
+ * \param[out] buf #od_enc_profile: Filled in with a copy of the counters.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(od_enc_profile)</tt>.*/
+#define OD_GET_PROFILE 4124
+/**Enables or disables the screen-content encoding mode.
+ * This mode is meant for desktop and application capture, which is mostly
+ *  static or scrolls by whole pixels.
+ * Motion estimation looks up exact copies of each block in the reference
+ *  frames with a hash table before falling back to its usual search, and stops
+ *  at full-pel resolution.
+ * Blocks that the prediction matches exactly are coded as skipped without
+ *  running the transform, PVQ search or block-size search.
+ * Level 2 also skips blocks whose input is unchanged from the part of the
+ *  reference frames it is predicted from.
+ * This is faster, but such blocks keep whatever quantization error they were
+ *  coded with, instead of being refined by later frames.
+ * The stream remains decodable by any decoder.
+ * Screen-content mode is disabled by default.
+ * \param[in] buf <tt>int</tt>: 0 to disable screen-content mode, 1 to enable
+ *                 it, or 2 to enable it with the faster skip decision.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(int)</tt>, or the level is
+ *                    out of range.*/
+#define OD_SET_SCREEN_CONTENT 4126
+/**Sets a target for the wall-clock time spent encoding each frame.
+ * This is meant for real-time use, such as video conferencing, where the
+ *  latency of every frame matters more than the best possible quality.
+ * The encoder picks the effective complexity of each frame from the time the
+ *  previous frames took, and lowers it further in the middle of a frame that
+ *  falls behind schedule: first the motion search and PVQ search effort, then
+ *  the depth of the block size search and the deringing filter search.
+ * It never exceeds the level set with #OD_SET_COMPLEXITY, and the target is
+ *  not a hard limit: a frame whose work at the lowest level does not fit in the
+ *  target still completes.
+ * Setting the target resets the statistics returned by
+ *  #OD_GET_DEADLINE_STATS.
+ * The deadline is disabled by default.
+ * \param[in] buf <tt>int</tt>: The target, in microseconds, or 0 to disable.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(int)</tt>, or the target is
+ *                     negative.*/
+#define OD_SET_DEADLINE 4128
+/**Retrieves the statistics collected while a deadline is set.
+ * \see OD_SET_DEADLINE
+ * \param[out] buf #od_enc_deadline_stats: Filled in with a copy of the
+ *                  statistics.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not
+ *                     <tt>sizeof(od_enc_deadline_stats)</tt>.*/
+#define OD_GET_DEADLINE_STATS 4130
+/**Splits each frame into several packets of a few superblock rows each.
+ * This is meant for interactive streams, where it lets the application start
+ *  sending (and the decoder start decoding) the top of a frame while the rest
+ *  is still being encoded.
+ * The first packet of a frame holds the frame header, the motion vectors and
+ *  the first group of superblock rows, and each call to
+ *  daala_encode_packet_out() codes the next group and returns it as a
+ *  separate packet.
+ * The motion vectors are still searched over the whole frame before the
+ *  first packet, but the block sizes are searched one group at a time.
+ * The deringing filter levels follow the last group, in the last packet.
+ * Each packet is terminated separately, but the coding contexts carry over
+ *  from one packet of a frame to the next, so the packets must be decoded in
+ *  order, and a frame is only complete once its last packet has been
+ *  decoded.
+ * Only the last packet of a frame has a valid granule position.
+ * Frames are never dropped by the rate control while this is enabled, since
+ *  part of a frame may already have been sent.
+ * This can only be changed between frames.
+ * It requires #OD_STREAM_VERSION_MINOR_CHUNKS or later.
+ * Frames are output as a single packet by default.
+ * \param[in] buf <tt>int</tt>: The number of superblock rows per packet, or 0
+ *                 to output each frame as a single packet.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(int)</tt>, the number of rows
+ *                     is negative, a frame is partially output, or the
+ *                     stream version does not support it.*/
+#define OD_SET_CHUNK_ROWS 4132
+/**Enables or disables bit accounting.
+ * When enabled, the encoder adds up the bits it spends in each superblock and
+ *  on each broad class of symbols while coding a frame, so that the cost of
+ *  each region can be had without decoding the stream again.
+ * Only the bits of the final coding pass are counted, not those of the trial
+ *  encodes made during the RDO searches.
+ * Accounting is disabled by default.
+ * \see OD_GET_ACCOUNTING
+ * \param[in] buf <tt>int</tt>: 0 to disable accounting, a non-zero value
+ *                 otherwise.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>, or the per-superblock
+ *                     totals could not be allocated.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(int)</tt>, or a frame is
+ *                     partially output.*/
+#define OD_SET_ACCOUNTING 4134
+/**Retrieves the bit accounting of the frame of the last packet returned by
+ *  daala_encode_packet_out().
+ * If the frame is output in several packets (see #OD_SET_CHUNK_ROWS), this
+ *  covers the packets of the frame output so far.
+ * \see OD_SET_ACCOUNTING
+ * \param[out] buf #od_enc_accounting: Filled in with the totals.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not <tt>sizeof(od_enc_accounting)</tt>, or
+ *                     accounting is not enabled.*/
+#define OD_GET_ACCOUNTING 4136
+/**Codes the video data packets directly into buffers supplied by the
+ *  application, so that daala_encode_packet_out() can return them in
+ *  daala_packet::packet without a copy.
+ * The get callback is called from within daala_encode_packet_out() each time
+ *  the encoder starts coding a packet, and that packet is coded into the
+ *  buffer it returns.
+ * The encoder only writes to the buffer until that call returns, and may
+ *  overwrite some of it beyond the end of the packet.
+ * If the packet does not fit, the encoder finishes it in its own memory, and
+ *  daala_packet::packet points there as it does without this setting.
+ * Header packets always use the encoder's own memory.
+ * \param[in] buf #daala_packet_buffer_funcs: The callbacks.
+ *                 A <tt>NULL</tt> get callback goes back to using the
+ *                 encoder's own memory for every packet.
+ * \retval OD_SUCCESS Success.
+ * \retval OD_EFAULT  \a enc or \a buf is <tt>NULL</tt>.
+ * \retval OD_EINVAL  \a buf_sz is not
+ *                     <tt>sizeof(daala_packet_buffer_funcs)</tt>.*/
+#define OD_SET_PACKET_BUFFER_FUNCS 4138
+/*@}*/
+
+/**\name Encoder profiling stages
+ * \anchor profstages
+ * Indices into od_enc_profile::stages.
+ * Stages may nest: e.g., #OD_PROF_PVQ is counted both on its own and as part
+ *  of #OD_PROF_COEFF_BLOCKS, and the coefficient coding sub-stages also count
+ *  the trial encodes made during block-size RDO, which are themselves part of
+ *  #OD_PROF_SPLIT.*/
+/*@{*/
+/**The whole of frame encoding, from header coding to reconstruction.*/
+#define OD_PROF_FRAME (0)
+/**Copying and padding the input image into the input queue.*/
+#define OD_PROF_INPUT_COPY (1)
+/**Motion estimation: initial EPZS^2 search of every MV.*/
+#define OD_PROF_MV_INIT (2)
+/**Motion estimation: decimation of the MV grid.*/
+#define OD_PROF_MV_DECIMATE (3)
+/**Motion estimation: full-pel refinement.*/
+#define OD_PROF_MV_REFINE (4)
+/**Motion estimation: sub-pel refinement.*/
+#define OD_PROF_MV_SUBPEL (5)
+/**Motion compensated prediction of the whole frame.*/
+#define OD_PROF_MC_PREDICT (6)
+/**Block size decision (open-loop or RDO).*/
+#define OD_PROF_SPLIT (7)
+/**Conversion of the input and prediction to coefficients and the
+    prefilter.*/
+#define OD_PROF_COEFF_PREFILTER (8)
+/**Per-superblock transform, quantization and coding.*/
+#define OD_PROF_COEFF_BLOCKS (9)
+/**The PVQ search and coding of a single block.*/
+#define OD_PROF_PVQ (10)
+/**The postfilter.*/
+#define OD_PROF_POSTFILTER (11)
+/**The deringing filter RDO and application.*/
+#define OD_PROF_DERING (12)
+/**Conversion of the coefficients back to the reference image.*/
+#define OD_PROF_COEFF_RECON (13)
+/**Flushing the entropy coder into the output packet.*/
+#define OD_PROF_EC_DONE (14)
+/**The number of profiling stages.*/
+#define OD_PROF_NSTAGES (15)
+/*@}*/
+
+/**Cumulative counters for a single profiling stage.*/
+typedef struct {
+  /**The total number of ticks spent in the stage.*/
+  int64_t ticks;
+  /**The number of times the stage was entered.*/
+  int64_t calls;
+} od_enc_prof_counter;
+
+/**Per-stage profiling counters returned by #OD_GET_PROFILE.*/
+typedef struct {
+  /**The counters for each stage, indexed by
+      \ref profstages "the stage constants".*/
+  od_enc_prof_counter stages[OD_PROF_NSTAGES];
+  /**The rate of the tick counter.
+     This is 0 when the ticks are CPU cycles from the timestamp counter, whose
+      rate is not known to the library, and <tt>CLOCKS_PER_SEC</tt> when they
+      come from <tt>clock()</tt>.*/
+  int64_t ticks_per_second;
+} od_enc_profile;
+
+/**Statistics returned by #OD_GET_DEADLINE_STATS.
+ * Times are wall-clock times in microseconds.*/
+typedef struct {
+  /**The number of frames encoded since the deadline was set.*/
+  int64_t frames;
+  /**The number of those frames that took longer than the target.*/
+  int64_t late_frames;
+  /**The time taken by the most recent frame.*/
+  int64_t last_frame_us;
+  /**The longest time taken by any frame.*/
+  int64_t max_frame_us;
+  /**The complexity level the most recent frame started with.
+     Parts of it may have been encoded at a lower level.*/
+  int complexity;
+} od_enc_deadline_stats;
+
+/**\name Encoder accounting classes
+ * \anchor acctclasses
+ * Indices into od_enc_accounting::class_bits_q3.*/
+/*@{*/
+/**The frame header, the quantizer and quantization matrices, and anything
+    else not in another class.*/
+#define OD_ENC_ACCT_HEADER (0)
+/**The motion vectors and their flags.*/
+#define OD_ENC_ACCT_MV (1)
+/**The superblock DC coefficients of keyframes.*/
+#define OD_ENC_ACCT_DC (2)
+/**The rest of the luma plane: skip flags, block DCs and PVQ.*/
+#define OD_ENC_ACCT_LUMA (3)
+/**The rest of the other planes.*/
+#define OD_ENC_ACCT_CHROMA (4)
+/**The deringing filter levels.*/
+#define OD_ENC_ACCT_DERING (5)
+/**The number of accounting classes.*/
+#define OD_ENC_ACCT_NCLASSES (6)
 /*@}*/
 
+/**Bit accounting returned by #OD_GET_ACCOUNTING.
+ * All sizes are in units of 1/8 bit.*/
+typedef struct {
+  /**The bits of each class, indexed by
+      \ref acctclasses "the class constants".*/
+  uint32_t class_bits_q3[OD_ENC_ACCT_NCLASSES];
+  /**The number of superblocks in each row.*/
+  int nhsb;
+  /**The number of superblock rows.*/
+  int nvsb;
+  /**The bits of each superblock, in raster order.
+     These count every class but #OD_ENC_ACCT_HEADER, with each motion vector
+      counted in the superblock containing its grid point.
+     The motion vector resolution is coded once for the whole frame, so it
+      is only counted in #OD_ENC_ACCT_MV, and these do not add up to that
+      class.
+     This points into the encoder, and is overwritten by the next frame.*/
+  const uint32_t *sb_bits_q3;
+  /**The bits of the whole frame.*/
+  uint32_t total_bits_q3;
+} od_enc_accounting;
+
+/**An application-supplied packet buffer.
+ * See #OD_SET_PACKET_BUFFER_FUNCS.*/
+typedef struct {
+  /**The start of the buffer.*/
+  unsigned char *data;
+  /**The size of the buffer in bytes.*/
+  size_t size;
+} daala_packet_buffer;
+
+/**Supplies the buffer to code the next video data packet into.
+ * \param ctx The <tt>ctx</tt> member of #daala_packet_buffer_funcs.
+ * \param[out] pb Filled in with the buffer.
+ * \return 0 on success, or a negative value to code the packet in the
+ *          encoder's own memory.*/
+typedef int (*daala_get_packet_buffer_func)(void *ctx,
+ daala_packet_buffer *pb);
+
+/**The packet buffer callback set with #OD_SET_PACKET_BUFFER_FUNCS.*/
+typedef struct {
+  daala_get_packet_buffer_func get;
+  /**Passed to the callback.*/
+  void *ctx;
+} daala_packet_buffer_funcs;
+
 /**\name OD_SET_RATE_FLAGS flags
  * \anchor ratectlflags
  * These are the flags available for use with #OD_SET_RATE_FLAGS.*/
@@ -31,76 +31,141 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include "logging.h"
 #include "accounting.h"
 
-static int od_acct_hash(const char *str) {
-  uint32_t val;
-  const unsigned char *ustr;
-  val = 0;
-  ustr = (const unsigned char*)str;
-  /* This is about the worst hash one can design, but it should be good enough
-     here. */
-  while (*ustr) val += *ustr++;
-  return val % OD_ACCT_HASH_SIZE;
-}
+const char *const OD_ACCT_NAMES[OD_ACCT_NIDS] = {
+  "flags",
+  "qm",
+  "quantizer",
+  "dering",
+  "skip",
+  "quant",
+  "cfl:flip",
+  "dc:mag",
+  "dc:sign",
+  "haardc:mag:top",
+  "haardc:sign:top",
+  "haardc:mag:level",
+  "haardc:sign:level",
+  "haar:top",
+  "haar:split",
+  "haar:coeffsplit",
+  "haar:sign",
+  "pvq:gaintheta",
+  "pvq:gain",
+  "pvq:theta",
+  "pvq:k1",
+  "pvq:split",
+  "pvq:run",
+  "pvq:mag",
+  "pvq:sign",
+  "pvq:skiprest",
+  "mv:res",
+  "mv:valid",
+  "mv:ref",
+  "mv:low",
+  "mv:high:x",
+  "mv:high:y",
+  "mv:sign:x",
+  "mv:sign:y"
+};
 
-/* Dictionary lookup based on an open-addressing hash table. */
-int od_accounting_dict_lookup(od_accounting_internal *acct, const char *str) {
-  int hash;
-  od_accounting_dict *dict;
-  dict = &acct->acct.dict;
-  hash = od_acct_hash(str);
-  while (acct->hash_dict[hash] != -1) {
-    if (strcmp(dict->str[acct->hash_dict[hash]], str) == 0) {
-      return acct->hash_dict[hash];
-    }
-    hash++;
-    if (hash == OD_ACCT_HASH_SIZE) hash = 0;
-  }
-  /* No match found. */
-  OD_ASSERT(dict->nb_str + 1 < MAX_SYMBOL_TYPES);
-  acct->hash_dict[hash] = dict->nb_str;
-  dict->str[dict->nb_str] = malloc(strlen(str) + 1);
-  strcpy(dict->str[dict->nb_str], str);
-  dict->nb_str++;
-  return dict->nb_str - 1;
-}
-
-void od_accounting_init(od_accounting_internal *acct) {
+/*All the buffers are allocated here, so that recording a symbol never
+   allocates unless the individual symbols are logged.*/
+int od_accounting_init(od_accounting_internal *acct, const daala_info *info,
+ int nhsb, int nvsb) {
+  int pli;
   int i;
+  OD_CLEAR(acct, 1);
+  OD_ASSERT(OD_ACCT_NIDS <= MAX_SYMBOL_TYPES);
+  for (i = 0; i < OD_ACCT_NIDS; i++) {
+    acct->acct.dict.str[i] = (char *)OD_ACCT_NAMES[i];
+  }
+  acct->acct.dict.nb_str = OD_ACCT_NIDS;
+  for (pli = 0; pli < info->nplanes; pli++) {
+    acct->xdec[pli] = info->plane_info[pli].xdec;
+    acct->ydec[pli] = info->plane_info[pli].ydec;
+  }
+  acct->nhsb = nhsb;
+  acct->nvsb = nvsb;
+  acct->nb_sbs_alloc = OD_MAXI(nhsb*nvsb, 1);
+  acct->sb_bits_q3 = (uint32_t *)malloc(
+   sizeof(*acct->sb_bits_q3)*acct->nb_sbs_alloc);
   acct->nb_syms_alloc = 1000;
-  acct->acct.syms = malloc(sizeof(acct->acct.syms[0])*acct->nb_syms_alloc);
-  acct->acct.dict.nb_str = 0;
-  OD_ASSERT(OD_ACCT_HASH_SIZE > 2*MAX_SYMBOL_TYPES);
-  for (i = 0; i < OD_ACCT_HASH_SIZE; i++) acct->hash_dict[i] = -1;
+  acct->acct.syms = (od_acct_symbol *)malloc(
+   sizeof(acct->acct.syms[0])*acct->nb_syms_alloc);
+  if (OD_UNLIKELY(acct->sb_bits_q3 == NULL || acct->acct.syms == NULL)) {
+    od_accounting_clear(acct);
+    return OD_EFAULT;
+  }
+  od_accounting_reset_totals(acct);
   od_accounting_reset(acct);
+  return OD_SUCCESS;
 }
 
+/*Changes the superblock grid the totals are kept for, after the decoder is
+   reset for a new frame size.
+  The frame can only shrink from the size acct was initialized with, so this
+   never allocates.*/
+void od_accounting_set_frame_size(od_accounting_internal *acct, int nhsb,
+ int nvsb) {
+  OD_ASSERT(nhsb*nvsb <= acct->nb_sbs_alloc);
+  acct->nhsb = nhsb;
+  acct->nvsb = nvsb;
+  od_accounting_reset_totals(acct);
+}
+
+/*Starts a new packet.*/
 void od_accounting_reset(od_accounting_internal *acct) {
   acct->acct.nb_syms = 0;
   acct->curr_x = acct->curr_y = acct->curr_level = acct->curr_layer = -1;
+  acct->curr_bits_q3 = &acct->frame_bits_q3;
   acct->last_tell = 0;
 }
 
+/*Starts a new frame.*/
+void od_accounting_reset_totals(od_accounting_internal *acct) {
+  OD_CLEAR(acct->class_bits_q3, OD_ACCT_NIDS);
+  OD_CLEAR(acct->sb_bits_q3, acct->nhsb*acct->nvsb);
+  acct->frame_bits_q3 = 0;
+}
+
 void od_accounting_clear(od_accounting_internal *acct) {
-  int i;
   free(acct->acct.syms);
-  for (i = 0; i < acct->acct.dict.nb_str; i++) {
-    free(acct->acct.dict.str[i]);
-  }
+  acct->acct.syms = NULL;
+  free(acct->sb_bits_q3);
+  acct->sb_bits_q3 = NULL;
 }
 
 void od_accounting_set_location(od_accounting_internal *acct, int layer,
  int level, int x, int y) {
+  int sbx;
+  int sby;
   acct->curr_x = x;
   acct->curr_y = y;
   acct->curr_level = level;
   acct->curr_layer = layer;
-
+  if (layer == OD_ACCT_FRAME) {
+    acct->curr_bits_q3 = &acct->frame_bits_q3;
+    return;
+  }
+  if (layer == OD_ACCT_MV) {
+    /*Grid points on the right and bottom edges go to the last superblock.*/
+    sbx = x >> (OD_LOG_BSIZE_MAX - OD_LOG_MVBSIZE_MIN);
+    sby = y >> (OD_LOG_BSIZE_MAX - OD_LOG_MVBSIZE_MIN);
+  }
+  else {
+    OD_ASSERT(layer >= 0 && layer < OD_NPLANES_MAX);
+    sbx = x >> (OD_LOG_BSIZE_MAX - OD_LOG_BSIZE0 - acct->xdec[layer]);
+    sby = y >> (OD_LOG_BSIZE_MAX - OD_LOG_BSIZE0 - acct->ydec[layer]);
+  }
+  sbx = OD_MINI(sbx, acct->nhsb - 1);
+  sby = OD_MINI(sby, acct->nvsb - 1);
+  acct->curr_bits_q3 = acct->sb_bits_q3 + sby*acct->nhsb + sbx;
 }
 
-void od_accounting_record(od_accounting_internal *acct, char *str,
- int bits_q3) {
+/*Appends a symbol to the log returned by OD_DECCTL_GET_ACCOUNTING.
+  The totals are updated by the caller.*/
+void od_accounting_record(od_accounting_internal *acct, int id, int bits_q3) {
   od_acct_symbol curr;
-  int id;
   OD_ASSERT(acct->curr_x >= 0);
   OD_ASSERT(acct->curr_y >= 0);
   OD_ASSERT(bits_q3 <= 255);
@@ -109,8 +174,6 @@ void od_accounting_record(od_accounting_internal *acct, char *str,
   curr.level = acct->curr_level;
   curr.layer = acct->curr_layer;
   curr.bits_q3 = bits_q3;
-  id = od_accounting_dict_lookup(acct, str);
-  OD_ASSERT(id <= 255);
   curr.id = id;
   if (acct->acct.nb_syms == acct->nb_syms_alloc) {
     acct->nb_syms_alloc *= 2;
@@ -120,3 +183,19 @@ void od_accounting_record(od_accounting_internal *acct, char *str,
   }
   acct->acct.syms[acct->acct.nb_syms++] = curr;
 }
+
+void od_accounting_get_totals(od_accounting_internal *acct,
+ od_accounting_totals *totals) {
+  uint32_t total;
+  int i;
+  totals->nclasses = OD_ACCT_NIDS;
+  totals->class_names = OD_ACCT_NAMES;
+  totals->class_bits_q3 = acct->class_bits_q3;
+  totals->nhsb = acct->nhsb;
+  totals->nvsb = acct->nvsb;
+  totals->sb_bits_q3 = acct->sb_bits_q3;
+  totals->frame_bits_q3 = acct->frame_bits_q3;
+  total = 0;
+  for (i = 0; i < OD_ACCT_NIDS; i++) total += acct->class_bits_q3[i];
+  totals->total_bits_q3 = total;
+}
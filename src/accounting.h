@@ -29,12 +29,58 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 # include "internal.h"
 # include "../include/daala/daaladec.h"
 
-#define OD_ACCT_HASH_SIZE (1021)
+/*The symbol classes recorded by the accounting code.
+  These replace the strings that used to be passed to every od_ec_decode_*()
+   call, so that recording a symbol does not need a dictionary lookup.
+  The names reported in od_accounting_dict are in OD_ACCT_NAMES, in the same
+   order.*/
+typedef enum {
+  OD_ACCT_ID_FLAGS,
+  OD_ACCT_ID_QM,
+  OD_ACCT_ID_QUANTIZER,
+  OD_ACCT_ID_DERING,
+  OD_ACCT_ID_SKIP,
+  OD_ACCT_ID_QUANT,
+  OD_ACCT_ID_CFL_FLIP,
+  OD_ACCT_ID_DC_MAG,
+  OD_ACCT_ID_DC_SIGN,
+  OD_ACCT_ID_HAARDC_MAG_TOP,
+  OD_ACCT_ID_HAARDC_SIGN_TOP,
+  OD_ACCT_ID_HAARDC_MAG_LEVEL,
+  OD_ACCT_ID_HAARDC_SIGN_LEVEL,
+  OD_ACCT_ID_HAAR_TOP,
+  OD_ACCT_ID_HAAR_SPLIT,
+  OD_ACCT_ID_HAAR_COEFFSPLIT,
+  OD_ACCT_ID_HAAR_SIGN,
+  OD_ACCT_ID_PVQ_GAINTHETA,
+  OD_ACCT_ID_PVQ_GAIN,
+  OD_ACCT_ID_PVQ_THETA,
+  OD_ACCT_ID_PVQ_K1,
+  OD_ACCT_ID_PVQ_SPLIT,
+  OD_ACCT_ID_PVQ_RUN,
+  OD_ACCT_ID_PVQ_MAG,
+  OD_ACCT_ID_PVQ_SIGN,
+  OD_ACCT_ID_PVQ_SKIPREST,
+  OD_ACCT_ID_MV_RES,
+  OD_ACCT_ID_MV_VALID,
+  OD_ACCT_ID_MV_REF,
+  OD_ACCT_ID_MV_LOW,
+  OD_ACCT_ID_MV_HIGH_X,
+  OD_ACCT_ID_MV_HIGH_Y,
+  OD_ACCT_ID_MV_SIGN_X,
+  OD_ACCT_ID_MV_SIGN_Y,
+  OD_ACCT_NIDS
+} od_acct_id;
+
+extern const char *const OD_ACCT_NAMES[OD_ACCT_NIDS];
 
 typedef struct {
   od_accounting acct;
   /** Size allocated for syms (not all may be used). */
   int nb_syms_alloc;
+  /** Whether each symbol is appended to acct.syms, or only the totals are
+      kept. */
+  int log_syms;
   /* Current location (x, y, level, layer) where we are recording. */
   int curr_x;
   int curr_y;
@@ -42,20 +88,39 @@ typedef struct {
   int curr_layer;
   /* Last value returned from od_ec_dec_tell_frac(). */
   uint32_t last_tell;
-  int16_t hash_dict[OD_ACCT_HASH_SIZE];
+  /* Chroma decimation of each plane, to find the superblock of a block. */
+  int xdec[OD_NPLANES_MAX];
+  int ydec[OD_NPLANES_MAX];
+  /* Totals for the current frame, in 1/8 bits. */
+  uint32_t class_bits_q3[OD_ACCT_NIDS];
+  uint32_t frame_bits_q3;
+  int nhsb;
+  int nvsb;
+  uint32_t *sb_bits_q3;
+  /* Size allocated for sb_bits_q3. */
+  int nb_sbs_alloc;
+  /* The total the bits at the current location are added to. */
+  uint32_t *curr_bits_q3;
 } od_accounting_internal;
 
-int od_accounting_dict_lookup(od_accounting_internal *acct, const char *str);
+int od_accounting_init(od_accounting_internal *acct, const daala_info *info,
+ int nhsb, int nvsb);
 
-void od_accounting_init(od_accounting_internal *acct);
+void od_accounting_set_frame_size(od_accounting_internal *acct, int nhsb,
+ int nvsb);
 
 void od_accounting_reset(od_accounting_internal *acct);
 
+void od_accounting_reset_totals(od_accounting_internal *acct);
+
 void od_accounting_clear(od_accounting_internal *acct);
 
 void od_accounting_set_location(od_accounting_internal *acct, int layer,
  int level, int x, int y);
 
-void od_accounting_record(od_accounting_internal *acct, char *str, int bits_q3);
+void od_accounting_record(od_accounting_internal *acct, int id, int bits_q3);
+
+void od_accounting_get_totals(od_accounting_internal *acct,
+ od_accounting_totals *totals);
 
 #endif
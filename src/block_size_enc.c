@@ -149,7 +149,7 @@ static int od_count_overlapping4x4(int bsize) {
  *  neighboring blocks, since we can't know the size of all the neighboring
  *  blocks, we use an approximation.
  */
-static unsigned int od_overlap_var4x4[OD_BLOCK_SIZES] = { 1, 1, 2, 3 };
+static const unsigned int od_overlap_var4x4[OD_BLOCK_SIZES] = { 1, 1, 2, 3 };
 
 /* Calculate the noise of a block based on the variances of overlapping 4x4
  *  blocks.
@@ -260,7 +260,7 @@ static int od_count_overlapping8x8(int bsize) {
  * `od_noise_var8x8` and `od_psy_var8x8`.
  * The margin must be less than or equal to OD_MAX_OVERLAP_8.
  */
-static unsigned int od_overlap_var8x8[OD_BLOCK_SIZES] = { 0, 0, 1, 1 };
+static const unsigned int od_overlap_var8x8[OD_BLOCK_SIZES] = { 0, 0, 1, 1 };
 
 /* Same as `od_noise_var4x4` but using overlapping 8x8 blocks. */
 static int od_noise_var8x8(od_superblock_stats *img_stats,
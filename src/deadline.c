@@ -0,0 +1,227 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+/*clock_gettime() is not declared in strict C89 mode without this.*/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+# define _POSIX_C_SOURCE (199309L)
+#endif
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+#include "encint.h"
+
+/*Real-time deadline control.
+  Each frame starts at the highest complexity level whose recent frames fit in
+   the target with some headroom.
+  During the frame, the encoder checks the elapsed time against a schedule
+   learned from the previous frames at a few checkpoints (between the motion
+   estimation stages and before every superblock after that) and lowers the
+   level for the rest of the frame when it falls behind.*/
+
+/*The fraction of the target that the starting level of a frame should fit
+   in, in Q15.
+  The headroom absorbs frames that take longer than the recent average.*/
+#define OD_RT_BUDGET_Q15 (28672)
+/*A frame counts as behind schedule once it is late by more than
+   1/(1 << OD_RT_SLACK_SHIFT) of the target, so that the noise in the timing
+   of individual superblocks does not trigger it.*/
+#define OD_RT_SLACK_SHIFT (4)
+/*Each further 1/(1 << OD_RT_LATE_SHIFT) of the target behind schedule costs
+   one additional complexity level.*/
+#define OD_RT_LATE_SHIFT (3)
+/*The rate at which estimates for unused levels decay towards 0, as a
+   shift.*/
+#define OD_RT_DECAY_SHIFT (7)
+
+/*The initial schedule: the fraction of the frame time elapsed at the end of
+   each stage, in Q15, for inter frames and keyframes.
+  These are rough figures from profiling the default complexity; they get
+   replaced by measurements after a few frames.*/
+static const int32_t OD_RT_SCHED_INIT[2][OD_RT_NSTAGES] = {
+  { 18022, 29491, 31785, 32440 },
+  {     0, 14746, 31130, 32440 }
+};
+
+/*The rough relative cost of a frame at each complexity level, used to
+   estimate the levels that have not been measured yet.*/
+static const int32_t OD_RT_LEVEL_COST[OD_COMPLEXITY_MAX + 1] = {
+  38, 38, 95, 95, 95, 256, 256, 256, 300, 400, 600
+};
+
+/*Returns a monotonic wall-clock time in microseconds.*/
+static int64_t od_rt_time_us(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (int64_t)(now.QuadPart/freq.QuadPart*1000000
+   + now.QuadPart%freq.QuadPart*1000000/freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#else
+  return (int64_t)clock()*1000000/CLOCKS_PER_SEC;
+#endif
+}
+
+/*Resets the controller and sets a new target, 0 to disable it.*/
+void od_rt_reset(od_rt_state *rt, int64_t target_us, int complexity) {
+  OD_CLEAR(rt, 1);
+  rt->target_us = target_us;
+  rt->frame_level = rt->level = complexity;
+  rt->next_level[0] = rt->next_level[1] = complexity;
+  OD_COPY(rt->sched[0], OD_RT_SCHED_INIT[0], OD_RT_NSTAGES);
+  OD_COPY(rt->sched[1], OD_RT_SCHED_INIT[1], OD_RT_NSTAGES);
+}
+
+/*Picks the complexity level of a frame and starts its clock.*/
+void od_rt_frame_begin(od_enc_ctx *enc, int is_keyframe) {
+  od_rt_state *rt;
+  int stage;
+  rt = &enc->rt;
+  rt->late = 0;
+  if (rt->target_us <= 0) {
+    rt->frame_level = rt->level = enc->complexity;
+    return;
+  }
+  rt->frame_class = !!is_keyframe;
+  rt->frame_level = rt->level =
+   OD_MINI(rt->next_level[rt->frame_class], enc->complexity);
+  for (stage = 0; stage < OD_RT_NSTAGES; stage++) rt->mark[stage] = -1;
+  rt->frame_start = od_rt_time_us();
+}
+
+/*Compares the elapsed time with the schedule before done out of total units
+   of work in a stage, lowering rt->level in proportion to how far behind the
+   frame is.
+  Return: Whether the frame is currently behind schedule.*/
+int od_rt_check(od_enc_ctx *enc, int stage, int done, int total) {
+  od_rt_state *rt;
+  int64_t elapsed;
+  int64_t allowed;
+  int32_t lo;
+  int32_t hi;
+  int drop;
+  rt = &enc->rt;
+  elapsed = od_rt_time_us() - rt->frame_start;
+  rt->mark[stage] = elapsed;
+  if (elapsed >= rt->target_us) {
+    /*Already over the target: finish the frame as cheaply as possible.*/
+    rt->late = 1;
+    rt->level = 0;
+    return 1;
+  }
+  lo = stage > 0 ? rt->sched[rt->frame_class][stage - 1] : 0;
+  hi = rt->sched[rt->frame_class][stage];
+  allowed = rt->target_us*(lo + (int64_t)(hi - lo)*done/OD_MAXI(total, 1))
+   >> 15;
+  allowed += rt->target_us >> OD_RT_SLACK_SHIFT;
+  if (elapsed <= allowed) return 0;
+  rt->late = 1;
+  drop = 1 + (int)(((elapsed - allowed) << OD_RT_LATE_SHIFT)/rt->target_us);
+  rt->level = OD_MINI(rt->level, OD_MAXI(rt->frame_level - drop, 0));
+  return 1;
+}
+
+/*Stops the clock of a frame while the application handles one of its
+   packets (see OD_SET_CHUNK_ROWS).*/
+void od_rt_frame_pause(od_enc_ctx *enc) {
+  if (enc->rt.target_us <= 0) return;
+  enc->rt.pause_start = od_rt_time_us();
+}
+
+/*Restarts the clock of a paused frame.*/
+void od_rt_frame_resume(od_enc_ctx *enc) {
+  if (enc->rt.target_us <= 0) return;
+  enc->rt.frame_start += od_rt_time_us() - enc->rt.pause_start;
+}
+
+/*Stops the clock of a frame, updates the schedule and the per-level time
+   estimates, and picks the starting level of the next frame of its class.*/
+void od_rt_frame_end(od_enc_ctx *enc) {
+  od_rt_state *rt;
+  int64_t *level_us;
+  int64_t elapsed;
+  int64_t prev;
+  int64_t budget;
+  int64_t level_est;
+  int32_t frac;
+  int stage;
+  int level;
+  int l;
+  rt = &enc->rt;
+  if (rt->target_us <= 0) return;
+  elapsed = OD_MAXI(od_rt_time_us() - rt->frame_start, 1);
+  /*Stages that were not reached this frame took no time.
+    The marks are increasing, so the schedule stays sorted.*/
+  prev = 0;
+  for (stage = 0; stage < OD_RT_NSTAGES; stage++) {
+    if (rt->mark[stage] >= 0) prev = rt->mark[stage];
+    frac = (int32_t)OD_MINI(prev*32768/elapsed, 32768);
+    rt->sched[rt->frame_class][stage] +=
+     (frac - rt->sched[rt->frame_class][stage]) >> 2;
+  }
+  level_us = rt->level_us[rt->frame_class];
+  level = rt->frame_level;
+  for (l = 0; l <= OD_COMPLEXITY_MAX; l++) {
+    if (l != level) level_us[l] -= level_us[l] >> OD_RT_DECAY_SHIFT;
+  }
+  if (level_us[level] == 0) level_us[level] = elapsed;
+  else level_us[level] += (elapsed - level_us[level]) >> 2;
+  /*A frame that had to drop its level part way through took less time than
+     its starting level would have, so that level does not fit.*/
+  if (rt->level < level) {
+    level_us[level] = OD_MAXI(level_us[level], rt->target_us);
+  }
+  /*Higher levels never cost less.
+    Levels that have not been measured keep using the estimate from
+     OD_RT_LEVEL_COST, which is already larger.*/
+  for (l = level + 1; l <= OD_COMPLEXITY_MAX; l++) {
+    if (level_us[l] > 0) level_us[l] = OD_MAXI(level_us[l], level_us[level]);
+  }
+  /*Start the next frame at the highest level estimated to fit.*/
+  budget = rt->target_us*OD_RT_BUDGET_Q15 >> 15;
+  for (l = enc->complexity; l > 0; l--) {
+    level_est = level_us[l];
+    if (level_est == 0) {
+      level_est = level_us[level]*OD_RT_LEVEL_COST[l]/OD_RT_LEVEL_COST[level];
+    }
+    if (level_est <= budget) break;
+  }
+  rt->next_level[rt->frame_class] = l;
+  rt->stats.frames++;
+  if (elapsed > rt->target_us) rt->stats.late_frames++;
+  rt->stats.last_frame_us = elapsed;
+  rt->stats.max_frame_us = OD_MAXI(rt->stats.max_frame_us, elapsed);
+  rt->stats.complexity = rt->frame_level;
+}
@@ -28,6 +28,73 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 # include "state.h"
 
 typedef struct daala_dec_ctx od_dec_ctx;
+typedef struct od_mb_dec_ctx od_mb_dec_ctx;
+typedef struct od_dec_chunk od_dec_chunk;
+
+/*The number of superblock rows held by each of the MC and deringing working
+   buffers in low-memory mode.
+  The MC prefilter runs one row ahead of coefficient decoding, and the
+   deringing filter reads one row above and below the current one.*/
+# define OD_DEC_LOW_MEM_MC_ROWS (2)
+# define OD_DEC_LOW_MEM_MD_ROWS (1)
+# define OD_DEC_LOW_MEM_E_ROWS (3)
+
+/*The most application frame buffers the decoder can hold at once: one per
+   reference slot, one for the frame being decoded (obtained before its slot
+   is freed), one per reorder queue entry, and the last output image.*/
+# define OD_DEC_FB_POOL_SZ (OD_FRAME_MAX + 2 + OD_MAX_REORDER + 1)
+
+typedef struct od_dec_fb od_dec_fb;
+
+/*An application frame buffer held by the decoder.*/
+struct od_dec_fb {
+  daala_frame_buffer fb;
+  /*The number of reference slots, reorder queue entries and output images
+     using this buffer.
+    The buffer is released to the application when this drops to zero.*/
+  int refs;
+};
+
+/*Block-level decoder context information.
+  Global decoder context information is in od_dec_ctx.*/
+struct od_mb_dec_ctx {
+  od_coeff *c;
+  od_coeff **d;
+  od_coeff *md;
+  od_coeff *mc;
+  od_coeff *l;
+  int is_keyframe;
+  int num_refs;
+  int use_activity_masking;
+  int qm;
+  int use_haar_wavelet;
+  int is_golden_frame;
+  /*The first superblock row held in mc and md.
+    This is always 0 unless the decoder is in low-memory mode, where those
+     buffers only hold the rows currently being reconstructed.*/
+  int mc_sby;
+};
+
+/*The state of a frame that is coded in several packets of superblock rows,
+   kept between calls to daala_decode_packet_in().*/
+struct od_dec_chunk {
+  od_mb_dec_ctx mbctx;
+  /*The number of superblock rows per packet in the current frame.*/
+  int rows;
+  /*The next superblock row to decode, or 0 if no frame is in progress.*/
+  int sby;
+  int frame_number;
+  /*The pool entry holding the frame's application buffer, or -1.*/
+  int fb_id;
+};
+
+/*Decoding normally.*/
+# define OD_DEC_RESTART_NONE (0)
+/*Waiting for a keyframe.*/
+# define OD_DEC_RESTART_KEYFRAME (1)
+/*Dropping the B-frames that follow the keyframe but are displayed before
+   it.*/
+# define OD_DEC_RESTART_LEADING (2)
 
 /*Constants for the packet state machine specific to the decoder.*/
 /*Next packet to read: Data packet.*/
@@ -52,12 +119,37 @@ struct daala_dec_ctx {
   daala_image *user_mc_img;
   od_output_queue out;
 #if OD_ACCOUNTING
+  /*One of the OD_ACCOUNTING_* modes.*/
   int acct_enabled;
   od_accounting_internal acct;
 #endif
   /*User provided buffer for storing the deringing filter flags per superblock.
     This is set via daala_decode_ctl with OD_DECCTL_SET_DERING_BUFFER.*/
   unsigned char *user_dering;
+  /*Whether the MC and deringing working buffers only hold the superblock rows
+     being reconstructed, set via OD_DECCTL_SET_LOW_MEMORY.*/
+  int low_memory;
+  /*Application frame buffer callbacks, set via
+     OD_DECCTL_SET_FRAME_BUFFER_FUNCS.*/
+  daala_frame_buffer_funcs fb_funcs;
+  int use_fb_funcs;
+  od_dec_fb fb_pool[OD_DEC_FB_POOL_SZ];
+  /*The pool entry backing each reference slot, or -1 if the slot uses the
+     decoder's own buffer.*/
+  int ref_fb[OD_FRAME_MAX + 1];
+  /*The pool entry backing the image last returned by daala_decode_img_out(),
+     or -1.*/
+  int out_fb;
+  /*The decoder's own reference images, restored when a slot is unbound from
+     an application buffer.*/
+  daala_image own_ref_imgs[OD_FRAME_MAX + 1];
+  od_dec_chunk chunk;
+  /*Where the decoder is in restarting at a keyframe (see
+     OD_DECCTL_RESTART_AT_KEYFRAME), one of the OD_DEC_RESTART_* values.*/
+  int restart;
+  /*Whether the continuation packets of the current frame are dropped, because
+     it is a B-frame dropped after a restart.*/
+  int drop_frame;
 };
 
 # if OD_ACCOUNTING
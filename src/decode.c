@@ -48,6 +48,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 static int od_dec_init(od_dec_ctx *dec, const daala_info *info,
  const daala_setup_info *setup) {
   int ret;
+  int refi;
   OD_UNUSED(setup);
   memset(dec, 0, sizeof(*dec));
   ret = od_state_init(&dec->state, info);
@@ -63,14 +64,90 @@ static int od_dec_init(od_dec_ctx *dec, const daala_info *info,
   if (OD_UNLIKELY(ret < 0)) {
     return ret;
   }
+  for (refi = 0; refi <= OD_FRAME_MAX; refi++) {
+    dec->own_ref_imgs[refi] = dec->state.ref_imgs[refi];
+    dec->ref_fb[refi] = -1;
+  }
+  dec->out_fb = -1;
 #if OD_ACCOUNTING
-  od_accounting_init(&dec->acct);
-  dec->acct_enabled = 0;
+  ret = od_accounting_init(&dec->acct, info, dec->state.nhsb,
+   dec->state.nvsb);
+  if (OD_UNLIKELY(ret < 0)) {
+    return ret;
+  }
+  dec->acct_enabled = OD_ACCOUNTING_DISABLED;
 #endif
   return 0;
 }
 
+/*Drops one reference to an application frame buffer, and hands it back to
+   the application once the decoder no longer uses it.*/
+static void od_dec_fb_unref(od_dec_ctx *dec, int id) {
+  od_dec_fb *dfb;
+  if (id < 0) return;
+  dfb = dec->fb_pool + id;
+  OD_ASSERT(dfb->refs > 0);
+  if (--dfb->refs == 0) {
+    (*dec->fb_funcs.release)(dec->fb_funcs.ctx, &dfb->fb);
+    dfb->fb.data = NULL;
+  }
+}
+
+/*Gets a buffer for a new frame from the application.
+  Return: The pool entry holding the buffer, with one reference, or a
+   negative error code.*/
+static int od_dec_fb_get(od_dec_ctx *dec) {
+  od_dec_fb *dfb;
+  size_t size;
+  int id;
+  for (id = 0; id < OD_DEC_FB_POOL_SZ && dec->fb_pool[id].refs > 0; id++);
+  if (OD_UNLIKELY(id >= OD_DEC_FB_POOL_SZ)) return OD_EFAULT;
+  dfb = dec->fb_pool + id;
+  size = od_state_ref_img_sz(&dec->state);
+  OD_CLEAR(&dfb->fb, 1);
+  if ((*dec->fb_funcs.get)(dec->fb_funcs.ctx, size, &dfb->fb) < 0
+   || dfb->fb.data == NULL) {
+    dfb->fb.data = NULL;
+    return OD_EFAULT;
+  }
+  if (dfb->fb.size < size || ((size_t)dfb->fb.data & 31)) {
+    (*dec->fb_funcs.release)(dec->fb_funcs.ctx, &dfb->fb);
+    dfb->fb.data = NULL;
+    return OD_EINVAL;
+  }
+  dfb->refs = 1;
+  return id;
+}
+
+/*Makes reference slot refi use the buffer in pool entry id, taking over the
+   caller's reference to it, or the decoder's own buffer if id is -1.*/
+static void od_dec_bind_ref_slot(od_dec_ctx *dec, int refi, int id) {
+  od_dec_fb_unref(dec, dec->ref_fb[refi]);
+  dec->ref_fb[refi] = id;
+  if (id < 0) dec->state.ref_imgs[refi] = dec->own_ref_imgs[refi];
+  else {
+    od_state_ref_img_setup(&dec->state, dec->state.ref_imgs + refi,
+     dec->fb_pool[id].fb.data);
+  }
+}
+
+/*Hands every application frame buffer still held back to the application.*/
+static void od_dec_release_fbs(od_dec_ctx *dec) {
+  int refi;
+  int i;
+  if (!dec->use_fb_funcs) return;
+  for (refi = 0; refi <= OD_FRAME_MAX; refi++) {
+    od_dec_bind_ref_slot(dec, refi, -1);
+  }
+  for (i = 0; i < OD_MAX_REORDER; i++) {
+    if (dec->out.output_used[i]) od_dec_fb_unref(dec, dec->out.frames[i].id);
+  }
+  od_dec_fb_unref(dec, dec->out_fb);
+  dec->out_fb = -1;
+}
+
 static void od_dec_clear(od_dec_ctx *dec) {
+  od_dec_release_fbs(dec);
 #if OD_ACCOUNTING
   od_accounting_clear(&dec->acct);
 #endif
@@ -91,6 +168,44 @@ daala_dec_ctx *daala_decode_create(const daala_info *info,
   return dec;
 }
 
+/*Drops all decoding state and re-targets dec at the stream described by info,
+   which must already have passed od_state_check_reset().
+  The buffers set with the OD_DECCTL_SET_* controls are kept.*/
+static void od_dec_restart(od_dec_ctx *dec, const daala_info *info) {
+  int refi;
+  od_dec_release_fbs(dec);
+  od_state_reset(&dec->state, info);
+  od_output_queue_reset(&dec->out, &dec->state);
+  for (refi = 0; refi <= OD_FRAME_MAX; refi++) {
+    dec->own_ref_imgs[refi] = dec->state.ref_imgs[refi];
+  }
+  dec->packet_state = OD_PACKET_DATA;
+  dec->last_qm = -1;
+  OD_CLEAR(&dec->chunk, 1);
+  dec->restart = OD_DEC_RESTART_NONE;
+  dec->drop_frame = 0;
+#if OD_ACCOUNTING
+  od_accounting_set_frame_size(&dec->acct, dec->state.nhsb, dec->state.nvsb);
+#endif
+}
+
+int daala_decode_reset(daala_dec_ctx *dec, const daala_info *info,
+ const daala_setup_info *setup) {
+  int ret;
+  OD_UNUSED(setup);
+  OD_RETURN_CHECK(dec, OD_EFAULT);
+  OD_RETURN_CHECK(info, OD_EFAULT);
+  ret = od_state_check_reset(&dec->state, info);
+  if (ret < 0) return ret;
+  od_dec_restart(dec, info);
+  dec->user_bsize = NULL;
+  dec->user_flags = NULL;
+  dec->user_mv_grid = NULL;
+  dec->user_mc_img = NULL;
+  dec->user_dering = NULL;
+  return OD_SUCCESS;
+}
+
 void daala_decode_free(daala_dec_ctx *dec) {
   if (dec != NULL) {
     od_dec_clear(dec);
@@ -98,6 +213,108 @@ void daala_decode_free(daala_dec_ctx *dec) {
   }
 }
 
+/*Reallocates the MC and deringing working buffers, either for the whole frame
+   or for just the superblock rows needed in low-memory mode.
+  On failure, the current buffers are left untouched.*/
+static int od_dec_set_low_memory(od_dec_ctx *dec, int low_memory) {
+  od_state *state;
+  od_coeff *mctmp[OD_NPLANES_MAX];
+  od_coeff *mdtmp[OD_NPLANES_MAX];
+  int16_t *etmp[OD_NPLANES_MAX];
+  int nplanes;
+  int pli;
+  state = &dec->state;
+  nplanes = state->info.nplanes;
+  for (pli = 0; pli < nplanes; pli++) {
+    size_t w;
+    size_t h;
+    size_t row_sz;
+    w = state->frame_width >> state->info.plane_info[pli].xdec;
+    h = state->frame_height >> state->info.plane_info[pli].ydec;
+    row_sz = w*(OD_BSIZE_MAX >> state->info.plane_info[pli].ydec);
+    mctmp[pli] = (od_coeff *)malloc(sizeof(*mctmp[pli])*
+     (low_memory ? OD_DEC_LOW_MEM_MC_ROWS*row_sz : w*h));
+    mdtmp[pli] = (od_coeff *)malloc(sizeof(*mdtmp[pli])*
+     (low_memory ? OD_DEC_LOW_MEM_MD_ROWS*row_sz : w*h));
+    etmp[pli] = (int16_t *)malloc(sizeof(*etmp[pli])*
+     (low_memory ? OD_DEC_LOW_MEM_E_ROWS*row_sz : w*h));
+    if (OD_UNLIKELY(!mctmp[pli] || !mdtmp[pli] || !etmp[pli])) {
+      nplanes = pli + 1;
+      for (pli = 0; pli < nplanes; pli++) {
+        free(mctmp[pli]);
+        free(mdtmp[pli]);
+        free(etmp[pli]);
+      }
+      return OD_EFAULT;
+    }
+  }
+  for (pli = 0; pli < nplanes; pli++) {
+    free(state->mctmp[pli]);
+    free(state->mdtmp[pli]);
+    free(state->etmp[pli]);
+    state->mctmp[pli] = mctmp[pli];
+    state->mdtmp[pli] = mdtmp[pli];
+    state->etmp[pli] = etmp[pli];
+  }
+  dec->low_memory = low_memory;
+  return OD_SUCCESS;
+}
+
+/*Adds up the size of the decoder's allocations.*/
+static void od_dec_get_memory_footprint(od_dec_ctx *dec,
+ od_dec_memory_footprint *footprint) {
+  od_state *state;
+  size_t nsb;
+  int nplanes;
+  int pli;
+  state = &dec->state;
+  nplanes = state->info.nplanes;
+  nsb = (size_t)state->nhsb*state->nvsb;
+  footprint->reference_frames = state->ref_img_data_sz;
+  footprint->working_buffers = 0;
+  footprint->side_info = 0;
+  for (pli = 0; pli < nplanes; pli++) {
+    size_t w;
+    size_t h;
+    size_t row_sz;
+    int xdec;
+    int ydec;
+    xdec = state->info.plane_info[pli].xdec;
+    ydec = state->info.plane_info[pli].ydec;
+    w = state->frame_width >> xdec;
+    h = state->frame_height >> ydec;
+    row_sz = w*(OD_BSIZE_MAX >> ydec);
+    /*ctmp and dtmp.*/
+    footprint->working_buffers += 2*w*h*sizeof(od_coeff);
+    if (dec->low_memory) {
+      footprint->working_buffers +=
+       (OD_DEC_LOW_MEM_MC_ROWS + OD_DEC_LOW_MEM_MD_ROWS)*row_sz
+       *sizeof(od_coeff) + OD_DEC_LOW_MEM_E_ROWS*row_sz*sizeof(int16_t);
+    }
+    else {
+      footprint->working_buffers += 2*w*h*sizeof(od_coeff)
+       + w*h*sizeof(int16_t);
+    }
+    if (state->ltmp[pli] != NULL) {
+      footprint->working_buffers +=
+       OD_BSIZE_MAX*OD_BSIZE_MAX*sizeof(od_coeff);
+    }
+    footprint->working_buffers += nsb*sizeof(od_coeff);
+    footprint->side_info += nsb << (2*(OD_NBSIZES - 1) - xdec - ydec);
+    footprint->side_info += nsb*OD_BSKIP_MASK_ROWS*sizeof(uint16_t);
+  }
+  footprint->side_info += (size_t)(state->nhsb + 2)*OD_BSIZE_GRID
+   *(state->nvsb + 2)*OD_BSIZE_GRID;
+  footprint->side_info += (size_t)(state->nhmvbs + 1)*(state->nvmvbs + 1)
+   *sizeof(od_mv_grid_pt);
+  footprint->side_info += (size_t)(state->frame_width >>
+   (OD_LOG_DERING_GRID + OD_LOG_BSIZE0))*(state->frame_height >>
+   (OD_LOG_DERING_GRID + OD_LOG_BSIZE0));
+  footprint->side_info += nsb;
+  footprint->total = footprint->reference_frames
+   + footprint->working_buffers + footprint->side_info + sizeof(*dec);
+}
+
 int daala_decode_ctl(daala_dec_ctx *dec, int req, void *buf, size_t buf_sz) {
   switch (req) {
     case OD_DECCTL_SET_BSIZE_BUFFER : {
@@ -143,17 +360,28 @@ int daala_decode_ctl(daala_dec_ctx *dec, int req, void *buf, size_t buf_sz) {
       OD_RETURN_CHECK(dec, OD_EFAULT);
       OD_RETURN_CHECK(buf, OD_EFAULT);
       OD_RETURN_CHECK(buf_sz == sizeof(int), OD_EINVAL);
-      dec->acct_enabled = *(int*)buf != 0;
+      OD_RETURN_CHECK(*(int *)buf >= OD_ACCOUNTING_DISABLED
+       && *(int *)buf <= OD_ACCOUNTING_TOTALS, OD_EINVAL);
+      dec->acct_enabled = *(int *)buf;
+      dec->acct.log_syms = dec->acct_enabled == OD_ACCOUNTING_SYMBOLS;
       return OD_SUCCESS;
     }
     case OD_DECCTL_GET_ACCOUNTING : {
       OD_RETURN_CHECK(dec, OD_EFAULT);
       OD_RETURN_CHECK(buf, OD_EFAULT);
-      OD_RETURN_CHECK(dec->acct_enabled, OD_EINVAL);
+      OD_RETURN_CHECK(dec->acct_enabled == OD_ACCOUNTING_SYMBOLS, OD_EINVAL);
       OD_RETURN_CHECK(buf_sz == sizeof(od_accounting *), OD_EINVAL);
       *(od_accounting **)buf = &dec->acct.acct;
       return OD_SUCCESS;
     }
+    case OD_DECCTL_GET_ACCOUNTING_TOTALS : {
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(dec->acct_enabled, OD_EINVAL);
+      OD_RETURN_CHECK(buf_sz == sizeof(od_accounting_totals), OD_EINVAL);
+      od_accounting_get_totals(&dec->acct, (od_accounting_totals *)buf);
+      return OD_SUCCESS;
+    }
 #endif
     case OD_DECCTL_SET_DERING_BUFFER : {
       int nhdr;
@@ -167,6 +395,66 @@ int daala_decode_ctl(daala_dec_ctx *dec, int req, void *buf, size_t buf_sz) {
       dec->user_dering = (unsigned char *)buf;
       return OD_SUCCESS;
     }
+    case OD_DECCTL_SET_LOW_MEMORY : {
+      int low_memory;
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(int), OD_EINVAL);
+      low_memory = *(int *)buf != 0;
+      if (low_memory == dec->low_memory) return OD_SUCCESS;
+      return od_dec_set_low_memory(dec, low_memory);
+    }
+    case OD_DECCTL_SET_FRAME_BUFFER_FUNCS : {
+      const daala_frame_buffer_funcs *funcs;
+      int refi;
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(daala_frame_buffer_funcs), OD_EINVAL);
+      funcs = (const daala_frame_buffer_funcs *)buf;
+      OD_RETURN_CHECK(funcs->get != NULL && funcs->release != NULL,
+       OD_EFAULT);
+      /*The references would have to be converted for output anyway.*/
+      OD_RETURN_CHECK(!dec->state.info.full_precision_references, OD_EIMPL);
+      /*No frame may have been decoded yet.*/
+      for (refi = 0; refi <= OD_FRAME_MAX; refi++) {
+        OD_RETURN_CHECK(dec->state.ref_imgi[refi] < 0, OD_EINVAL);
+      }
+      dec->fb_funcs = *funcs;
+      if (!dec->use_fb_funcs) {
+        /*Output images point into the application buffers, so the queue's
+           own copies are never used.*/
+        od_output_queue_clear(&dec->out);
+        dec->out.output_img_data = NULL;
+        dec->use_fb_funcs = 1;
+      }
+      return OD_SUCCESS;
+    }
+    case OD_DECCTL_GET_FRAME_BUFFER : {
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(daala_frame_buffer), OD_EINVAL);
+      OD_RETURN_CHECK(dec->out_fb >= 0, OD_EINVAL);
+      *(daala_frame_buffer *)buf = dec->fb_pool[dec->out_fb].fb;
+      return OD_SUCCESS;
+    }
+    case OD_DECCTL_GET_MEMORY_FOOTPRINT : {
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(od_dec_memory_footprint), OD_EINVAL);
+      od_dec_get_memory_footprint(dec, (od_dec_memory_footprint *)buf);
+      return OD_SUCCESS;
+    }
+    case OD_DECCTL_RESTART_AT_KEYFRAME : {
+      daala_info info;
+      OD_UNUSED(buf);
+      OD_UNUSED(buf_sz);
+      OD_RETURN_CHECK(dec, OD_EFAULT);
+      /*od_state_reset() copies the info into the state.*/
+      info = dec->state.info;
+      od_dec_restart(dec, &info);
+      dec->restart = OD_DEC_RESTART_KEYFRAME;
+      return OD_SUCCESS;
+    }
     default: return OD_EIMPL;
   }
 }
@@ -191,6 +479,8 @@ static void od_dec_blank_img(daala_image *img) {
    buffers (i.e., decoding did not start on a key frame).
   We initialize them to a solid gray here.*/
 static void od_dec_init_dummy_frame(daala_dec_ctx *dec) {
+  /*Slot 0 may still hold a frame the application is displaying.*/
+  if (dec->ref_fb[0] >= 0) od_dec_bind_ref_slot(dec, 0, -1);
   dec->state.ref_imgi[OD_FRAME_GOLD] =
    dec->state.ref_imgi[OD_FRAME_PREV] =
    dec->state.ref_imgi[OD_FRAME_SELF] = 0;
@@ -215,7 +505,7 @@ static void od_decode_mv(daala_dec_ctx *dec, int num_refs, od_mv_grid_pt *mvg,
     OD_ASSERT(ref_pred < num_refs);
     mvg->ref = od_decode_cdf_adapt(&dec->ec,
      dec->state.adapt.mv_ref_cdf[ref_pred], num_refs, 256,
-     "mv:ref") + ref_offset;
+     OD_ACCT_ID_MV_REF) + ref_offset;
   }
   else {
     mvg->ref = OD_FRAME_PREV;
@@ -225,19 +515,19 @@ static void od_decode_mv(daala_dec_ctx *dec, int num_refs, od_mv_grid_pt *mvg,
    mv_res, mvg->ref);
   model = &dec->state.adapt.mv_model;
   id = od_decode_cdf_adapt(&dec->ec, dec->state.adapt.mv_small_cdf[equal_mvs],
-   16, dec->state.adapt.mv_small_increment, "mv:low");
+   16, dec->state.adapt.mv_small_increment, OD_ACCT_ID_MV_LOW);
   oy = id >> 2;
   ox = id & 0x3;
   if (ox == 3) {
     ox += generic_decode(&dec->ec, model, width << (3 - mv_res),
-     &dec->state.adapt.mv_ex[level], 6, "mv:high:x");
+     &dec->state.adapt.mv_ex[level], 6, OD_ACCT_ID_MV_HIGH_X);
   }
   if (oy == 3) {
     oy += generic_decode(&dec->ec, model, height << (3 - mv_res),
-     &dec->state.adapt.mv_ey[level], 6, "mv:high:y");
+     &dec->state.adapt.mv_ey[level], 6, OD_ACCT_ID_MV_HIGH_Y);
   }
-  if (ox && od_ec_dec_bits(&dec->ec, 1, "mv:sign:x")) ox = -ox;
-  if (oy && od_ec_dec_bits(&dec->ec, 1, "mv:sign:y")) oy = -oy;
+  if (ox && od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_MV_SIGN_X)) ox = -ox;
+  if (oy && od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_MV_SIGN_Y)) oy = -oy;
   if (mvg->ref == OD_FRAME_NEXT) {
     mvg->mv1[0] = (pred[0] + ox)*(1 << mv_res);;
     mvg->mv1[1] = (pred[1] + oy)*(1 << mv_res);;
@@ -248,27 +538,16 @@ static void od_decode_mv(daala_dec_ctx *dec, int num_refs, od_mv_grid_pt *mvg,
   }
 }
 
-/*Block-level decoder context information.
-  Global decoder context information is in od_dec_ctx.*/
-struct od_mb_dec_ctx {
-  od_coeff *c;
-  od_coeff **d;
-  od_coeff *md;
-  od_coeff *mc;
-  od_coeff *l;
-  int is_keyframe;
-  int num_refs;
-  int use_activity_masking;
-  int qm;
-  int use_haar_wavelet;
-  int is_golden_frame;
-};
-typedef struct od_mb_dec_ctx od_mb_dec_ctx;
+/*Converts the offset of a block in a plane to its offset in the MC
+   buffers.*/
+#define OD_DEC_MC_OFFSET(ctx, bo, w, ydec) \
+ ((bo) - ((ctx)->mc_sby << OD_LOG_BSIZE_MAX >> (ydec))*(w))
 
 static void od_decode_compute_pred(daala_dec_ctx *dec, od_mb_dec_ctx *ctx,
  od_coeff *pred, const od_coeff *d, int bs, int pli, int bx, int by) {
   int n;
   int xdec;
+  int ydec;
   int w;
   int bo;
   int y;
@@ -276,6 +555,7 @@ static void od_decode_compute_pred(daala_dec_ctx *dec, od_mb_dec_ctx *ctx,
   OD_ASSERT(bs >= 0 && bs < OD_NBSIZES);
   n = 1 << (bs + OD_LOG_BSIZE0);
   xdec = dec->state.info.plane_info[pli].xdec;
+  ydec = dec->state.info.plane_info[pli].ydec;
   w = dec->state.frame_width >> xdec;
   bo = (by << OD_LOG_BSIZE0)*w + (bx << OD_LOG_BSIZE0);
   /*We never use tf on the chroma planes, but if we do it will blow up, which
@@ -301,6 +581,7 @@ static void od_decode_compute_pred(daala_dec_ctx *dec, od_mb_dec_ctx *ctx,
   else {
     od_coeff *md;
     md = ctx->md;
+    bo = OD_DEC_MC_OFFSET(ctx, bo, w, ydec);
     for (y = 0; y < n; y++) {
       for (x = 0; x < n; x++) {
         pred[n*y + x] = md[bo + y*w + x];
@@ -310,34 +591,35 @@ static void od_decode_compute_pred(daala_dec_ctx *dec, od_mb_dec_ctx *ctx,
 }
 
 #if OD_ACCOUNTING
-# define od_ec_dec_unary(ec, str) od_ec_dec_unary_(ec, str)
-# define od_decode_coeff_split(dec, sum, ctx, str) od_decode_coeff_split_(dec, sum, ctx, str)
-# define od_decode_tree_split(dec, sum, ctx, str) od_decode_tree_split_(dec, sum, ctx, str)
+# define od_ec_dec_unary(ec, acc_id) od_ec_dec_unary_(ec, acc_id)
+# define od_decode_coeff_split(dec, sum, ctx, acc_id) od_decode_coeff_split_(dec, sum, ctx, acc_id)
+# define od_decode_tree_split(dec, sum, ctx, acc_id) od_decode_tree_split_(dec, sum, ctx, acc_id)
 #else
-# define od_ec_dec_unary(ec, str) od_ec_dec_unary_(ec)
-# define od_decode_coeff_split(dec, sum, ctx, str) od_decode_coeff_split_(dec, sum, ctx)
-# define od_decode_tree_split(dec, sum, ctx, str) od_decode_tree_split_(dec, sum, ctx)
+# define od_ec_dec_unary(ec, acc_id) od_ec_dec_unary_(ec)
+# define od_decode_coeff_split(dec, sum, ctx, acc_id) od_decode_coeff_split_(dec, sum, ctx)
+# define od_decode_tree_split(dec, sum, ctx, acc_id) od_decode_tree_split_(dec, sum, ctx)
 #endif
 
-static int od_ec_dec_unary_(od_ec_dec *ec OD_ACC_STR) {
+static int od_ec_dec_unary_(od_ec_dec *ec OD_ACC_ID) {
   int ret;
   ret = 0;
-  while (od_ec_dec_bits(ec, 1, acc_str) == 0) ret++;
+  while (od_ec_dec_bits(ec, 1, acc_id) == 0) ret++;
   return ret;
 }
 
-static int od_decode_coeff_split_(daala_dec_ctx *dec, int sum, int ctx OD_ACC_STR) {
+static int od_decode_coeff_split_(daala_dec_ctx *dec, int sum,
+ int ctx OD_ACC_ID) {
   int shift;
   int a;
   a = 0;
   if (sum == 0) return 0;
   shift = OD_MAXI(0, OD_ILOG(sum) - 4);
   if (shift) {
-    a = od_ec_dec_bits(&dec->ec, shift, acc_str);
+    a = od_ec_dec_bits(&dec->ec, shift, acc_id);
   }
   a += od_decode_cdf_adapt(&dec->ec, dec->state.adapt.haar_coeff_cdf[15*ctx
    + (sum >> shift) - 1], (sum >> shift) + 1,
-   dec->state.adapt.haar_coeff_increment, acc_str) << shift;
+   dec->state.adapt.haar_coeff_increment, acc_id) << shift;
   if (a > sum) {
     a = sum;
     dec->ec.error = 1;
@@ -345,18 +627,19 @@ static int od_decode_coeff_split_(daala_dec_ctx *dec, int sum, int ctx OD_ACC_ST
   return a;
 }
 
-static int od_decode_tree_split_(daala_dec_ctx *dec, int sum, int ctx OD_ACC_STR) {
+static int od_decode_tree_split_(daala_dec_ctx *dec, int sum,
+ int ctx OD_ACC_ID) {
   int shift;
   int a;
   a = 0;
   if (sum == 0) return 0;
   shift = OD_MAXI(0, OD_ILOG(sum) - 4);
   if (shift) {
-    a = od_ec_dec_bits(&dec->ec, shift, acc_str);
+    a = od_ec_dec_bits(&dec->ec, shift, acc_id);
   }
   a += od_decode_cdf_adapt(&dec->ec, dec->state.adapt.haar_split_cdf[15*(2*ctx
    + OD_MINI(shift, 1)) + (sum >> shift) - 1], (sum >> shift) + 1,
-   dec->state.adapt.haar_split_increment, acc_str) << shift;
+   dec->state.adapt.haar_split_increment, acc_id) << shift;
   if (a > sum) {
     a = sum;
     dec->ec.error = 1;
@@ -373,24 +656,28 @@ static void od_decode_sum_tree(daala_dec_ctx *dec, od_coeff *c, int ln,
   n = 1 << ln;
   if (tree_sum == 0) return;
   coeff_mag = od_decode_coeff_split(dec, tree_sum, dir
-   + 3*(OD_ILOG(OD_MAXI(x,y)) - 1), "haar:coeffsplit");
+   + 3*(OD_ILOG(OD_MAXI(x,y)) - 1), OD_ACCT_ID_HAAR_COEFFSPLIT);
   c[y*n + x] = coeff_mag;
   children_sum = tree_sum - coeff_mag;
   /* Decode sum of each four children relative to tree. */
   if (children_sum) {
     int sum1;
     if (dir == 0) {
-      sum1 = od_decode_tree_split(dec, children_sum, 0, "haar:split");
-      children[0][0] = od_decode_tree_split(dec, sum1, 2, "haar:split");
+      sum1 = od_decode_tree_split(dec, children_sum, 0, OD_ACCT_ID_HAAR_SPLIT);
+      children[0][0] = od_decode_tree_split(dec, sum1, 2,
+       OD_ACCT_ID_HAAR_SPLIT);
       children[0][1] = sum1 - children[0][0];
-      children[1][0] = od_decode_tree_split(dec, children_sum - sum1, 2, "haar:split");
+      children[1][0] = od_decode_tree_split(dec, children_sum - sum1, 2,
+       OD_ACCT_ID_HAAR_SPLIT);
       children[1][1] = children_sum - sum1 - children[1][0];
     }
     else {
-      sum1 = od_decode_tree_split(dec, children_sum, 1, "haar:split");
-      children[0][0] = od_decode_tree_split(dec, sum1, 2, "haar:split");
+      sum1 = od_decode_tree_split(dec, children_sum, 1, OD_ACCT_ID_HAAR_SPLIT);
+      children[0][0] = od_decode_tree_split(dec, sum1, 2,
+       OD_ACCT_ID_HAAR_SPLIT);
       children[1][0] = sum1 - children[0][0];
-      children[0][1] = od_decode_tree_split(dec, children_sum - sum1, 2, "haar:split");
+      children[0][1] = od_decode_tree_split(dec, children_sum - sum1, 2,
+       OD_ACCT_ID_HAAR_SPLIT);
       children[1][1] = children_sum - sum1 - children[0][1];
     }
   }
@@ -426,8 +713,8 @@ static void od_wavelet_unquantize(daala_dec_ctx *dec, int ln, od_coeff *pred,
   {
     int bits;
     bits = od_decode_cdf_adapt(&dec->ec, dec->state.adapt.haar_bits_cdf[pli],
-     16, dec->state.adapt.haar_bits_increment, "haar:top");
-    if (bits == 15) bits += od_ec_dec_unary(&dec->ec, "haar:top");
+     16, dec->state.adapt.haar_bits_increment, OD_ACCT_ID_HAAR_TOP);
+    if (bits == 15) bits += od_ec_dec_unary(&dec->ec, OD_ACCT_ID_HAAR_TOP);
     /* Theoretical maximum sum is around 2^7 * 2^OD_COEFF_SHIFT * 32x32,
        so 2^21, but let's play safe. */
     if (bits > 24) {
@@ -437,13 +724,14 @@ static void od_wavelet_unquantize(daala_dec_ctx *dec, int ln, od_coeff *pred,
     }
     else if (bits > 1) {
       tree_sum[0][0] = (1 << (bits - 1)) | od_ec_dec_bits(&dec->ec, bits - 1,
-       "haar:top");
+       OD_ACCT_ID_HAAR_TOP);
     }
     else tree_sum[0][0] = bits;
     /* Handle diagonal first to make H/V symmetric. */
-    tree_sum[1][1] = od_decode_tree_split(dec, tree_sum[0][0], 3, "haar:top");
+    tree_sum[1][1] = od_decode_tree_split(dec, tree_sum[0][0], 3,
+     OD_ACCT_ID_HAAR_TOP);
     tree_sum[0][1] = od_decode_tree_split(dec, tree_sum[0][0] - tree_sum[1][1],
-     4, "haar:top");
+     4, OD_ACCT_ID_HAAR_TOP);
     tree_sum[1][0] = tree_sum[0][0] - tree_sum[1][1] - tree_sum[0][1];
   }
   od_decode_sum_tree(dec, pred, ln, tree_sum[0][1], 1, 0, 0, pli);
@@ -456,7 +744,7 @@ static void od_wavelet_unquantize(daala_dec_ctx *dec, int ln, od_coeff *pred,
       od_coeff in;
       in = pred[i*n + j];
       if (in) {
-        sign = od_ec_dec_bits(&dec->ec, 1, "haar:sign");
+        sign = od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_HAAR_SIGN);
         if (sign) in = -in;
       }
       pred[i*n + j] = in;
@@ -483,8 +771,10 @@ static void od_block_decode(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int bs,
  int pli, int bx, int by, int skip) {
   int n;
   int xdec;
+  int ydec;
   int w;
   int bo;
+  int mbo;
   int frame_width;
   od_coeff *c;
   od_coeff *d;
@@ -503,20 +793,39 @@ static void od_block_decode(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int bs,
   bx <<= bs;
   by <<= bs;
   xdec = dec->state.info.plane_info[pli].xdec;
+  ydec = dec->state.info.plane_info[pli].ydec;
   frame_width = dec->state.frame_width;
   w = frame_width >> xdec;
   bo = (by << 2)*w + (bx << 2);
+  mbo = OD_DEC_MC_OFFSET(ctx, bo, w, ydec);
   c = ctx->c;
   d = ctx->d[pli];
   md = ctx->md;
   mc = ctx->mc;
+  /*A skipped block on an inter frame codes nothing: PVQ copies the AC of the
+     prediction and the DC residual is zero, so the inverse transform gives
+     back the prediction exactly.
+    Copy it directly instead of transforming it both ways.
+    The coefficients in d are only read on keyframes.*/
+  if (skip == 0 && !ctx->is_keyframe && !ctx->use_haar_wavelet) {
+    int i;
+    for (i = 0; i < n; i++) OD_COPY(c + bo + i*w, mc + mbo + i*w, n);
+    if (pli == 0 && dec->user_flags != NULL) {
+      unsigned int flags;
+      /*Every band is skipped and uses the reference.*/
+      flags = 0;
+      for (i = 0; i < OD_BAND_OFFSETS[bs][0]; i++) flags = flags << 2 | 1;
+      dec->user_flags[by*dec->user_fstride + bx] = flags;
+    }
+    return;
+  }
   /*Apply forward transform to MC predictor.*/
   if (!ctx->is_keyframe) {
     if (ctx->use_haar_wavelet) {
-      od_haar(md + bo, w, mc + bo, w, bs + 2);
+      od_haar(md + mbo, w, mc + mbo, w, bs + 2);
     }
     else {
-      (*dec->state.opt_vtbl.fdct_2d[bs])(md + bo, w, mc + bo, w);
+      (*dec->state.opt_vtbl.fdct_2d[bs])(md + mbo, w, mc + mbo, w);
     }
   }
   od_decode_compute_pred(dec, ctx, pred, d, bs, pli, bx, by);
@@ -563,8 +872,10 @@ static void od_block_decode(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int bs,
     if (!has_dc_skip || pred[0]) {
       pred[0] = has_dc_skip + generic_decode(&dec->ec,
        &dec->state.adapt.model_dc[pli], -1,
-       &dec->state.adapt.ex_dc[pli][bs][0], 2, "dc:mag");
-      if (pred[0]) pred[0] *= od_ec_dec_bits(&dec->ec, 1, "dc:sign") ? -1 : 1;
+       &dec->state.adapt.ex_dc[pli][bs][0], 2, OD_ACCT_ID_DC_MAG);
+      if (pred[0]) {
+        pred[0] *= od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_DC_SIGN) ? -1 : 1;
+      }
     }
     pred[0] = pred[0]*dc_quant + predt[0];
   }
@@ -636,9 +947,9 @@ static void od_decode_haar_dc_sb(daala_dec_ctx *dec, od_mb_dec_ctx *ctx,
   else if (bx > 0) sb_dc_pred = sb_dc_mem[by*nhsb + bx - 1];
   else sb_dc_pred = 0;
   quant = generic_decode(&dec->ec, &dec->state.adapt.model_dc[pli], -1,
-   &dec->state.adapt.ex_sb_dc[pli], 2, "haardc:mag:top");
+   &dec->state.adapt.ex_sb_dc[pli], 2, OD_ACCT_ID_HAARDC_MAG_TOP);
   if (quant) {
-    if (od_ec_dec_bits(&dec->ec, 1, "haardc:sign:top")) quant = -quant;
+    if (od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_HAARDC_SIGN_TOP)) quant = -quant;
   }
   sb_dc_curr = quant*dc_quant + sb_dc_pred;
   d[(by << ln)*w + (bx << ln)] = sb_dc_curr;
@@ -672,9 +983,11 @@ static void od_decode_haar_dc_level(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int
   for (i = 1; i < 4; i++) {
     int quant;
     quant = generic_decode(&dec->ec, &dec->state.adapt.model_dc[pli], -1,
-     &dec->state.adapt.ex_dc[pli][bsi][i-1], 2, "haardc:mag:level");
+     &dec->state.adapt.ex_dc[pli][bsi][i-1], 2, OD_ACCT_ID_HAARDC_MAG_LEVEL);
     if (quant) {
-      if (od_ec_dec_bits(&dec->ec, 1, "haardc:sign:level")) quant = -quant;
+      if (od_ec_dec_bits(&dec->ec, 1, OD_ACCT_ID_HAARDC_SIGN_LEVEL)) {
+        quant = -quant;
+      }
     }
     x[i] = quant*ac_quant[i == 3];
   }
@@ -709,7 +1022,7 @@ static void od_decode_quantizer_scaling(daala_dec_ctx *dec, int bx, int by,
      : 0;
     q_scaling = od_decode_cdf_adapt(&dec->ec,
      dec->state.adapt.q_cdf[above + left*4], 4,
-     dec->state.adapt.q_increment, "quant");
+     dec->state.adapt.q_increment, OD_ACCT_ID_QUANT);
   }
   else {
     q_scaling = 0;
@@ -740,7 +1053,7 @@ static void od_decode_recursive(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int pli,
   else if (pli == 0) {
     skip = od_decode_cdf_adapt(&dec->ec,
      dec->state.adapt.skip_cdf[2*bsi + (pli != 0)], 4 + (bsi > 0),
-     dec->state.adapt.skip_increment, "skip");
+     dec->state.adapt.skip_increment, OD_ACCT_ID_SKIP);
 #if OD_SIGNAL_Q_SCALING
     if (bsi == OD_NBSIZES - 1) {
       od_decode_quantizer_scaling(dec, bx, by, skip == 0);
@@ -777,15 +1090,11 @@ static void od_decode_recursive(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int pli,
       /* Decode the skip for chroma. */
       skip = od_decode_cdf_adapt(&dec->ec,
        dec->state.adapt.skip_cdf[2*bsi + (pli != 0)], 4,
-       dec->state.adapt.skip_increment, "skip");
+       dec->state.adapt.skip_increment, OD_ACCT_ID_SKIP);
     }
     od_block_decode(dec, ctx, bs, pli, bx, by, skip);
-    for (i = 0; i < 1 << bs; i++) {
-      for (j = 0; j < 1 << bs; j++) {
-        dec->state.bskip[pli][((by << bs) + i)*dec->state.skip_stride
-         + (bx << bs) + j] = (skip == 0) && !ctx->is_keyframe;
-      }
-    }
+    od_state_set_bskip(&dec->state, pli, bx, by, bs,
+     (skip == 0) && !ctx->is_keyframe);
 
   }
   else {
@@ -799,7 +1108,8 @@ static void od_decode_recursive(daala_dec_ctx *dec, od_mb_dec_ctx *ctx, int pli,
     hfilter = (bx + 1) << (OD_LOG_BSIZE0 + bs) <= dec->state.info.pic_width;
     vfilter = (by + 1) << (OD_LOG_BSIZE0 + bs) <= dec->state.info.pic_height;
     if (!ctx->is_keyframe) {
-      od_prefilter_split(ctx->mc + bo, w, bs, f, hfilter, vfilter);
+      od_prefilter_split(ctx->mc + OD_DEC_MC_OFFSET(ctx, bo, w, ydec), w, bs,
+       f, hfilter, vfilter);
     }
     if (ctx->is_keyframe) {
       od_decode_haar_dc_level(dec, ctx, pli, 2*bx, 2*by, bsi - 1, xdec, &hgrad,
@@ -843,7 +1153,7 @@ static void od_dec_mv_unpack(daala_dec_ctx *dec, int num_refs) {
   nhmvbs = dec->state.nhmvbs;
   nvmvbs = dec->state.nvmvbs;
   img = dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF];
-  mv_res = od_ec_dec_uint(&dec->ec, 3, "mv:res");
+  mv_res = od_ec_dec_uint(&dec->ec, 3, OD_ACCT_ID_MV_RES);
   od_state_set_mv_res(&dec->state, mv_res);
   width = (img->width + 32) << (3 - mv_res);
   height = (img->height + 32) << (3 - mv_res);
@@ -874,7 +1184,7 @@ static void od_dec_mv_unpack(daala_dec_ctx *dec, int num_refs) {
           cdf = od_mv_split_flag_cdf(&dec->state, vx, vy, level);
           mvp = grid[vy] + vx;
           mvp->valid = od_decode_cdf_adapt(&dec->ec,
-           cdf, 2, dec->state.adapt.split_flag_increment, "mv:valid");
+           cdf, 2, dec->state.adapt.split_flag_increment, OD_ACCT_ID_MV_VALID);
           if (mvp->valid) {
             od_decode_mv(dec, num_refs, mvp, vx, vy, level, mv_res,
              width, height);
@@ -894,7 +1204,7 @@ static void od_dec_mv_unpack(daala_dec_ctx *dec, int num_refs) {
           cdf = od_mv_split_flag_cdf(&dec->state, vx, vy, level);
           mvp = grid[vy] + vx;
           mvp->valid = od_decode_cdf_adapt(&dec->ec,
-           cdf, 2, dec->state.adapt.split_flag_increment, "mv:valid");
+           cdf, 2, dec->state.adapt.split_flag_increment, OD_ACCT_ID_MV_VALID);
           if (mvp->valid) {
             od_decode_mv(dec, num_refs, mvp, vx, vy, level, mv_res,
              width, height);
@@ -913,7 +1223,131 @@ static void od_dec_mv_unpack(daala_dec_ctx *dec, int num_refs) {
   }
 }
 
-static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
+/*The frame is reconstructed one superblock row at a time, so that each row
+   goes through MC, the prefilter, coefficient decoding and the postfilter
+   while it is still in cache, instead of streaming whole planes through each
+   stage in turn.
+  The lapping filters straddle superblock row edges, so the MC prefilter runs
+   one row ahead of coefficient decoding and the postfilter one row behind.
+  Deringing levels are coded after all of the coefficients, so deringing and
+   the final write-back to the reference frame form a second row pass.*/
+
+/*Loads the motion-compensated prediction of superblock row sby into mctmp
+   and applies the prefilter across the edge at the top of the row.*/
+static void od_dec_mc_sb_row(od_dec_ctx *dec, od_mb_dec_ctx *mbctx,
+ int sby) {
+  od_state *state;
+  daala_image *rec;
+  int pli;
+  state = &dec->state;
+  rec = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
+  /*If the application asked for the MC image, the whole frame has already
+     been predicted.*/
+  if (dec->user_mc_img == NULL) od_state_mc_predict_sb_row(state, rec, sby);
+  for (pli = 0; pli < state->info.nplanes; pli++) {
+    daala_image_plane *iplane;
+    int xdec;
+    int ydec;
+    int w;
+    int y0;
+    iplane = rec->planes + pli;
+    xdec = iplane->xdec;
+    ydec = iplane->ydec;
+    w = state->frame_width >> xdec;
+    y0 = sby << OD_LOG_BSIZE_MAX >> ydec;
+    od_ref_buf_to_coeff(state, state->mctmp[pli]
+     + OD_DEC_MC_OFFSET(mbctx, y0*w, w, ydec), w, OD_LOSSLESS(dec),
+     iplane->data + y0*iplane->ystride, iplane->xstride, iplane->ystride,
+     w, OD_BSIZE_MAX >> ydec);
+    if (!mbctx->use_haar_wavelet && sby > 0) {
+      od_apply_prefilter_sb_row_edge(state->mctmp[pli], w, state->nhsb,
+       sby - mbctx->mc_sby, xdec, ydec);
+    }
+  }
+}
+
+/*Copies superblock row sby into etmp, which is the input to the
+   deringing filter.
+  etmp starts at superblock row e_sby, which is always 0 unless the decoder
+   is in low-memory mode.*/
+static void od_dec_copy_dering_sb_row(od_dec_ctx *dec, int sby, int e_sby) {
+  od_state *state;
+  int pli;
+  state = &dec->state;
+  for (pli = 0; pli < state->info.nplanes; pli++) {
+    int16_t *e;
+    int i;
+    int i0;
+    int size;
+    int w;
+    int ydec;
+    w = state->frame_width >> state->info.plane_info[pli].xdec;
+    ydec = state->info.plane_info[pli].ydec;
+    i0 = (sby << OD_LOG_BSIZE_MAX >> ydec)*w;
+    size = (OD_BSIZE_MAX >> ydec)*w;
+    e = state->etmp[pli] + ((sby - e_sby) << OD_LOG_BSIZE_MAX >> ydec)*w;
+    for (i = 0; i < size; i++) e[i] = state->ctmp[pli][i0 + i];
+  }
+}
+
+/*Moves/scales/shifts the reconstructed superblock row sby from transform
+   storage back into the SELF reference frame.
+  If use_static is set, superblocks for which od_state_sb_static() holds are
+   left alone, since the frame already holds their prediction.*/
+static void od_dec_store_sb_row(od_dec_ctx *dec, int sby, int use_static) {
+  od_state *state;
+  daala_image *rec;
+  int sbx0;
+  int sbx1;
+  state = &dec->state;
+  rec = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
+  for (sbx0 = 0; sbx0 < state->nhsb; sbx0 = sbx1 + 1) {
+    int pli;
+    /*Find the next run of superblocks that needs to be stored.*/
+    if (use_static && od_state_sb_static(state, sbx0, sby)) {
+      sbx1 = sbx0;
+      continue;
+    }
+    for (sbx1 = sbx0 + 1; sbx1 < state->nhsb; sbx1++) {
+      if (use_static && od_state_sb_static(state, sbx1, sby)) break;
+    }
+    for (pli = 0; pli < state->info.nplanes; pli++) {
+      daala_image_plane *iplane;
+      int w;
+      int x0;
+      int y0;
+      iplane = rec->planes + pli;
+      w = state->frame_width >> iplane->xdec;
+      x0 = sbx0 << OD_LOG_BSIZE_MAX >> iplane->xdec;
+      y0 = sby << OD_LOG_BSIZE_MAX >> iplane->ydec;
+      od_coeff_to_ref_buf(state,
+       iplane->data + y0*iplane->ystride + x0*iplane->xstride,
+       iplane->xstride, iplane->ystride, state->ctmp[pli] + y0*w + x0, w,
+       OD_LOSSLESS(dec), (sbx1 - sbx0) << OD_LOG_BSIZE_MAX >> iplane->xdec,
+       OD_BSIZE_MAX >> iplane->ydec);
+    }
+  }
+}
+
+/*Decodes the quantizer and starts the prediction of the first superblock
+   row.*/
+static void od_decode_coefficients_begin(od_dec_ctx *dec,
+ od_mb_dec_ctx *mbctx) {
+  OD_ACCOUNTING_SET_LOCATION(dec, OD_ACCT_FRAME, 0, 0, 0);
+  /* Map our quantizer; we potentially need it to know what reference
+     resolution we're working at. */
+  dec->state.coded_quantizer =
+   od_ec_dec_uint(&dec->ec, OD_N_CODED_QUANTIZERS, OD_ACCT_ID_QUANTIZER);
+  dec->state.quantizer =
+   od_codedquantizer_to_quantizer(dec->state.coded_quantizer);
+  mbctx->mc_sby = 0;
+  if (!mbctx->is_keyframe) od_dec_mc_sb_row(dec, mbctx, 0);
+}
+
+/*Decodes the superblocks in rows sby0 through sby1 - 1, and postfilters
+   everything above the last of them.*/
+static void od_decode_sb_rows(od_dec_ctx *dec, od_mb_dec_ctx *mbctx,
+ int sby0, int sby1) {
   int nplanes;
   int pli;
   int xdec;
@@ -921,45 +1355,29 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
   int sby;
   int sbx;
   int w;
-  int y;
-  int x;
   int frame_width;
   int nvsb;
   int nhsb;
-  int nhdr;
-  int nvdr;
   od_state *state;
-  daala_image *rec;
   state = &dec->state;
-  /*Initialize the data needed for each plane.*/
   nplanes = state->info.nplanes;
   nhsb = state->nhsb;
   nvsb = state->nvsb;
   frame_width = state->frame_width;
-  rec = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
-  OD_ACCOUNTING_SET_LOCATION(dec, OD_ACCT_FRAME, 0, 0, 0);
-  /* Map our quantizer; we potentially need it to know what reference
-     resolution we're working at. */
-  dec->state.coded_quantizer =
-   od_ec_dec_uint(&dec->ec, OD_N_CODED_QUANTIZERS, "quantizer");
-  dec->state.quantizer =
-   od_codedquantizer_to_quantizer(dec->state.coded_quantizer);
-  /*Apply the prefilter to the motion-compensated reference.*/
-  if (!mbctx->is_keyframe) {
-    for (pli = 0; pli < nplanes; pli++) {
-      xdec = rec->planes[pli].xdec;
-      ydec = rec->planes[pli].ydec;
-      w = frame_width >> xdec;
-      /*Collect the image data needed for this plane.*/
-      od_ref_plane_to_coeff(state,
-       state->mctmp[pli], OD_LOSSLESS(dec), rec, pli);
+  for (sby = sby0; sby < sby1; sby++) {
+    /*Finish prefiltering the motion-compensated reference for this row.
+      This needs the next row to filter across the bottom edge.*/
+    if (!mbctx->is_keyframe) {
+      if (sby + 1 < nvsb) od_dec_mc_sb_row(dec, mbctx, sby + 1);
       if (!mbctx->use_haar_wavelet) {
-        od_apply_prefilter_frame_sbs(state->mctmp[pli], w, nhsb, nvsb, xdec,
-         ydec);
+        for (pli = 0; pli < nplanes; pli++) {
+          xdec = dec->state.info.plane_info[pli].xdec;
+          ydec = dec->state.info.plane_info[pli].ydec;
+          od_apply_prefilter_sb_row_cols(state->mctmp[pli],
+           frame_width >> xdec, nhsb, sby - mbctx->mc_sby, xdec, ydec);
+        }
       }
     }
-  }
-  for (sby = 0; sby < nvsb; sby++) {
     for (sbx = 0; sbx < nhsb; sbx++) {
       for (pli = 0; pli < nplanes; pli++) {
         od_coeff hgrad;
@@ -980,52 +1398,86 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
          ydec, hgrad, vgrad);
       }
     }
-  }
-  for (pli = 0; pli < nplanes; pli++) {
-    xdec = dec->state.info.plane_info[pli].xdec;
-    ydec = dec->state.info.plane_info[pli].ydec;
-    w = frame_width >> xdec;
+    /*Postfilter this row and the edge above it, which completes the row
+       above.*/
     if (!mbctx->use_haar_wavelet) {
-      od_apply_postfilter_frame_sbs(state->ctmp[pli], w, nhsb, nvsb, xdec,
-       ydec, dec->state.coded_quantizer, &dec->state.bskip[pli][0],
-       dec->state.skip_stride);
+      for (pli = 0; pli < nplanes; pli++) {
+        xdec = dec->state.info.plane_info[pli].xdec;
+        ydec = dec->state.info.plane_info[pli].ydec;
+        w = frame_width >> xdec;
+        od_apply_postfilter_sb_row_cols(state->ctmp[pli], w, nhsb, sby, xdec,
+         ydec, dec->state.coded_quantizer, &dec->state.bskip[pli][0],
+         dec->state.skip_stride);
+        if (sby > 0) {
+          od_apply_postfilter_sb_row_edge(state->ctmp[pli], w, nhsb, sby,
+           xdec, ydec, dec->state.coded_quantizer, &dec->state.bskip[pli][0],
+           dec->state.skip_stride);
+        }
+      }
+    }
+    /*In low-memory mode, slide the next row of the MC reference to the front
+       of the buffer.*/
+    if (dec->low_memory && !mbctx->is_keyframe && sby + 1 < nvsb) {
+      for (pli = 0; pli < nplanes; pli++) {
+        int size;
+        size = (OD_BSIZE_MAX >> dec->state.info.plane_info[pli].ydec)*
+         (frame_width >> dec->state.info.plane_info[pli].xdec);
+        OD_COPY(state->mctmp[pli], state->mctmp[pli] + size, size);
+      }
+      mbctx->mc_sby = sby + 1;
     }
   }
+}
+
+/*Decodes the deringing filter levels, applies the filter, and stores the
+   reconstruction in the reference frame.*/
+static void od_decode_coefficients_end(od_dec_ctx *dec,
+ od_mb_dec_ctx *mbctx) {
+  int nplanes;
+  int pli;
+  int xdec;
+  int ydec;
+  int sby;
+  int sbx;
+  int w;
+  int y;
+  int x;
+  int frame_width;
+  int nvsb;
+  int nhdr;
+  int nvdr;
+  int e_sby;
+  int use_static;
+  od_state *state;
+  state = &dec->state;
+  /*The Haar wavelet does not code a luma skip flag, so bskip does not tell
+     which blocks are static.*/
+  use_static = !mbctx->is_keyframe && !mbctx->use_haar_wavelet;
+  nplanes = state->info.nplanes;
+  nvsb = state->nvsb;
+  frame_width = state->frame_width;
   nhdr = state->frame_width >> (OD_LOG_DERING_GRID + OD_LOG_BSIZE0);
   nvdr = state->frame_height >> (OD_LOG_DERING_GRID + OD_LOG_BSIZE0);
+  /*The row passes below assume one deringing block per superblock.*/
+  OD_ASSERT(OD_LOG_DERING_GRID + OD_LOG_BSIZE0 == OD_LOG_BSIZE_MAX);
   if (!OD_LOSSLESS(dec)) {
     double base_threshold;
     int nblocks;
     nblocks = 1 << (OD_LOG_DERING_GRID - OD_BLOCK_8X8);
     base_threshold = pow(state->quantizer, 0.84182);
-    for (pli = 0; pli < nplanes; pli++) {
-      int i;
-      int size;
-      xdec = dec->state.info.plane_info[pli].xdec;
-      ydec = dec->state.info.plane_info[pli].ydec;
-      size = nvsb*nhsb*OD_BSIZE_MAX*OD_BSIZE_MAX >> xdec >> ydec;
-      for (i = 0; i < size; i++) {
-        state->etmp[pli][i] = state->ctmp[pli][i];
-      }
-    }
+    /*In low-memory mode, etmp holds the rows above, at and below the one
+       being deringed.*/
+    e_sby = dec->low_memory ? -1 : 0;
+    od_dec_copy_dering_sb_row(dec, 0, e_sby);
     for (sby = 0; sby < nvdr; sby++) {
+      /*The filter reads past the bottom of this row, so the next one needs to
+         be copied before it is deringed.*/
+      if (sby + 1 < nvdr) od_dec_copy_dering_sb_row(dec, sby + 1, e_sby);
       for (sbx = 0; sbx < nhdr; sbx++) {
         int level;
         int c;
-        int i;
-        int j;
-        unsigned char *bskip;
-        state->dering_level[sby*nhdr + sbx] = 0;
-        bskip = dec->state.bskip[0] +
-         (sby << OD_LOG_DERING_GRID)*dec->state.skip_stride +
-         (sbx << OD_LOG_DERING_GRID);
-        for (j = 0; j < 1 << OD_LOG_DERING_GRID; j++) {
-          for (i = 0; i < 1 << OD_LOG_DERING_GRID; i++) {
-            if (!bskip[j*dec->state.skip_stride + i]) {
-              state->dering_level[sby*nhdr + sbx] = 1;
-            }
-          }
-        }
+        state->dering_level[sby*nhdr + sbx] =
+         !od_state_sb_skipped(&dec->state, 0, sbx, sby);
         if (!state->dering_level[sby*nhdr + sbx]) {
           continue;
         }
@@ -1044,7 +1496,7 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
         }
         else c = 0;
         level = od_decode_cdf_adapt(&dec->ec, state->adapt.dering_cdf[c],
-         OD_DERING_LEVELS, state->adapt.dering_increment, "dering");
+         OD_DERING_LEVELS, state->adapt.dering_increment, OD_ACCT_ID_DERING);
         state->dering_level[sby*nhdr + sbx] = level;
         if (level) {
           for (pli = 0; pli < nplanes; pli++) {
@@ -1067,7 +1519,7 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
               we do this anyway on the edge pixels. Unfortunately, this limits
               potential parallelism.*/
             od_dering(&state->opt_vtbl.dering, buf, n,
-             &state->etmp[pli][(sby << ln)*w +
+             &state->etmp[pli][((sby - e_sby) << ln)*w +
              (sbx << ln)], w, nblocks, nblocks, sbx, sby, nhdr, nvdr,
              xdec, dir, pli, &dec->state.bskip[pli]
              [(sby << (OD_LOG_DERING_GRID - ydec))*dec->state.skip_stride
@@ -1082,6 +1534,16 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
           }
         }
       }
+      od_dec_store_sb_row(dec, sby, use_static);
+      if (dec->low_memory && sby + 1 < nvdr) {
+        for (pli = 0; pli < nplanes; pli++) {
+          int size;
+          size = (OD_BSIZE_MAX >> dec->state.info.plane_info[pli].ydec)*
+           (frame_width >> dec->state.info.plane_info[pli].xdec);
+          OD_MOVE(state->etmp[pli], state->etmp[pli] + size, 2*size);
+        }
+        e_sby = sby;
+      }
     }
     if (dec->user_dering != NULL) {
       for (sby = 0; sby < nvdr; sby++) {
@@ -1096,23 +1558,210 @@ static void od_decode_coefficients(od_dec_ctx *dec, od_mb_dec_ctx *mbctx) {
     if (dec->user_dering != NULL) {
       OD_CLEAR(dec->user_dering, nhdr*nvdr);
     }
+    for (sby = 0; sby < nvsb; sby++) {
+      od_dec_store_sb_row(dec, sby, use_static);
+    }
   }
-  for (pli = 0; pli < nplanes; pli++) {
-    /*Move/scale/shift reconstructed data values from transform
-      storage back into the SELF reference frame.*/
-    od_coeff_to_ref_plane(state, rec, pli,
-     state->ctmp[pli], OD_LOSSLESS(dec));
+}
+
+/*Finishes the reconstruction of a frame once all of its superblocks have been
+   decoded, queues it for output and updates the reference frame state.*/
+static void od_dec_frame_end(od_dec_ctx *dec, od_mb_dec_ctx *mbctx,
+ int frame_number, int fb_id) {
+  daala_image *ref_img;
+  int frame_type;
+  frame_type = dec->state.frame_type;
+  od_decode_coefficients_end(dec, mbctx);
+  if (dec->user_bsize != NULL) {
+    int j;
+    int nhsb;
+    int nvsb;
+    nhsb = dec->state.nhsb;
+    nvsb = dec->state.nvsb;
+    for (j = 0; j < nvsb*OD_BSIZE_GRID; j++) {
+      memcpy(&dec->user_bsize[dec->user_bstride*j],
+       &dec->state.bsize[dec->state.bstride*j], nhsb*OD_BSIZE_GRID);
+    }
+  }
+  ref_img = dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF];
+  if (dec->use_fb_funcs) {
+    /*The reorder queue holds its own reference until the frame is output.*/
+    dec->fb_pool[fb_id].refs++;
+    od_output_queue_add_ref(&dec->out, ref_img, frame_number, fb_id);
+  }
+  else od_output_queue_add(&dec->out, ref_img, frame_number);
+  OD_ASSERT(ref_img);
+  od_img_edge_ext(ref_img);
+  if (mbctx->is_golden_frame) {
+    dec->state.ref_imgi[OD_FRAME_GOLD] =
+     dec->state.ref_imgi[OD_FRAME_SELF];
+  }
+  /*B frames cannot be a reference frame.*/
+  if (frame_type != OD_B_FRAME) {
+    /*1st P frame in closed GOP or 1st P in the sequence with open GOP?*/
+    if (dec->state.ref_imgi[OD_FRAME_PREV] < 0 &&
+     dec->state.ref_imgi[OD_FRAME_NEXT] < 0) {
+      /*Only previous reference frame (i.e. I frame) is available.*/
+      dec->state.ref_imgi[OD_FRAME_PREV] =
+       dec->state.ref_imgi[OD_FRAME_SELF];
+      dec->state.ref_imgi[OD_FRAME_NEXT] =
+       dec->state.ref_imgi[OD_FRAME_SELF];
+    }
+    else {
+      /*Update two reference frames.*/
+      dec->state.ref_imgi[OD_FRAME_PREV] =
+       dec->state.ref_imgi[OD_FRAME_NEXT];
+      dec->state.ref_imgi[OD_FRAME_NEXT] =
+       dec->state.ref_imgi[OD_FRAME_SELF];
+    }
+  }
+}
+
+/*Decodes the next packet of superblock rows of a frame that is coded in
+   several.*/
+static int od_dec_frame_chunk(od_dec_ctx *dec) {
+  od_dec_chunk *chunk;
+  int nvsb;
+  int sby1;
+  chunk = &dec->chunk;
+  nvsb = dec->state.nvsb;
+  sby1 = OD_MINI(chunk->sby + chunk->rows, nvsb);
+  od_decode_sb_rows(dec, &chunk->mbctx, chunk->sby, sby1);
+  if (sby1 < nvsb) {
+    chunk->sby = sby1;
+    return 0;
+  }
+  chunk->sby = 0;
+  od_dec_frame_end(dec, &chunk->mbctx, chunk->frame_number, chunk->fb_id);
+  return 0;
+}
+
+/*Reads the header at the start of the first packet of a frame, up to the
+   keyframe QMs.
+  For a later packet of a frame, only its first superblock row is read.
+  sby: Returns the first superblock row of the packet, which is 0 for the
+   first packet of a frame.
+  Return: 0 on success, or OD_EBADPACKET if the packet is not a video data
+   packet.*/
+static int od_dec_read_frame_header(od_ec_dec *ec, const daala_info *info,
+ int nvsb, od_mb_dec_ctx *mbctx, int *frame_type, int *frame_number,
+ int *chunk_rows, int *sby) {
+  int chunked;
+  *sby = 0;
+  /*Read the packet type bit.*/
+  if (od_ec_decode_bool_q15(ec, 16384, OD_ACCT_ID_FLAGS)) {
+    return OD_EBADPACKET;
+  }
+  mbctx->is_keyframe = od_ec_decode_bool_q15(ec, 16384, OD_ACCT_ID_FLAGS);
+  if (info->version_minor >= OD_STREAM_VERSION_MINOR_CHUNKS
+   && !mbctx->is_keyframe
+   && od_ec_decode_bool_q15(ec, 16384, OD_ACCT_ID_FLAGS)) {
+    /*This is a later packet of a frame split into several.*/
+    if (nvsb < 2) return OD_EBADPACKET;
+    *sby = od_ec_dec_uint(ec, nvsb, OD_ACCT_ID_FLAGS);
+    return *sby > 0 ? 0 : OD_EBADPACKET;
+  }
+  if (info->version_minor >= OD_STREAM_VERSION_MINOR_PACKED_HEADER) {
+    uint32_t hdr;
+    hdr = od_ec_dec_bits(ec,
+     mbctx->is_keyframe ? OD_FHDR_INTRA_BITS : OD_FHDR_INTER_BITS,
+     OD_ACCT_ID_FLAGS);
+    if (mbctx->is_keyframe) {
+      *frame_type = OD_I_FRAME;
+      mbctx->num_refs = 0;
+    }
+    else {
+      *frame_type = hdr >> OD_FHDR_B_FRAME & 1 ? OD_B_FRAME : OD_P_FRAME;
+      mbctx->num_refs = (hdr >> OD_FHDR_NUM_REFS & 1) + 1;
+    }
+    *frame_number = hdr >> OD_FHDR_FRAME_NUMBER & (OD_MAX_REORDER - 1);
+    mbctx->use_activity_masking = hdr >> OD_FHDR_ACTIVITY_MASKING & 1;
+    mbctx->qm = hdr >> OD_FHDR_QM & 1;
+    mbctx->use_haar_wavelet = hdr >> OD_FHDR_HAAR & 1;
+    mbctx->is_golden_frame = hdr >> OD_FHDR_GOLDEN & 1;
+    chunked = hdr >> OD_FHDR_CHUNKED & 1;
   }
+  else {
+    if (mbctx->is_keyframe) *frame_type = OD_I_FRAME;
+    else {
+      if (od_ec_decode_bool_q15(ec, 16384, OD_ACCT_ID_FLAGS)) {
+        *frame_type = OD_B_FRAME;
+      }
+      else {
+        *frame_type = OD_P_FRAME;
+      }
+    }
+    if (*frame_type != OD_I_FRAME) {
+      mbctx->num_refs = od_ec_dec_uint(ec, OD_MAX_CODED_REFS,
+       OD_ACCT_ID_FLAGS) + 1;
+    }
+    else {
+      mbctx->num_refs = 0;
+    }
+    *frame_number = od_ec_dec_uint(ec, OD_MAX_REORDER, OD_ACCT_ID_FLAGS);
+    mbctx->use_activity_masking = od_ec_decode_bool_q15(ec, 16384,
+     OD_ACCT_ID_FLAGS);
+    mbctx->qm = od_ec_decode_bool_q15(ec, 16384, OD_ACCT_ID_FLAGS);
+    mbctx->use_haar_wavelet = od_ec_decode_bool_q15(ec, 16384,
+     OD_ACCT_ID_FLAGS);
+    mbctx->is_golden_frame = od_ec_decode_bool_q15(ec, 16384,
+     OD_ACCT_ID_FLAGS);
+    chunked = 0;
+  }
+  /*Read the number of superblock rows per packet.*/
+  *chunk_rows = nvsb;
+  if (chunked) {
+    if (info->version_minor < OD_STREAM_VERSION_MINOR_CHUNKS || nvsb < 2) {
+      return OD_EBADPACKET;
+    }
+    *chunk_rows = od_ec_dec_uint(ec, nvsb, OD_ACCT_ID_FLAGS) + 1;
+  }
+  return 0;
+}
+
+int daala_decode_frame_header(const daala_info *info, const daala_packet *dp,
+ daala_frame_header *hdr) {
+  od_ec_dec ec;
+  od_mb_dec_ctx mbctx;
+  int frame_type;
+  int frame_number;
+  int chunk_rows;
+  int nvsb;
+  int sby;
+  int ret;
+  OD_RETURN_CHECK(info, OD_EFAULT);
+  OD_RETURN_CHECK(dp, OD_EFAULT);
+  OD_RETURN_CHECK(hdr, OD_EFAULT);
+  nvsb = ((info->pic_height + (OD_BSIZE_MAX - 1)) & ~(OD_BSIZE_MAX - 1))
+   >> OD_LOG_BSIZE_MAX;
+  od_ec_dec_init(&ec, dp->packet, dp->bytes);
+  ret = od_dec_read_frame_header(&ec, info, nvsb, &mbctx, &frame_type,
+   &frame_number, &chunk_rows, &sby);
+  if (ret < 0) return ret;
+  if (sby > 0) return OD_EBADPACKET;
+  hdr->is_keyframe = mbctx.is_keyframe;
+  hdr->is_b_frame = frame_type == OD_B_FRAME;
+  hdr->frame_number = frame_number;
+  hdr->npackets = (nvsb + chunk_rows - 1)/chunk_rows;
+  return OD_SUCCESS;
 }
 
 int daala_decode_packet_in(daala_dec_ctx *dec, const daala_packet *op) {
   int refi;
   od_mb_dec_ctx mbctx;
-  daala_image *ref_img;
   int frame_number;
   int frame_type;
+  int nvsb;
+  int chunk_rows;
+  int sby;
+  int fb_id;
+  int ret;
   if (dec == NULL || op == NULL) return OD_EFAULT;
   if (dec->packet_state != OD_PACKET_DATA) return OD_EINVAL;
+  /*The image returned by the last daala_decode_img_out() call is no longer
+     needed by the application.*/
+  od_dec_fb_unref(dec, dec->out_fb);
+  dec->out_fb = -1;
   if (op->e_o_s) {
     dec->packet_state = OD_PACKET_DONE;
   }
@@ -1120,51 +1769,81 @@ int daala_decode_packet_in(daala_dec_ctx *dec, const daala_packet *op) {
 #if OD_ACCOUNTING
   if (dec->acct_enabled) {
     od_accounting_reset(&dec->acct);
+    if (dec->chunk.sby == 0) od_accounting_reset_totals(&dec->acct);
     dec->ec.acct = &dec->acct;
   }
   else dec->ec.acct = NULL;
 #endif
   OD_ACCOUNTING_SET_LOCATION(dec, OD_ACCT_FRAME, 0, 0, 0);
-  /*Read the packet type bit.*/
-  if (od_ec_decode_bool_q15(&dec->ec, 16384, "flags")) return OD_EBADPACKET;
-  mbctx.is_keyframe = od_ec_decode_bool_q15(&dec->ec, 16384, "flags");
-  if (mbctx.is_keyframe) frame_type = OD_I_FRAME;
-  else {
-    if (od_ec_decode_bool_q15(&dec->ec, 16384, "flags")) {
-      frame_type = OD_B_FRAME;
-    }
-    else {
-      frame_type = OD_P_FRAME;
+  nvsb = dec->state.nvsb;
+  ret = od_dec_read_frame_header(&dec->ec, &dec->state.info, nvsb, &mbctx,
+   &frame_type, &frame_number, &chunk_rows, &sby);
+  if (dec->chunk.sby > 0 && (ret < 0 || sby != dec->chunk.sby)) {
+    /*A packet is missing: give up on the frame that is partially decoded.*/
+    dec->chunk.sby = 0;
+  }
+  if (ret < 0) return ret;
+  if (sby > 0) {
+    /*The rest of a frame that started before the keyframe being waited for
+       cannot be decoded.*/
+    if (dec->restart == OD_DEC_RESTART_KEYFRAME) return OD_EBADPACKET;
+    /*The rest of a B-frame dropped after OD_DECCTL_RESTART_AT_KEYFRAME.*/
+    if (dec->drop_frame) return 0;
+    /*The earlier packets of this frame were not decoded.*/
+    if (dec->chunk.sby == 0) return OD_EBADPACKET;
+    /*Continue the frame that is partially decoded.*/
+    return od_dec_frame_chunk(dec);
+  }
+  dec->drop_frame = 0;
+  if (dec->restart == OD_DEC_RESTART_KEYFRAME) {
+    /*Nothing before the first keyframe can be decoded.*/
+    if (!mbctx.is_keyframe) return OD_EBADPACKET;
+    /*Frames are output in display order starting from this one.*/
+    dec->out.output_index = OD_REORDER_INDEX(frame_number);
+    dec->restart = OD_DEC_RESTART_LEADING;
+  }
+  else if (dec->restart == OD_DEC_RESTART_LEADING) {
+    if (frame_type == OD_B_FRAME) {
+      /*The B-frames coded right after the keyframe are displayed before it,
+         and predicted from a frame that was never decoded.
+        Nothing refers to them, so they are dropped, with all their
+         packets.*/
+      dec->drop_frame = 1;
+      return 0;
     }
+    dec->restart = OD_DEC_RESTART_NONE;
   }
   dec->state.frame_type = frame_type;
-  if (frame_type != OD_I_FRAME) {
-    mbctx.num_refs = od_ec_dec_uint(&dec->ec, OD_MAX_CODED_REFS, "flags") + 1;
-  }
-  else {
-    mbctx.num_refs = 0;
-  }
-  frame_number = od_ec_dec_uint(&dec->ec, OD_MAX_REORDER, "flags");
-  mbctx.use_activity_masking = od_ec_decode_bool_q15(&dec->ec, 16384, "flags");
-  mbctx.qm = od_ec_decode_bool_q15(&dec->ec, 16384, "flags");
   if (mbctx.qm != dec->last_qm) {
-    od_init_qm(dec->state.qm, dec->state.qm_inv,
-     mbctx.qm == OD_HVS_QM ? OD_QM8_Q4_HVS : OD_QM8_Q4_FLAT);
+    dec->state.qm = od_qm_get(&dec->state.qm_inv, mbctx.qm);
     dec->last_qm = mbctx.qm;
   }
-  mbctx.use_haar_wavelet = od_ec_decode_bool_q15(&dec->ec, 16384, "flags");
-  mbctx.is_golden_frame = od_ec_decode_bool_q15(&dec->ec, 16384, "flags");
   if (mbctx.is_keyframe) {
     int nplanes;
     int pli;
     nplanes = dec->state.info.nplanes;
     for (pli = 0; pli < nplanes; pli++) {
       int i;
-      for (i = 0; i < OD_QM_SIZE; i++) {
-        dec->state.pvq_qm_q4[pli][i] = od_ec_dec_bits(&dec->ec, 8, "qm");
+      /*The QM bytes are raw bits, so several can be read at once.*/
+      for (i = 0; i < OD_QM_SIZE; i += OD_QM_BATCH) {
+        uint32_t bytes;
+        int nbytes;
+        int j;
+        nbytes = OD_MINI(OD_QM_SIZE - i, OD_QM_BATCH);
+        bytes = od_ec_dec_bits(&dec->ec, 8*nbytes, OD_ACCT_ID_QM);
+        for (j = 0; j < nbytes; j++) {
+          dec->state.pvq_qm_q4[pli][i + j] = (unsigned char)(bytes >> 8*j);
+        }
       }
     }
   }
+  /*Get the buffer for this frame before touching the reference state, so a
+     failure leaves the decoder usable.*/
+  fb_id = -1;
+  if (dec->use_fb_funcs) {
+    fb_id = od_dec_fb_get(dec);
+    if (OD_UNLIKELY(fb_id < 0)) return fb_id;
+  }
   /*Update the reference buffer state.*/
   if (frame_type == OD_P_FRAME) {
     dec->state.ref_imgi[OD_FRAME_PREV] = dec->state.ref_imgi[OD_FRAME_NEXT];
@@ -1189,64 +1868,43 @@ int daala_decode_packet_in(daala_dec_ctx *dec, const daala_packet *op) {
    || refi == dec->state.ref_imgi[OD_FRAME_PREV]
    || refi == dec->state.ref_imgi[OD_FRAME_NEXT]; refi++);
   dec->state.ref_imgi[OD_FRAME_SELF] = refi;
+  if (dec->use_fb_funcs) od_dec_bind_ref_slot(dec, refi, fb_id);
   od_adapt_ctx_reset(&dec->state.adapt, mbctx.is_keyframe);
   if (!mbctx.is_keyframe) {
     int num_refs;
     num_refs = mbctx.num_refs;
     od_dec_mv_unpack(dec, num_refs);
-    od_state_mc_predict(&dec->state,
-     dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF]);
+    /*The prediction is normally computed one superblock row at a time in
+       od_decode_coefficients(), but the application wants the whole image.*/
     if (dec->user_mc_img != NULL) {
+      od_state_mc_predict(&dec->state,
+       dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF]);
       od_img_copy(dec->user_mc_img,
        dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF]);
     }
   }
-  od_decode_coefficients(dec, &mbctx);
-  if (dec->user_bsize != NULL) {
-    int j;
-    int nhsb;
-    int nvsb;
-    nhsb = dec->state.nhsb;
-    nvsb = dec->state.nvsb;
-    for (j = 0; j < nvsb*OD_BSIZE_GRID; j++) {
-      memcpy(&dec->user_bsize[dec->user_bstride*j],
-       &dec->state.bsize[dec->state.bstride*j], nhsb*OD_BSIZE_GRID);
-    }
-  }
-  ref_img = dec->state.ref_imgs + dec->state.ref_imgi[OD_FRAME_SELF];
-  od_output_queue_add(&dec->out, ref_img, frame_number);
-  OD_ASSERT(ref_img);
-  od_img_edge_ext(ref_img);
-  if (mbctx.is_golden_frame) {
-    dec->state.ref_imgi[OD_FRAME_GOLD] =
-     dec->state.ref_imgi[OD_FRAME_SELF];
-  }
-  /*B frames cannot be a reference frame.*/
-  if (frame_type != OD_B_FRAME) {
-    /*1st P frame in closed GOP or 1st P in the sequence with open GOP?*/
-    if (dec->state.ref_imgi[OD_FRAME_PREV] < 0 &&
-     dec->state.ref_imgi[OD_FRAME_NEXT] < 0) {
-      /*Only previous reference frame (i.e. I frame) is available.*/
-      dec->state.ref_imgi[OD_FRAME_PREV] =
-       dec->state.ref_imgi[OD_FRAME_SELF];
-      dec->state.ref_imgi[OD_FRAME_NEXT] =
-       dec->state.ref_imgi[OD_FRAME_SELF];
-    }
-    else {
-      /*Update two reference frames.*/
-      dec->state.ref_imgi[OD_FRAME_PREV] =
-       dec->state.ref_imgi[OD_FRAME_NEXT];
-      dec->state.ref_imgi[OD_FRAME_NEXT] =
-       dec->state.ref_imgi[OD_FRAME_SELF];
-    }
-  }
+  od_decode_coefficients_begin(dec, &mbctx);
+  od_decode_sb_rows(dec, &mbctx, 0, chunk_rows);
+  if (chunk_rows < nvsb) {
+    /*The rest of the frame comes in the following packets.*/
+    dec->chunk.mbctx = mbctx;
+    dec->chunk.rows = chunk_rows;
+    dec->chunk.sby = chunk_rows;
+    dec->chunk.frame_number = frame_number;
+    dec->chunk.fb_id = fb_id;
+    return 0;
+  }
+  od_dec_frame_end(dec, &mbctx, frame_number, fb_id);
   return 0;
 }
 
 int daala_decode_img_out(daala_dec_ctx *dec, daala_image *img) {
   if (od_output_queue_has_next(&dec->out)) {
     od_output_frame *frame;
+    od_dec_fb_unref(dec, dec->out_fb);
     frame = od_output_queue_next(&dec->out);
+    /*The queue's reference now belongs to the output image.*/
+    dec->out_fb = frame->id;
     *img = *frame->img;
     img->width = dec->state.info.pic_width;
     img->height = dec->state.info.pic_height;
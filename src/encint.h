@@ -34,6 +34,10 @@ typedef struct od_input_queue od_input_queue;
 typedef struct od_input_frame od_input_frame;
 typedef struct od_iir_bessel2 od_iir_bessel2;
 typedef struct od_rc_state od_rc_state;
+typedef struct od_rt_state od_rt_state;
+typedef struct od_mb_enc_ctx od_mb_enc_ctx;
+typedef struct od_enc_chunk od_enc_chunk;
+typedef struct od_enc_acct od_enc_acct;
 
 # include "../include/daala/daaladec.h"
 # include "../include/daala/daalaenc.h"
@@ -64,6 +68,10 @@ typedef struct od_rc_state od_rc_state;
    refinement.*/
 # define OD_MC_SQUARE_SUBPEL_REFINEMENT_COMPLEXITY (10)
 
+/*The screen-content level where we skip blocks whose source is unchanged
+   since the references they are predicted from were coded.*/
+# define OD_SCREEN_CONTENT_SOURCE_SKIP (2)
+
 /*Constants for frame QP modulation.*/
 # define OD_MQP_I (1.00)
 # define OD_MQP_P (1.05)
@@ -160,6 +168,115 @@ struct od_rc_state {
   int64_t rate_bias;
 };
 
+/*The largest value accepted by OD_SET_COMPLEXITY.*/
+# define OD_COMPLEXITY_MAX (10)
+
+/*The checkpoints of the real-time deadline control, in the order a frame
+   reaches them.*/
+/*Motion estimation.*/
+# define OD_RT_MV     (0)
+/*The block size RDO pass, checked before each superblock.*/
+# define OD_RT_SPLIT  (1)
+/*The coefficient coding pass, checked before each superblock.*/
+# define OD_RT_CODE   (2)
+/*The deringing filter search, checked before each filter block.*/
+# define OD_RT_DERING (3)
+# define OD_RT_NSTAGES (4)
+
+/*Real-time deadline control state (see OD_SET_DEADLINE).
+  The per-class arrays are indexed by whether the frame is a keyframe.*/
+struct od_rt_state {
+  /*The per-frame encoding time target in microseconds, or 0 if disabled.*/
+  int64_t target_us;
+  /*The time the current frame started, in microseconds.*/
+  int64_t frame_start;
+  /*Whether the current frame is a keyframe.*/
+  int frame_class;
+  /*The complexity level the current frame started with.*/
+  int frame_level;
+  /*The complexity level in effect for the rest of the current frame.
+    This is always the configured complexity when the deadline is disabled.*/
+  int level;
+  /*Whether the current frame has fallen behind schedule.*/
+  int late;
+  /*The complexity level to start the next frame of each class with.*/
+  int next_level[2];
+  /*The smoothed time taken by frames of each class started at each level, in
+     microseconds, or 0 if unknown.
+    The estimates of levels that are not being used decay towards 0, so that
+     the controller eventually tries them again.*/
+  int64_t level_us[2][OD_COMPLEXITY_MAX + 1];
+  /*The smoothed fraction of the frame time elapsed at the end of each
+     checkpoint stage, in Q15.*/
+  int32_t sched[2][OD_RT_NSTAGES];
+  /*The time elapsed at the last check of each stage in the current frame,
+     or -1 if the stage was not reached.*/
+  int64_t mark[OD_RT_NSTAGES];
+  /*The time the current frame was paused between two packets, in
+     microseconds.*/
+  int64_t pause_start;
+  od_enc_deadline_stats stats;
+};
+
+/*Block-level encoder context information.
+  Global encoder context information is in od_enc_ctx.*/
+struct od_mb_enc_ctx {
+  od_coeff *c;
+  od_coeff **d;
+  od_coeff *md;
+  od_coeff *mc;
+  od_coeff *l;
+  int is_keyframe;
+  int num_refs;
+  int use_activity_masking;
+  int qm;
+  int use_haar_wavelet;
+  int is_golden_frame;
+  int frame_type;
+  int q_scaling;
+};
+
+/*The state of a frame that is output in several packets of superblock rows
+   (see OD_SET_CHUNK_ROWS), kept between calls to
+   daala_encode_packet_out().*/
+struct od_enc_chunk {
+  od_mb_enc_ctx mbctx;
+  /*The number of superblock rows per packet in the current frame.*/
+  int rows;
+  /*The next superblock row to code, or 0 if no frame is in progress.*/
+  int sby;
+  /*Whether the block sizes of each packet are searched just before it is
+     coded.*/
+  int split_rdo;
+  int duration;
+  int display_frame_number;
+  /*Whether this is the last frame of the stream.*/
+  int last;
+  /*The number of bits in the packets of the current frame already
+     output.*/
+  int32_t bits;
+  /*The start of the frame for OD_PROF_FRAME, and the time it was paused
+     between two packets.*/
+  int64_t prof_t0;
+  int64_t prof_pause;
+};
+
+/*Bit accounting of the frame being coded (see OD_SET_ACCOUNTING).
+  Only the final coding pass is counted, never the RDO trial encodes, by
+   adding up od_ec_enc_tell_frac() deltas around the code of each superblock,
+   motion vector grid point and deringing filter level.*/
+struct od_enc_acct {
+  int enabled;
+  /*The bits of each class, except OD_ENC_ACCT_HEADER, which is whatever the
+     other classes do not account for.*/
+  uint32_t class_bits_q3[OD_ENC_ACCT_NCLASSES];
+  /*The bits of each superblock, in raster order.
+    The frame-level motion vector resolution is left out.*/
+  uint32_t *sb_bits_q3;
+  /*The bits of the packets of the frame already output.*/
+  uint32_t packet_bits_q3;
+};
+
 /*Unsanitized user parameters*/
 struct od_params_ctx {
   /*Set using OD_SET_MV_LEVEL_MIN*/
@@ -201,6 +318,30 @@ struct od_input_queue {
   int closed_gop;
 };
 
+/*The alignment of every scratch arena allocation, in bytes.*/
+# define OD_SCRATCH_ALIGN (64)
+
+/*The size of the encoder scratch arena.
+  This is the worst case for a 64x64 superblock: one block copy at the
+   superblock level, four per level of block size RDO, seven in
+   od_block_encode() and one in od_pvq_encode(), plus the PVQ search buffers
+   and the alignment padding of every allocation.*/
+# define OD_ENC_SCRATCH_SZ \
+ ((1 + 4*(OD_NBSIZES - 1) + 7 + 1)*OD_BSIZE_MAX*OD_BSIZE_MAX*sizeof(od_coeff) \
+ + MAXN*(sizeof(od_coeff) + 4*sizeof(od_val16)) \
+ + 64*OD_SCRATCH_ALIGN)
+
+/*A cache-aligned bump allocator for encoder scratch buffers.
+  Allocations are released in LIFO order by restoring a mark obtained with
+   od_scratch_mark(), so the working set of a superblock stays contiguous.*/
+typedef struct {
+  unsigned char *buf;
+  size_t size;
+  size_t top;
+  /*The largest value of top seen since the arena was created.*/
+  size_t peak;
+} od_scratch;
+
 struct daala_enc_ctx{
   od_state state;
   od_enc_opt_vtbl opt_vtbl;
@@ -215,6 +356,32 @@ struct daala_enc_ctx{
   int qm;
   int use_haar_wavelet;
   int b_frames;
+  /*The screen-content level, or 0 to not use the screen-content tools (see
+     OD_SET_SCREEN_CONTENT).*/
+  int screen_content;
+  /*The number of superblock rows per packet, or 0 for one packet per frame
+     (see OD_SET_CHUNK_ROWS).*/
+  int chunk_rows;
+  od_enc_chunk chunk;
+  /*The luma input saved around the block size search of each packet,
+     allocated the first time it is needed.*/
+  od_coeff *chunk_save;
+  size_t chunk_save_sz;
+  /*The buffer holding sc_src_imgs and sc_pred_img, allocated the first time
+     a frame is encoded at OD_SCREEN_CONTENT_SOURCE_SKIP.*/
+  unsigned char *sc_img_data;
+  /*The source image coded into each reference image buffer.
+    Indexed like state.ref_imgs.*/
+  daala_image sc_src_imgs[OD_FRAME_MAX + 1];
+  /*Whether each entry of sc_src_imgs is up to date.*/
+  int sc_src_valid[OD_FRAME_MAX + 1];
+  /*The prediction of the current source image from the sources of its
+     references, using the final motion field.
+    At OD_SCREEN_CONTENT_SOURCE_SKIP, the encoder codes a skip wherever this
+     matches the source exactly.*/
+  daala_image sc_pred_img;
+  /*Whether sc_pred_img holds the prediction for the current frame.*/
+  int sc_pred_valid;
   /*The quantizer value we wish we could use if we were able to
      code any possible quantizer value to the stream.
     This value is not used in any quantization, but it is used to
@@ -246,14 +413,9 @@ struct daala_enc_ctx{
   FILE *bsize_dist_file;
 #endif
   od_block_size_comp *bs;
-  /* These buffers are for saving pixel data during block size RDO. */
-  od_coeff mc_orig[OD_NBSIZES-1][OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff c_orig[OD_NBSIZES-1][OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff nosplit[OD_NBSIZES-1][OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff split[OD_NBSIZES-1][OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff block_c_orig[OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff block_mc_orig[OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff block_c_noskip[OD_BSIZE_MAX*OD_BSIZE_MAX];
+  /* Scratch buffers for block size RDO, block coding and the PVQ search.
+     The arena is reset at the start of every superblock. */
+  od_scratch scratch;
   /* This structure manages reordering the input frames from display order
       to encode order.
      It currently supports in order B-frames with a periodic out of order
@@ -271,6 +433,16 @@ struct daala_enc_ctx{
   int64_t ip_frame_count;
   /** Setup and state used to drive rate control. */
   od_rc_state rc;
+  /** Whether the per-stage profiling counters are being updated. */
+  int use_profiling;
+  /** Cumulative per-stage profiling counters. */
+  od_enc_profile prof;
+  /** Real-time deadline control state. */
+  od_rt_state rt;
+  /** Bit accounting state. */
+  od_enc_acct acct;
+  /** Set using OD_SET_PACKET_BUFFER_FUNCS. */
+  daala_packet_buffer_funcs packet_funcs;
 #if defined(OD_DUMP_RECONS)
   od_output_queue out;
 #endif
@@ -291,11 +463,54 @@ struct od_rollback_buffer {
   od_adapt_ctx adapt;
 };
 
+/*Per-stage profiling.
+  When profiling is disabled, OD_ENC_PROF_BEGIN() does not read the timer and
+   OD_ENC_PROF_END() is a single branch.*/
+# define OD_ENC_PROF_BEGIN(enc) \
+  (OD_UNLIKELY((enc)->use_profiling) ? od_enc_prof_ticks() : 0)
+
+# define OD_ENC_PROF_END(enc, stage, t0) \
+  do { \
+    if (OD_UNLIKELY((enc)->use_profiling)) { \
+      (enc)->prof.stages[(stage)].ticks += od_enc_prof_ticks() - (t0); \
+      (enc)->prof.stages[(stage)].calls++; \
+    } \
+  } \
+  while (0)
+
+int64_t od_enc_prof_ticks(void);
+
+/*Real-time deadline control.
+  OD_RT_CHECK() evaluates to whether the current frame is behind schedule
+   before done out of total units of work in the given stage, lowering the
+   complexity level in enc->rt.level if it is.
+  When the deadline is disabled, it is a single branch that evaluates to 0.*/
+# define OD_RT_CHECK(enc, stage, done, total) \
+  (OD_UNLIKELY((enc)->rt.target_us > 0) \
+   && od_rt_check((enc), (stage), (done), (total)))
+
+void od_rt_reset(od_rt_state *rt, int64_t target_us, int complexity);
+void od_rt_frame_begin(od_enc_ctx *enc, int is_keyframe);
+int od_rt_check(od_enc_ctx *enc, int stage, int done, int total);
+void od_rt_frame_pause(od_enc_ctx *enc);
+void od_rt_frame_resume(od_enc_ctx *enc);
+void od_rt_frame_end(od_enc_ctx *enc);
+
+int od_scratch_init(od_scratch *scratch, size_t size);
+void od_scratch_clear(od_scratch *scratch);
+void *od_scratch_alloc(od_scratch *scratch, size_t size);
+# define od_scratch_mark(scratch) ((scratch)->top)
+# define od_scratch_release(scratch, mark) ((void)((scratch)->top = (mark)))
+# define od_scratch_reset(scratch) od_scratch_release(scratch, 0)
+# define OD_SCRATCH_ALLOC(scratch, type, n) \
+  ((type *)od_scratch_alloc(scratch, sizeof(type)*(n)))
+
 void od_encode_checkpoint(const daala_enc_ctx *enc, od_rollback_buffer *rbuf);
 void od_encode_rollback(daala_enc_ctx *enc, const od_rollback_buffer *rbuf);
 
 od_mv_est_ctx *od_mv_est_alloc(od_enc_ctx *enc);
 void od_mv_est_free(od_mv_est_ctx *est);
+void od_mv_est_reset(od_mv_est_ctx *est);
 void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs);
 
 int od_enc_rc_init(od_enc_ctx *enc, long bitrate);
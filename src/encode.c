@@ -31,6 +31,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include "encint.h"
 #if defined(OD_ENCODER_CHECK)
 # include "decint.h"
@@ -192,60 +193,17 @@ static void od_enc_opt_vtbl_init(od_enc_ctx *enc) {
 #endif
 }
 
-static int od_input_queue_init(od_input_queue *in, od_enc_ctx *enc) {
-  od_state *state;
+/*Empties the queue and lays out its images for the current frame size.*/
+static void od_input_queue_reset(od_input_queue *in, od_enc_ctx *enc) {
   daala_info *info;
-  int pli;
+  size_t img_sz;
   int imgi;
-  size_t data_sz;
-  int frame_buf_width;
-  int frame_buf_height;
-  unsigned char *input_img_data;
-  int input_bits;
-  int input_bytes;
-  state = &enc->state;
-  info = &state->info;
-  /* Pad the input image further to have a border of OD_BUFFER_PADDING. */
-  frame_buf_width = state->frame_width + (OD_BUFFER_PADDING << 1);
-  frame_buf_height = state->frame_height + (OD_BUFFER_PADDING << 1);
-  /* Compute the memory requirements for input frames. */
-  input_bits = info->full_precision_references ? 8 + OD_COEFF_SHIFT : 8;
-  input_bytes = info->full_precision_references ? 2 : 1;
-  data_sz = 0;
-  for (pli = 0; pli < info->nplanes; pli++) {
-    data_sz += OD_MAX_REORDER*(frame_buf_width >> info->plane_info[pli].xdec)*
-     (frame_buf_height >> info->plane_info[pli].ydec)*input_bytes;
-  }
-  in->input_img_data = input_img_data =
-   (unsigned char *)od_aligned_malloc(data_sz, 32);
-  if (OD_UNLIKELY(!input_img_data)) {
-    return OD_EFAULT;
-  }
-  /*Fill in the input img structure.*/
+  info = &enc->state.info;
+  /*The input images are padded the same way as the reference images.*/
+  img_sz = od_state_ref_img_sz(&enc->state);
   for (imgi = 0; imgi < OD_MAX_REORDER; imgi++) {
-    daala_image *img;
-    img = &in->images[imgi];
-    img->nplanes = info->nplanes;
-    img->width = state->frame_width;
-    img->height = state->frame_height;
-    for (pli = 0; pli < img->nplanes; pli++) {
-      daala_image_plane *iplane;
-      int plane_buf_width;
-      int plane_buf_height;
-      iplane = &img->planes[pli];
-      iplane->xdec = info->plane_info[pli].xdec;
-      iplane->ydec = info->plane_info[pli].ydec;
-      plane_buf_width = frame_buf_width >> iplane->xdec;
-      plane_buf_height = frame_buf_height >> iplane->ydec;
-      iplane->bitdepth = input_bits;
-      /*Internal buffers are always planar.*/
-      iplane->xstride = input_bytes;
-      iplane->ystride = plane_buf_width*iplane->xstride;
-      iplane->data = input_img_data
-       + iplane->xstride*(OD_BUFFER_PADDING >> iplane->xdec)
-       + iplane->ystride*(OD_BUFFER_PADDING >> iplane->ydec);
-      input_img_data += plane_buf_height*iplane->ystride;
-    }
+    od_state_ref_img_setup(&enc->state, &in->images[imgi],
+     in->input_img_data + imgi*img_sz);
   }
   in->input_head = 0;
   in->input_size = 0;
@@ -260,6 +218,15 @@ static int od_input_queue_init(od_input_queue *in, od_enc_ctx *enc) {
   in->last_keyframe = in->keyframe_rate - 1;
   in->end_of_input = 0;
   in->frame_number = 0;
+}
+
+static int od_input_queue_init(od_input_queue *in, od_enc_ctx *enc) {
+  in->input_img_data = (unsigned char *)od_aligned_malloc(
+   OD_MAX_REORDER*od_state_ref_img_sz(&enc->state), 32);
+  if (OD_UNLIKELY(!in->input_img_data)) {
+    return OD_EFAULT;
+  }
+  od_input_queue_reset(in, enc);
   return OD_SUCCESS;
 }
 
@@ -364,6 +331,39 @@ od_input_frame *od_input_queue_next(od_input_queue *in, int *last) {
   return NULL;
 }
 
+/*Sets the encoder parameters and per-stream state that do not depend on any
+   allocation to their defaults.
+  The frame queues and motion estimator are reset separately.*/
+static void od_enc_set_defaults(od_enc_ctx *enc) {
+  enc->use_satd = 0;
+  enc->packet_state = OD_PACKET_INFO_HDR;
+  enc->quality = 10;
+  enc->complexity = 7;
+  enc->use_activity_masking = 1;
+  enc->use_dering = 1;
+  enc->qm = OD_HVS_QM;
+  enc->state.qm = od_qm_get(&enc->state.qm_inv, enc->qm);
+  enc->use_haar_wavelet = OD_USE_HAAR_WAVELET;
+  enc->params.mv_level_min = 0;
+  enc->params.mv_level_max = 4;
+  enc->b_frames = 0;
+  enc->screen_content = 0;
+  enc->chunk_rows = 0;
+  OD_CLEAR(&enc->chunk, 1);
+  enc->frame_delay = enc->b_frames + 1;
+  enc->curr_img = NULL;
+  enc->ip_frame_count = 0;
+  enc->curr_coding_order = 0;
+  OD_CLEAR(&enc->rc, 1);
+  od_enc_rc_init(enc, -1);
+  enc->use_profiling = 0;
+  OD_CLEAR(&enc->prof, 1);
+  od_rt_reset(&enc->rt, 0, enc->complexity);
+  enc->acct.enabled = 0;
+  enc->packet_funcs.get = NULL;
+  enc->packet_funcs.ctx = NULL;
+}
+
 static int od_enc_init(od_enc_ctx *enc, const daala_info *info) {
   int ret;
 #if defined(OD_DUMP_BSIZE_DIST)
@@ -372,29 +372,24 @@ static int od_enc_init(od_enc_ctx *enc, const daala_info *info) {
 #endif
   ret = od_state_init(&enc->state, info);
   if (ret < 0) return ret;
-  enc->use_satd = 0;
   od_enc_opt_vtbl_init(enc);
   oggbyte_writeinit(&enc->obb);
   od_ec_enc_init(&enc->ec, 65025);
-  enc->packet_state = OD_PACKET_INFO_HDR;
-  enc->quality = 10;
-  enc->complexity = 7;
-  enc->use_activity_masking = 1;
-  enc->use_dering = 1;
-  enc->qm = OD_HVS_QM;
-  od_init_qm(enc->state.qm, enc->state.qm_inv,
-   enc->qm == OD_HVS_QM ? OD_QM8_Q4_HVS : OD_QM8_Q4_FLAT);
-  enc->use_haar_wavelet = OD_USE_HAAR_WAVELET;
+  od_enc_set_defaults(enc);
+  enc->sc_img_data = NULL;
+  enc->sc_pred_valid = 0;
+  enc->chunk_save = NULL;
+  enc->chunk_save_sz = 0;
+  enc->acct.sb_bits_q3 = NULL;
   enc->mvest = od_mv_est_alloc(enc);
   if (OD_UNLIKELY(!enc->mvest)) {
     return OD_EFAULT;
   }
-  enc->params.mv_level_min = 0;
-  enc->params.mv_level_max = 4;
+  ret = od_scratch_init(&enc->scratch, OD_ENC_SCRATCH_SZ);
+  if (OD_UNLIKELY(ret < 0)) return ret;
   enc->bs = (od_block_size_comp *)malloc(sizeof(*enc->bs));
-  enc->b_frames = 0;
-  enc->frame_delay = enc->b_frames + 1;
-  od_input_queue_init(&enc->input_queue, enc);
+  ret = od_input_queue_init(&enc->input_queue, enc);
+  if (OD_UNLIKELY(ret < 0)) return ret;
 #if defined(OD_DUMP_RECONS)
   od_output_queue_init(&enc->out, &enc->state);
 #endif
@@ -472,9 +467,6 @@ static int od_enc_init(od_enc_ctx *enc, const daala_info *info) {
   }
   }
 #endif
-  enc->curr_img = NULL;
-  enc->ip_frame_count = 0;
-  enc->curr_coding_order = 0;
 #if defined(OD_ENCODER_CHECK)
   enc->dec = daala_decode_create(info, NULL);
 #endif
@@ -495,12 +487,15 @@ static int od_enc_init(od_enc_ctx *enc, const daala_info *info) {
     return OD_EFAULT;
   }
 #endif
-  od_enc_rc_init(enc, -1);
   return 0;
 }
 
 static void od_enc_clear(od_enc_ctx *enc) {
+  od_aligned_free(enc->sc_img_data);
+  free(enc->chunk_save);
+  free(enc->acct.sb_bits_q3);
   od_mv_est_free(enc->mvest);
+  od_scratch_clear(&enc->scratch);
   od_ec_enc_clear(&enc->ec);
   oggbyte_writeclear(&enc->obb);
   od_input_queue_clear(&enc->input_queue);
@@ -524,6 +519,41 @@ daala_enc_ctx *daala_encode_create(const daala_info *info) {
   return enc;
 }
 
+int daala_encode_reset(daala_enc_ctx *enc, const daala_info *info) {
+  int ret;
+  OD_RETURN_CHECK(enc, OD_EFAULT);
+  OD_RETURN_CHECK(info, OD_EFAULT);
+#if defined(OD_DUMP_IMAGES)
+  /*The visualization images are not re-targeted.*/
+  return OD_EIMPL;
+#endif
+  ret = od_state_reset(&enc->state, info);
+  if (ret < 0) return ret;
+#if defined(OD_ENCODER_CHECK)
+  if (enc->dec != NULL) daala_decode_reset(enc->dec, info, NULL);
+#endif
+  oggbyte_reset(&enc->obb);
+  od_ec_enc_reset(&enc->ec);
+  od_ec_enc_set_buffer(&enc->ec, NULL, 0);
+  od_enc_set_defaults(enc);
+  /*The screen-content images are reallocated for the new size on demand.*/
+  od_aligned_free(enc->sc_img_data);
+  enc->sc_img_data = NULL;
+  free(enc->chunk_save);
+  enc->chunk_save = NULL;
+  enc->chunk_save_sz = 0;
+  /*So are the per-superblock accounting totals.*/
+  free(enc->acct.sb_bits_q3);
+  enc->acct.sb_bits_q3 = NULL;
+  od_mv_est_reset(enc->mvest);
+  od_scratch_reset(&enc->scratch);
+  od_input_queue_reset(&enc->input_queue, enc);
+#if defined(OD_DUMP_RECONS)
+  od_output_queue_reset(&enc->out, &enc->state);
+#endif
+  return OD_SUCCESS;
+}
+
 void daala_encode_free(daala_enc_ctx *enc) {
 #if defined(OD_DUMP_BSIZE_DIST)
     int i;
@@ -547,6 +577,36 @@ void daala_encode_free(daala_enc_ctx *enc) {
   }
 }
 
+/*Starts the bit accounting of a new frame.*/
+static void od_enc_acct_reset(daala_enc_ctx *enc) {
+  OD_CLEAR(enc->acct.class_bits_q3, OD_ENC_ACCT_NCLASSES);
+  OD_CLEAR(enc->acct.sb_bits_q3, enc->state.nhsb*enc->state.nvsb);
+  enc->acct.packet_bits_q3 = 0;
+}
+
+/*Adds the bits coded since tell0, a value of od_ec_enc_tell_frac(), to
+   class ci and, unless sbi is negative, to superblock sbi.*/
+static void od_enc_acct_add(daala_enc_ctx *enc, int ci, int sbi,
+ uint32_t tell0) {
+  uint32_t bits_q3;
+  bits_q3 = od_ec_enc_tell_frac(&enc->ec) - tell0;
+  enc->acct.class_bits_q3[ci] += bits_q3;
+  if (sbi >= 0) enc->acct.sb_bits_q3[sbi] += bits_q3;
+}
+
+/*Returns the superblock containing MV grid point (vx, vy).
+  The grid points on the right and bottom edges of the frame go to the last
+   superblock of their row or column.*/
+static int od_enc_acct_mv_sb(const daala_enc_ctx *enc, int vx, int vy) {
+  int sbx;
+  int sby;
+  sbx = OD_MINI(vx >> (OD_LOG_BSIZE_MAX - OD_LOG_MVBSIZE_MIN),
+   enc->state.nhsb - 1);
+  sby = OD_MINI(vy >> (OD_LOG_BSIZE_MAX - OD_LOG_MVBSIZE_MIN),
+   enc->state.nvsb - 1);
+  return sby*enc->state.nhsb + sbx;
+}
+
 int daala_encode_ctl(daala_enc_ctx *enc, int req, void *buf, size_t buf_sz) {
   switch (req) {
     case OD_SET_QUANT:
@@ -565,7 +625,7 @@ int daala_encode_ctl(daala_enc_ctx *enc, int req, void *buf, size_t buf_sz) {
       OD_RETURN_CHECK(buf, OD_EFAULT);
       OD_RETURN_CHECK(buf_sz == sizeof(enc->complexity), OD_EINVAL);
       complexity = *(const int *)buf;
-      if (complexity < 0 || complexity > 10) return OD_EINVAL;
+      if (complexity < 0 || complexity > OD_COMPLEXITY_MAX) return OD_EINVAL;
       enc->complexity = complexity;
       return OD_SUCCESS;
     }
@@ -612,6 +672,52 @@ int daala_encode_ctl(daala_enc_ctx *enc, int req, void *buf, size_t buf_sz) {
       enc->use_dering = !!*(const int *)buf;
       return OD_SUCCESS;
     }
+    case OD_SET_SCREEN_CONTENT: {
+      int screen_content;
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(screen_content), OD_EINVAL);
+      screen_content = *(const int *)buf;
+      if (screen_content < 0
+       || screen_content > OD_SCREEN_CONTENT_SOURCE_SKIP) {
+        return OD_EINVAL;
+      }
+      enc->screen_content = screen_content;
+      return OD_SUCCESS;
+    }
+    case OD_SET_DEADLINE: {
+      int target_us;
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(target_us), OD_EINVAL);
+      target_us = *(const int *)buf;
+      if (target_us < 0) return OD_EINVAL;
+      od_rt_reset(&enc->rt, target_us, enc->complexity);
+      return OD_SUCCESS;
+    }
+    case OD_GET_DEADLINE_STATS: {
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(enc->rt.stats), OD_EINVAL);
+      OD_COPY((od_enc_deadline_stats *)buf, &enc->rt.stats, 1);
+      return OD_SUCCESS;
+    }
+    case OD_SET_CHUNK_ROWS: {
+      int rows;
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(rows), OD_EINVAL);
+      rows = *(const int *)buf;
+      if (rows < 0) return OD_EINVAL;
+      if (rows > 0
+       && enc->state.info.version_minor < OD_STREAM_VERSION_MINOR_CHUNKS) {
+        return OD_EINVAL;
+      }
+      /*The rows of the frame in progress have been signaled already.*/
+      if (enc->chunk.sby > 0) return OD_EINVAL;
+      enc->chunk_rows = rows;
+      return OD_SUCCESS;
+    }
     case OD_SET_QM: {
       int qm;
       OD_RETURN_CHECK(enc, OD_EFAULT);
@@ -623,8 +729,7 @@ int daala_encode_ctl(daala_enc_ctx *enc, int req, void *buf, size_t buf_sz) {
       }
       if (enc->qm != qm) {
         enc->qm = qm;
-        od_init_qm(enc->state.qm, enc->state.qm_inv,
-         enc->qm == OD_HVS_QM ? OD_QM8_Q4_HVS : OD_QM8_Q4_FLAT);
+        enc->state.qm = od_qm_get(&enc->state.qm_inv, enc->qm);
       }
       return OD_SUCCESS;
     }
@@ -734,10 +839,119 @@ int daala_encode_ctl(daala_enc_ctx *enc, int req, void *buf, size_t buf_sz) {
       OD_RETURN_CHECK(enc, OD_EFAULT);
       return od_enc_rc_2pass_in(enc, buf, buf_sz);
     }
+    case OD_SET_PROFILING: {
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(enc->use_profiling), OD_EINVAL);
+      enc->use_profiling = !!*(const int *)buf;
+      if (enc->use_profiling) {
+        OD_CLEAR(&enc->prof, 1);
+#if defined(OD_X86ASM) && defined(OD_GCC_INLINE_ASSEMBLY)
+        enc->prof.ticks_per_second = 0;
+#else
+        enc->prof.ticks_per_second = CLOCKS_PER_SEC;
+#endif
+      }
+      return OD_SUCCESS;
+    }
+    case OD_GET_PROFILE: {
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(enc->prof), OD_EINVAL);
+      OD_COPY((od_enc_profile *)buf, &enc->prof, 1);
+      return OD_SUCCESS;
+    }
+    case OD_SET_PACKET_BUFFER_FUNCS: {
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(daala_packet_buffer_funcs), OD_EINVAL);
+      enc->packet_funcs = *(const daala_packet_buffer_funcs *)buf;
+      return OD_SUCCESS;
+    }
+    case OD_SET_ACCOUNTING: {
+      int enabled;
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(enabled), OD_EINVAL);
+      enabled = !!*(const int *)buf;
+      /*The totals of the frame in progress would be incomplete.*/
+      if (enc->chunk.sby > 0) return OD_EINVAL;
+      if (enabled && enc->acct.sb_bits_q3 == NULL) {
+        enc->acct.sb_bits_q3 = (uint32_t *)malloc(
+         sizeof(*enc->acct.sb_bits_q3)*enc->state.nhsb*enc->state.nvsb);
+        if (OD_UNLIKELY(!enc->acct.sb_bits_q3)) return OD_EFAULT;
+      }
+      enc->acct.enabled = enabled;
+      if (enabled) od_enc_acct_reset(enc);
+      return OD_SUCCESS;
+    }
+    case OD_GET_ACCOUNTING: {
+      od_enc_accounting *acct;
+      uint32_t coded_q3;
+      int ci;
+      OD_RETURN_CHECK(enc, OD_EFAULT);
+      OD_RETURN_CHECK(buf, OD_EFAULT);
+      OD_RETURN_CHECK(buf_sz == sizeof(*acct), OD_EINVAL);
+      OD_RETURN_CHECK(enc->acct.enabled, OD_EINVAL);
+      acct = (od_enc_accounting *)buf;
+      OD_COPY(acct->class_bits_q3, enc->acct.class_bits_q3,
+       OD_ENC_ACCT_NCLASSES);
+      coded_q3 = 0;
+      for (ci = 0; ci < OD_ENC_ACCT_NCLASSES; ci++) {
+        coded_q3 += acct->class_bits_q3[ci];
+      }
+      acct->total_bits_q3 = enc->acct.packet_bits_q3;
+      acct->class_bits_q3[OD_ENC_ACCT_HEADER] =
+       OD_MAXI(acct->total_bits_q3, coded_q3) - coded_q3;
+      acct->nhsb = enc->state.nhsb;
+      acct->nvsb = enc->state.nvsb;
+      acct->sb_bits_q3 = enc->acct.sb_bits_q3;
+      return OD_SUCCESS;
+    }
     default: return OD_EIMPL;
   }
 }
 
+/*Reads the timer used by the profiling counters.
+  This is the timestamp counter where we can read it directly, which is cheap
+   enough to wrap even the per-block stages, and clock() elsewhere.*/
+int64_t od_enc_prof_ticks(void) {
+#if defined(OD_X86ASM) && defined(OD_GCC_INLINE_ASSEMBLY)
+  uint32_t lo;
+  uint32_t hi;
+  __asm__ __volatile__("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+  return (int64_t)((uint64_t)hi << 32 | lo);
+#else
+  return (int64_t)clock();
+#endif
+}
+
+int od_scratch_init(od_scratch *scratch, size_t size) {
+  scratch->buf = (unsigned char *)od_aligned_malloc(size, OD_SCRATCH_ALIGN);
+  if (OD_UNLIKELY(scratch->buf == NULL)) return OD_EFAULT;
+  scratch->size = size;
+  scratch->top = 0;
+  scratch->peak = 0;
+  return OD_SUCCESS;
+}
+
+void od_scratch_clear(od_scratch *scratch) {
+  od_aligned_free(scratch->buf);
+}
+
+/*Returns a pointer to size bytes aligned to OD_SCRATCH_ALIGN.
+  The contents are undefined.*/
+void *od_scratch_alloc(od_scratch *scratch, size_t size) {
+  void *ret;
+  size = (size + OD_SCRATCH_ALIGN - 1) & ~(size_t)(OD_SCRATCH_ALIGN - 1);
+  /*The arena is sized for the worst case, so running out is a bug.*/
+  OD_ASSERT(scratch->top + size <= scratch->size);
+  ret = scratch->buf + scratch->top;
+  scratch->top += size;
+  scratch->peak = OD_MAXI(scratch->peak, scratch->top);
+  return ret;
+}
+
 void od_encode_checkpoint(const daala_enc_ctx *enc, od_rollback_buffer *rbuf) {
   od_ec_enc_checkpoint(&rbuf->ec, &enc->ec);
   OD_COPY(&rbuf->adapt, &enc->state.adapt, 1);
@@ -835,25 +1049,6 @@ static void od_img_plane_copy_pad(daala_image *dst,
   }
 }
 
-/*Block-level encoder context information.
-  Global encoder context information is in od_enc_ctx.*/
-struct od_mb_enc_ctx {
-  od_coeff *c;
-  od_coeff **d;
-  od_coeff *md;
-  od_coeff *mc;
-  od_coeff *l;
-  int is_keyframe;
-  int num_refs;
-  int use_activity_masking;
-  int qm;
-  int use_haar_wavelet;
-  int is_golden_frame;
-  int frame_type;
-  int q_scaling;
-};
-typedef struct od_mb_enc_ctx od_mb_enc_ctx;
-
 static void od_encode_compute_pred(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
  od_coeff *pred, const od_coeff *d, int bs, int pli, int bx, int by) {
   int n;
@@ -1201,6 +1396,97 @@ static double od_compute_dist(daala_enc_ctx *enc, od_coeff *x, od_coeff *y,
   return sum;
 }
 
+/*Codes the "skip this block" symbol (0) for an inter block.*/
+static void od_encode_skip_symbol(daala_enc_ctx *enc, int pli, int bs,
+ int bx, int by) {
+  od_encode_cdf_adapt(&enc->ec, 0,
+   enc->state.adapt.skip_cdf[2*bs + (pli != 0)], 4 + (pli == 0 && bs > 0),
+   enc->state.adapt.skip_increment);
+#if OD_SIGNAL_Q_SCALING
+  if (bs == (OD_NBSIZES - 1) && pli == 0) {
+    od_encode_quantizer_scaling(enc, 0,
+     bx >> (OD_NBSIZES - 1), by >> (OD_NBSIZES - 1), 1);
+  }
+#else
+  (void)bx;
+  (void)by;
+#endif
+}
+
+/*Returns whether the prediction of an n x n block is exactly equal to the
+   input, so that its residual is zero in every transform domain.*/
+static int od_block_matches_pred(const od_mb_enc_ctx *ctx, int bo, int n,
+ int w) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (memcmp(ctx->c + bo + i*w, ctx->mc + bo + i*w,
+     n*sizeof(*ctx->c)) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*Copies an n x n block of coefficients between two planes of stride w.*/
+static void od_enc_copy_block(od_coeff *dst, const od_coeff *src, int n,
+ int w) {
+  int i;
+  for (i = 0; i < n; i++) OD_COPY(dst + i*w, src + i*w, n);
+}
+
+/*Returns whether the n x n block at (bx, by) (in units of 4x4 blocks) of
+   plane pli of an inter frame is a copy of its references, and so should be
+   skipped.
+  This is the case when the input is exactly equal to its prediction, so that
+   the skip loses nothing.
+  At OD_SCREEN_CONTENT_SOURCE_SKIP, it is also the case when the source is
+   exactly equal to its prediction from the sources of the references.
+  That part of the references has not changed since it was coded, but a
+   residual could still have reduced its quantization error, so this trades
+   quality for speed.*/
+static int od_block_is_copy(daala_enc_ctx *enc, const od_mb_enc_ctx *ctx,
+ int pli, int bx, int by, int n) {
+  const daala_image_plane *src;
+  const daala_image_plane *pred;
+  int xdec;
+  int ydec;
+  int w;
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+  int lap;
+  int y;
+  xdec = enc->state.info.plane_info[pli].xdec;
+  ydec = enc->state.info.plane_info[pli].ydec;
+  w = enc->state.frame_width >> xdec;
+  x0 = bx << OD_LOG_BSIZE0;
+  y0 = by << OD_LOG_BSIZE0;
+  if (od_block_matches_pred(ctx, y0*w + x0, n, w)) return 1;
+  if (enc->screen_content < OD_SCREEN_CONTENT_SOURCE_SKIP
+   || !enc->sc_pred_valid) {
+    return 0;
+  }
+  src = enc->curr_img->planes + pli;
+  pred = enc->sc_pred_img.planes + pli;
+  /*The lapping mixes in the pixels on the far side of each edge of the
+     block, so those have to match as well.*/
+  lap = (4 << OD_FILT_SIZE(0, xdec)) >> 1;
+  x1 = OD_MINI(x0 + n + lap, OD_PLANE_SZ(enc->state.info.pic_width, xdec));
+  y1 = OD_MINI(y0 + n + lap, OD_PLANE_SZ(enc->state.info.pic_height, ydec));
+  x0 = OD_MAXI(x0 - lap, 0);
+  y0 = OD_MAXI(y0 - lap, 0);
+  if (x0 >= x1 || y0 >= y1) return 0;
+  for (y = y0; y < y1; y++) {
+    if (memcmp(src->data + y*src->ystride + x0*src->xstride,
+     pred->data + y*pred->ystride + x0*pred->xstride,
+     (x1 - x0)*src->xstride) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 /* Returns 1 if the block is skipped, zero otherwise. */
 static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
  int pli, int bx, int by, int rdo_only) {
@@ -1214,10 +1500,10 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
   od_coeff *d;
   od_coeff *md;
   od_coeff *mc;
-  od_coeff pred[OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff predt[OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff dblock[OD_BSIZE_MAX*OD_BSIZE_MAX];
-  od_coeff scalar_out[OD_BSIZE_MAX*OD_BSIZE_MAX];
+  od_coeff *pred;
+  od_coeff *predt;
+  od_coeff *dblock;
+  od_coeff *scalar_out;
   int quant;
   int dc_quant;
   int lossless;
@@ -1230,6 +1516,7 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
   od_rollback_buffer pre_encode_buf;
   od_coeff *c_orig;
   od_coeff *mc_orig;
+  size_t scratch_mark;
 #if defined(OD_OUTPUT_PRED)
   od_coeff preds[OD_BSIZE_MAX*OD_BSIZE_MAX];
   int zzi;
@@ -1249,8 +1536,22 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
   md = ctx->md;
   mc = ctx->mc;
   lossless = OD_LOSSLESS(enc);
-  c_orig = enc->block_c_orig;
-  mc_orig = enc->block_mc_orig;
+  if (enc->screen_content && !ctx->is_keyframe && !ctx->use_haar_wavelet
+   && od_block_is_copy(enc, ctx, pli, bx, by, n)) {
+    /*Skip the block without running PVQ; like any skipped block, it
+       reconstructs to its prediction.*/
+    od_enc_copy_block(c + bo, mc + bo, n, w);
+    (*enc->state.opt_vtbl.fdct_2d[bs])(d + bo, w, c + bo, w);
+    od_encode_skip_symbol(enc, pli, bs, bx, by);
+    return 1;
+  }
+  scratch_mark = od_scratch_mark(&enc->scratch);
+  pred = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+  predt = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+  dblock = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+  scalar_out = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+  c_orig = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+  mc_orig = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
   has_late_skip_rdo = !ctx->is_keyframe && !ctx->use_haar_wavelet && bs > 0;
   if (has_late_skip_rdo) {
     for (i = 0; i < n; i++) {
@@ -1322,11 +1623,14 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
   }
   else {
     int off;
+    int64_t prof_t0;
     off = od_qm_offset(bs, xdec);
+    prof_t0 = OD_ENC_PROF_BEGIN(enc);
     skip = od_pvq_encode(enc, predt, dblock, scalar_out, quant, pli, bs,
      OD_PVQ_BETA[use_masking][pli][bs], OD_ROBUST_STREAM, ctx->is_keyframe,
      ctx->q_scaling, bx, by, enc->state.qm + off, enc->state.qm_inv
-     + off, rdo_only && enc->complexity < 5 ? 1 : 0);
+     + off, rdo_only && enc->rt.level < 5 ? 1 : 0);
+    OD_ENC_PROF_END(enc, OD_PROF_PVQ, prof_t0);
   }
   if (!ctx->is_keyframe) {
     int has_dc_skip;
@@ -1363,6 +1667,11 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
   if (ctx->use_haar_wavelet) {
     od_haar_inv(c + bo, w, d + bo, w, bs + 2);
   }
+  else if (skip && !ctx->is_keyframe) {
+    /*A skipped inter block reconstructs to exactly the prediction, since
+       d is the forward transform of mc, so skip the inverse transform.*/
+    od_enc_copy_block(c + bo, mc + bo, n, w);
+  }
   else {
     (*enc->state.opt_vtbl.idct_2d[bs])(c + bo, w, d + bo, w);
   }
@@ -1387,7 +1696,7 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
     double rate_skip;
     int rate_noskip;
     od_coeff *c_noskip;
-    c_noskip = enc->block_c_noskip;
+    c_noskip = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
     for (i = 0; i < n; i++) {
       for (j = 0; j < n; j++) c_noskip[n*i + j] = c[bo + i*w + j];
     }
@@ -1400,25 +1709,17 @@ static int od_block_encode(daala_enc_ctx *enc, od_mb_enc_ctx *ctx, int bs,
      4 + (pli == 0 && bs > 0));
     if (dist_skip + lambda*rate_skip < dist_noskip + lambda*rate_noskip) {
       od_encode_rollback(enc, &pre_encode_buf);
-      /* Code the "skip this block" symbol (0). */
-      od_encode_cdf_adapt(&enc->ec, 0,
-       enc->state.adapt.skip_cdf[2*bs + (pli != 0)], 4 + (pli == 0 && bs > 0),
-       enc->state.adapt.skip_increment);
-#if OD_SIGNAL_Q_SCALING
-      if (bs == (OD_NBSIZES - 1) && pli == 0) {
-        od_encode_quantizer_scaling(enc, 0,
-         bx >> (OD_NBSIZES - 1), by >> (OD_NBSIZES - 1), 1);
-      }
-#endif
+      od_encode_skip_symbol(enc, pli, bs, bx, by);
       skip = 1;
       for (i = 0; i < n; i++) {
         for (j = 0; j < n; j++) {
           d[bo + i*w + j] = md[bo + i*w + j];
         }
       }
-      (*enc->state.opt_vtbl.idct_2d[bs])(c + bo, w, d + bo, w);
+      od_enc_copy_block(c + bo, mc + bo, n, w);
     }
   }
+  od_scratch_release(&enc->scratch, scratch_mark);
   return skip;
 }
 
@@ -1644,8 +1945,6 @@ static int od_encode_recursive(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
   OD_ASSERT(bs <= bsi);
   if (bs == bsi) {
     int skip;
-    int i;
-    int j;
     bs -= xdec;
     /*Construct the luma predictors for chroma planes.*/
     if (ctx->l != NULL) {
@@ -1655,12 +1954,8 @@ static int od_encode_recursive(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
        frame_width, xdec, ydec, bs, obs);
     }
     skip = od_block_encode(enc, ctx, bs, pli, bx, by, rdo_only);
-    for (i = 0; i < 1 << bs; i++) {
-      for (j = 0; j < 1 << bs; j++) {
-        enc->state.bskip[pli][((by << bs) + i)*enc->state.skip_stride
-         + (bx << bs) + j] = skip && !ctx->is_keyframe;
-      }
-    }
+    od_state_set_bskip(&enc->state, pli, bx, by, bs,
+     skip && !ctx->is_keyframe);
     return skip;
   }
   else {
@@ -1681,19 +1976,38 @@ static int od_encode_recursive(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
     int rate_split;
     int hfilter;
     int vfilter;
-    c_orig = enc->c_orig[bsi - 1];
-    mc_orig = enc->mc_orig[bsi - 1];
-    nosplit = enc->nosplit[bsi - 1];
-    split = enc->split[bsi - 1];
+    size_t scratch_mark;
     /* Silence gcc -Wmaybe-uninitialized */
     rate_nosplit = skip_nosplit = 0;
+    c_orig = mc_orig = nosplit = split = NULL;
     bs = bsi - xdec;
     bo = (by << (OD_LOG_BSIZE0 + bs))*w + (bx << (OD_LOG_BSIZE0 + bs));
     n = 4 << bs;
+    if (rdo_only && bsi <= OD_LIMIT_BSIZE_MAX && enc->screen_content
+     && !ctx->is_keyframe && !ctx->use_haar_wavelet
+     && od_block_is_copy(enc, ctx, pli, bx << bs, by << bs, n)) {
+      int i;
+      int j;
+      /*A copied block will be skipped whole, so don't try any splits.*/
+      skip_block = od_block_encode(enc, ctx, bs, pli, bx, by, rdo_only);
+      for (i = 0; i < 1 << (bs - 1); i++) {
+        for (j = 0; j < 1 << (bs - 1); j++) {
+          enc->state.bsize[((by << bsi >> 1) + i)*enc->state.bstride
+           + (bx << bsi >> 1) + j] = bs;
+        }
+      }
+      od_state_set_bskip(&enc->state, pli, bx, by, bs, skip_block);
+      return skip_block;
+    }
+    scratch_mark = od_scratch_mark(&enc->scratch);
     if (rdo_only && bsi <= OD_LIMIT_BSIZE_MAX) {
       int i;
       int j;
       od_coeff dc_orig[(OD_BSIZE_MAX/4)*(OD_BSIZE_MAX/4)];
+      c_orig = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+      mc_orig = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+      nosplit = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
+      split = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, n*n);
       tell = od_ec_enc_tell_frac(&enc->ec);
       for (i = 0; i < n; i++) {
         for (j = 0; j < n; j++) c_orig[n*i + j] = ctx->c[bo + i*w + j];
@@ -1788,12 +2102,8 @@ static int od_encode_recursive(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
              + (bx << bsi >> 1) + j] = bs;
           }
         }
-        for (i = 0; i < 1 << bs; i++) {
-          for (j = 0; j < 1 << bs; j++) {
-            enc->state.bskip[pli][((by << bs) + i)*enc->state.skip_stride
-             + (bx << bs) + j] = skip_nosplit && !ctx->is_keyframe;
-          }
-        }
+        od_state_set_bskip(&enc->state, pli, bx, by, bs,
+         skip_nosplit && !ctx->is_keyframe);
         skip_block = skip_nosplit;
 #if defined(OD_DUMP_BSIZE_DIST)
         if (bsi == OD_NBSIZES - 2) {
@@ -1810,6 +2120,7 @@ static int od_encode_recursive(daala_enc_ctx *enc, od_mb_enc_ctx *ctx,
         for (j = 0; j < n; j++) ctx->mc[bo + i*w + j] = mc_orig[n*i + j];
       }
     }
+    od_scratch_release(&enc->scratch, scratch_mark);
     return skip_block && rdo_only;
   }
 }
@@ -2330,15 +2641,75 @@ static void daala_image_dump_padded(daala_enc_ctx *enc) {
 }
 #endif
 
+/*Lays out the screen-content source images for the current frame size.*/
+static int od_enc_sc_init(daala_enc_ctx *enc) {
+  size_t img_sz;
+  int imgi;
+  img_sz = od_state_ref_img_sz(&enc->state);
+  enc->sc_img_data = (unsigned char *)od_aligned_malloc(
+   (OD_FRAME_MAX + 2)*img_sz, 32);
+  if (OD_UNLIKELY(!enc->sc_img_data)) {
+    return OD_EFAULT;
+  }
+  for (imgi = 0; imgi <= OD_FRAME_MAX; imgi++) {
+    od_state_ref_img_setup(&enc->state, enc->sc_src_imgs + imgi,
+     enc->sc_img_data + imgi*img_sz);
+    enc->sc_src_valid[imgi] = 0;
+  }
+  od_state_ref_img_setup(&enc->state, &enc->sc_pred_img,
+   enc->sc_img_data + (OD_FRAME_MAX + 1)*img_sz);
+  enc->sc_pred_valid = 0;
+  return OD_SUCCESS;
+}
+
+/*Records img as the source of the reference image buffer refi.*/
+static void od_enc_sc_store(daala_enc_ctx *enc, int refi, daala_image *img) {
+  od_img_copy(enc->sc_src_imgs + refi, img);
+  od_img_edge_ext(enc->sc_src_imgs + refi);
+  enc->sc_src_valid[refi] = 1;
+}
+
+/*Predicts the current source image from the sources of its references, by
+   running motion compensation with the final motion field on those instead
+   of on the reconstructions.*/
+static void od_enc_sc_predict(daala_enc_ctx *enc) {
+  od_state *state;
+  daala_image ref_imgs[OD_FRAME_MAX + 1];
+  int ref;
+  state = &enc->state;
+  for (ref = 0; ref < OD_FRAME_SELF; ref++) {
+    if (state->ref_imgi[ref] >= 0
+     && !enc->sc_src_valid[state->ref_imgi[ref]]) {
+      return;
+    }
+  }
+  OD_COPY(ref_imgs, state->ref_imgs, OD_FRAME_MAX + 1);
+  for (ref = 0; ref < OD_FRAME_SELF; ref++) {
+    if (state->ref_imgi[ref] >= 0) {
+      state->ref_imgs[state->ref_imgi[ref]] =
+       enc->sc_src_imgs[state->ref_imgi[ref]];
+    }
+  }
+  od_state_mc_predict(state, &enc->sc_pred_img);
+  OD_COPY(state->ref_imgs, ref_imgs, OD_FRAME_MAX + 1);
+  enc->sc_pred_valid = 1;
+}
+
 static void od_predict_frame(daala_enc_ctx *enc, int num_refs) {
+  int64_t prof_t0;
 #if defined(OD_DUMP_IMAGES) && defined(OD_ANIMATE)
   enc->ani_iter = 0;
 #endif
   OD_LOG((OD_LOG_ENCODER, OD_LOG_INFO, "Predicting frame %i:",
    (int)daala_granule_basetime(enc, enc->state.cur_time)));
   od_mv_est(enc->mvest, enc->mv_rdo_lambda, num_refs);
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
   od_state_mc_predict(&enc->state,
    enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_SELF]);
+  if (enc->screen_content >= OD_SCREEN_CONTENT_SOURCE_SKIP) {
+    od_enc_sc_predict(enc);
+  }
+  OD_ENC_PROF_END(enc, OD_PROF_MC_PREDICT, prof_t0);
   /*Do edge extension here because the block-size analysis needs to read
     outside the frame, but otherwise isn't read from.*/
   od_img_edge_ext(enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_SELF]);
@@ -2385,22 +2756,34 @@ static void od_split_superblocks(daala_enc_ctx *enc, int is_keyframe) {
     for (j = 0; j < nhsb; j++) {
       int bsize[OD_BSIZE_GRID][OD_BSIZE_GRID];
       unsigned char *state_bsize;
-      state_bsize =
-       &state->bsize[i*OD_BSIZE_GRID*state->bstride + j*OD_BSIZE_GRID];
-      od_split_superblock(enc->bs, bimg + j*OD_BSIZE_MAX, istride,
-       is_keyframe ? NULL : rimg + j*OD_BSIZE_MAX, rstride, bsize,
-       state->quantizer);
-      /* Grab the 4x4 information returned from `od_split_superblock` in bsize
-         and store it in the od_state bsize. */
-      for (k = 0; k < OD_BSIZE_GRID; k++) {
-        for (m = 0; m < OD_BSIZE_GRID; m++) {
-          if (OD_LIMIT_BSIZE_MIN != OD_LIMIT_BSIZE_MAX) {
-            state_bsize[k*bstride + m] =
-             OD_MAXI(OD_MINI(bsize[k][m], OD_LIMIT_BSIZE_MAX),
-             OD_LIMIT_BSIZE_MIN);
-          }
-          else {
-            state_bsize[k*bstride + m] = OD_LIMIT_BSIZE_MIN;
+      int qi;
+      int qj;
+      /* `od_split_superblock` decides a 32x32 region at a time, so run it on
+         each quadrant of the superblock. */
+      for (qi = 0; qi < 2; qi++) {
+        for (qj = 0; qj < 2; qj++) {
+          int off;
+          off = (qi*istride + qj)*(OD_BSIZE_MAX >> 1);
+          state_bsize = &state->bsize[(i*OD_BSIZE_GRID
+           + qi*(OD_BSIZE_GRID >> 1))*state->bstride
+           + j*OD_BSIZE_GRID + qj*(OD_BSIZE_GRID >> 1)];
+          od_split_superblock(enc->bs, bimg + j*OD_BSIZE_MAX + off, istride,
+           is_keyframe ? NULL : rimg + j*OD_BSIZE_MAX
+           + (qi*rstride + qj)*(OD_BSIZE_MAX >> 1), rstride, bsize,
+           state->quantizer);
+          /* Grab the 4x4 information returned from `od_split_superblock` in
+             bsize and store it in the od_state bsize. */
+          for (k = 0; k < OD_BSIZE_GRID >> 1; k++) {
+            for (m = 0; m < OD_BSIZE_GRID >> 1; m++) {
+              if (OD_LIMIT_BSIZE_MIN != OD_LIMIT_BSIZE_MAX) {
+                state_bsize[k*bstride + m] =
+                 OD_MAXI(OD_MINI(bsize[k][m], OD_LIMIT_BSIZE_MAX),
+                 OD_LIMIT_BSIZE_MIN);
+              }
+              else {
+                state_bsize[k*bstride + m] = OD_LIMIT_BSIZE_MIN;
+              }
+            }
           }
         }
       }
@@ -2423,13 +2806,19 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
   od_mv_grid_pt *mvp;
   od_mv_grid_pt **grid;
   uint16_t *cdf;
+  int acct;
+  uint32_t tell0;
   state = &enc->state;
   nhmvbs = enc->state.nhmvbs;
   nvmvbs = enc->state.nvmvbs;
   mvimg = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
   mv_res = enc->state.mv_res;
+  acct = enc->acct.enabled;
+  tell0 = acct ? od_ec_enc_tell_frac(&enc->ec) : 0;
   OD_ASSERT(0 <= mv_res && mv_res < 3);
   od_ec_enc_uint(&enc->ec, mv_res, 3);
+  /*The resolution belongs to the whole frame, not to any superblock.*/
+  if (acct) od_enc_acct_add(enc, OD_ENC_ACCT_MV, -1, tell0);
   width = (mvimg->width + 32) << ((3 - mv_res) + 1); /* delta mvx range */
   height = (mvimg->height + 32) << ((3 - mv_res) + 1);/* delta mvy range */
   grid = enc->state.mv_grid;
@@ -2439,7 +2828,12 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
   for (vy = 0; vy <= nvmvbs; vy += OD_MVB_DELTA0) {
     for (vx = 0; vx <= nhmvbs; vx += OD_MVB_DELTA0) {
       mvp = grid[vy] + vx;
+      if (acct) tell0 = od_ec_enc_tell_frac(&enc->ec);
       od_encode_mv(enc, num_refs, mvp, vx, vy, 0, mv_res, width, height);
+      if (acct) {
+        od_enc_acct_add(enc, OD_ENC_ACCT_MV, od_enc_acct_mv_sb(enc, vx, vy),
+         tell0);
+      }
     }
   }
   /*od_ec_acct_add_label(&enc->ec.acct, "mvf-l1");
@@ -2453,6 +2847,7 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
     for (vy = mvb_sz; vy <= nvmvbs; vy += 2*mvb_sz) {
       for (vx = mvb_sz; vx <= nhmvbs; vx += 2*mvb_sz) {
         mvp = grid[vy] + vx;
+        if (acct) tell0 = od_ec_enc_tell_frac(&enc->ec);
         if (grid[vy - mvb_sz][vx - mvb_sz].valid
          && grid[vy - mvb_sz][vx + mvb_sz].valid
          && grid[vy + mvb_sz][vx + mvb_sz].valid
@@ -2468,6 +2863,10 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
         else {
           OD_ASSERT(!mvp->valid);
         }
+        if (acct) {
+          od_enc_acct_add(enc, OD_ENC_ACCT_MV,
+           od_enc_acct_mv_sb(enc, vx, vy), tell0);
+        }
       }
     }
     level++;
@@ -2475,6 +2874,7 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
     for (vy = 0; vy <= nvmvbs; vy += mvb_sz) {
       for (vx = mvb_sz*!(vy & mvb_sz); vx <= nhmvbs; vx += 2*mvb_sz) {
         mvp = grid[vy] + vx;
+        if (acct) tell0 = od_ec_enc_tell_frac(&enc->ec);
         if ((vy - mvb_sz < 0 || grid[vy - mvb_sz][vx].valid)
          && (vx - mvb_sz < 0 || grid[vy][vx - mvb_sz].valid)
          && (vy + mvb_sz > nvmvbs || grid[vy + mvb_sz][vx].valid)
@@ -2490,6 +2890,10 @@ static void od_encode_mvs(daala_enc_ctx *enc, int num_refs) {
         else {
           OD_ASSERT(!mvp->valid);
         }
+        if (acct) {
+          od_enc_acct_add(enc, OD_ENC_ACCT_MV,
+           od_enc_acct_mv_sb(enc, vx, vy), tell0);
+        }
       }
     }
   }
@@ -2506,12 +2910,12 @@ static int od_compute_superblock_q_scaling(daala_enc_ctx *enc, od_coeff *x,
 
 #define OD_ENCODE_REAL (0)
 #define OD_ENCODE_RDO (1)
-static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
- int rdo_only) {
+/*Codes the quantizer and loads the prefiltered source and prediction into
+   ctmp and mctmp.*/
+static void od_encode_coefficients_begin(daala_enc_ctx *enc,
+ od_mb_enc_ctx *mbctx, int rdo_only) {
   int xdec;
   int ydec;
-  int sby;
-  int sbx;
   int w;
   int y;
   int x;
@@ -2522,6 +2926,7 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
   int nvsb;
   od_state *state;
   daala_image *rec;
+  int64_t prof_t0;
   state = &enc->state;
   nplanes = state->info.nplanes;
   if (rdo_only) nplanes = 1;
@@ -2530,6 +2935,7 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
   nvsb = state->nvsb;
   rec = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
   od_ec_enc_uint(&enc->ec, state->coded_quantizer, OD_N_CODED_QUANTIZERS);
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
   for (pli = 0; pli < nplanes; pli++) {
     int pic_width;
     int pic_height;
@@ -2574,8 +2980,45 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
       }
     }
   }
-  for (sby = 0; sby < nvsb; sby++) {
+  OD_ENC_PROF_END(enc, OD_PROF_COEFF_PREFILTER, prof_t0);
+}
+
+/*Codes the superblocks in rows sby0 through sby1 - 1.*/
+static void od_encode_sb_rows(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
+ int rdo_only, int sby0, int sby1) {
+  int xdec;
+  int ydec;
+  int sby;
+  int sbx;
+  int pli;
+  int nplanes;
+  int nhsb;
+  int nvsb;
+  od_state *state;
+  int64_t prof_t0;
+  int rt_stage;
+  int acct;
+  state = &enc->state;
+  nplanes = state->info.nplanes;
+  if (rdo_only) nplanes = 1;
+  nhsb = state->nhsb;
+  nvsb = state->nvsb;
+  acct = enc->acct.enabled && !rdo_only;
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
+  /*When the block sizes are searched one packet at a time, the search is
+     part of coding each packet.*/
+  rt_stage = rdo_only && !enc->chunk.split_rdo ? OD_RT_SPLIT : OD_RT_CODE;
+  for (sby = sby0; sby < sby1; sby++) {
     for (sbx = 0; sbx < nhsb; sbx++) {
+      (void)OD_RT_CHECK(enc, rt_stage, sby*nhsb + sbx, nvsb*nhsb);
+      if (rdo_only && enc->rt.late) {
+        int i;
+        /*Behind schedule: don't search block sizes below 16x16.*/
+        for (i = 0; i < OD_BSIZE_GRID; i++) {
+          memset(state->bsize + (sby*OD_BSIZE_GRID + i)*state->bstride
+           + sbx*OD_BSIZE_GRID, OD_BLOCK_16X16, OD_BSIZE_GRID);
+        }
+      }
       for (pli = 0; pli < nplanes; pli++) {
         od_coeff *c_orig;
         int i;
@@ -2584,9 +3027,12 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
         od_rollback_buffer buf;
         od_coeff hgrad;
         od_coeff vgrad;
+        uint32_t tell0;
         width = enc->state.frame_width;
         hgrad = vgrad = 0;
-        c_orig = enc->c_orig[0];
+        od_scratch_reset(&enc->scratch);
+        c_orig = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff,
+         OD_BSIZE_MAX*OD_BSIZE_MAX);
         mbctx->c = state->ctmp[pli];
         mbctx->d = state->dtmp;
         mbctx->mc = state->mctmp[pli];
@@ -2606,6 +3052,7 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
           if (rdo_only) {
             od_encode_checkpoint(enc, &buf);
           }
+          tell0 = acct ? od_ec_enc_tell_frac(&enc->ec) : 0;
           od_compute_dcts(enc, mbctx, pli, sbx, sby, OD_NBSIZES - 1, xdec,
            ydec, mbctx->use_haar_wavelet && !rdo_only);
           od_quantize_haar_dc_sb(enc, mbctx, pli, sbx, sby, xdec, ydec,
@@ -2619,16 +3066,55 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
               }
             }
           }
+          if (acct) {
+            od_enc_acct_add(enc, OD_ENC_ACCT_DC, sby*nhsb + sbx, tell0);
+          }
         }
         if (pli == 0 && !OD_LOSSLESS(enc)) {
           mbctx->q_scaling =
            od_compute_superblock_q_scaling(enc, c_orig, OD_BSIZE_MAX);
         }
+        tell0 = acct ? od_ec_enc_tell_frac(&enc->ec) : 0;
         od_encode_recursive(enc, mbctx, pli, sbx, sby, OD_NBSIZES - 1, xdec,
          ydec, rdo_only, hgrad, vgrad);
+        if (acct) {
+          od_enc_acct_add(enc, pli == 0 ? OD_ENC_ACCT_LUMA : OD_ENC_ACCT_CHROMA,
+           sby*nhsb + sbx, tell0);
+        }
       }
     }
   }
+  OD_ENC_PROF_END(enc, OD_PROF_COEFF_BLOCKS, prof_t0);
+}
+
+/*Applies the postfilter, chooses and codes the deringing filter levels, and
+   stores the reconstruction in the reference frame.*/
+static void od_encode_coefficients_end(daala_enc_ctx *enc,
+ od_mb_enc_ctx *mbctx, int rdo_only) {
+  int xdec;
+  int ydec;
+  int sby;
+  int sbx;
+  int w;
+  int y;
+  int x;
+  int pli;
+  int nplanes;
+  int frame_width;
+  int nhsb;
+  int nvsb;
+  od_state *state;
+  daala_image *rec;
+  int64_t prof_t0;
+  state = &enc->state;
+  nplanes = state->info.nplanes;
+  if (rdo_only) nplanes = 1;
+  frame_width = state->frame_width;
+  nhsb = state->nhsb;
+  nvsb = state->nvsb;
+  rec = state->ref_imgs + state->ref_imgi[OD_FRAME_SELF];
+  (void)OD_RT_CHECK(enc, rdo_only ? OD_RT_SPLIT : OD_RT_CODE, nvsb*nhsb,
+   nvsb*nhsb);
 #if defined(OD_DUMP_IMAGES)
   if (!rdo_only) {
     /*Dump the lapped frame (before the postfilter has been applied)*/
@@ -2639,6 +3125,7 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
     od_state_dump_img(&enc->state, rec, "lapped");
   }
 #endif
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
   for (pli = 0; pli < nplanes; pli++) {
     xdec = state->info.plane_info[pli].xdec;
     ydec = state->info.plane_info[pli].ydec;
@@ -2649,12 +3136,16 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
        enc->state.skip_stride);
     }
   }
+  OD_ENC_PROF_END(enc, OD_PROF_POSTFILTER, prof_t0);
   if (!rdo_only && !OD_LOSSLESS(enc)) {
     int nhdr;
     int nvdr;
     double base_threshold;
     int nblocks;
+    int last_gi;
+    uint32_t tell0;
     nblocks = 1 << (OD_LOG_DERING_GRID - OD_BLOCK_8X8);
+    last_gi = OD_DERING_LEVELS >> 1;
     /* The threshold is meant to be the estimated amount of ringing for a given
        quantizer. Ringing is mostly proportional to the quantizer, but we
        use an exponent slightly smaller than unity because as quantization
@@ -2663,6 +3154,7 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
        value here comes from observing that on ntt-short, the best threshold
        for -v 5 appeared to be around 0.5*q, while the best threshold for
        -v 400 was 0.25*q, i.e. 1-log(.5/.25)/log(400/5) = 0.84182 */
+    prof_t0 = OD_ENC_PROF_BEGIN(enc);
     base_threshold = pow(state->quantizer, 0.84182);
     /* We copy ctmp to dtmp so we can use it as an unmodified input
        and avoid filtering some pixels twice. */
@@ -2691,21 +3183,10 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
         od_coeff *output;
         int c;
         int dir[OD_DERING_NBLOCKS][OD_DERING_NBLOCKS];
-        int i;
-        int j;
-        unsigned char *bskip;
         int best_gi;
-        state->dering_level[sby*nhdr + sbx] = 0;
-        bskip = enc->state.bskip[0] +
-         (sby << OD_LOG_DERING_GRID)*enc->state.skip_stride +
-         (sbx << OD_LOG_DERING_GRID);
-        for (j = 0; j < 1 << OD_LOG_DERING_GRID; j++) {
-          for (i = 0; i < 1 << OD_LOG_DERING_GRID; i++) {
-            if (!bskip[j*enc->state.skip_stride + i]) {
-              state->dering_level[sby*nhdr + sbx] = 1;
-            }
-          }
-        }
+        (void)OD_RT_CHECK(enc, OD_RT_DERING, sby*nhdr + sbx, nvdr*nhdr);
+        state->dering_level[sby*nhdr + sbx] =
+         !od_state_sb_skipped(&enc->state, 0, sbx, sby);
         if (!state->dering_level[sby*nhdr + sbx]) {
           continue;
         }
@@ -2755,6 +3236,8 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
           best_dist = dist + enc->dering_lambda*
            od_encode_cdf_cost(0, state->adapt.dering_cdf[c], OD_DERING_LEVELS);
           for (gi = 1; gi < OD_DERING_LEVELS; gi++) {
+            /*Behind schedule: only try the last strength used.*/
+            if (enc->rt.late && gi != last_gi) continue;
             threshold = (int)(OD_DERING_GAIN_TABLE[gi]*base_threshold);
             od_dering(&state->opt_vtbl.dering, buf, n, &state->etmp[pli]
              [(sby << ln)*w + (sbx << ln)], w, nblocks, nblocks, sbx, sby,
@@ -2781,8 +3264,14 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
           }
         }
         state->dering_level[sby*nhdr + sbx] = best_gi;
+        if (best_gi) last_gi = best_gi;
+        tell0 = enc->acct.enabled ? od_ec_enc_tell_frac(&enc->ec) : 0;
         od_encode_cdf_adapt(&enc->ec, best_gi, state->adapt.dering_cdf[c],
          OD_DERING_LEVELS, state->adapt.dering_increment);
+        /*The deringing grid is the superblock grid.*/
+        if (enc->acct.enabled) {
+          od_enc_acct_add(enc, OD_ENC_ACCT_DERING, sby*nhsb + sbx, tell0);
+        }
         if (best_gi) {
           for (pli = 0; pli < nplanes; pli++) {
             int threshold;
@@ -2811,15 +3300,26 @@ static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
         }
       }
     }
+    (void)OD_RT_CHECK(enc, OD_RT_DERING, nvdr*nhdr, nvdr*nhdr);
+    OD_ENC_PROF_END(enc, OD_PROF_DERING, prof_t0);
   }
   if (!rdo_only) {
+    prof_t0 = OD_ENC_PROF_BEGIN(enc);
     for (pli = 0; pli < nplanes; pli++) {
       od_coeff_to_ref_plane(state, rec, pli,
        state->ctmp[pli], OD_LOSSLESS(enc));
     }
+    OD_ENC_PROF_END(enc, OD_PROF_COEFF_RECON, prof_t0);
   }
 }
 
+static void od_encode_coefficients(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
+ int rdo_only) {
+  od_encode_coefficients_begin(enc, mbctx, rdo_only);
+  od_encode_sb_rows(enc, mbctx, rdo_only, 0, enc->state.nvsb);
+  od_encode_coefficients_end(enc, mbctx, rdo_only);
+}
+
 #if defined(OD_LOGGING_ENABLED)
 static void od_dump_frame_metrics(daala_enc_ctx *enc) {
   od_state *state;
@@ -2919,15 +3419,190 @@ static void od_split_superblocks_rdo(daala_enc_ctx *enc,
   od_encode_rollback(enc, &rbuf);
 }
 
+/*Searches the block sizes of superblock rows sby0 through sby1 - 1 of a frame
+   that is output in several packets, just before they are coded.
+  The search reconstructs the luma plane in place, so the prefiltered input of
+   those rows is saved and restored around it.*/
+static void od_split_sb_rows_rdo(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
+ int sby0, int sby1) {
+  od_rollback_buffer rbuf;
+  size_t off;
+  size_t size;
+  int w;
+  int ydec;
+  int64_t split_t0;
+  split_t0 = OD_ENC_PROF_BEGIN(enc);
+  w = enc->state.frame_width >> enc->state.info.plane_info[0].xdec;
+  ydec = enc->state.info.plane_info[0].ydec;
+  off = (size_t)(sby0 << OD_LOG_BSIZE_MAX >> ydec)*w;
+  size = (size_t)((sby1 - sby0) << OD_LOG_BSIZE_MAX >> ydec)*w;
+  OD_ASSERT(2*size <= enc->chunk_save_sz);
+  OD_COPY(enc->chunk_save, enc->state.ctmp[0] + off, size);
+  OD_COPY(enc->chunk_save + size, enc->state.mctmp[0] + off, size);
+  od_encode_checkpoint(enc, &rbuf);
+  od_encode_sb_rows(enc, mbctx, OD_ENCODE_RDO, sby0, sby1);
+  od_encode_rollback(enc, &rbuf);
+  OD_COPY(enc->state.ctmp[0] + off, enc->chunk_save, size);
+  OD_COPY(enc->state.mctmp[0] + off, enc->chunk_save + size, size);
+  OD_ENC_PROF_END(enc, OD_PROF_SPLIT, split_t0);
+}
+
+/*Codes superblock rows sby0 through sby1 - 1 of the current frame.*/
+static void od_encode_chunk_rows(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
+ int sby0, int sby1) {
+  if (enc->chunk.split_rdo) od_split_sb_rows_rdo(enc, mbctx, sby0, sby1);
+  od_encode_sb_rows(enc, mbctx, OD_ENCODE_REAL, sby0, sby1);
+}
+
 static void od_enc_drop_frame(daala_enc_ctx *enc){
   /*Use the previous frame's reconstruction image.*/
   od_img_copy(enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_SELF],
    enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_PREV]);
+  if (enc->sc_img_data != NULL) {
+    enc->sc_src_valid[enc->state.ref_imgi[OD_FRAME_SELF]] = 0;
+    if (enc->sc_src_valid[enc->state.ref_imgi[OD_FRAME_PREV]]) {
+      od_enc_sc_store(enc, enc->state.ref_imgi[OD_FRAME_SELF],
+       enc->sc_src_imgs + enc->state.ref_imgi[OD_FRAME_PREV]);
+    }
+  }
   /*Zero the MV state.*/
   od_zero_2d((void **)enc->state.mv_grid, enc->state.nvmvbs + 1,
    enc->state.nhmvbs + 1, sizeof(**enc->state.mv_grid));
   /*Clear encoder state so that we emit a nil packet*/
   od_ec_enc_reset(&enc->ec);
+  if (enc->acct.enabled) od_enc_acct_reset(enc);
+}
+
+/*Resets the entropy coder for a new video data packet, and points it at a
+   buffer from the application if there is one (see
+   OD_SET_PACKET_BUFFER_FUNCS).*/
+static void od_enc_packet_begin(daala_enc_ctx *enc) {
+  daala_packet_buffer pb;
+  od_ec_enc_reset(&enc->ec);
+  od_ec_enc_set_buffer(&enc->ec, NULL, 0);
+  if (enc->packet_funcs.get != NULL
+   && (*enc->packet_funcs.get)(enc->packet_funcs.ctx, &pb) >= 0
+   && pb.data != NULL) {
+    od_ec_enc_set_buffer(&enc->ec, pb.data,
+     pb.size < 0xFFFFFFFFU ? (uint32_t)pb.size : 0xFFFFFFFFU);
+  }
+}
+
+/*Finishes the reconstruction of a frame once all of its superblocks have been
+   coded, and updates the rate control and reference frame state.*/
+static void od_encode_frame_end(daala_enc_ctx *enc, od_mb_enc_ctx *mbctx,
+ int duration, int display_frame_number, int64_t prof_t0) {
+  daala_image *ref_img;
+  int frame_type;
+#if defined(OD_DUMP_BSIZE_DIST)
+  int pli;
+#endif
+  OD_UNUSED(display_frame_number);
+  frame_type = mbctx->frame_type;
+  od_encode_coefficients_end(enc, mbctx, OD_ENCODE_REAL);
+  /*Perform rate mangement update here before we flush anything to output
+     buffers.
+    We may need to press the panic button and drop the frame to avoid busting
+     rate budget constraints.*/
+  if (enc->rc.target_bitrate > 0) {
+    /*Right now, droppability is computed very simply.
+      If we're using B frames, only B frames are droppable.
+      If we're using only I and P frames, only P frames are droppable.
+      Eventually this should be smarter and both allow dropping anything not
+       used as a reference, as well as references + dependent frames when
+       needed.*/
+    int droppable;
+    droppable = 0;
+    if (enc->b_frames > 0) {
+      if (frame_type == OD_B_FRAME) {
+        droppable = 1;
+      }
+    }
+    else{
+      if (frame_type == OD_P_FRAME) {
+        droppable = 1;
+      }
+    }
+    /*Part of the frame has already been output.*/
+    if (enc->chunk.rows < enc->state.nvsb) droppable = 0;
+    if (od_enc_rc_update_state(enc,
+     enc->chunk.bits + od_ec_enc_tell(&enc->ec),
+     mbctx->is_golden_frame, frame_type, droppable)) {
+      /*Nonzero return indicates we busted budget on a droppable frame.*/
+      od_enc_drop_frame (enc);
+    }
+  }
+  enc->packet_state = OD_PACKET_READY;
+  ref_img = enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_SELF];
+  if (frame_type != OD_B_FRAME) {
+    OD_ASSERT(ref_img);
+    od_img_edge_ext(ref_img);
+  }
+#if defined(OD_DUMP_RECONS)
+  od_output_queue_add(&enc->out, ref_img, display_frame_number);
+  while (od_output_queue_has_next(&enc->out)) {
+    od_output_frame *frame;
+    frame = od_output_queue_next(&enc->out);
+    od_state_dump_yuv(&enc->state, frame->img, "out");
+  }
+#endif
+#if defined(OD_LOGGING_ENABLED)
+  od_dump_frame_metrics(enc);
+#endif
+  /*Update the reference buffer state.*/
+  if (mbctx->is_golden_frame) {
+    enc->state.ref_imgi[OD_FRAME_GOLD] =
+     enc->state.ref_imgi[OD_FRAME_SELF];
+  }
+  /*B frames cannot be a reference frame.*/
+  if (enc->b_frames == 0) {
+    enc->state.ref_imgi[OD_FRAME_PREV] =
+     enc->state.ref_imgi[OD_FRAME_SELF];
+  }
+  else {
+    if (frame_type != OD_B_FRAME) {
+      /*1st P frame in closed GOP or 1st P in the sequence with open GOP?*/
+      if (enc->state.ref_imgi[OD_FRAME_PREV] < 0 &&
+       enc->state.ref_imgi[OD_FRAME_NEXT] < 0) {
+        /*Only previous reference frame (i.e. I frame) is available.*/
+        enc->state.ref_imgi[OD_FRAME_PREV] =
+         enc->state.ref_imgi[OD_FRAME_SELF];
+        enc->state.ref_imgi[OD_FRAME_NEXT] =
+         enc->state.ref_imgi[OD_FRAME_SELF];
+      }
+      else {
+        /*Update two reference frames.*/
+        enc->state.ref_imgi[OD_FRAME_PREV] =
+         enc->state.ref_imgi[OD_FRAME_NEXT];
+        enc->state.ref_imgi[OD_FRAME_NEXT] =
+         enc->state.ref_imgi[OD_FRAME_SELF];
+      }
+    }
+  }
+#if defined(OD_DUMP_IMAGES)
+  /*Dump reference frame.*/
+  /*od_state_dump_img(&enc->state,
+   enc->state.ref_img + enc->state.ref_imigi[OD_FRAME_SELF], "ref");*/
+#endif
+  if (enc->state.info.frame_duration == 0) enc->state.cur_time += duration;
+  else enc->state.cur_time += enc->state.info.frame_duration;
+#if defined(OD_DUMP_BSIZE_DIST)
+  for (pli = 0; pli < enc->state.info.nplanes; pli++){
+    /* Write value for this frame and reset it */
+    fprintf(enc->bsize_dist_file, "%-7G\t",
+     10*log10(enc->bsize_dist[pli]));
+    enc->bsize_dist_total[pli] += enc->bsize_dist[pli];
+    enc->bsize_dist[pli] = 0.0;
+  }
+  fprintf(enc->bsize_dist_file, "\n");
+#endif
+  OD_ASSERT(mbctx->is_keyframe == (frame_type == OD_I_FRAME));
+  ++enc->curr_coding_order;
+  if (frame_type == OD_I_FRAME || frame_type == OD_P_FRAME) {
+    ++enc->ip_frame_count;
+  }
+  od_rt_frame_end(enc);
+  OD_ENC_PROF_END(enc, OD_PROF_FRAME, prof_t0);
 }
 
 /*This function can only return an error code if the enc or img parameters
@@ -2938,10 +3613,12 @@ static int od_encode_frame(daala_enc_ctx *enc, daala_image *img, int frame_type,
   int nplanes;
   int pli;
   int use_masking;
+  int nvsb;
   od_mb_enc_ctx mbctx;
-  daala_image *ref_img;
+  int64_t prof_t0;
   OD_RETURN_CHECK(enc, OD_EFAULT);
   OD_RETURN_CHECK(img, OD_EFAULT);
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
   nplanes = enc->state.info.nplanes;
   use_masking = enc->use_activity_masking;
   enc->curr_img = img;
@@ -2971,6 +3648,16 @@ static int od_encode_frame(daala_enc_ctx *enc, daala_image *img, int frame_type,
    || refi == enc->state.ref_imgi[OD_FRAME_PREV]
    || refi == enc->state.ref_imgi[OD_FRAME_NEXT]; refi++);
   enc->state.ref_imgi[OD_FRAME_SELF] = refi;
+  enc->sc_pred_valid = 0;
+  if (enc->screen_content >= OD_SCREEN_CONTENT_SOURCE_SKIP) {
+    if (enc->sc_img_data == NULL && od_enc_sc_init(enc) < 0) return OD_EFAULT;
+    od_enc_sc_store(enc, refi, img);
+  }
+  else if (enc->sc_img_data != NULL) {
+    /*The sources are only tracked for the source skip decision.*/
+    OD_CLEAR(enc->sc_src_valid, OD_FRAME_MAX + 1);
+  }
+  od_rt_frame_begin(enc, mbctx.is_keyframe);
   /*We must be a keyframe if we don't have a reference.*/
   if (enc->state.ref_imgi[OD_FRAME_PREV] < 0) {
     OD_ASSERT(mbctx.is_keyframe);
@@ -2998,29 +3685,65 @@ static int od_encode_frame(daala_enc_ctx *enc, daala_image *img, int frame_type,
      that it's silly to have just some planes be lossless. */
   mbctx.use_haar_wavelet = enc->use_haar_wavelet || OD_LOSSLESS(enc);
   /*Initialize the entropy coder.*/
-  od_ec_enc_reset(&enc->ec);
+  od_enc_packet_begin(enc);
+  if (enc->acct.enabled) od_enc_acct_reset(enc);
+  nvsb = enc->state.nvsb;
+  enc->chunk.rows = nvsb;
+  if (enc->chunk_rows > 0 && enc->chunk_rows < nvsb) {
+    enc->chunk.rows = enc->chunk_rows;
+  }
+  enc->chunk.bits = 0;
+  enc->chunk.split_rdo = 0;
   /*Write a bit to mark this as a data packet.*/
   od_ec_encode_bool_q15(&enc->ec, 0, 16384);
   /*Code the keyframe bit.*/
   od_ec_encode_bool_q15(&enc->ec, mbctx.is_keyframe, 16384);
-  /*If not I frame, code the bit to tell whether it is P or B frame.*/
-  if (!mbctx.is_keyframe) {
-    od_ec_encode_bool_q15(&enc->ec, frame_type == OD_B_FRAME, 16384);
-  }
-  /*Code the number of references.*/
-  if (frame_type != OD_I_FRAME) {
-    od_ec_enc_uint(&enc->ec, mbctx.num_refs - 1, OD_MAX_CODED_REFS);
-  }
-  /*Code the frame number for now*/
-  od_ec_enc_uint(&enc->ec, OD_REORDER_INDEX(enc->curr_display_order),
-   OD_MAX_REORDER);
-  /*Code whether or not activity masking is being used.*/
-  od_ec_encode_bool_q15(&enc->ec, mbctx.use_activity_masking, 16384);
-  /*Code whether flat or hvs quantization matrices are being used.
-   * FIXME: will need to be a wider type if other QMs get added */
-  od_ec_encode_bool_q15(&enc->ec, mbctx.qm, 16384);
-  od_ec_encode_bool_q15(&enc->ec, mbctx.use_haar_wavelet, 16384);
-  od_ec_encode_bool_q15(&enc->ec, mbctx.is_golden_frame, 16384);
+  /*Mark this as the first packet of the frame.*/
+  if (enc->state.info.version_minor >= OD_STREAM_VERSION_MINOR_CHUNKS
+   && !mbctx.is_keyframe) {
+    od_ec_encode_bool_q15(&enc->ec, 0, 16384);
+  }
+  if (enc->state.info.version_minor >= OD_STREAM_VERSION_MINOR_PACKED_HEADER) {
+    uint32_t hdr;
+    /*Pack the rest of the header into one run of raw bits.*/
+    hdr = mbctx.use_activity_masking << OD_FHDR_ACTIVITY_MASKING
+     | mbctx.qm << OD_FHDR_QM
+     | mbctx.use_haar_wavelet << OD_FHDR_HAAR
+     | mbctx.is_golden_frame << OD_FHDR_GOLDEN
+     | (enc->chunk.rows < nvsb) << OD_FHDR_CHUNKED
+     | OD_REORDER_INDEX(enc->curr_display_order) << OD_FHDR_FRAME_NUMBER;
+    if (mbctx.is_keyframe) od_ec_enc_bits(&enc->ec, hdr, OD_FHDR_INTRA_BITS);
+    else {
+      hdr |= (frame_type == OD_B_FRAME) << OD_FHDR_B_FRAME
+       | (mbctx.num_refs - 1) << OD_FHDR_NUM_REFS;
+      od_ec_enc_bits(&enc->ec, hdr, OD_FHDR_INTER_BITS);
+    }
+  }
+  else {
+    /*If not I frame, code the bit to tell whether it is P or B frame.*/
+    if (!mbctx.is_keyframe) {
+      od_ec_encode_bool_q15(&enc->ec, frame_type == OD_B_FRAME, 16384);
+    }
+    /*Code the number of references.*/
+    if (frame_type != OD_I_FRAME) {
+      od_ec_enc_uint(&enc->ec, mbctx.num_refs - 1, OD_MAX_CODED_REFS);
+    }
+    /*Code the frame number for now*/
+    od_ec_enc_uint(&enc->ec, OD_REORDER_INDEX(enc->curr_display_order),
+     OD_MAX_REORDER);
+    /*Code whether or not activity masking is being used.*/
+    od_ec_encode_bool_q15(&enc->ec, mbctx.use_activity_masking, 16384);
+    /*Code whether flat or hvs quantization matrices are being used.
+     * FIXME: will need to be a wider type if other QMs get added */
+    od_ec_encode_bool_q15(&enc->ec, mbctx.qm, 16384);
+    od_ec_encode_bool_q15(&enc->ec, mbctx.use_haar_wavelet, 16384);
+    od_ec_encode_bool_q15(&enc->ec, mbctx.is_golden_frame, 16384);
+  }
+  /*Code the number of superblock rows per packet, if the frame is split into
+     several.*/
+  if (enc->chunk.rows < nvsb) {
+    od_ec_enc_uint(&enc->ec, enc->chunk.rows - 1, nvsb);
+  }
   if (mbctx.is_keyframe) {
     for (pli = 0; pli < nplanes; pli++) {
       int i;
@@ -3044,8 +3767,16 @@ static int od_encode_frame(daala_enc_ctx *enc, daala_image *img, int frame_type,
     }
     for (pli = 0; pli < nplanes; pli++) {
       int i;
-      for (i = 0; i < OD_QM_SIZE; i++) {
-        od_ec_enc_bits(&enc->ec, enc->state.pvq_qm_q4[pli][i], 8);
+      for (i = 0; i < OD_QM_SIZE; i += OD_QM_BATCH) {
+        uint32_t bytes;
+        int nbytes;
+        int j;
+        nbytes = OD_MINI(OD_QM_SIZE - i, OD_QM_BATCH);
+        bytes = 0;
+        for (j = 0; j < nbytes; j++) {
+          bytes |= (uint32_t)enc->state.pvq_qm_q4[pli][i + j] << 8*j;
+        }
+        od_ec_enc_bits(&enc->ec, bytes, 8*nbytes);
       }
     }
   }
@@ -3060,117 +3791,90 @@ static int od_encode_frame(daala_enc_ctx *enc, daala_image *img, int frame_type,
     od_state_init_superblock_split(&enc->state, OD_BLOCK_64X64);
   }
   else {
+    int64_t split_t0;
+    split_t0 = OD_ENC_PROF_BEGIN(enc);
     /* Enable block size RDO for all but complexity 0 and 1. We might want to
        revise that choice if we get a better open-loop block size algorithm. */
     od_state_init_superblock_split(&enc->state, OD_LIMIT_BSIZE_MIN);
-    if (enc->complexity >= 2) od_split_superblocks_rdo(enc, &mbctx);
-    else od_split_superblocks(enc, mbctx.is_keyframe);
-  }
-  od_encode_coefficients(enc, &mbctx, OD_ENCODE_REAL);
-  /*Perform rate mangement update here before we flush anything to output
-     buffers.
-    We may need to press the panic button and drop the frame to avoid busting
-     rate budget constraints.*/
-  if (enc->rc.target_bitrate > 0) {
-    /*Right now, droppability is computed very simply.
-      If we're using B frames, only B frames are droppable.
-      If we're using only I and P frames, only P frames are droppable.
-      Eventually this should be smarter and both allow dropping anything not
-       used as a reference, as well as references + dependent frames when
-       needed.*/
-    int droppable;
-    droppable = 0;
-    if (enc->b_frames > 0) {
-      if (frame_type == OD_B_FRAME) {
-        droppable = 1;
-      }
-    }
-    else{
-      if (frame_type == OD_P_FRAME) {
-        droppable = 1;
+    if (enc->rt.level < 2) od_split_superblocks(enc, mbctx.is_keyframe);
+    else if (enc->chunk.rows < nvsb) {
+      /*Search the block sizes of each packet just before coding it, so that
+         the first one is not held up by the search over the whole frame.*/
+      size_t save_sz;
+      save_sz = 2*(size_t)(enc->chunk.rows*OD_BSIZE_MAX
+       >> enc->state.info.plane_info[0].ydec)
+       *(enc->state.frame_width >> enc->state.info.plane_info[0].xdec);
+      if (enc->chunk_save_sz < save_sz) {
+        free(enc->chunk_save);
+        enc->chunk_save_sz = 0;
+        enc->chunk_save = (od_coeff *)malloc(save_sz*sizeof(od_coeff));
+        if (OD_UNLIKELY(!enc->chunk_save)) return OD_EFAULT;
+        enc->chunk_save_sz = save_sz;
       }
-    }
-    if (od_enc_rc_update_state(enc, od_ec_enc_tell(&enc->ec),
-     mbctx.is_golden_frame, frame_type, droppable)) {
-      /*Nonzero return indicates we busted budget on a droppable frame.*/
-      od_enc_drop_frame (enc);
-    }
-  }
-  enc->packet_state = OD_PACKET_READY;
-  ref_img = enc->state.ref_imgs + enc->state.ref_imgi[OD_FRAME_SELF];
-  if (frame_type != OD_B_FRAME) {
-    OD_ASSERT(ref_img);
-    od_img_edge_ext(ref_img);
-  }
-#if defined(OD_DUMP_RECONS)
-  od_output_queue_add(&enc->out, ref_img, display_frame_number);
-  while (od_output_queue_has_next(&enc->out)) {
-    od_output_frame *frame;
-    frame = od_output_queue_next(&enc->out);
-    od_state_dump_yuv(&enc->state, frame->img, "out");
-  }
-#endif
-#if defined(OD_LOGGING_ENABLED)
-  od_dump_frame_metrics(enc);
-#endif
-  /*Update the reference buffer state.*/
-  if (mbctx.is_golden_frame) {
-    enc->state.ref_imgi[OD_FRAME_GOLD] =
-     enc->state.ref_imgi[OD_FRAME_SELF];
-  }
-  /*B frames cannot be a reference frame.*/
-  if (enc->b_frames == 0) {
-    enc->state.ref_imgi[OD_FRAME_PREV] =
-     enc->state.ref_imgi[OD_FRAME_SELF];
-  }
-  else {
-    if (frame_type != OD_B_FRAME) {
-      /*1st P frame in closed GOP or 1st P in the sequence with open GOP?*/
-      if (enc->state.ref_imgi[OD_FRAME_PREV] < 0 &&
-       enc->state.ref_imgi[OD_FRAME_NEXT] < 0) {
-        /*Only previous reference frame (i.e. I frame) is available.*/
-        enc->state.ref_imgi[OD_FRAME_PREV] =
-         enc->state.ref_imgi[OD_FRAME_SELF];
-        enc->state.ref_imgi[OD_FRAME_NEXT] =
-         enc->state.ref_imgi[OD_FRAME_SELF];
-      }
-      else {
-        /*Update two reference frames.*/
-        enc->state.ref_imgi[OD_FRAME_PREV] =
-         enc->state.ref_imgi[OD_FRAME_NEXT];
-        enc->state.ref_imgi[OD_FRAME_NEXT] =
-         enc->state.ref_imgi[OD_FRAME_SELF];
-      }
-    }
-  }
-#if defined(OD_DUMP_IMAGES)
-  /*Dump reference frame.*/
-  /*od_state_dump_img(&enc->state,
-   enc->state.ref_img + enc->state.ref_imigi[OD_FRAME_SELF], "ref");*/
-#endif
-  if (enc->state.info.frame_duration == 0) enc->state.cur_time += duration;
-  else enc->state.cur_time += enc->state.info.frame_duration;
-#if defined(OD_DUMP_BSIZE_DIST)
-  for (pli = 0; pli < nplanes; pli++){
-    /* Write value for this frame and reset it */
-    fprintf(enc->bsize_dist_file, "%-7G\t",
-     10*log10(enc->bsize_dist[pli]));
-    enc->bsize_dist_total[pli] += enc->bsize_dist[pli];
-    enc->bsize_dist[pli] = 0.0;
-  }
-  fprintf(enc->bsize_dist_file, "\n");
-#endif
-  OD_ASSERT(mbctx.is_keyframe == (frame_type == OD_I_FRAME));
-  ++enc->curr_coding_order;
-  if (frame_type == OD_I_FRAME || frame_type == OD_P_FRAME) {
-    ++enc->ip_frame_count;
-  }
+      enc->chunk.split_rdo = 1;
+    }
+    else od_split_superblocks_rdo(enc, &mbctx);
+    OD_ENC_PROF_END(enc, OD_PROF_SPLIT, split_t0);
+  }
+  od_encode_coefficients_begin(enc, &mbctx, OD_ENCODE_REAL);
+  od_encode_chunk_rows(enc, &mbctx, 0, enc->chunk.rows);
+  if (enc->chunk.rows < nvsb) {
+    /*The rest of the frame is coded by the following calls to
+       daala_encode_packet_out().*/
+    enc->chunk.mbctx = mbctx;
+    enc->chunk.sby = enc->chunk.rows;
+    enc->chunk.duration = duration;
+    enc->chunk.display_frame_number = display_frame_number;
+    enc->chunk.bits = od_ec_enc_tell(&enc->ec);
+    enc->chunk.prof_t0 = prof_t0;
+    enc->chunk.prof_pause = OD_ENC_PROF_BEGIN(enc);
+    od_rt_frame_pause(enc);
+    return OD_SUCCESS;
+  }
+  od_encode_frame_end(enc, &mbctx, duration, display_frame_number, prof_t0);
   return OD_SUCCESS;
 }
 
+/*Codes the next packet of superblock rows of a frame that is output in
+   several (see OD_SET_CHUNK_ROWS).*/
+static void od_encode_frame_chunk(daala_enc_ctx *enc) {
+  od_enc_chunk *chunk;
+  int nvsb;
+  int sby1;
+  chunk = &enc->chunk;
+  nvsb = enc->state.nvsb;
+  OD_ASSERT(chunk->sby > 0 && chunk->sby < nvsb);
+  od_rt_frame_resume(enc);
+  chunk->prof_t0 += OD_ENC_PROF_BEGIN(enc) - chunk->prof_pause;
+  sby1 = OD_MINI(chunk->sby + chunk->rows, nvsb);
+  od_enc_packet_begin(enc);
+  /*Code the data packet and keyframe bits as 0, like an inter frame header,
+     then mark this as a later packet of the frame.*/
+  od_ec_encode_bool_q15(&enc->ec, 0, 16384);
+  od_ec_encode_bool_q15(&enc->ec, 0, 16384);
+  od_ec_encode_bool_q15(&enc->ec, 1, 16384);
+  /*Code the first row of the packet, so that the decoder can tell when one
+     is missing.*/
+  od_ec_enc_uint(&enc->ec, chunk->sby, nvsb);
+  od_encode_chunk_rows(enc, &chunk->mbctx, chunk->sby, sby1);
+  if (sby1 < nvsb) {
+    chunk->sby = sby1;
+    chunk->bits += od_ec_enc_tell(&enc->ec);
+    chunk->prof_pause = OD_ENC_PROF_BEGIN(enc);
+    od_rt_frame_pause(enc);
+    return;
+  }
+  chunk->sby = 0;
+  od_encode_frame_end(enc, &chunk->mbctx, chunk->duration,
+   chunk->display_frame_number, chunk->prof_t0);
+}
+
+
 int daala_encode_img_in(daala_enc_ctx *enc, daala_image *img, int duration) {
   daala_info *info;
   int pli;
+  int ret;
+  int64_t prof_t0;
   OD_RETURN_CHECK(enc, OD_EFAULT);
   OD_RETURN_CHECK(img, OD_EFAULT);
   OD_RETURN_CHECK(duration >= 0, OD_EINVAL);
@@ -3188,7 +3892,10 @@ int daala_encode_img_in(daala_enc_ctx *enc, daala_image *img, int duration) {
   /*Add the img input frame to the input_queue.
     The only way this can fail is if more than OD_MAX_REORDER frames are
      queued before daala_encode_packet_out is called.*/
-  if (od_input_queue_add(&enc->input_queue, img, duration)) {
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
+  ret = od_input_queue_add(&enc->input_queue, img, duration);
+  OD_ENC_PROF_END(enc, OD_PROF_INPUT_COPY, prof_t0);
+  if (ret) {
     return OD_EINVAL;
   }
 #if defined(OD_DUMP_IMAGES)
@@ -3211,6 +3918,8 @@ static void daala_encoder_check(daala_enc_ctx *ctx, daala_image *img,
     fprintf(stderr, "encoder_check: decode failed\n");
     return;
   }
+  /*Wait for the rest of the frame.*/
+  if (ctx->chunk.sby > 0) return;
   /*We won't use out_img after this.*/
   daala_decode_img_out(ctx->dec, &out_img);
   dec_img = ctx->dec->state.ref_imgs[ctx->dec->state.ref_imgi[OD_FRAME_SELF]];
@@ -3246,36 +3955,57 @@ static void daala_encoder_check(daala_enc_ctx *ctx, daala_image *img,
 int daala_encode_packet_out(daala_enc_ctx *enc, int last, daala_packet *op) {
   od_input_frame *input_frame;
   uint32_t nbytes;
+  int64_t prof_t0;
   OD_RETURN_CHECK(enc, OD_EFAULT);
   OD_RETURN_CHECK(op, OD_EFAULT);
-  /*If the last frame has been reached, set the end_of_input flag in the
-     input_queue so that it does not wait until frame_delay input frames
-     have been queued before batching frames for encoding.*/
-  if (last) {
-    enc->input_queue.end_of_input = 1;
-  }
-  /*Request the next frame to encode.
-    This will return NULL if less than frame_delay input frames have been
-     queued and end_of_input has not been reached.*/
-  input_frame = od_input_queue_next(&enc->input_queue, &last);
-  if (input_frame == NULL) {
-    return 0;
-  }
-  if (od_encode_frame(enc, input_frame->img, input_frame->type,
-   input_frame->duration, input_frame->number)) {
-    printf("error encoding frame\n");
-    return 0;
+  if (enc->chunk.sby > 0) {
+    /*Continue the frame that is partially output.*/
+    od_encode_frame_chunk(enc);
+    last = enc->chunk.last;
   }
+  else {
+    /*If the last frame has been reached, set the end_of_input flag in the
+       input_queue so that it does not wait until frame_delay input frames
+       have been queued before batching frames for encoding.*/
+    if (last) {
+      enc->input_queue.end_of_input = 1;
+    }
+    /*Request the next frame to encode.
+      This will return NULL if less than frame_delay input frames have been
+       queued and end_of_input has not been reached.*/
+    input_frame = od_input_queue_next(&enc->input_queue, &last);
+    if (input_frame == NULL) {
+      return 0;
+    }
+    enc->chunk.last = last;
+    if (od_encode_frame(enc, input_frame->img, input_frame->type,
+     input_frame->duration, input_frame->number)) {
+      printf("error encoding frame\n");
+      return 0;
+    }
+  }
+  if (enc->acct.enabled) {
+    enc->acct.packet_bits_q3 += od_ec_enc_tell_frac(&enc->ec);
+  }
+  prof_t0 = OD_ENC_PROF_BEGIN(enc);
   op->packet = od_ec_enc_done(&enc->ec, &nbytes);
+  OD_ENC_PROF_END(enc, OD_PROF_EC_DONE, prof_t0);
   op->bytes = nbytes;
   OD_LOG((OD_LOG_ENCODER, OD_LOG_INFO, "Output Bytes: %ld (%ld Kbits)",
    op->bytes, op->bytes*8/1024));
   op->b_o_s = 0;
-  op->e_o_s = last;
   op->packetno = 0;
-  op->granulepos = enc->state.cur_time;
-  if (last) enc->packet_state = OD_PACKET_DONE;
-  else enc->packet_state = OD_PACKET_EMPTY;
+  if (enc->chunk.sby > 0) {
+    /*Only the last packet of a frame ends it.*/
+    op->e_o_s = 0;
+    op->granulepos = -1;
+  }
+  else {
+    op->e_o_s = last;
+    op->granulepos = enc->state.cur_time;
+    if (last) enc->packet_state = OD_PACKET_DONE;
+    else enc->packet_state = OD_PACKET_EMPTY;
+  }
 #if defined(OD_ENCODER_CHECK)
   /*Compare reconstructed frame against decoded frame.*/
   daala_encoder_check(enc,
@@ -26,10 +26,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 # include "config.h"
 #endif
 
+#include <stdlib.h>
 #include "entdec.h"
 #if OD_ACCOUNTING
 # include "accounting.h"
 #endif
+#if defined(OD_SSE2_BASELINE)
+# include <emmintrin.h>
+#endif
 
 /*A range decoder.
   This is an entropy decoder based upon \cite{Mar79}, which is itself a
@@ -87,18 +91,29 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
   }*/
 
 #if OD_ACCOUNTING
-# define od_ec_dec_normalize(dec, dif, rng, ret, str) od_ec_dec_normalize_(dec, dif, rng, ret, str)
-static void od_process_accounting(od_ec_dec *dec, char *str) {
-  if (dec->acct != NULL) {
+# define od_ec_dec_normalize(dec, dif, rng, ret, acc_id) od_ec_dec_normalize_(dec, dif, rng, ret, acc_id)
+/*Adds the bits used since the last symbol to the totals of its class and of
+   the current location.
+  This is done here rather than in accounting.c so it stays cheap enough to
+   leave on; only logging the individual symbols needs a call.*/
+static void od_process_accounting(od_ec_dec *dec, int acc_id) {
+  od_accounting_internal *acct;
+  acct = dec->acct;
+  if (acct != NULL) {
     uint32_t tell;
+    int bits_q3;
     tell = od_ec_dec_tell_frac(dec);
-    OD_ASSERT(tell >= dec->acct->last_tell);
-    od_accounting_record(dec->acct, str, tell - dec->acct->last_tell);
-    dec->acct->last_tell = tell;
+    OD_ASSERT(tell >= acct->last_tell);
+    OD_ASSERT(acc_id >= 0 && acc_id < OD_ACCT_NIDS);
+    bits_q3 = (int)(tell - acct->last_tell);
+    acct->last_tell = tell;
+    acct->class_bits_q3[acc_id] += bits_q3;
+    *acct->curr_bits_q3 += bits_q3;
+    if (acct->log_syms) od_accounting_record(acct, acc_id, bits_q3);
   }
 }
 #else
-# define od_ec_dec_normalize(dec, dif, rng, ret, str) od_ec_dec_normalize_(dec, dif, rng, ret)
+# define od_ec_dec_normalize(dec, dif, rng, ret, acc_id) od_ec_dec_normalize_(dec, dif, rng, ret)
 #endif
 
 /*This is meant to be a large, positive constant that can still be efficiently
@@ -106,6 +121,36 @@ static void od_process_accounting(od_ec_dec *dec, char *str) {
   Even relatively modest values like 100 would work fine.*/
 #define OD_EC_LOTS_OF_BITS (0x4000)
 
+/*Loads a whole window of bytes in big-endian order from a buffer that might
+   not be aligned.*/
+static od_ec_window od_ec_load_window(const unsigned char *bptr) {
+#if defined(__BYTE_ORDER__) && OD_GNUC_PREREQ(4, 6, 0)
+  od_ec_window w;
+  memcpy(&w, bptr, sizeof(w));
+# if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return w;
+# elif OD_EC_WINDOW64
+  return __builtin_bswap64(w);
+# else
+  return __builtin_bswap32(w);
+# endif
+#elif defined(_MSC_VER)
+  od_ec_window w;
+  memcpy(&w, bptr, sizeof(w));
+# if OD_EC_WINDOW64
+  return _byteswap_uint64(w);
+# else
+  return _byteswap_ulong(w);
+# endif
+#else
+  od_ec_window w;
+  int i;
+  w = 0;
+  for (i = 0; i < (int)sizeof(w); i++) w = w << 8 | bptr[i];
+  return w;
+#endif
+}
+
 static void od_ec_dec_refill(od_ec_dec *dec) {
   int s;
   od_ec_window dif;
@@ -117,6 +162,20 @@ static void od_ec_dec_refill(od_ec_dec *dec) {
   bptr = dec->bptr;
   end = dec->end;
   s = OD_EC_WINDOW_SIZE - 9 - (cnt + 15);
+  OD_ASSERT(s <= OD_EC_WINDOW_SIZE - 8);
+  if (s >= 0 && end - bptr >= (int)sizeof(od_ec_window)) {
+    int n;
+    /*Away from the end of the buffer, read all the bytes the loop below would
+       with a single load.
+      The bits below the last whole byte that fits are dropped, so that dif is
+       exactly what the loop would have produced.*/
+    n = (s >> 3) + 1;
+    dif |= od_ec_load_window(bptr) >> (OD_EC_WINDOW_SIZE - 8 - s)
+     >> (s & 7) << (s & 7);
+    cnt += n << 3;
+    bptr += n;
+    s -= n << 3;
+  }
   for (; s >= 0 && bptr < end; s -= 8, bptr++) {
     OD_ASSERT(s <= OD_EC_WINDOW_SIZE - 8);
     dif |= (od_ec_window)bptr[0] << s;
@@ -140,7 +199,7 @@ static void od_ec_dec_refill(od_ec_dec *dec) {
   Return: ret.
           This allows the compiler to jump to this function via a tail-call.*/
 static int od_ec_dec_normalize_(od_ec_dec *dec,
- od_ec_window dif, unsigned rng, int ret OD_ACC_STR) {
+ od_ec_window dif, unsigned rng, int ret OD_ACC_ID) {
   int d;
   OD_ASSERT(rng <= 65535U);
   d = 16 - OD_ILOG_NZ(rng);
@@ -149,11 +208,89 @@ static int od_ec_dec_normalize_(od_ec_dec *dec,
   dec->rng = rng << d;
   if (dec->cnt < 0) od_ec_dec_refill(dec);
 #if OD_ACCOUNTING
-  od_process_accounting(dec, acc_str);
+  od_process_accounting(dec, acc_id);
 #endif
   return ret;
 }
 
+/*Computes floor(n/3) with a multiply, for any 32-bit n.*/
+#define OD_EC_DIV3(n) ((unsigned)((n)*(uint64_t)0xAAAAAAABU >> 33))
+
+#if defined(OD_SSE2_BASELINE)
+/*Returns a mask with 2 bits set for each of the 8 CDF values in cdfv that
+   are no larger than the corresponding value in qv (treating both as
+   unsigned).*/
+static unsigned od_ec_cdf_le_mask_sse2(__m128i cdfv, __m128i qv) {
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(cdfv, qv),
+   _mm_setzero_si128()));
+}
+
+/*Computes (cdf*r >> ftb) for 8 CDF values at once, where cdfv holds the CDF
+   values scaled up by 1 << (15 - ftb).*/
+static __m128i od_ec_cdf_scale_sse2(__m128i cdfv, __m128i rv) {
+  return _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epu16(cdfv, rv), 1),
+   _mm_srli_epi16(_mm_mullo_epi16(cdfv, rv), 15));
+}
+#endif
+
+/*Finds the symbol q falls in: the number of values among the first
+   nsyms - 1 of a CDF that are no larger than q.
+  The CDF is non-decreasing, so this is the index of the first value larger
+   than q, but counting them avoids a data-dependent branch for each symbol.
+  cdf[nsyms - 1] must be larger than q.*/
+static int od_ec_cdf_search(const uint16_t *cdf, int nsyms, unsigned q) {
+  int ret;
+  int i;
+#if defined(OD_SSE2_BASELINE)
+  /*Below 9 symbols, the scalar loop is as fast.*/
+  if (nsyms > 8) {
+    __m128i qv;
+    unsigned m;
+    /*The values that are no larger than q form a prefix of the CDF, so two
+       overlapping loads that together cover the CDF give the length of that
+       prefix as the index of the highest set bit of the combined mask.
+      Both loads stay inside the nsyms entries of the CDF.*/
+    qv = _mm_set1_epi16((short)q);
+    m = od_ec_cdf_le_mask_sse2(_mm_loadu_si128((const __m128i *)cdf), qv);
+    m |= od_ec_cdf_le_mask_sse2(
+     _mm_loadu_si128((const __m128i *)(cdf + nsyms - 8)), qv)
+     << 2*(nsyms - 8);
+    return OD_ILOG(m) >> 1;
+  }
+#endif
+  ret = 0;
+  for (i = 0; i < nsyms - 1; i++) ret += cdf[i] <= q;
+  return ret;
+}
+
+/*Like od_ec_cdf_search(), but for a CDF that sums to 1 << ftb, which gets
+   scaled by r before the comparison with c.*/
+static int od_ec_cdf_search_dyadic(const uint16_t *cdf, int nsyms,
+ unsigned r, unsigned ftb, unsigned c) {
+  int ret;
+  int i;
+#if defined(OD_SSE2_BASELINE)
+  if (nsyms > 8) {
+    __m128i cv;
+    __m128i rv;
+    __m128i sv;
+    unsigned m;
+    cv = _mm_set1_epi16((short)c);
+    rv = _mm_set1_epi16((short)r);
+    sv = _mm_cvtsi32_si128(15 - ftb);
+    m = od_ec_cdf_le_mask_sse2(od_ec_cdf_scale_sse2(_mm_sll_epi16(
+     _mm_loadu_si128((const __m128i *)cdf), sv), rv), cv);
+    m |= od_ec_cdf_le_mask_sse2(od_ec_cdf_scale_sse2(_mm_sll_epi16(
+     _mm_loadu_si128((const __m128i *)(cdf + nsyms - 8)), sv), rv), cv)
+     << 2*(nsyms - 8);
+    return OD_ILOG(m) >> 1;
+  }
+#endif
+  ret = 0;
+  for (i = 0; i < nsyms - 1; i++) ret += (cdf[i]*(uint32_t)r >> ftb) <= c;
+  return ret;
+}
+
 /*Initializes the decoder.
   buf: The input buffer to use.
   Return: 0 on success, or a negative value on error.*/
@@ -163,7 +300,10 @@ void od_ec_dec_init(od_ec_dec *dec,
   dec->eptr = buf + storage;
   dec->end_window = 0;
   dec->nend_bits = 0;
-  dec->tell_offs = 10 - (OD_EC_WINDOW_SIZE - 8);
+  /*The first refill reads 8*k bits into dif and leaves cnt at 8*k - 15, for
+     some k that depends on the window size, so this makes od_ec_dec_tell()
+     start at 1, like od_ec_enc_tell().*/
+  dec->tell_offs = 1 - 15;
   dec->end = buf + storage;
   dec->bptr = buf;
   dec->dif = 0;
@@ -181,7 +321,7 @@ void od_ec_dec_init(od_ec_dec *dec,
   ft: The total probability.
       This must be at least 16384 and no more than 32768.
   Return: The value decoded (0 or 1).*/
-int od_ec_decode_bool_(od_ec_dec *dec, unsigned fz, unsigned ft OD_ACC_STR) {
+int od_ec_decode_bool_(od_ec_dec *dec, unsigned fz, unsigned ft OD_ACC_ID) {
   od_ec_window dif;
   od_ec_window vw;
   unsigned r;
@@ -215,7 +355,7 @@ int od_ec_decode_bool_(od_ec_dec *dec, unsigned fz, unsigned ft OD_ACC_STR) {
   ret = dif >= vw;
   if (ret) dif -= vw;
   r = ret ? r - v : v;
-  return od_ec_dec_normalize(dec, dif, r, ret, acc_str);
+  return od_ec_dec_normalize(dec, dif, r, ret, acc_id);
 }
 
 /*Decode a bit that has an fz probability of being a zero in Q15.
@@ -226,7 +366,7 @@ int od_ec_decode_bool_(od_ec_dec *dec, unsigned fz, unsigned ft OD_ACC_STR) {
    or _dyadic() functions instead.
   fz: The probability that the bit is zero, scaled by 32768.
   Return: The value decoded (0 or 1).*/
-int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_STR) {
+int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_ID) {
   od_ec_window dif;
   od_ec_window vw;
   unsigned r;
@@ -248,7 +388,7 @@ int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_STR) {
     dif -= vw;
     ret = 1;
   }
-  return od_ec_dec_normalize(dec, dif, r_new, ret, acc_str);
+  return od_ec_dec_normalize(dec, dif, r_new, ret, acc_id);
 }
 
 /*Decodes a symbol given a cumulative distribution function (CDF) table.
@@ -259,7 +399,7 @@ int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_STR) {
   nsyms: The number of symbols in the alphabet.
          This should be at most 16.
   Return: The decoded symbol s.*/
-int od_ec_decode_cdf_(od_ec_dec *dec, const uint16_t *cdf, int nsyms OD_ACC_STR) {
+int od_ec_decode_cdf_(od_ec_dec *dec, const uint16_t *cdf, int nsyms OD_ACC_ID) {
   od_ec_window dif;
   unsigned r;
   unsigned c;
@@ -293,18 +433,16 @@ int od_ec_decode_cdf_(od_ec_dec *dec, const uint16_t *cdf, int nsyms OD_ACC_STR)
   e = OD_SUBSATU(2*d, ft);
   /*The correctness of this inverse partition function is not obvious, but it
      was checked exhaustively for all possible values of r, ft, and c.
-    TODO: It should be possible to optimize this better than the compiler,
-     given that we do not care about the accuracy of negative results (as we
-     will not use them).
-    It would also be nice to get rid of the 32-bit dividend, as it requires a
-     32x32->64 bit multiply to invert.*/
-  q = OD_MAXI((int)q, (int)((2*(int32_t)c + 1 - (int32_t)e)/3));
+    We do not care about the accuracy of negative results (as we will not use
+     them), so the dividend saturates at 0 and the division by 3 becomes an
+     unsigned multiply.*/
+  q = OD_MAXI(q, OD_EC_DIV3(OD_SUBSATU(2*c + 1, e)));
 #endif
   q >>= s;
   OD_ASSERT(q < ft >> s);
-  fl = 0;
-  ret = 0;
-  for (fh = cdf[ret]; fh <= q; fh = cdf[++ret]) fl = fh;
+  ret = od_ec_cdf_search(cdf, nsyms, q);
+  fl = ret > 0 ? cdf[ret - 1] : 0;
+  fh = cdf[ret];
   OD_ASSERT(fh <= ft >> s);
   fl <<= s;
   fh <<= s;
@@ -317,7 +455,7 @@ int od_ec_decode_cdf_(od_ec_dec *dec, const uint16_t *cdf, int nsyms OD_ACC_STR)
 #endif
   r = v - u;
   dif -= (od_ec_window)u << (OD_EC_WINDOW_SIZE - 16);
-  return od_ec_dec_normalize(dec, dif, r, ret, acc_str);
+  return od_ec_dec_normalize(dec, dif, r, ret, acc_id);
 }
 
 /*Decodes a symbol given a cumulative distribution function (CDF) table.
@@ -329,7 +467,7 @@ int od_ec_decode_cdf_(od_ec_dec *dec, const uint16_t *cdf, int nsyms OD_ACC_STR)
          This should be at most 16.
   Return: The decoded symbol s.*/
 int od_ec_decode_cdf_unscaled_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms OD_ACC_STR) {
+ const uint16_t *cdf, int nsyms OD_ACC_ID) {
   od_ec_window dif;
   unsigned r;
   unsigned c;
@@ -365,14 +503,14 @@ int od_ec_decode_cdf_unscaled_(od_ec_dec *dec,
   q = OD_MAXI((int)(c >> 1), (int)(c - d));
 #if OD_EC_REDUCED_OVERHEAD
   e = OD_SUBSATU(2*d, ft);
-  /*TODO: See TODO above.*/
-  q = OD_MAXI((int)q, (int)((2*(int32_t)c + 1 - (int32_t)e)/3));
+  /*See the comment in od_ec_decode_cdf_() above.*/
+  q = OD_MAXI(q, OD_EC_DIV3(OD_SUBSATU(2*c + 1, e)));
 #endif
   q >>= s;
   OD_ASSERT(q < ft >> s);
-  fl = 0;
-  ret = 0;
-  for (fh = cdf[ret]; fh <= q; fh = cdf[++ret]) fl = fh;
+  ret = od_ec_cdf_search(cdf, nsyms, q);
+  fl = ret > 0 ? cdf[ret - 1] : 0;
+  fh = cdf[ret];
   OD_ASSERT(fh <= ft >> s);
   fl <<= s;
   fh <<= s;
@@ -385,7 +523,7 @@ int od_ec_decode_cdf_unscaled_(od_ec_dec *dec,
 #endif
   r = v - u;
   dif -= (od_ec_window)u << (OD_EC_WINDOW_SIZE - 16);
-  return od_ec_dec_normalize(dec, dif, r, ret, acc_str);
+  return od_ec_dec_normalize(dec, dif, r, ret, acc_id);
 }
 
 /*Decodes a symbol given a cumulative distribution function (CDF) table that
@@ -405,14 +543,13 @@ int od_ec_decode_cdf_unscaled_(od_ec_dec *dec,
        This must be no more than 15.
   Return: The decoded symbol s.*/
 int od_ec_decode_cdf_unscaled_dyadic_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms, unsigned ftb OD_ACC_STR) {
+ const uint16_t *cdf, int nsyms, unsigned ftb OD_ACC_ID) {
   od_ec_window dif;
   unsigned r;
   unsigned c;
   unsigned u;
   unsigned v;
   int ret;
-  OD_UNUSED(nsyms);
   dif = dec->dif;
   r = dec->rng;
   OD_ASSERT(dif >> (OD_EC_WINDOW_SIZE - 16) < r);
@@ -420,17 +557,15 @@ int od_ec_decode_cdf_unscaled_dyadic_(od_ec_dec *dec,
   OD_ASSERT(cdf[nsyms - 1] == 1U << ftb);
   OD_ASSERT(32768U <= r);
   c = (unsigned)(dif >> (OD_EC_WINDOW_SIZE - 16));
-  v = 0;
-  ret = -1;
-  do {
-    u = v;
-    v = cdf[++ret]*(uint32_t)r >> ftb;
-  }
-  while (v <= c);
+  ret = od_ec_cdf_search_dyadic(cdf, nsyms, r, ftb, c);
+  u = ret > 0 ? cdf[ret - 1]*(uint32_t)r >> ftb : 0;
+  v = cdf[ret]*(uint32_t)r >> ftb;
+  OD_ASSERT(u <= c);
+  OD_ASSERT(c < v);
   OD_ASSERT(v <= r);
   r = v - u;
   dif -= (od_ec_window)u << (OD_EC_WINDOW_SIZE - 16);
-  return od_ec_dec_normalize(dec, dif, r, ret, acc_str);
+  return od_ec_dec_normalize(dec, dif, r, ret, acc_id);
 }
 
 /*Decodes a symbol given a cumulative distribution function (CDF) table in Q15.
@@ -447,8 +582,8 @@ int od_ec_decode_cdf_unscaled_dyadic_(od_ec_dec *dec,
          This should be at most 16.
   Return: The decoded symbol s.*/
 int od_ec_decode_cdf_q15_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms OD_ACC_STR) {
-  return od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, 15, acc_str);
+ const uint16_t *cdf, int nsyms OD_ACC_ID) {
+  return od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, 15, acc_id);
 }
 
 /*Extracts a raw unsigned integer with a non-power-of-2 range from the stream.
@@ -456,7 +591,7 @@ int od_ec_decode_cdf_q15_(od_ec_dec *dec,
   ft: The number of integers that can be decoded (one more than the max).
       This must be at least 2, and no more than 2**29.
   Return: The decoded bits.*/
-uint32_t od_ec_dec_uint_(od_ec_dec *dec, uint32_t ft OD_ACC_STR) {
+uint32_t od_ec_dec_uint_(od_ec_dec *dec, uint32_t ft OD_ACC_ID) {
   OD_ASSERT(ft >= 2);
   OD_ASSERT(ft <= (uint32_t)1 << (25 + OD_EC_UINT_BITS));
   if (ft > 1U << OD_EC_UINT_BITS) {
@@ -466,13 +601,13 @@ uint32_t od_ec_dec_uint_(od_ec_dec *dec, uint32_t ft OD_ACC_STR) {
     ft--;
     ftb = OD_ILOG_NZ(ft) - OD_EC_UINT_BITS;
     ft1 = (int)(ft >> ftb) + 1;
-    t = od_ec_decode_cdf_q15(dec, OD_UNIFORM_CDF_Q15(ft1), ft1, acc_str);
-    t = t << ftb | od_ec_dec_bits(dec, ftb, acc_str);
+    t = od_ec_decode_cdf_q15(dec, OD_UNIFORM_CDF_Q15(ft1), ft1, acc_id);
+    t = t << ftb | od_ec_dec_bits(dec, ftb, acc_id);
     if (t <= ft) return t;
     dec->error = 1;
     return ft;
   }
-  return od_ec_decode_cdf_q15(dec, OD_UNIFORM_CDF_Q15(ft), (int)ft, acc_str);
+  return od_ec_decode_cdf_q15(dec, OD_UNIFORM_CDF_Q15(ft), (int)ft, acc_id);
 }
 
 /*Extracts a sequence of raw bits from the stream.
@@ -480,7 +615,7 @@ uint32_t od_ec_dec_uint_(od_ec_dec *dec, uint32_t ft OD_ACC_STR) {
   ftb: The number of bits to extract.
        This must be between 0 and 25, inclusive.
   Return: The decoded bits.*/
-uint32_t od_ec_dec_bits_(od_ec_dec *dec, unsigned ftb OD_ACC_STR) {
+uint32_t od_ec_dec_bits_(od_ec_dec *dec, unsigned ftb OD_ACC_ID) {
   od_ec_window window;
   int available;
   uint32_t ret;
@@ -511,7 +646,7 @@ uint32_t od_ec_dec_bits_(od_ec_dec *dec, unsigned ftb OD_ACC_STR) {
   dec->end_window = window;
   dec->nend_bits = available;
 #if OD_ACCOUNTING
-  od_process_accounting(dec, acc_str);
+  od_process_accounting(dec, acc_id);
 #endif
   return ret;
 }
@@ -33,25 +33,25 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 typedef struct od_ec_dec od_ec_dec;
 
 #if OD_ACCOUNTING
-# define OD_ACC_STR , char *acc_str
-# define od_ec_decode_bool(dec, fz, ft, str) od_ec_decode_bool_(dec, fz, ft, str)
-# define od_ec_decode_bool_q15(dec, fz, str) od_ec_decode_bool_q15_(dec, fz, str)
-# define od_ec_decode_cdf(dec, cdf, nsyms, str) od_ec_decode_cdf_(dec, cdf, nsyms, str)
-# define od_ec_decode_cdf_q15(dec, cdf, nsyms, str) od_ec_decode_cdf_q15_(dec, cdf, nsyms, str)
-# define od_ec_decode_cdf_unscaled(dec, cdf, nsyms, str) od_ec_decode_cdf_unscaled_(dec, cdf, nsyms, str)
-# define od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, ftb, str) od_ec_decode_cdf_unscaled_dyadic_(dec, cdf, nsyms, ftb, str)
-# define od_ec_dec_uint(dec, ft, str) od_ec_dec_uint_(dec, ft, str)
-# define od_ec_dec_bits(dec, ftb, str) od_ec_dec_bits_(dec, ftb, str)
+# define OD_ACC_ID , int acc_id
+# define od_ec_decode_bool(dec, fz, ft, acc_id) od_ec_decode_bool_(dec, fz, ft, acc_id)
+# define od_ec_decode_bool_q15(dec, fz, acc_id) od_ec_decode_bool_q15_(dec, fz, acc_id)
+# define od_ec_decode_cdf(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_(dec, cdf, nsyms, acc_id)
+# define od_ec_decode_cdf_q15(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_q15_(dec, cdf, nsyms, acc_id)
+# define od_ec_decode_cdf_unscaled(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_unscaled_(dec, cdf, nsyms, acc_id)
+# define od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, ftb, acc_id) od_ec_decode_cdf_unscaled_dyadic_(dec, cdf, nsyms, ftb, acc_id)
+# define od_ec_dec_uint(dec, ft, acc_id) od_ec_dec_uint_(dec, ft, acc_id)
+# define od_ec_dec_bits(dec, ftb, acc_id) od_ec_dec_bits_(dec, ftb, acc_id)
 #else
-# define OD_ACC_STR
-# define od_ec_decode_bool(dec, fz, ft, str) od_ec_decode_bool_(dec, fz, ft)
-# define od_ec_decode_bool_q15(dec, fz, str) od_ec_decode_bool_q15_(dec, fz)
-# define od_ec_decode_cdf(dec, cdf, nsyms, str) od_ec_decode_cdf_(dec, cdf, nsyms)
-# define od_ec_decode_cdf_q15(dec, cdf, nsyms, str) od_ec_decode_cdf_q15_(dec, cdf, nsyms)
-# define od_ec_decode_cdf_unscaled(dec, cdf, nsyms, str) od_ec_decode_cdf_unscaled_(dec, cdf, nsyms)
-# define od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, ftb, str) od_ec_decode_cdf_unscaled_dyadic_(dec, cdf, nsyms, ftb)
-# define od_ec_dec_uint(dec, ft, str) od_ec_dec_uint_(dec, ft)
-# define od_ec_dec_bits(dec, ftb, str) od_ec_dec_bits_(dec, ftb)
+# define OD_ACC_ID
+# define od_ec_decode_bool(dec, fz, ft, acc_id) od_ec_decode_bool_(dec, fz, ft)
+# define od_ec_decode_bool_q15(dec, fz, acc_id) od_ec_decode_bool_q15_(dec, fz)
+# define od_ec_decode_cdf(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_(dec, cdf, nsyms)
+# define od_ec_decode_cdf_q15(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_q15_(dec, cdf, nsyms)
+# define od_ec_decode_cdf_unscaled(dec, cdf, nsyms, acc_id) od_ec_decode_cdf_unscaled_(dec, cdf, nsyms)
+# define od_ec_decode_cdf_unscaled_dyadic(dec, cdf, nsyms, ftb, acc_id) od_ec_decode_cdf_unscaled_dyadic_(dec, cdf, nsyms, ftb)
+# define od_ec_dec_uint(dec, ft, acc_id) od_ec_dec_uint_(dec, ft)
+# define od_ec_dec_bits(dec, ftb, acc_id) od_ec_dec_bits_(dec, ftb)
 #endif
 
 /*The entropy decoder context.*/
@@ -94,24 +94,24 @@ void od_ec_dec_init(od_ec_dec *dec,
  OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
 
 OD_WARN_UNUSED_RESULT int od_ec_decode_bool_(od_ec_dec *dec, unsigned fz,
- unsigned ft OD_ACC_STR) OD_ARG_NONNULL(1);
-OD_WARN_UNUSED_RESULT int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_STR)
+ unsigned ft OD_ACC_ID) OD_ARG_NONNULL(1);
+OD_WARN_UNUSED_RESULT int od_ec_decode_bool_q15_(od_ec_dec *dec, unsigned fz OD_ACC_ID)
  OD_ARG_NONNULL(1);
 OD_WARN_UNUSED_RESULT int od_ec_decode_cdf_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms OD_ACC_STR) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
+ const uint16_t *cdf, int nsyms OD_ACC_ID) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
 OD_WARN_UNUSED_RESULT int od_ec_decode_cdf_q15_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms OD_ACC_STR) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
+ const uint16_t *cdf, int nsyms OD_ACC_ID) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
 OD_WARN_UNUSED_RESULT int od_ec_decode_cdf_unscaled_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms OD_ACC_STR) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
+ const uint16_t *cdf, int nsyms OD_ACC_ID) OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
 OD_WARN_UNUSED_RESULT int od_ec_decode_cdf_unscaled_dyadic_(od_ec_dec *dec,
- const uint16_t *cdf, int nsyms, unsigned _ftb OD_ACC_STR)
+ const uint16_t *cdf, int nsyms, unsigned _ftb OD_ACC_ID)
  OD_ARG_NONNULL(1) OD_ARG_NONNULL(2);
 
 OD_WARN_UNUSED_RESULT uint32_t od_ec_dec_uint_(od_ec_dec *dec,
- uint32_t ft OD_ACC_STR) OD_ARG_NONNULL(1);
+ uint32_t ft OD_ACC_ID) OD_ARG_NONNULL(1);
 
 OD_WARN_UNUSED_RESULT uint32_t od_ec_dec_bits_(od_ec_dec *dec,
- unsigned ftb OD_ACC_STR) OD_ARG_NONNULL(1);
+ unsigned ftb OD_ACC_ID) OD_ARG_NONNULL(1);
 
 OD_WARN_UNUSED_RESULT int od_ec_dec_tell(const od_ec_dec *dec)
  OD_ARG_NONNULL(1);
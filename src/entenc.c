@@ -55,8 +55,84 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
    URL="http://researchcommons.waikato.ac.nz/bitstream/handle/10289/78/content.pdf"
   }*/
 
+/*Enlarges the output buffer so that it holds at least size bytes, keeping
+   the raw bits at its end.
+  Return: 0 on success, or -1 if the allocation failed.*/
+static int od_ec_enc_grow(od_ec_enc *enc, uint32_t size) {
+  unsigned char *buf;
+  uint32_t storage;
+  uint32_t end_offs;
+  storage = 2*enc->storage;
+  if (storage < size) storage = size;
+  end_offs = enc->end_offs;
+  if (enc->buf != enc->own_buf) {
+    /*An external buffer cannot be reallocated, so the rest of the packet is
+       coded in our own, after a copy of what has been output so far.*/
+    if (enc->own_storage < storage) {
+      buf = (unsigned char *)realloc(enc->own_buf, sizeof(*buf)*storage);
+      if (buf == NULL) {
+        enc->error = -1;
+        return -1;
+      }
+      enc->own_buf = buf;
+      enc->own_storage = storage;
+    }
+    buf = enc->own_buf;
+    storage = enc->own_storage;
+    OD_COPY(buf, enc->buf, enc->offs);
+    OD_COPY(buf + storage - end_offs, enc->buf + enc->storage - end_offs,
+     end_offs);
+  }
+  else {
+    buf = (unsigned char *)realloc(enc->buf, sizeof(*buf)*storage);
+    if (buf == NULL) {
+      enc->error = -1;
+      return -1;
+    }
+    OD_MOVE(buf + storage - end_offs, buf + enc->storage - end_offs,
+     end_offs);
+    enc->own_buf = buf;
+    enc->own_storage = storage;
+  }
+  enc->buf = buf;
+  enc->storage = storage;
+  return 0;
+}
+
+/*Outputs one entropy-coded byte.
+  A byte is only written to the buffer once no carry from a later byte can
+   change it: until then it is held in rem or, if it is 0xFF, counted in ext
+   (a carry would turn the whole run into 0x00 bytes and stop at rem).
+  This keeps the carry propagation to a bounded number of pending bytes, and
+   lets od_ec_enc_rollback() discard the bytes output since a checkpoint by
+   restoring just offs, rem and ext.
+  buf: The output buffer.
+  offs: The number of bytes output before this one.
+  rem: The pending byte, updated in place.
+  ext: The number of pending 0xFF bytes, updated in place.
+  c: The byte to output, with its carry flag in bit 8.*/
+static void od_ec_enc_carry_out(unsigned char *buf, uint32_t offs,
+ int *rem, uint32_t *ext, unsigned c) {
+  if (c == 0xFF) (*ext)++;
+  else {
+    uint32_t pos;
+    uint32_t n;
+    unsigned carry;
+    carry = c >> 8;
+    n = *ext;
+    pos = offs - n - (*rem >= 0);
+    if (*rem >= 0) {
+      OD_ASSERT(*rem + carry <= 0xFF);
+      buf[pos++] = (unsigned char)(*rem + carry);
+    }
+    while (n-- > 0) buf[pos++] = (unsigned char)(0xFF + carry);
+    *ext = 0;
+    *rem = c & 0xFF;
+  }
+}
+
 /*Takes updated low and range values, renormalizes them so that
-   32768 <= rng < 65536 (flushing bytes from low to the pre-carry buffer if
+   32768 <= rng < 65536 (flushing bytes from low to the output buffer if
    necessary), and stores them back in the encoder context.
   low: The new value of low.
   rng: The new value of the range.*/
@@ -69,44 +145,43 @@ static void od_ec_enc_normalize(od_ec_enc *enc,
   OD_ASSERT(rng <= 65535U);
   d = 16 - OD_ILOG_NZ(rng);
   s = c + d;
-  /*TODO: Right now we flush every time we have at least one byte available.
-    Instead we should use an od_ec_window and flush right before we're about to
-     shift bits off the end of the window.
-    For a 32-bit window this is about the same amount of work, but for a 64-bit
-     window it should be a fair win.*/
-  if (s >= 0) {
-    uint16_t *buf;
-    uint32_t storage;
+  /*We flush all the whole bytes in low at once, just before shifting low up
+     by d could push its top bits (including one carry bit) off the end of the
+     window.
+    For a 32-bit window this is every time we have at least one byte
+     available, but a 64-bit window holds 4 more bytes between flushes.*/
+  if (s >= OD_EC_WINDOW_SIZE - 32) {
+    unsigned char *buf;
     uint32_t offs;
-    unsigned m;
-    buf = enc->precarry_buf;
-    storage = enc->precarry_storage;
+    uint32_t ext;
+    int rem;
+    od_ec_window m;
+    int n;
     offs = enc->offs;
-    if (offs + 2 > storage) {
-      storage = 2*storage + 2;
-      buf = (uint16_t *)realloc(buf, sizeof(*buf)*storage);
-      if (buf == NULL) {
-        enc->error = -1;
-        enc->offs = 0;
-        return;
-      }
-      enc->precarry_buf = buf;
-      enc->precarry_storage = storage;
+    n = (s >> 3) + 1;
+    if (offs + n + enc->end_offs > enc->storage
+     && od_ec_enc_grow(enc, offs + n + enc->end_offs) < 0) {
+      enc->offs = 0;
+      enc->rem = -1;
+      enc->ext = 0;
+      return;
     }
+    buf = enc->buf;
+    rem = enc->rem;
+    ext = enc->ext;
     c += 16;
-    m = (1 << c) - 1;
-    if (s >= 8) {
-      OD_ASSERT(offs < storage);
-      buf[offs++] = (uint16_t)(low >> c);
+    m = ((od_ec_window)1 << c) - 1;
+    do {
+      od_ec_enc_carry_out(buf, offs++, &rem, &ext, (unsigned)(low >> c));
       low &= m;
       c -= 8;
       m >>= 8;
     }
-    OD_ASSERT(offs < storage);
-    buf[offs++] = (uint16_t)(low >> c);
-    s = c + d - 24;
-    low &= m;
+    while (--n > 0);
+    s = c + d - 16;
     enc->offs = offs;
+    enc->rem = rem;
+    enc->ext = ext;
   }
   enc->low = low << d;
   enc->rng = rng << d;
@@ -123,13 +198,8 @@ void od_ec_enc_init(od_ec_enc *enc, uint32_t size) {
     enc->storage = 0;
     enc->error = -1;
   }
-  enc->precarry_buf =
-   (uint16_t *)malloc(sizeof(*enc->precarry_buf)*size);
-  enc->precarry_storage = size;
-  if (size > 0 && enc->precarry_buf == NULL) {
-    enc->precarry_storage = 0;
-    enc->error = -1;
-  }
+  enc->own_buf = enc->buf;
+  enc->own_storage = enc->storage;
 }
 
 /*Reinitializes the encoder.*/
@@ -138,6 +208,8 @@ void od_ec_enc_reset(od_ec_enc *enc) {
   enc->end_window = 0;
   enc->nend_bits = 0;
   enc->offs = 0;
+  enc->rem = -1;
+  enc->ext = 0;
   enc->low = 0;
   enc->rng = 0x8000;
   /*This is initialized to -9 so that it crosses zero after we've accumulated
@@ -152,8 +224,27 @@ void od_ec_enc_reset(od_ec_enc *enc) {
 
 /*Frees the buffers used by the encoder.*/
 void od_ec_enc_clear(od_ec_enc *enc) {
-  free(enc->precarry_buf);
-  free(enc->buf);
+  free(enc->own_buf);
+}
+
+/*Codes the current packet into an external buffer instead of the encoder's
+   own, so that od_ec_enc_done() returns a pointer into it and the packet
+   does not have to be copied.
+  This must be called before anything is coded, e.g., right after
+   od_ec_enc_reset().
+  If the packet outgrows the buffer, the encoder copies what it has output so
+   far back into its own buffer and finishes the packet there.
+  The external buffer is used until the next call to this function.
+  buf: The buffer, or NULL to go back to the encoder's own.
+  size: The size of the buffer, in bytes.*/
+void od_ec_enc_set_buffer(od_ec_enc *enc, unsigned char *buf, uint32_t size) {
+  OD_ASSERT(enc->offs == 0 && enc->end_offs == 0);
+  if (buf == NULL) {
+    buf = enc->own_buf;
+    size = enc->own_storage;
+  }
+  enc->buf = buf;
+  enc->storage = size;
 }
 
 /*Encodes a symbol given its scaled frequency information.
@@ -442,26 +533,15 @@ void od_ec_enc_bits(od_ec_enc *enc, uint32_t fl, unsigned ftb) {
     unsigned char *buf;
     uint32_t storage;
     uint32_t end_offs;
-    buf = enc->buf;
-    storage = enc->storage;
     end_offs = enc->end_offs;
-    if (end_offs + (OD_EC_WINDOW_SIZE >> 3) >= storage) {
-      unsigned char *new_buf;
-      uint32_t new_storage;
-      new_storage = 2*storage + (OD_EC_WINDOW_SIZE >> 3);
-      new_buf = (unsigned char *)malloc(sizeof(*new_buf)*new_storage);
-      if (new_buf == NULL) {
-        enc->error = -1;
-        enc->end_offs = 0;
-        return;
-      }
-      OD_COPY(new_buf + new_storage - end_offs,
-       buf + storage - end_offs, end_offs);
-      storage = new_storage;
-      free(buf);
-      enc->buf = buf = new_buf;
-      enc->storage = storage;
+    if (enc->offs + end_offs + (OD_EC_WINDOW_SIZE >> 3) > enc->storage
+     && od_ec_enc_grow(enc,
+     enc->offs + end_offs + (OD_EC_WINDOW_SIZE >> 3)) < 0) {
+      enc->end_offs = 0;
+      return;
     }
+    buf = enc->buf;
+    storage = enc->storage;
     do {
       OD_ASSERT(end_offs < storage);
       buf[storage - ++end_offs] = (unsigned char)end_window;
@@ -500,10 +580,18 @@ void od_ec_enc_patch_initial_bits(od_ec_enc *enc, unsigned val, int nbits) {
   OD_ASSERT(val < 1U << nbits);
   shift = 8 - nbits;
   mask = ((1U << nbits) - 1) << shift;
-  if (enc->offs > 0) {
-    /*The first byte has been finalized.*/
-    enc->precarry_buf[0] =
-     (uint16_t)((enc->precarry_buf[0] & ~mask) | val << shift);
+  if (enc->offs > enc->ext + (enc->rem >= 0)) {
+    /*The first byte has been written to the buffer.*/
+    enc->buf[0] = (unsigned char)((enc->buf[0] & ~mask) | val << shift);
+  }
+  else if (enc->rem >= 0) {
+    /*The first byte is still pending.*/
+    enc->rem = (int)((enc->rem & ~mask) | val << shift);
+  }
+  else if (enc->ext > 0) {
+    /*The first byte is the first of a run of pending 0xFF bytes.*/
+    enc->rem = (int)((0xFF & ~mask) | val << shift);
+    enc->ext--;
   }
   else if (9 + enc->cnt + (enc->rng == 0x8000) > nbits) {
     /*The first byte has yet to be output.*/
@@ -527,10 +615,12 @@ void od_ec_enc_patch_initial_bits(od_ec_enc *enc, unsigned val, int nbits) {
 unsigned char *od_ec_enc_done(od_ec_enc *enc, uint32_t *nbytes) {
   unsigned char *out;
   uint32_t storage;
-  uint16_t *buf;
   uint32_t offs;
   uint32_t end_offs;
+  uint32_t ext;
+  int rem;
   int nend_bits;
+  int nfinal;
   od_ec_window m;
   od_ec_window e;
   od_ec_window l;
@@ -562,25 +652,31 @@ unsigned char *od_ec_enc_done(od_ec_enc *enc, uint32_t *nbytes) {
     e = (l + m) & ~m;
   }
   s += c;
+  /*Make sure there's enough room for the entropy-coded bits, the raw bits, and
+     a copy of the raw bits right after the entropy-coded ones that does not
+     overlap them.*/
+  nfinal = s > 0 ? (s + 7) >> 3 : 0;
+  nend_bits = enc->nend_bits;
+  end_offs = enc->end_offs
+   + OD_MAXI((nend_bits - (8*nfinal - s) + 7) >> 3, 0);
+  offs = enc->offs + nfinal;
+  if (offs + 2*end_offs > enc->storage
+   && od_ec_enc_grow(enc, offs + 2*end_offs) < 0) {
+    return NULL;
+  }
+  out = enc->buf;
+  storage = enc->storage;
+  /*Output the final bytes and resolve the pending ones.
+    This works on copies of offs, rem and ext, so that the encoder state is
+     left untouched.*/
   offs = enc->offs;
-  buf = enc->precarry_buf;
+  rem = enc->rem;
+  ext = enc->ext;
   if (s > 0) {
-    unsigned n;
-    storage = enc->precarry_storage;
-    if (offs + ((s + 7) >> 3) > storage) {
-      storage = storage*2 + ((s + 7) >> 3);
-      buf = (uint16_t *)realloc(buf, sizeof(*buf)*storage);
-      if (buf == NULL) {
-        enc->error = -1;
-        return NULL;
-      }
-      enc->precarry_buf = buf;
-      enc->precarry_storage = storage;
-    }
-    n = (1 << (c + 16)) - 1;
+    od_ec_window n;
+    n = ((od_ec_window)1 << (c + 16)) - 1;
     do {
-      OD_ASSERT(offs < storage);
-      buf[offs++] = (uint16_t)(e >> (c + 16));
+      od_ec_enc_carry_out(out, offs++, &rem, &ext, (unsigned)(e >> (c + 16)));
       e &= n;
       s -= 8;
       c -= 8;
@@ -588,27 +684,13 @@ unsigned char *od_ec_enc_done(od_ec_enc *enc, uint32_t *nbytes) {
     }
     while (s > 0);
   }
-  /*Make sure there's enough room for the entropy-coded bits and the raw
-     bits.*/
-  out = enc->buf;
-  storage = enc->storage;
+  /*Outputting one more byte without a carry writes out all the pending ones,
+     and nothing else.*/
+  od_ec_enc_carry_out(out, offs, &rem, &ext, 0);
+  /*If we have buffered raw bits, flush them as well.*/
   end_offs = enc->end_offs;
   e = enc->end_window;
-  nend_bits = enc->nend_bits;
   s = -s;
-  c = OD_MAXI((nend_bits - s + 7) >> 3, 0);
-  if (offs + end_offs + c > storage) {
-    storage = offs + end_offs + c;
-    out = (unsigned char *)realloc(out, sizeof(*out)*storage);
-    if (out == NULL) {
-      enc->error = -1;
-      return NULL;
-    }
-    OD_MOVE(out + storage - end_offs, out + enc->storage - end_offs, end_offs);
-    enc->buf = out;
-    enc->storage = storage;
-  }
-  /*If we have buffered raw bits, flush them as well.*/
   while (nend_bits > s) {
     OD_ASSERT(end_offs < storage);
     out[storage - ++end_offs] = (unsigned char)e;
@@ -616,26 +698,20 @@ unsigned char *od_ec_enc_done(od_ec_enc *enc, uint32_t *nbytes) {
     nend_bits -= 8;
   }
   *nbytes = offs + end_offs;
-  /*Perform carry propagation.*/
-  OD_ASSERT(offs + end_offs <= storage);
-  out = out + storage - (offs + end_offs);
-  c = 0;
-  end_offs = offs;
-  while (offs-- > 0) {
-    c = buf[offs] + c;
-    out[offs] = (unsigned char)c;
-    c >>= 8;
-  }
+  /*Copy the raw bits down after the entropy-coded bits.*/
+  OD_ASSERT(offs + 2*end_offs <= storage);
+  OD_COPY(out + offs, out + storage - end_offs, end_offs);
   /*Add any remaining raw bits to the last byte.
     There is guaranteed to be enough room, because nend_bits <= s.*/
-  OD_ASSERT(nend_bits <= 0 || end_offs > 0);
-  if (nend_bits > 0) out[end_offs - 1] |= (unsigned char)e;
+  OD_ASSERT(nend_bits <= 0 || offs > 0);
+  if (nend_bits > 0) out[offs - 1] |= (unsigned char)e;
   /*Note: Unless there's an allocation error, if you keep encoding into the
      current buffer and call this function again later, everything will work
      just fine (you won't get a new packet out, but you will get a single
      buffer with the new data appended to the old).
-    However, this function is O(N) where N is the amount of data coded so far,
-     so calling it more than once for a given packet is a bad idea.*/
+    The carries have already been resolved for all but a few pending bytes,
+     so this only takes time proportional to the number of bytes of raw bits,
+     not to the size of the packet.*/
   return out;
 }
 
@@ -684,17 +760,16 @@ void od_ec_enc_checkpoint(od_ec_enc *dst, const od_ec_enc *src) {
 void od_ec_enc_rollback(od_ec_enc *dst, const od_ec_enc *src) {
   unsigned char *buf;
   uint32_t storage;
-  uint16_t *precarry_buf;
-  uint32_t precarry_storage;
+  unsigned char *own_buf;
+  uint32_t own_storage;
   OD_ASSERT(dst->storage >= src->storage);
-  OD_ASSERT(dst->precarry_storage >= src->precarry_storage);
   buf = dst->buf;
   storage = dst->storage;
-  precarry_buf = dst->precarry_buf;
-  precarry_storage = dst->precarry_storage;
+  own_buf = dst->own_buf;
+  own_storage = dst->own_storage;
   OD_COPY(dst, src, 1);
   dst->buf = buf;
   dst->storage = storage;
-  dst->precarry_buf = precarry_buf;
-  dst->precarry_storage = precarry_storage;
+  dst->own_buf = own_buf;
+  dst->own_storage = own_storage;
 }
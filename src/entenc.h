@@ -33,23 +33,33 @@ typedef struct od_ec_enc od_ec_enc;
 /*The entropy encoder context.*/
 struct od_ec_enc {
   /*Buffered output.
-    This contains only the raw bits until the final call to od_ec_enc_done(),
-     where all the arithmetic-coded data gets prepended to it.*/
+    The arithmetic-coded bytes are written at the start as soon as no carry
+     can change them any more, and the raw bits at the end.
+    The final call to od_ec_enc_done() moves the raw bits down to join them.*/
   unsigned char *buf;
   /*The size of the buffer.*/
   uint32_t storage;
+  /*The encoder's own buffer.
+    buf points to it unless the current packet is being coded into an
+     external buffer (see od_ec_enc_set_buffer()).*/
+  unsigned char *own_buf;
+  /*The size of the encoder's own buffer.*/
+  uint32_t own_storage;
   /*The offset at which the last byte containing raw bits was written.*/
   uint32_t end_offs;
   /*Bits that will be read from/written at the end.*/
   od_ec_window end_window;
   /*Number of valid bits in end_window.*/
   int nend_bits;
-  /*A buffer for output bytes with their associated carry flags.*/
-  uint16_t *precarry_buf;
-  /*The size of the pre-carry buffer.*/
-  uint32_t precarry_storage;
-  /*The offset at which the next entropy-coded byte will be written.*/
+  /*The number of entropy-coded bytes output so far, including the ones that
+     are still pending in rem and ext.*/
   uint32_t offs;
+  /*The last output byte that a carry could still change, or -1 if there is
+     none.*/
+  int rem;
+  /*The number of 0xFF bytes output after rem, which a carry would turn into
+     0x00 bytes.*/
+  uint32_t ext;
   /*The low end of the current range.*/
   od_ec_window low;
   /*The number of values in the current range.*/
@@ -69,6 +79,8 @@ struct od_ec_enc {
 void od_ec_enc_init(od_ec_enc *enc, uint32_t size) OD_ARG_NONNULL(1);
 void od_ec_enc_reset(od_ec_enc *enc) OD_ARG_NONNULL(1);
 void od_ec_enc_clear(od_ec_enc *enc) OD_ARG_NONNULL(1);
+void od_ec_enc_set_buffer(od_ec_enc *enc, unsigned char *buf, uint32_t size)
+ OD_ARG_NONNULL(1);
 
 void od_ec_encode_bool(od_ec_enc *enc, int val, unsigned fz, unsigned _ft)
  OD_ARG_NONNULL(1);
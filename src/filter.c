@@ -1351,7 +1351,7 @@ void od_post_filter32(od_coeff _x[32], const od_coeff _y[32]) {
    adapted for use in Daala. See draft-fuldseth-netvc-thor-00 or the Thor
    codebase for more details. */
 
-int beta_table[52] = {
+static const int beta_table[52] = {
      0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
      16, 17, 18, 20, 22, 24, 26, 28, 30, 32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62, 64
 };
@@ -1526,31 +1526,57 @@ void od_postfilter_split(od_coeff *c0, int stride, int bs, int f, int q,
 #endif
 }
 
-void od_apply_prefilter_frame_sbs(od_coeff *c0, int stride, int nhsb, int nvsb,
- int xdec, int ydec) {
+/*Applies the prefilter across the horizontal edge at the top of superblock
+   row sby (which must be at least 1).*/
+void od_apply_prefilter_sb_row_edge(od_coeff *c0, int stride, int nhsb,
+ int sby, int xdec, int ydec) {
 #if OD_DEBLOCKING
+  OD_UNUSED(c0);
+  OD_UNUSED(stride);
+  OD_UNUSED(nhsb);
+  OD_UNUSED(sby);
+  OD_UNUSED(xdec);
+  OD_UNUSED(ydec);
 #else
-  int sbx;
-  int sby;
-  int i;
   int j;
   int f;
   od_coeff *c;
+  OD_ASSERT(sby > 0);
   f = OD_FILT_SIZE(OD_NBSIZES - 1, xdec);
-  c = c0 + ((OD_BSIZE_MAX >> ydec) - (2 << f))*stride;
-  for (sby = 1; sby < nvsb; sby++) {
-    for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j++) {
-      int k;
-      od_coeff t[4 << OD_NBSIZES];
-      for (k = 0; k < 4 << f; k++) t[k] = c[stride*k + j];
-      (*OD_PRE_FILTER[f])(t, t);
-      for (k = 0; k < 4 << f; k++) c[stride*k + j] = t[k];
-    }
-    c += OD_BSIZE_MAX*stride >> ydec;
+  c = c0 + ((sby << OD_LOG_BSIZE_MAX >> ydec) - (2 << f))*stride;
+  for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j++) {
+    int k;
+    od_coeff t[4 << OD_NBSIZES];
+    for (k = 0; k < 4 << f; k++) t[k] = c[stride*k + j];
+    (*OD_PRE_FILTER[f])(t, t);
+    for (k = 0; k < 4 << f; k++) c[stride*k + j] = t[k];
   }
-  c = c0 + (OD_BSIZE_MAX >> ydec) - (2 << f);
+#endif
+}
+
+/*Applies the prefilter across the vertical superblock edges within superblock
+   row sby.
+  The horizontal edges at the top and bottom of the row must already have been
+   filtered.*/
+void od_apply_prefilter_sb_row_cols(od_coeff *c0, int stride, int nhsb,
+ int sby, int xdec, int ydec) {
+#if OD_DEBLOCKING
+  OD_UNUSED(c0);
+  OD_UNUSED(stride);
+  OD_UNUSED(nhsb);
+  OD_UNUSED(sby);
+  OD_UNUSED(xdec);
+  OD_UNUSED(ydec);
+#else
+  int sbx;
+  int i;
+  int f;
+  od_coeff *c;
+  f = OD_FILT_SIZE(OD_NBSIZES - 1, xdec);
+  c = c0 + (sby << OD_LOG_BSIZE_MAX >> ydec)*stride
+   + (OD_BSIZE_MAX >> xdec) - (2 << f);
   for (sbx = 1; sbx < nhsb; sbx++) {
-    for (i = 0; i < nvsb << OD_LOG_BSIZE_MAX >> ydec; i++) {
+    for (i = 0; i < OD_BSIZE_MAX >> ydec; i++) {
       (*OD_PRE_FILTER[f])(c + i*stride, c + i*stride);
     }
     c += OD_BSIZE_MAX >> xdec;
@@ -1558,16 +1584,30 @@ void od_apply_prefilter_frame_sbs(od_coeff *c0, int stride, int nhsb, int nvsb,
 #endif
 }
 
-void od_apply_postfilter_frame_sbs(od_coeff *c0, int stride, int nhsb,
- int nvsb, int xdec, int ydec, int q, unsigned char *skip, int skip_stride) {
+void od_apply_prefilter_frame_sbs(od_coeff *c0, int stride, int nhsb, int nvsb,
+ int xdec, int ydec) {
+  int sby;
+  for (sby = 1; sby < nvsb; sby++) {
+    od_apply_prefilter_sb_row_edge(c0, stride, nhsb, sby, xdec, ydec);
+  }
+  for (sby = 0; sby < nvsb; sby++) {
+    od_apply_prefilter_sb_row_cols(c0, stride, nhsb, sby, xdec, ydec);
+  }
+}
+
+/*Applies the postfilter across the vertical superblock edges within
+   superblock row sby.*/
+void od_apply_postfilter_sb_row_cols(od_coeff *c0, int stride, int nhsb,
+ int sby, int xdec, int ydec, int q, unsigned char *skip, int skip_stride) {
 #if OD_DEBLOCKING
   od_coeff *c;
   int sbx;
-  int sby;
+  int i0;
+  i0 = sby << OD_LOG_BSIZE_MAX >> ydec;
   c = c0 + (OD_BSIZE_MAX >> ydec);
   for (sbx = 1; sbx < nhsb; sbx++) {
     int i;
-    for (i = 0; i < nvsb << OD_LOG_BSIZE_MAX >> ydec; i+=8) {
+    for (i = i0; i < i0 + (OD_BSIZE_MAX >> ydec); i += 8) {
       if (!skip[(i >> 2)*skip_stride + (sbx << 3 >> xdec) - 1]
        || !skip[(i >> 2)*skip_stride + (sbx << 3 >> xdec)]) {
         od_thor_deblock_col8(c + i*stride, stride, q);
@@ -1575,49 +1615,75 @@ void od_apply_postfilter_frame_sbs(od_coeff *c0, int stride, int nhsb,
     }
     c += OD_BSIZE_MAX >> xdec;
   }
-  c = c0 + (OD_BSIZE_MAX >> ydec)*stride;
-  for (sby = 1; sby < nvsb; sby++) {
-    int j;
-    for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j+=8) {
-      if (!skip[((sby << 3 >> xdec) - 1)*skip_stride + (j >> 2)]
-       || !skip[(sby << 3 >> xdec)*skip_stride + (j >> 2)]) {
-        od_thor_deblock_row8(c + j, stride, q);
-      }
-    }
-    c += OD_BSIZE_MAX*stride >> ydec;
-  }
 #else
   int sbx;
-  int sby;
   int i;
-  int j;
   int f;
   od_coeff *c;
   OD_UNUSED(q);
   OD_UNUSED(skip);
   OD_UNUSED(skip_stride);
   f = OD_FILT_SIZE(OD_NBSIZES - 1, xdec);
-  c = c0 + (OD_BSIZE_MAX >> ydec) - (2 << f);
+  c = c0 + (sby << OD_LOG_BSIZE_MAX >> ydec)*stride
+   + (OD_BSIZE_MAX >> xdec) - (2 << f);
   for (sbx = 1; sbx < nhsb; sbx++) {
-    for (i = 0; i < nvsb << OD_LOG_BSIZE_MAX >> ydec; i++) {
+    for (i = 0; i < OD_BSIZE_MAX >> ydec; i++) {
       (*OD_POST_FILTER[f])(c + i*stride, c + i*stride);
     }
     c += OD_BSIZE_MAX >> xdec;
   }
-  c = c0 + ((OD_BSIZE_MAX >> ydec) - (2 << f))*stride;
-  for (sby = 1; sby < nvsb; sby++) {
-    for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j++) {
-      int k;
-      od_coeff t[4 << OD_NBSIZES];
-      for (k = 0; k < 4 << f; k++) t[k] = c[stride*k + j];
-      (*OD_POST_FILTER[f])(t, t);
-      for (k = 0; k < 4 << f; k++) c[stride*k + j] = t[k];
+#endif
+}
+
+/*Applies the postfilter across the horizontal edge at the top of superblock
+   row sby (which must be at least 1).
+  The vertical edges of both adjacent rows must already have been filtered.*/
+void od_apply_postfilter_sb_row_edge(od_coeff *c0, int stride, int nhsb,
+ int sby, int xdec, int ydec, int q, unsigned char *skip, int skip_stride) {
+#if OD_DEBLOCKING
+  od_coeff *c;
+  int j;
+  OD_ASSERT(sby > 0);
+  c = c0 + (sby << OD_LOG_BSIZE_MAX >> ydec)*stride;
+  for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j += 8) {
+    if (!skip[((sby << 3 >> xdec) - 1)*skip_stride + (j >> 2)]
+     || !skip[(sby << 3 >> xdec)*skip_stride + (j >> 2)]) {
+      od_thor_deblock_row8(c + j, stride, q);
     }
-    c += OD_BSIZE_MAX*stride >> ydec;
+  }
+#else
+  int j;
+  int f;
+  od_coeff *c;
+  OD_UNUSED(q);
+  OD_UNUSED(skip);
+  OD_UNUSED(skip_stride);
+  OD_ASSERT(sby > 0);
+  f = OD_FILT_SIZE(OD_NBSIZES - 1, xdec);
+  c = c0 + ((sby << OD_LOG_BSIZE_MAX >> ydec) - (2 << f))*stride;
+  for (j = 0; j < nhsb << OD_LOG_BSIZE_MAX >> xdec; j++) {
+    int k;
+    od_coeff t[4 << OD_NBSIZES];
+    for (k = 0; k < 4 << f; k++) t[k] = c[stride*k + j];
+    (*OD_POST_FILTER[f])(t, t);
+    for (k = 0; k < 4 << f; k++) c[stride*k + j] = t[k];
   }
 #endif
 }
 
+void od_apply_postfilter_frame_sbs(od_coeff *c0, int stride, int nhsb,
+ int nvsb, int xdec, int ydec, int q, unsigned char *skip, int skip_stride) {
+  int sby;
+  for (sby = 0; sby < nvsb; sby++) {
+    od_apply_postfilter_sb_row_cols(c0, stride, nhsb, sby, xdec, ydec, q,
+     skip, skip_stride);
+  }
+  for (sby = 1; sby < nvsb; sby++) {
+    od_apply_postfilter_sb_row_edge(c0, stride, nhsb, sby, xdec, ydec, q,
+     skip, skip_stride);
+  }
+}
+
 
 
 #if defined(TEST)
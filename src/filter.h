@@ -81,8 +81,16 @@ void od_prefilter_split(od_coeff *c0, int stride, int bs, int f, int hfilter,
  int vfilter);
 void od_postfilter_split(od_coeff *c0, int stride, int bs, int f, int q,
  unsigned char *skip, int skip_stride, int hfilter, int vfilter);
+void od_apply_prefilter_sb_row_edge(od_coeff *c, int stride, int nhsb,
+ int sby, int xdec, int ydec);
+void od_apply_prefilter_sb_row_cols(od_coeff *c, int stride, int nhsb,
+ int sby, int xdec, int ydec);
 void od_apply_prefilter_frame_sbs(od_coeff *c, int stride, int nhsb, int nvsb,
  int xdec, int ydec);
+void od_apply_postfilter_sb_row_cols(od_coeff *c, int stride, int nhsb,
+ int sby, int xdec, int ydec, int q, unsigned char *skip, int skip_stride);
+void od_apply_postfilter_sb_row_edge(od_coeff *c, int stride, int nhsb,
+ int sby, int xdec, int ydec, int q, unsigned char *skip, int skip_stride);
 void od_apply_postfilter_frame_sbs(od_coeff *c, int stride, int nhsb, int nvsb,
  int xdec, int ydec, int q, unsigned char *skip, int skip_stride);
 void od_apply_filter_sb_rows(od_coeff *c, int stride, int nhsb, int nvsb,
@@ -27,6 +27,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #endif
 
 #include "generic_code.h"
+#if defined(OD_SSE2_BASELINE)
+# include <emmintrin.h>
+#endif
 
 void od_cdf_init(uint16_t *cdf, int ncdfs, int nsyms, int val, int first) {
   int i;
@@ -38,34 +41,151 @@ void od_cdf_init(uint16_t *cdf, int ncdfs, int nsyms, int val, int first) {
   }
 }
 
+#if defined(OD_SSE2_BASELINE)
+/*The kernels below update a CDF of 8 to 16 entries with two overlapping
+   8-entry vectors, the first starting at entry 0 and the second ending at
+   entry n - 1, so that they never touch memory past the end of the CDF.
+  Each entry is updated independently, so the entries covered by both vectors
+   get the same value from either one, and storing both is safe.
+  od_cdf_adapt() does the same with two 4-entry halves for 4 to 7 entries.*/
+
+/*Returns the indices of the entries in the second vector, which ends at
+   entry n - 1 and has w entries.*/
+static __m128i od_cdf_hi_idx_sse2(__m128i idx, int n, int w) {
+  return _mm_add_epi16(idx, _mm_set1_epi16((short)(n - w)));
+}
+
+/*Adapts the entries with indices idx in cdfv.*/
+static __m128i od_cdf_adapt_vec_sse2(__m128i cdfv, __m128i idx, int halve,
+ __m128i valv, __m128i incv) {
+  if (halve) {
+    cdfv = _mm_add_epi16(_mm_srli_epi16(cdfv, 1),
+     _mm_add_epi16(idx, _mm_set1_epi16(1)));
+  }
+  return _mm_add_epi16(cdfv, _mm_and_si128(_mm_cmpgt_epi16(idx, valv), incv));
+}
+
+static void od_cdf_adapt_sse2(int val, uint16_t *cdf, int n, int increment) {
+  __m128i idx0;
+  __m128i valv;
+  __m128i incv;
+  int halve;
+  idx0 = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  halve = cdf[n - 1] + increment > 32767;
+  valv = _mm_set1_epi16((short)(val - 1));
+  incv = _mm_set1_epi16((short)increment);
+  if (n >= 8) {
+    __m128i cdf0;
+    __m128i cdf1;
+    cdf0 = od_cdf_adapt_vec_sse2(_mm_loadu_si128((__m128i *)cdf), idx0,
+     halve, valv, incv);
+    cdf1 = od_cdf_adapt_vec_sse2(_mm_loadu_si128((__m128i *)(cdf + n - 8)),
+     od_cdf_hi_idx_sse2(idx0, n, 8), halve, valv, incv);
+    _mm_storeu_si128((__m128i *)(cdf + n - 8), cdf1);
+    _mm_storeu_si128((__m128i *)cdf, cdf0);
+  }
+  else {
+    __m128i cdf0;
+    __m128i cdf1;
+    OD_ASSERT(n >= 4);
+    cdf0 = od_cdf_adapt_vec_sse2(_mm_loadl_epi64((__m128i *)cdf), idx0,
+     halve, valv, incv);
+    cdf1 = od_cdf_adapt_vec_sse2(_mm_loadl_epi64((__m128i *)(cdf + n - 4)),
+     od_cdf_hi_idx_sse2(idx0, n, 4), halve, valv, incv);
+    _mm_storel_epi64((__m128i *)(cdf + n - 4), cdf1);
+    _mm_storel_epi64((__m128i *)cdf, cdf0);
+  }
+}
+
+/*Applies the steady-state Q15 update to 4 entries widened to 32 bits, given
+   the low and high offsets from od_cdf_adapt_q15() broadcast into lov and
+   hiv.*/
+static __m128i od_cdf_adapt_q15_4_sse2(__m128i cdf, __m128i idx, __m128i valv,
+ __m128i lov, __m128i hiv, __m128i ratev) {
+  __m128i tmp;
+  tmp = _mm_add_epi32(_mm_add_epi32(lov, idx),
+   _mm_and_si128(_mm_cmpgt_epi32(idx, valv), hiv));
+  return _mm_sub_epi32(cdf, _mm_sra_epi32(_mm_sub_epi32(cdf, tmp), ratev));
+}
+
+/*Applies the steady-state Q15 update to 8 entries with indices idx.*/
+static __m128i od_cdf_adapt_q15_8_sse2(__m128i cdf, __m128i idx, __m128i valv,
+ __m128i lov, __m128i hiv, __m128i ratev) {
+  __m128i zero;
+  __m128i lo;
+  __m128i hi;
+  zero = _mm_setzero_si128();
+  lo = od_cdf_adapt_q15_4_sse2(_mm_unpacklo_epi16(cdf, zero),
+   _mm_unpacklo_epi16(idx, zero), valv, lov, hiv, ratev);
+  hi = od_cdf_adapt_q15_4_sse2(_mm_unpackhi_epi16(cdf, zero),
+   _mm_unpackhi_epi16(idx, zero), valv, lov, hiv, ratev);
+  /*Keep the low 16 bits of each result, like the store to a uint16_t does,
+     by sign-extending them before the saturating pack.*/
+  lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+  hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+  return _mm_packs_epi32(lo, hi);
+}
+
+static void od_cdf_adapt_q15_sse2(int val, uint16_t *cdf, int n, int lo_off,
+ int hi_off, int rate) {
+  __m128i idx0;
+  __m128i idx1;
+  __m128i valv;
+  __m128i lov;
+  __m128i hiv;
+  __m128i ratev;
+  __m128i cdf0;
+  __m128i cdf1;
+  idx0 = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  idx1 = od_cdf_hi_idx_sse2(idx0, n, 8);
+  valv = _mm_set1_epi32(val - 1);
+  lov = _mm_set1_epi32(lo_off);
+  hiv = _mm_set1_epi32(hi_off);
+  ratev = _mm_cvtsi32_si128(rate);
+  cdf0 = od_cdf_adapt_q15_8_sse2(_mm_loadu_si128((__m128i *)cdf), idx0,
+   valv, lov, hiv, ratev);
+  cdf1 = od_cdf_adapt_q15_8_sse2(_mm_loadu_si128((__m128i *)(cdf + n - 8)),
+   idx1, valv, lov, hiv, ratev);
+  _mm_storeu_si128((__m128i *)(cdf + n - 8), cdf1);
+  _mm_storeu_si128((__m128i *)cdf, cdf0);
+}
+#endif
+
 /** Adapts a Q15 cdf after encoding/decoding a symbol. */
 void od_cdf_adapt_q15(int val, uint16_t *cdf, int n, int *count, int rate) {
   int i;
   *count = OD_MINI(*count + 1, 1 << rate);
   OD_ASSERT(cdf[n - 1] == 32768);
   if (*count >= 1 << rate) {
-    /* Steady-state adaptation based on a simple IIR with dyadic rate. */
+    int lo_off;
+    int hi_off;
+    /* Steady-state adaptation based on a simple IIR with dyadic rate.
+       When (i < val), we want the adjustment ((cdf[i] - tmp) >> rate) to be
+       positive so long as (cdf[i] > i + 1), and 0 when (cdf[i] == i + 1),
+       to ensure we don't drive any probabilities to 0. Replacing cdf[i] with
+       (i + 2) and solving ((i + 2 - tmp) >> rate == 1) for tmp produces
+       tmp == i + 2 - (1 << rate). Using this value of tmp with
+       cdf[i] == i + 1 instead gives an adjustment of 0 as desired.
+
+       When (i >= val), we want ((cdf[i] - tmp) >> rate) to be negative so
+       long as cdf[i] < 32768 - (n - 1 - i), and 0 when
+       cdf[i] == 32768 - (n - 1 - i), again to ensure we don't drive any
+       probabilities to 0. Since right-shifting any negative value is still
+       negative, we can solve (32768 - (n - 1 - i) - tmp == 0) for tmp,
+       producing tmp = 32769 - n + i. Using this value of tmp with smaller
+       values of cdf[i] instead gives negative adjustments, as desired.
+
+       Combining the two cases gives tmp = lo_off + i + (i >= val)*hi_off,
+       where the two offsets only depend on n and rate. */
+    lo_off = 2 - (1 << rate);
+    hi_off = 32767 + (1 << rate) - n;
+#if defined(OD_SSE2_BASELINE)
+    if (n >= 8) od_cdf_adapt_q15_sse2(val, cdf, n, lo_off, hi_off, rate);
+    else
+#endif
     for (i = 0; i < n; i++) {
       int tmp;
-      /* When (i < val), we want the adjustment ((cdf[i] - tmp) >> rate) to be
-         positive so long as (cdf[i] > i + 1), and 0 when (cdf[i] == i + 1),
-         to ensure we don't drive any probabilities to 0. Replacing cdf[i] with
-         (i + 2) and solving ((i + 2 - tmp) >> rate == 1) for tmp produces
-         tmp == i + 2 - (1 << rate). Using this value of tmp with
-         cdf[i] == i + 1 instead gives an adjustment of 0 as desired.
-
-         When (i >= val), we want ((cdf[i] - tmp) >> rate) to be negative so
-         long as cdf[i] < 32768 - (n - 1 - i), and 0 when
-         cdf[i] == 32768 - (n - 1 - i), again to ensure we don't drive any
-         probabilities to 0. Since right-shifting any negative value is still
-         negative, we can solve (32768 - (n - 1 - i) - tmp == 0) for tmp,
-         producing tmp = 32769 - n + i. Using this value of tmp with smaller
-         values of cdf[i] instead gives negative adjustments, as desired.
-
-         Combining the two cases gives the expression below. These could be
-         stored in a lookup table indexed by n and rate to avoid the
-         arithmetic. */
-      tmp = 2 - (1<<rate) + i + (32767 + (1<<rate) - n)*(i >= val);
+      tmp = lo_off + i + hi_off*(i >= val);
       cdf[i] -= (cdf[i] - tmp) >> rate;
     }
   }
@@ -84,6 +204,31 @@ void od_cdf_adapt_q15(int val, uint16_t *cdf, int n, int *count, int rate) {
   OD_ASSERT(cdf[n - 1] == 32768);
 }
 
+/** Adapts a cdf of frequency counts after encoding/decoding a symbol.
+ *
+ * @param [in]     val       value that was encoded/decoded
+ * @param [in,out] cdf       CDF of the variable (unscaled counts)
+ * @param [in]     n         number of values possible (at most 16)
+ * @param [in]     increment adaptation speed (Q15)
+ */
+void od_cdf_adapt(int val, uint16_t *cdf, int n, int increment) {
+  int i;
+#if defined(OD_SSE2_BASELINE)
+  if (n >= 4) {
+    od_cdf_adapt_sse2(val, cdf, n, increment);
+    return;
+  }
+#endif
+  if (cdf[n - 1] + increment > 32767) {
+    for (i = 0; i < n; i++) {
+      /* Second term ensures that the pdf is non-null */
+      cdf[i] = (cdf[i] >> 1) + i + 1;
+    }
+  }
+  /*Updating every entry avoids a branch that depends on val.*/
+  for (i = 0; i < n; i++) cdf[i] += increment*(i >= val);
+}
+
 /** Initializes the cdfs and freq counts for a model.
  *
  * @param [out] model model being initialized
@@ -135,21 +280,12 @@ int log_ex(int ex_q16) {
  */
 void generic_model_update(generic_encoder *model, int *ex_q16, int x, int xs,
  int id, int integration) {
-  int i;
   int xenc;
   uint16_t *cdf;
   cdf = model->cdf[id];
-  /* Renormalize if we cannot add increment */
-  if (cdf[15] + model->increment > 32767) {
-    for (i = 0; i < 16; i++) {
-      /* Second term ensures that the pdf is non-null */
-      cdf[i] = (cdf[i] >> 1) + i + 1;
-    }
-  }
-  /* Update freq count */
+  /* Update freq count, renormalizing if we cannot add increment */
   xenc = OD_MINI(15, xs);
-  /* This can be easily vectorized */
-  for (i = xenc; i < 16; i++) cdf[i] += model->increment;
+  od_cdf_adapt(xenc, cdf, 16, model->increment);
   /* We could have saturated ExQ16 directly, but this is safe and simpler */
   x = OD_MINI(x, 32767);
   OD_IIR_DIADIC(*ex_q16, x << 16, integration);
@@ -31,13 +31,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 # define GENERIC_TABLES 12
 
 #if OD_ACCOUNTING
-# define generic_decode(dec, model, max, ex_q16, integration, str) generic_decode_(dec, model, max, ex_q16, integration, str)
-# define od_decode_cdf_adapt_q15(ec, cdf, n, count, rate, str) od_decode_cdf_adapt_q15_(ec, cdf, n, count, rate, str)
-# define od_decode_cdf_adapt(ec, cdf, n, increment, str) od_decode_cdf_adapt_(ec, cdf, n, increment, str)
+# define generic_decode(dec, model, max, ex_q16, integration, acc_id) generic_decode_(dec, model, max, ex_q16, integration, acc_id)
+# define od_decode_cdf_adapt_q15(ec, cdf, n, count, rate, acc_id) od_decode_cdf_adapt_q15_(ec, cdf, n, count, rate, acc_id)
+# define od_decode_cdf_adapt(ec, cdf, n, increment, acc_id) od_decode_cdf_adapt_(ec, cdf, n, increment, acc_id)
 #else
-# define generic_decode(dec, model, max, ex_q16, integration, str) generic_decode_(dec, model, max, ex_q16, integration)
-# define od_decode_cdf_adapt_q15(ec, cdf, n, count, rate, str) od_decode_cdf_adapt_q15_(ec, cdf, n, count, rate)
-# define od_decode_cdf_adapt(ec, cdf, n, increment, str) od_decode_cdf_adapt_(ec, cdf, n, increment)
+# define generic_decode(dec, model, max, ex_q16, integration, acc_id) generic_decode_(dec, model, max, ex_q16, integration)
+# define od_decode_cdf_adapt_q15(ec, cdf, n, count, rate, acc_id) od_decode_cdf_adapt_q15_(ec, cdf, n, count, rate)
+# define od_decode_cdf_adapt(ec, cdf, n, increment, acc_id) od_decode_cdf_adapt_(ec, cdf, n, increment)
 #endif
 
 typedef struct {
@@ -67,6 +67,8 @@ void od_cdf_init(uint16_t *cdf, int ncdfs, int nsyms, int val, int first);
 
 void od_cdf_adapt_q15(int val, uint16_t *cdf, int n, int *count, int rate);
 
+void od_cdf_adapt(int val, uint16_t *cdf, int n, int increment);
+
 void od_encode_cdf_adapt_q15(od_ec_enc *ec, int val, uint16_t *cdf, int n,
  int *count, int rate);
 
@@ -74,7 +76,7 @@ void od_encode_cdf_adapt(od_ec_enc *ec, int val, uint16_t *cdf, int n,
  int increment);
 
 int od_decode_cdf_adapt_(od_ec_dec *ec, uint16_t *cdf, int n,
- int increment OD_ACC_STR);
+ int increment OD_ACC_ID);
 
 void generic_encode(od_ec_enc *enc, generic_encoder *model, int x, int max,
  int *ex_q16, int integration);
@@ -84,10 +86,10 @@ double generic_encode_cost(generic_encoder *model, int x, int max,
 double od_encode_cdf_cost(int val, uint16_t *cdf, int n);
 
 int od_decode_cdf_adapt_q15_(od_ec_dec *ec, uint16_t *cdf, int n,
- int *count, int rate OD_ACC_STR);
+ int *count, int rate OD_ACC_ID);
 
 int generic_decode_(od_ec_dec *dec, generic_encoder *model, int max,
- int *ex_q16, int integration OD_ACC_STR);
+ int *ex_q16, int integration OD_ACC_ID);
 
 int log_ex(int ex_q16);
 
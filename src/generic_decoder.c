@@ -45,7 +45,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
  * @return decoded variable
  */
 int od_decode_cdf_adapt_q15_(od_ec_dec *ec, uint16_t *cdf, int n,
- int *count, int rate OD_ACC_STR) {
+ int *count, int rate OD_ACC_ID) {
   int val;
   int i;
   if (*count == 0) {
@@ -55,7 +55,7 @@ int od_decode_cdf_adapt_q15_(od_ec_dec *ec, uint16_t *cdf, int n,
       cdf[i] = cdf[i]*32768/ft;
     }
   }
-  val = od_ec_decode_cdf_q15(ec, cdf, n, acc_str);
+  val = od_ec_decode_cdf_q15(ec, cdf, n, acc_id);
   od_cdf_adapt_q15(val, cdf, n, count, rate);
   return val;
 }
@@ -71,17 +71,10 @@ int od_decode_cdf_adapt_q15_(od_ec_dec *ec, uint16_t *cdf, int n,
  * @retval decoded variable
  */
 int od_decode_cdf_adapt_(od_ec_dec *ec, uint16_t *cdf, int n,
- int increment OD_ACC_STR) {
-  int i;
+ int increment OD_ACC_ID) {
   int val;
-  val = od_ec_decode_cdf_unscaled(ec, cdf, n, acc_str);
-  if (cdf[n-1] + increment > 32767) {
-    for (i = 0; i < n; i++) {
-      /* Second term ensures that the pdf is non-null */
-      cdf[i] = (cdf[i] >> 1) + i + 1;
-    }
-  }
-  for (i = val; i < n; i++) cdf[i] += increment;
+  val = od_ec_decode_cdf_unscaled(ec, cdf, n, acc_id);
+  od_cdf_adapt(val, cdf, n, increment);
   return val;
 }
 
@@ -99,7 +92,7 @@ int od_decode_cdf_adapt_(od_ec_dec *ec, uint16_t *cdf, int n,
  * @retval decoded variable x
  */
 int generic_decode_(od_ec_dec *dec, generic_encoder *model, int max,
- int *ex_q16, int integration OD_ACC_STR) {
+ int *ex_q16, int integration OD_ACC_ID) {
   int lg_q1;
   int shift;
   int id;
@@ -119,8 +112,8 @@ int generic_decode_(od_ec_dec *dec, generic_encoder *model, int max,
   id = OD_MINI(GENERIC_TABLES - 1, lg_q1);
   cdf = model->cdf[id];
   ms = (max + (1 << shift >> 1)) >> shift;
-  if (max == -1) xs = od_ec_decode_cdf_unscaled(dec, cdf, 16, acc_str);
-  else xs = od_ec_decode_cdf_unscaled(dec, cdf, OD_MINI(ms + 1, 16), acc_str);
+  if (max == -1) xs = od_ec_decode_cdf_unscaled(dec, cdf, 16, acc_id);
+  else xs = od_ec_decode_cdf_unscaled(dec, cdf, OD_MINI(ms + 1, 16), acc_id);
   if (xs == 15) {
     int e;
     unsigned decay;
@@ -131,14 +124,14 @@ int generic_decode_(od_ec_dec *dec, generic_encoder *model, int max,
     OD_ASSERT(*ex_q16 < INT_MAX >> 1);
     e = ((2**ex_q16 >> 8) + (1 << shift >> 1)) >> shift;
     decay = OD_MAXI(2, OD_MINI(254, 256*e/(e + 256)));
-    xs += laplace_decode_special(dec, decay, (max == -1) ? -1 : ms - 15, acc_str);
+    xs += laplace_decode_special(dec, decay, (max == -1) ? -1 : ms - 15, acc_id);
   }
   if (shift != 0) {
     int special;
     /* Because of the rounding, there's only half the number of possibilities
        for xs=0 */
     special = xs == 0;
-    if (shift - special > 0) lsb = od_ec_dec_bits(dec, shift - special, acc_str);
+    if (shift - special > 0) lsb = od_ec_dec_bits(dec, shift - special, acc_id);
     lsb -= !special << (shift - 1);
   }
   x = (xs << shift) + lsb;
@@ -73,15 +73,8 @@ void od_encode_cdf_adapt_q15(od_ec_enc *ec, int val, uint16_t *cdf, int n,
  */
 void od_encode_cdf_adapt(od_ec_enc *ec, int val, uint16_t *cdf, int n,
  int increment) {
-  int i;
   od_ec_encode_cdf_unscaled(ec, val, cdf, n);
-  if (cdf[n-1] + increment > 32767) {
-    for (i = 0; i < n; i++) {
-      /* Second term ensures that the pdf is non-null */
-      cdf[i] = (cdf[i] >> 1) + i + 1;
-    }
-  }
-  for (i = val; i < n; i++) cdf[i] += increment;
+  od_cdf_adapt(val, cdf, n, increment);
 }
 
 /** Encodes a random variable using a "generic" model, assuming that the
@@ -33,7 +33,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 void daala_info_init(daala_info *_info) {
   OD_CLEAR(_info, 1);
   _info->version_major = OD_VERSION_MAJOR;
-  _info->version_minor = OD_VERSION_MINOR;
+  /*Newer stream versions are opt-in until they are known to be better.*/
+  _info->version_minor = OD_STREAM_VERSION_MINOR_BASE;
   _info->version_sub = OD_VERSION_SUB;
   _info->keyframe_granule_shift = 31;
   _info->bitdepth_mode = OD_BITDEPTH_MODE_8;
@@ -30,6 +30,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <stdlib.h>
 #include <string.h>
 #include "internal.h"
+#if defined(_MSC_VER)
+# include <intrin.h>
+# pragma intrinsic(_InterlockedCompareExchange)
+# pragma intrinsic(_InterlockedExchange)
+#endif
 
 /*Constants for use with OD_DIVU_SMALL().
   See \cite{Rob05} for details on computing these constants.
@@ -43,7 +48,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
     month=Jun,
     year=2005
   }*/
-uint32_t OD_DIVU_SMALL_CONSTS[OD_DIVU_DMAX][2] = {
+const uint32_t OD_DIVU_SMALL_CONSTS[OD_DIVU_DMAX][2] = {
   {0xFFFFFFFF,0xFFFFFFFF}, {0xFFFFFFFF,0xFFFFFFFF}, {0xAAAAAAAB,         0},
   {0xFFFFFFFF,0xFFFFFFFF}, {0xCCCCCCCD,         0}, {0xAAAAAAAB,         0},
   {0x92492492,0x92492492}, {0xFFFFFFFF,0xFFFFFFFF}, {0xE38E38E4,         0},
@@ -483,6 +488,21 @@ void od_zero_2d(void **buf, size_t height, size_t width, size_t sz) {
   }
 }
 
+/*Points the row pointers of a 2D array from od_malloc_2d() or od_calloc_2d()
+   at consecutive rows of the given width, which must not be larger than the
+   one it was allocated with, as though it had been allocated with that size.
+  height must not be larger than the allocated height either.*/
+void od_relayout_2d(void **buf, size_t height, size_t width, size_t sz) {
+  if (buf != NULL) {
+    char *datptr;
+    size_t rowsz;
+    size_t i;
+    rowsz = sz*width;
+    datptr = (char *)buf[0];
+    for (i = 0; i < height; i++, datptr += rowsz) buf[i] = (void *)datptr;
+  }
+}
+
 void od_free_2d(void *_ptr) {
   free(_ptr);
 }
@@ -666,3 +686,47 @@ int daala_packet_isheader(daala_packet *dpkt) {
 int daala_packet_iskeyframe(daala_packet *dpkt) {
   return dpkt->bytes > 0 ? dpkt->packet[0] & 0x40 : 0;
 }
+
+/*The states of an od_once_flag.*/
+#define OD_ONCE_UNINIT (0)
+#define OD_ONCE_BUSY (1)
+#define OD_ONCE_DONE (2)
+
+#if defined(_MSC_VER)
+# define OD_ONCE_CAS(flag, expected, desired) \
+  (_InterlockedCompareExchange((flag), (desired), (expected)) == (expected))
+/*Interlocked operations are full barriers.*/
+# define OD_ONCE_LOAD(flag) (_InterlockedCompareExchange((flag), 0, 0))
+# define OD_ONCE_STORE(flag, val) ((void)_InterlockedExchange((flag), (val)))
+#elif OD_GNUC_PREREQ(4, 7, 0) || defined(__clang__)
+# define OD_ONCE_CAS(flag, expected, desired) \
+  (od_once_cas((flag), (expected), (desired)))
+# define OD_ONCE_LOAD(flag) (__atomic_load_n((flag), __ATOMIC_ACQUIRE))
+# define OD_ONCE_STORE(flag, val) \
+  (__atomic_store_n((flag), (val), __ATOMIC_RELEASE))
+
+static int od_once_cas(volatile od_once_flag *flag, od_once_flag expected,
+ od_once_flag desired) {
+  return __atomic_compare_exchange_n(flag, &expected, desired, 0,
+   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#else
+# define OD_ONCE_CAS(flag, expected, desired) \
+  (*(flag) == (expected) ? (*(flag) = (desired), 1) : 0)
+# define OD_ONCE_LOAD(flag) (*(flag))
+# define OD_ONCE_STORE(flag, val) ((void)(*(flag) = (val)))
+#endif
+
+int od_once_begin(volatile od_once_flag *flag) {
+  if (OD_ONCE_LOAD(flag) == OD_ONCE_DONE) return 0;
+  if (OD_ONCE_CAS(flag, OD_ONCE_UNINIT, OD_ONCE_BUSY)) return 1;
+  /*Another thread is building the data.
+    This only takes a few microseconds, so just spin.*/
+  while (OD_ONCE_LOAD(flag) != OD_ONCE_DONE);
+  return 0;
+}
+
+void od_once_end(volatile od_once_flag *flag) {
+  OD_ASSERT(OD_ONCE_LOAD(flag) == OD_ONCE_BUSY);
+  OD_ONCE_STORE(flag, OD_ONCE_DONE);
+}
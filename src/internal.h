@@ -38,7 +38,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 # endif
 
 # define OD_VERSION_MAJOR (0)
-# define OD_VERSION_MINOR (0)
+# define OD_VERSION_MINOR (3)
 # define OD_VERSION_SUB   (0)
 
 /* PACKAGE_STRING needs to be defined for deterministic builds */
@@ -185,6 +185,13 @@ void od_fatal_impl(const char *_str, const char *_file, int _line);
 #  define OD_UNLIKELY(_x) (!!(_x))
 # endif
 
+/*SSE2 is part of the baseline instruction set on x86-64, so small kernels
+   called too often to go through the CPU-flag dispatch in od_state can use
+   SSE2 intrinsics directly when the compiler targets it.*/
+# if defined(OD_SSE2_INTRINSICS) && (defined(__SSE2__) || defined(_M_X64))
+#  define OD_SSE2_BASELINE (1)
+# endif
+
 /*Currently this structure is only in Tremor, and is read-only.*/
 typedef struct oggbyte_buffer oggbyte_buffer;
 
@@ -224,11 +231,30 @@ int od_ilog(uint32_t _v);
 void **od_malloc_2d(size_t _height, size_t _width, size_t _sz);
 void **od_calloc_2d(size_t _height, size_t _width, size_t _sz);
 void od_zero_2d(void **buf, size_t height, size_t width, size_t sz);
+void od_relayout_2d(void **buf, size_t height, size_t width, size_t sz);
 void od_free_2d(void *_ptr);
 
+/*One-time initialization of process-wide data shared by all contexts.
+  Usage:
+    static od_once_flag once;
+    if (od_once_begin(&once)) {
+      ...build the data...
+      od_once_end(&once);
+    }
+  od_once_begin() returns 1 in exactly one caller, which must initialize the
+   data and then call od_once_end().
+  Every other caller waits until that has happened and gets 0, after which
+   the data is safe to read.
+  The flag must be zero-initialized (i.e., have static storage duration).
+  Without compiler support for atomic operations, this is not thread-safe.*/
+typedef long od_once_flag;
+
+int od_once_begin(volatile od_once_flag *flag);
+void od_once_end(volatile od_once_flag *flag);
+
 # define OD_DIVU_DMAX (1024)
 
-extern uint32_t OD_DIVU_SMALL_CONSTS[OD_DIVU_DMAX][2];
+extern const uint32_t OD_DIVU_SMALL_CONSTS[OD_DIVU_DMAX][2];
 
 /*Translate unsigned division by small divisors into multiplications.*/
 # define OD_DIVU_SMALL(_x, _d) \
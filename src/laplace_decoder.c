@@ -41,7 +41,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #endif
 
 static int od_decode_pvq_split_(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
- int sum, int ctx OD_ACC_STR) {
+ int sum, int ctx OD_ACC_ID) {
   int shift;
   int count;
   int msbs;
@@ -51,8 +51,8 @@ static int od_decode_pvq_split_(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
   shift = OD_MAXI(0, OD_ILOG(sum) - 3);
   fctx = 7*ctx + (sum >> shift) - 1;
   msbs = od_decode_cdf_adapt(ec, adapt->pvq_split_cdf[fctx],
-   (sum >> shift) + 1, adapt->pvq_split_increment, acc_str);
-  if (shift) count = od_ec_dec_bits(ec, shift, acc_str);
+   (sum >> shift) + 1, adapt->pvq_split_increment, acc_id);
+  if (shift) count = od_ec_dec_bits(ec, shift, acc_id);
   count += msbs << shift;
   if (count > sum) {
     count = sum;
@@ -77,19 +77,97 @@ void od_decode_band_pvq_splits(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
     cdf_id = od_pvq_k1_ctx(n, level == 0);
     OD_CLEAR(y, n);
     pos = od_decode_cdf_adapt(ec, adapt->pvq_k1_cdf[cdf_id], n,
-     adapt->pvq_k1_increment, "pvq:k1");
+     adapt->pvq_k1_increment, OD_ACCT_ID_PVQ_K1);
     y[pos] = 1;
   }
   else {
     mid = n >> 1;
     count_right = od_decode_pvq_split(ec, adapt, k, od_pvq_size_ctx(n),
-     "pvq:split");
+     OD_ACCT_ID_PVQ_SPLIT);
     od_decode_band_pvq_splits(ec, adapt, y, mid, k - count_right, level + 1);
     od_decode_band_pvq_splits(ec, adapt, y + mid, n - mid, count_right,
      level + 1);
   }
 }
 
+/** Decodes a PVQ codeword coded with od_encode_band_pvq_runs(). The signs
+ * are not decoded here.
+ *
+ * @param [in,out] ec     range decoder
+ * @param [in,out] adapt  adaptation context
+ * @param [out]    y      codeword
+ * @param [in]     n      number of positions in y
+ * @param [in]     k      sum of the magnitudes of y
+ */
+void od_decode_band_pvq_runs(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
+ od_coeff *y, int n, int k) {
+  int pos;
+  int n_left;
+  int m;
+  OD_CLEAR(y, n);
+  pos = 0;
+  while (k > 0 && (n_left = n - pos) > 1) {
+    if (k < n_left) {
+      unsigned decay;
+      int run;
+      int sym;
+      int ctx;
+      ctx = od_pvq_run_ctx(n_left, k);
+      decay = 256 - (k << 8)/n_left;
+      sym = od_decode_cdf_adapt(ec, adapt->pvq_run_cdf[ctx], 16,
+       adapt->pvq_run_increment, OD_ACCT_ID_PVQ_RUN);
+      if (k == 1) {
+        run = sym;
+        if (run == 15 && n_left > 16) {
+          run += laplace_decode_special(ec, decay, n_left - 16,
+           OD_ACCT_ID_PVQ_RUN);
+        }
+        m = 1;
+      }
+      else {
+        run = sym >> 1;
+        if (run == 7 && n_left > 8) {
+          run += laplace_decode_special(ec, decay, n_left - 8,
+           OD_ACCT_ID_PVQ_RUN);
+        }
+        m = 1;
+        if (sym & 1) {
+          m = run < n_left - 1 ?
+           2 + laplace_decode_special(ec, 128, k - 2, OD_ACCT_ID_PVQ_MAG) : k;
+        }
+      }
+      if (run > n_left - 1) {
+        run = n_left - 1;
+        ec->error = 1;
+      }
+      if (run == n_left - 1) m = k;
+      pos += run;
+      y[pos++] = m;
+    }
+    else {
+      int shift;
+      int sym;
+      shift = od_pvq_mag_shift(n_left, k);
+      sym = od_decode_cdf_adapt(ec,
+       adapt->pvq_mag_cdf[od_pvq_mag_ctx(n_left, k)], 16,
+       adapt->pvq_run_increment, OD_ACCT_ID_PVQ_MAG);
+      if (sym == 15 && (k >> shift) > 15) {
+        sym += laplace_decode_special(ec, 192, (k >> shift) - 15,
+         OD_ACCT_ID_PVQ_MAG);
+      }
+      m = sym << shift;
+      if (shift) m += od_ec_dec_bits(ec, shift, OD_ACCT_ID_PVQ_MAG);
+      if (m > k) {
+        m = k;
+        ec->error = 1;
+      }
+      y[pos++] = m;
+    }
+    k -= m;
+  }
+  if (k > 0) y[pos] = k;
+}
+
 /** Decodes the tail of a Laplace-distributed variable, i.e. it doesn't
  * do anything special for the zero case.
  *
@@ -99,7 +177,7 @@ void od_decode_band_pvq_splits(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
  *
  * @retval decoded variable x
  */
-int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_STR) {
+int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_ID) {
   int pos;
   int shift;
   int xs;
@@ -132,14 +210,14 @@ int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_STR)
     }
     if (ms > 0 && ms < 15) {
       /* Simple way of truncating the pdf when we have a bound. */
-      sym = od_ec_decode_cdf_unscaled(dec, cdf, ms + 1, acc_str);
+      sym = od_ec_decode_cdf_unscaled(dec, cdf, ms + 1, acc_id);
     }
-    else sym = od_ec_decode_cdf_q15(dec, cdf, 16, acc_str);
+    else sym = od_ec_decode_cdf_q15(dec, cdf, 16, acc_id);
     xs += sym;
     ms -= 15;
   }
   while (sym >= 15 && ms != 0);
-  if (shift) pos = (xs << shift) + od_ec_dec_bits(dec, shift, acc_str);
+  if (shift) pos = (xs << shift) + od_ec_dec_bits(dec, shift, acc_id);
   else pos = xs;
   OD_ASSERT(pos >> shift <= max >> shift || max == -1);
   if (max != -1 && pos > max) {
@@ -158,7 +236,7 @@ int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_STR)
  *
  * @retval decoded variable (including sign)
  */
-int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_STR) {
+int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_ID) {
   int j;
   int shift;
   uint16_t cdf[16];
@@ -180,17 +258,17 @@ int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_STR) {
   }
   /* Simple way of truncating the pdf when we have a bound */
   if (k == 0) sym = 0;
-  else sym = od_ec_decode_cdf_unscaled(dec, cdf, OD_MINI(k + 1, 16), acc_str);
+  else sym = od_ec_decode_cdf_unscaled(dec, cdf, OD_MINI(k + 1, 16), acc_id);
   if (shift) {
     int special;
     /* Because of the rounding, there's only half the number of possibilities
        for xs=0 */
     special = (sym == 0);
-    if (shift - special > 0) lsb = od_ec_dec_bits(dec, shift - special, acc_str);
+    if (shift - special > 0) lsb = od_ec_dec_bits(dec, shift - special, acc_id);
     lsb -= (!special << (shift - 1));
   }
   /* Handle the exponentially-decaying tail of the distribution */
-  if (sym == 15) sym += laplace_decode_special(dec, decay, k - 15, acc_str);
+  if (sym == 15) sym += laplace_decode_special(dec, decay, k - 15, acc_id);
   return (sym << shift) + lsb;
 }
 
@@ -202,7 +280,7 @@ int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_STR) {
 
 static void laplace_decode_vector_delta_(od_ec_dec *dec, od_coeff *y, int n, int k,
                                         int32_t *curr, const int32_t *means
-                                        OD_ACC_STR) {
+                                        OD_ACC_ID) {
   int i;
   int prev;
   int sum_ex;
@@ -236,16 +314,17 @@ static void laplace_decode_vector_delta_(od_ec_dec *dec, od_coeff *y, int n, int
          (int)((256*ex/(ex + 256) + (ex>>5)*ex/((n + 1)*(n - 1)*(n - 1)))));
       }
       /*Update mean position.*/
-      count = laplace_decode_special(dec, decay, n - 1, acc_str);
+      count = laplace_decode_special(dec, decay, n - 1, acc_id);
       first = 0;
     }
-    else count = laplace_decode(dec, coef*(n - prev)/k_left, n - prev - 1, acc_str);
+    else count = laplace_decode(dec, coef*(n - prev)/k_left, n - prev - 1,
+     acc_id);
     sum_ex += 256*(n - prev);
     sum_c += count*k_left;
     pos += count;
     OD_ASSERT(pos < n);
     if (y[pos] == 0)
-      sign = od_ec_dec_bits(dec, 1, acc_str);
+      sign = od_ec_dec_bits(dec, 1, acc_id);
     y[pos] += sign ? -1 : 1;
     prev = pos;
     k_left--;
@@ -274,7 +353,7 @@ static void laplace_decode_vector_delta_(od_ec_dec *dec, od_coeff *y, int n, int
  * @param [in]     means Adaptation context input.
  */
 void laplace_decode_vector_(od_ec_dec *dec, od_coeff *y, int n, int k,
-                           int32_t *curr, const int32_t *means OD_ACC_STR) {
+                           int32_t *curr, const int32_t *means OD_ACC_ID) {
   int i;
   int sum_ex;
   int kn;
@@ -284,7 +363,7 @@ void laplace_decode_vector_(od_ec_dec *dec, od_coeff *y, int n, int k,
   int ran_delta;
   ran_delta = 0;
   if (k <= 1) {
-    laplace_decode_vector_delta(dec, y, n, k, curr, means, acc_str);
+    laplace_decode_vector_delta(dec, y, n, k, curr, means, acc_id);
     return;
   }
   if (k == 0) {
@@ -307,7 +386,7 @@ void laplace_decode_vector_(od_ec_dec *dec, od_coeff *y, int n, int k,
     int x;
     if (kn == 0) break;
     if (kn <= 1 && i != n - 1) {
-      laplace_decode_vector_delta(dec, y + i, n - i, kn, curr, means, acc_str);
+      laplace_decode_vector_delta(dec, y + i, n - i, kn, curr, means, acc_id);
       ran_delta = 1;
       i = n;
       break;
@@ -318,10 +397,10 @@ void laplace_decode_vector_(od_ec_dec *dec, od_coeff *y, int n, int k,
     if (ex > kn*256) ex = kn*256;
     sum_ex += (2*256*kn + (n - i))/(2*(n - i));
     /* No need to encode the magnitude for the last bin. */
-    if (i != n - 1) x = laplace_decode(dec, ex, kn, acc_str);
+    if (i != n - 1) x = laplace_decode(dec, ex, kn, acc_id);
     else x = kn;
     if (x != 0) {
-      if (od_ec_dec_bits(dec, 1, acc_str)) x = -x;
+      if (od_ec_dec_bits(dec, 1, acc_id)) x = -x;
     }
     y[i] = x;
     kn -= abs(x);
@@ -79,6 +79,66 @@ void od_encode_band_pvq_splits(od_ec_enc *ec, od_pvq_codeword_ctx *adapt,
   }
 }
 
+/** Encodes a PVQ codeword as runs of zeros (while the pulses are sparse) or
+ * as magnitudes (while they are dense), with 16-ary adaptive symbols. Used
+ * from OD_STREAM_VERSION_MINOR_PVQ_RUNS on. The signs are not coded here.
+ *
+ * @param [in,out] ec     range encoder
+ * @param [in,out] adapt  adaptation context
+ * @param [in]     y      codeword
+ * @param [in]     n      number of positions in y
+ * @param [in]     k      sum of the magnitudes of y
+ */
+void od_encode_band_pvq_runs(od_ec_enc *ec, od_pvq_codeword_ctx *adapt,
+ const int *y, int n, int k) {
+  int pos;
+  int n_left;
+  int m;
+  pos = 0;
+  /* The magnitude at the last position is implied by what is left of k. */
+  while (k > 0 && (n_left = n - pos) > 1) {
+    if (k < n_left) {
+      unsigned decay;
+      int run;
+      int ctx;
+      for (run = 0; !y[pos + run]; run++);
+      OD_ASSERT(run < n_left);
+      m = abs(y[pos + run]);
+      ctx = od_pvq_run_ctx(n_left, k);
+      decay = 256 - (k << 8)/n_left;
+      if (k == 1) {
+        od_encode_cdf_adapt(ec, OD_MINI(run, 15), adapt->pvq_run_cdf[ctx], 16,
+         adapt->pvq_run_increment);
+        if (run >= 15) laplace_encode_special(ec, run - 15, decay, n_left - 16);
+      }
+      else {
+        od_encode_cdf_adapt(ec, 2*OD_MINI(run, 7) + (m > 1),
+         adapt->pvq_run_cdf[ctx], 16, adapt->pvq_run_increment);
+        if (run >= 7) laplace_encode_special(ec, run - 7, decay, n_left - 8);
+        if (m > 1 && run < n_left - 1) {
+          laplace_encode_special(ec, m - 2, 128, k - 2);
+        }
+      }
+      pos += run + 1;
+    }
+    else {
+      int shift;
+      int ms;
+      m = abs(y[pos]);
+      shift = od_pvq_mag_shift(n_left, k);
+      ms = m >> shift;
+      od_encode_cdf_adapt(ec, OD_MINI(ms, 15),
+       adapt->pvq_mag_cdf[od_pvq_mag_ctx(n_left, k)], 16,
+       adapt->pvq_run_increment);
+      if (ms >= 15) laplace_encode_special(ec, ms - 15, 192, (k >> shift) - 15);
+      if (shift) od_ec_enc_bits(ec, m & ((1 << shift) - 1), shift);
+      pos++;
+    }
+    k -= m;
+  }
+  OD_ASSERT(k == 0 || abs(y[pos]) == k);
+}
+
 /** Encodes the tail of a Laplace-distributed variable, i.e. it doesn't
  * do anything special for the zero case.
  *
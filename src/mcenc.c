@@ -1747,12 +1747,36 @@ static int32_t od_enc_satd(od_enc_ctx *enc, const unsigned char *p,
   return od_mc_compute_sad16_c(src, iplane->ystride, p, pystride, w, h);
 }
 
-static int od_mv_est_init_impl(od_mv_est_ctx *est, od_enc_ctx *enc) {
+/*Initializes the MV mesh for the current frame size of the encoder, and the
+   configuration to its defaults.
+  est->mvs must be zeroed.*/
+static void od_mv_est_init_grid(od_mv_est_ctx *est) {
+  od_enc_ctx *enc;
   int nhmvbs;
   int nvmvbs;
-  int log_mvb_sz;
   int vx;
   int vy;
+  enc = est->enc;
+  nhmvbs = enc->state.nhmvbs;
+  nvmvbs = enc->state.nvmvbs;
+  for (vy = 0; vy <= nvmvbs; vy++) {
+    for (vx = 0; vx <= nhmvbs; vx++) {
+      est->mvs[vy][vx].vx = vx;
+      est->mvs[vy][vx].vy = vy;
+      est->mvs[vy][vx].heapi = -1;
+      enc->state.mv_grid[vy][vx].valid = 1;
+    }
+  }
+  /*Set to UCHAR_MAX so that od_mv_est_clear_hit_cache initializes hit_cache.*/
+  est->hit_bit = UCHAR_MAX;
+  est->mv_res_min = 0;
+  est->flags = OD_MC_USE_CHROMA;
+}
+
+static int od_mv_est_init_impl(od_mv_est_ctx *est, od_enc_ctx *enc) {
+  int nhmvbs;
+  int nvmvbs;
+  int log_mvb_sz;
   if (OD_UNLIKELY(!est)) {
     return OD_EFAULT;
   }
@@ -1790,28 +1814,23 @@ static int od_mv_est_init_impl(od_mv_est_ctx *est, od_enc_ctx *enc) {
   if (OD_UNLIKELY(!est->col_counts)) {
     return OD_EFAULT;
   }
-  for (vy = 0; vy <= nvmvbs; vy++) {
-    for (vx = 0; vx <= nhmvbs; vx++) {
-      est->mvs[vy][vx].vx = vx;
-      est->mvs[vy][vx].vy = vy;
-      est->mvs[vy][vx].heapi = -1;
-      enc->state.mv_grid[vy][vx].valid = 1;
-    }
-  }
   est->dec_heap = (od_mv_node **)malloc(
    sizeof(*est->dec_heap)*(nvmvbs + 1)*(nhmvbs + 1));
   if (OD_UNLIKELY(!est->dec_heap)) {
     return OD_EFAULT;
   }
-  /*Set to UCHAR_MAX so that od_mv_est_clear_hit_cache initializes hit_cache.*/
-  est->hit_bit = UCHAR_MAX;
-  est->mv_res_min = 0;
-  est->flags = OD_MC_USE_CHROMA;
+  od_mv_est_init_grid(est);
   return OD_SUCCESS;
 }
 
 static void od_mv_est_clear(od_mv_est_ctx *est) {
   int log_mvb_sz;
+  int ref;
+  for (ref = 0; ref < OD_FRAME_MAX; ref++) {
+    free(est->hash[ref].heads);
+    free(est->hash[ref].next);
+    free(est->hash[ref].hashes);
+  }
   free(est->dec_heap);
   free(est->col_counts);
   free(est->row_counts);
@@ -2172,28 +2191,41 @@ static int od_mv_est_cand_bits(od_mv_est_ctx *est, int equal_mvs,
   return cost;
 }
 
-/*Estimate the number of bits that will be used to encode the given MV grid
-  point, including reference index.*/
-static int od_mv_est_bits(od_mv_est_ctx *est, int vx, int vy, int mv_res) {
+/*Computes the predictor state used to estimate the rate of the given MV grid
+   point.*/
+static void od_mv_est_get_rate_pred(od_mv_est_ctx *est, od_mv_rate_pred *rp,
+ int vx, int vy, int mv_res) {
   od_state *state;
-  int pred[2];
-  int equal_mvs;
-  int mv_rate;
-  int ref_pred;
   od_mv_grid_pt *mvg;
-  int *mv;
+  int level;
   state = &est->enc->state;
   mvg = state->mv_grid[vy] + vx;
-  equal_mvs = od_state_get_predictor(state, pred, vx, vy,
-   OD_MC_LEVEL[vy & OD_MVB_MASK][vx & OD_MVB_MASK], mv_res, mvg->ref);
-  ref_pred = od_mc_get_ref_predictor(state,  vx, vy,
-   OD_MC_LEVEL[vy & OD_MVB_MASK][vx & OD_MVB_MASK]);
+  level = OD_MC_LEVEL[vy & OD_MVB_MASK][vx & OD_MVB_MASK];
+  rp->equal_mvs = od_state_get_predictor(state, rp->pred, vx, vy,
+   level, mv_res, mvg->ref);
+  rp->ref_pred = od_mc_get_ref_predictor(state, vx, vy, level);
+  rp->valid = 1;
+}
+
+/*Estimate the number of bits that will be used to encode the current MV of a
+   grid point with a known predictor state, including reference index.*/
+static int od_mv_est_pred_bits(od_mv_est_ctx *est, const od_mv_grid_pt *mvg,
+ const od_mv_rate_pred *rp, int mv_res) {
+  const int *mv;
   if (mvg->ref == OD_FRAME_NEXT) mv = mvg->mv1;
   else mv = mvg->mv;
-  mv_rate = od_mv_est_cand_bits(est, equal_mvs,
-   mv[0] >> mv_res, mv[1] >> mv_res, pred[0], pred[1],
-   mvg->ref, ref_pred);
-  return mv_rate;
+  return od_mv_est_cand_bits(est, rp->equal_mvs,
+   mv[0] >> mv_res, mv[1] >> mv_res, rp->pred[0], rp->pred[1],
+   mvg->ref, rp->ref_pred);
+}
+
+/*Estimate the number of bits that will be used to encode the given MV grid
+  point, including reference index.*/
+static int od_mv_est_bits(od_mv_est_ctx *est, int vx, int vy, int mv_res) {
+  od_mv_rate_pred rp;
+  od_mv_est_get_rate_pred(est, &rp, vx, vy, mv_res);
+  return od_mv_est_pred_bits(est, est->enc->state.mv_grid[vy] + vx, &rp,
+   mv_res);
 }
 
 #if defined(OD_LOGGING_ENABLED)
@@ -2503,6 +2535,306 @@ static int od_mv_est_get_boundary_case(od_mv_limits *limits,
    (dy - dsz < mvymin) << 2 | (dy + dsz > mvymax) << 3;
 }
 
+/*The multipliers of the polynomial hash used for the block hash table.
+  Any odd constants would do; these are the FNV prime and the golden ratio.*/
+#define OD_MV_HASH_MUL_Y (0x01000193U)
+#define OD_MV_HASH_MUL_X (0x9E3779B1U)
+
+static uint32_t od_mv_hash_sample(const unsigned char *p, int xstride) {
+  return xstride > 1 ? p[0] | (uint32_t)p[1] << 8 : p[0];
+}
+
+static uint32_t od_mv_hash_pow(uint32_t mul) {
+  uint32_t ret;
+  int i;
+  ret = 1;
+  for (i = 1; i < 1 << OD_LOG_MV_HASH_BSIZE; i++) ret *= mul;
+  return ret;
+}
+
+/*Computes the hash of the block with its upper-left corner at p.
+  This is the same value od_mv_est_hash_build() computes incrementally: each
+   column of the block is hashed from top to bottom, and then the column
+   hashes are hashed from left to right.*/
+static uint32_t od_mv_hash_block(const unsigned char *p, int ystride,
+ int xstride) {
+  uint32_t h;
+  uint32_t col;
+  int i;
+  int j;
+  h = 0;
+  for (j = 0; j < 1 << OD_LOG_MV_HASH_BSIZE; j++) {
+    col = 0;
+    for (i = 0; i < 1 << OD_LOG_MV_HASH_BSIZE; i++) {
+      col = col*OD_MV_HASH_MUL_Y
+       + od_mv_hash_sample(p + i*ystride + j*xstride, xstride);
+    }
+    h = h*OD_MV_HASH_MUL_X + col;
+  }
+  return h;
+}
+
+/*Returns the source image that was coded into the given reference frame, or
+   NULL if it is not known.*/
+static const daala_image *od_mv_est_ref_src(od_mv_est_ctx *est, int ref) {
+  od_enc_ctx *enc;
+  int refi;
+  enc = est->enc;
+  refi = enc->state.ref_imgi[ref];
+  if (enc->sc_img_data == NULL || refi < 0 || !enc->sc_src_valid[refi]) {
+    return NULL;
+  }
+  return enc->sc_src_imgs + refi;
+}
+
+/*Hashes the luma block at every full-pel position of the source image of the
+   given reference frame.
+  The source is used instead of the reconstruction because, in lossy coding,
+   only the source of an unchanged region is guaranteed to still match.
+  The hashes are updated incrementally, so this costs a handful of operations
+   per pixel regardless of the block size.
+  If the source is not known or the tables cannot be allocated, they are left
+   empty and the motion search proceeds without them.*/
+static void od_mv_est_hash_build(od_mv_est_ctx *est, int ref) {
+  const daala_image *src;
+  od_state *state;
+  od_mv_hash *hash;
+  const daala_image_plane *iplane;
+  uint32_t *cols;
+  uint32_t pow_y;
+  uint32_t pow_x;
+  size_t npos;
+  int pic_width;
+  int pic_height;
+  int bsize;
+  int x;
+  int y;
+  state = &est->enc->state;
+  hash = est->hash + ref;
+  hash->nhpos = hash->nvpos = 0;
+  pic_width = state->info.pic_width;
+  pic_height = state->info.pic_height;
+  bsize = 1 << OD_LOG_MV_HASH_BSIZE;
+  src = od_mv_est_ref_src(est, ref);
+  if (src == NULL || pic_width < bsize || pic_height < bsize) return;
+  npos = (size_t)(pic_width - bsize + 1)*(pic_height - bsize + 1);
+  /*The column hashes of a row live past the end of the position hashes.*/
+  if (npos + pic_width > hash->npos_max) {
+    free(hash->hashes);
+    free(hash->next);
+    hash->npos_max = 0;
+    hash->hashes = (uint32_t *)malloc(
+     sizeof(*hash->hashes)*(npos + pic_width));
+    hash->next = (int32_t *)malloc(sizeof(*hash->next)*(npos + pic_width));
+    if (OD_UNLIKELY(hash->hashes == NULL || hash->next == NULL)) return;
+    hash->npos_max = npos + pic_width;
+  }
+  if (hash->heads == NULL) {
+    hash->heads = (int32_t *)malloc(sizeof(*hash->heads)
+     << OD_MV_HASH_BITS);
+    if (OD_UNLIKELY(hash->heads == NULL)) return;
+  }
+  memset(hash->heads, 0xFF, sizeof(*hash->heads) << OD_MV_HASH_BITS);
+  hash->nhpos = pic_width - bsize + 1;
+  hash->nvpos = pic_height - bsize + 1;
+  iplane = src->planes + 0;
+  cols = hash->hashes + npos;
+  pow_y = od_mv_hash_pow(OD_MV_HASH_MUL_Y);
+  pow_x = od_mv_hash_pow(OD_MV_HASH_MUL_X);
+  for (x = 0; x < pic_width; x++) {
+    cols[x] = 0;
+    for (y = 0; y < bsize; y++) {
+      cols[x] = cols[x]*OD_MV_HASH_MUL_Y + od_mv_hash_sample(iplane->data
+       + y*iplane->ystride + x*iplane->xstride, iplane->xstride);
+    }
+  }
+  for (y = 0; y < hash->nvpos; y++) {
+    const unsigned char *row;
+    uint32_t h;
+    int32_t pos;
+    if (y > 0) {
+      /*Slide the column hashes down by one row.*/
+      row = iplane->data + (y - 1)*iplane->ystride;
+      for (x = 0; x < pic_width; x++) {
+        cols[x] = (cols[x] - od_mv_hash_sample(row + x*iplane->xstride,
+         iplane->xstride)*pow_y)*OD_MV_HASH_MUL_Y
+         + od_mv_hash_sample(row + bsize*iplane->ystride + x*iplane->xstride,
+         iplane->xstride);
+      }
+    }
+    h = 0;
+    for (x = 0; x < bsize - 1; x++) h = h*OD_MV_HASH_MUL_X + cols[x];
+    for (x = 0; x < hash->nhpos; x++) {
+      int bucket;
+      if (x > 0) h -= cols[x - 1]*pow_x;
+      h = h*OD_MV_HASH_MUL_X + cols[x + bsize - 1];
+      pos = y*hash->nhpos + x;
+      bucket = h >> (32 - OD_MV_HASH_BITS);
+      hash->hashes[pos] = h;
+      hash->next[pos] = hash->heads[bucket];
+      hash->heads[bucket] = pos;
+    }
+  }
+}
+
+/*Returns whether the source block at (bx, by) of the current frame is an
+   exact copy of the block displaced by the full-pel MV (dx, dy) in the source
+   image of a reference frame.
+  Both blocks must lie inside the picture.
+  Chroma is only compared (if enabled) when the MV lands on whole chroma
+   pixels.*/
+static int od_mv_est_src_match(od_mv_est_ctx *est, const daala_image *src,
+ int bx, int by, int dx, int dy, int blk_sz) {
+  int nplanes;
+  int pli;
+  nplanes = (est->flags & OD_MC_USE_CHROMA) ? src->nplanes : 1;
+  for (pli = 0; pli < nplanes; pli++) {
+    const daala_image_plane *iplane;
+    const daala_image_plane *rplane;
+    const unsigned char *cur;
+    const unsigned char *ref;
+    int xdec;
+    int ydec;
+    int w;
+    int h;
+    int y;
+    iplane = est->enc->curr_img->planes + pli;
+    rplane = src->planes + pli;
+    xdec = iplane->xdec;
+    ydec = iplane->ydec;
+    if ((dx & ((1 << xdec) - 1)) || (dy & ((1 << ydec) - 1))) continue;
+    w = (blk_sz >> xdec)*iplane->xstride;
+    h = blk_sz >> ydec;
+    cur = iplane->data + (by >> ydec)*iplane->ystride
+     + (bx >> xdec)*iplane->xstride;
+    ref = rplane->data + ((by + dy) >> ydec)*rplane->ystride
+     + ((bx + dx) >> xdec)*rplane->xstride;
+    for (y = 0; y < h; y++) {
+      if (memcmp(cur + y*iplane->ystride, ref + y*rplane->ystride, w) != 0) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*Looks for a full-pel MV that copies the BMA block at (bx, by) exactly from
+   the source of the reference frame.
+  The current best MV (the median predictor) and the zero MV are tried first,
+   since most of a desktop is either static or scrolls along with its
+   neighbors, followed by the other positions whose upper-left 8x8 block has
+   the same hash.
+  Every candidate is verified against the source, so hash collisions never
+   produce a wrong match.
+  Return: 1 if a match was found, in which case the best MV, SAD, rate and
+   cost are replaced by those of the cheapest match, or 0 otherwise.*/
+static int od_mv_est_hash_search(od_mv_est_ctx *est, int ref,
+ int bx, int by, int log_mvb_sz, const od_mv_limits *limits, int equal_mvs,
+ const int pred[2], int ref_pred, int32_t *best_sad, int *best_rate,
+ int32_t *best_cost, int best_vec[2]) {
+  od_state *state;
+  od_mv_hash *hash;
+  const daala_image *src;
+  daala_image_plane *iplane;
+  int32_t found_sad;
+  int32_t found_cost;
+  int found_rate;
+  int found_vec[2];
+  int found;
+  uint32_t h;
+  int32_t pos;
+  int blk_sz;
+  int ncands;
+  int ci;
+  state = &est->enc->state;
+  hash = est->hash + ref;
+  src = od_mv_est_ref_src(est, ref);
+  blk_sz = 1 << (log_mvb_sz + OD_LOG_MVBSIZE_MIN);
+  /*Only blocks that lie entirely inside the picture can be matched.*/
+  if (hash->nhpos <= 0 || src == NULL || bx < 0 || by < 0
+   || bx + blk_sz > state->info.pic_width
+   || by + blk_sz > state->info.pic_height) {
+    return 0;
+  }
+  iplane = est->enc->curr_img->planes + 0;
+  h = od_mv_hash_block(iplane->data + by*iplane->ystride
+   + bx*iplane->xstride, iplane->ystride, iplane->xstride);
+  pos = hash->heads[h >> (32 - OD_MV_HASH_BITS)];
+  found = 0;
+  found_sad = found_cost = found_rate = 0;
+  found_vec[0] = found_vec[1] = 0;
+  ncands = 0;
+  for (ci = 0;; ci++) {
+    int32_t sad;
+    int32_t cost;
+    int rate;
+    int candx;
+    int candy;
+    int rx;
+    int ry;
+    if (ci == 0) {
+      /*The median predictor, which has already been marked as hit.*/
+      candx = best_vec[0];
+      candy = best_vec[1];
+      if ((candx | candy) & 1) continue;
+    }
+    else if (ci == 1) {
+      candx = candy = 0;
+    }
+    else {
+      int32_t cur_pos;
+      if (pos < 0 || ncands >= OD_MV_HASH_MAX_CANDS) break;
+      cur_pos = pos;
+      pos = hash->next[pos];
+      if (hash->hashes[cur_pos] != h) continue;
+      ncands++;
+      candx = 2*(cur_pos%hash->nhpos - bx);
+      candy = 2*(cur_pos/hash->nhpos - by);
+    }
+    rx = bx + (candx >> 1);
+    ry = by + (candy >> 1);
+    if (rx < 0 || ry < 0 || rx + blk_sz > state->info.pic_width
+     || ry + blk_sz > state->info.pic_height
+     || candx < 2*limits->xmin || candx > 2*limits->xmax
+     || candy < 2*limits->ymin || candy > 2*limits->ymax) {
+      continue;
+    }
+    if (ci > 0) {
+      if (od_mv_est_is_hit(est, candx, candy)) continue;
+      od_mv_est_set_hit(est, candx, candy);
+    }
+    if (!od_mv_est_src_match(est, src, bx, by, candx >> 1, candy >> 1,
+     blk_sz)) {
+      continue;
+    }
+    /*The cost is still measured against the reconstruction, which is what
+       the prediction will actually be built from.*/
+    sad = ci == 0 ? *best_sad
+     : od_mv_est_bma_sad(est, ref, bx, by, candx, candy, log_mvb_sz);
+    rate = od_mv_est_cand_bits(est, equal_mvs,
+     candx, candy, pred[0], pred[1], ref, ref_pred);
+    cost = (sad << OD_ERROR_SCALE) + rate*est->lambda;
+    OD_LOG((OD_LOG_MOTION_ESTIMATION, OD_LOG_DEBUG,
+     "Source copy: (%i, %i)    Cost: %i", candx, candy, cost));
+    if (!found || cost < found_cost) {
+      found = 1;
+      found_sad = sad;
+      found_rate = rate;
+      found_cost = cost;
+      found_vec[0] = candx;
+      found_vec[1] = candy;
+    }
+  }
+  if (found) {
+    *best_sad = found_sad;
+    *best_rate = found_rate;
+    *best_cost = found_cost;
+    best_vec[0] = found_vec[0];
+    best_vec[1] = found_vec[1];
+  }
+  return found;
+}
+
 static void od_mv_est_init_mv(od_mv_est_ctx *est, int ref, int vx, int vy,
  int must_update) {
   static const od_mv_node ZERO_NODE;
@@ -2544,6 +2876,7 @@ static void od_mv_est_init_mv(od_mv_est_ctx *est, int ref, int vx, int vy,
   int prev_display_order;
   int prev_prev_display_order;
   int bma_time_index;
+  int copied;
 #if defined(OD_DUMP_IMAGES) && defined(OD_ANIMATE)
   int animating;
   int x0;
@@ -2700,11 +3033,16 @@ static void od_mv_est_init_mv(od_mv_est_ctx *est, int ref, int vx, int vy,
   od_mv_est_set_hit(est, candx, candy);
   best_vec[0] = candx;
   best_vec[1] = candy;
+  /*In screen content, a copy of an unchanged part of the reference is by far
+     the most likely match, and finding one ends the search.*/
+  copied = est->enc->screen_content
+   && od_mv_est_hash_search(est, ref, bx, by, log_mvb_sz, &limits, equal_mvs,
+   pred, ref_pred, &best_sad, &best_rate, &best_cost, best_vec);
   OD_LOG((OD_LOG_MOTION_ESTIMATION, OD_LOG_DEBUG,
    "Threshold: %i", est->thresh1[log_mvb_sz]));
   /*TODO: adjust the BMA thresholds if B-frame is used, i.e. P frame's MV
     will introduce much larger MC error if B-frames are used.*/
-  if (best_sad > est->thresh1[log_mvb_sz]) {
+  if (!copied && best_sad > est->thresh1[log_mvb_sz]) {
     int32_t sad;
     int32_t cost;
     int rate;
@@ -2910,7 +3248,7 @@ static void od_mv_est_init_mv(od_mv_est_ctx *est, int ref, int vx, int vy,
     }
   }
   /*Halfpel refinement step.*/
-  {
+  if (!copied) {
     const int *pattern;
     int best_site;
     int nsites;
@@ -3049,6 +3387,7 @@ static void od_mv_est_init_mvs(od_mv_est_ctx *est, int ref, int must_update) {
       }
     }
   }
+  if (est->enc->screen_content) od_mv_est_hash_build(est, ref);
   /*We initialize MVs a MVB at a time for cache coherency.
     Proceeding level-by-level would involve less branching and less complex
      code, but the SADs dominate.
@@ -4537,6 +4876,7 @@ static int od_mv_dp_get_rate_change(od_mv_est_ctx *est, od_mv_dp_node *dp,
  int prevsi, int mv_res) {
   od_mv_node *mv;
   od_mv_grid_pt *mvg;
+  od_mv_rate_pred *rp;
   int pi;
   int dr;
   /*Move the state from the current trellis path into the grid.*/
@@ -4583,10 +4923,14 @@ static int od_mv_dp_get_rate_change(od_mv_est_ctx *est, od_mv_dp_node *dp,
     }
     OD_LOG_PARTIAL((OD_LOG_MOTION_ESTIMATION, OD_LOG_DEBUG, "\n"));
   }
-  /*Compute the new rate for the current MV.*/
+  /*Compute the new rate for the current MV.
+    Its predictor only depends on the state of the previous node, so it is
+     cached across all the states of this node.*/
   mv = dp->mv;
   mvg = dp->mvg;
-  *cur_mv_rate = od_mv_est_bits(est, mv->vx, mv->vy, mv_res);
+  rp = dp->rate_preds + prevsi + 1;
+  if (!rp->valid) od_mv_est_get_rate_pred(est, rp, mv->vx, mv->vy, mv_res);
+  *cur_mv_rate = od_mv_est_pred_bits(est, mvg, rp, mv_res);
   OD_LOG((OD_LOG_MOTION_ESTIMATION, OD_LOG_DEBUG,
    "Current MV rate: %i - %i = %i",
    *cur_mv_rate, mv->mv_rate, *cur_mv_rate - mv->mv_rate));
@@ -4808,6 +5152,7 @@ static void od_mv_dp_row_init(od_mv_est_ctx *est,
     dp->original_mv[1] = dp->mvg->mv[1];
   }
   dp->original_mv_rate = dp->mv->mv_rate;
+  for (pi = 0; pi <= OD_DP_NSTATES_MAX; pi++) dp->rate_preds[pi].valid = 0;
   nhmvbs = state->nhmvbs;
   nvmvbs = state->nvmvbs;
   /*Get the list of MVs we help predict.*/
@@ -5527,6 +5872,7 @@ static void od_mv_dp_col_init(od_mv_est_ctx *est,
     dp->original_mv[1] = dp->mvg->mv[1];
   }
   dp->original_mv_rate = dp->mv->mv_rate;
+  for (pi = 0; pi <= OD_DP_NSTATES_MAX; pi++) dp->rate_preds[pi].valid = 0;
   nhmvbs = state->nhmvbs;
   nvmvbs = state->nvmvbs;
   /*Get the list of MVs we help predict.*/
@@ -6270,6 +6616,42 @@ void od_mv_est_free(od_mv_est_ctx *est) {
   }
 }
 
+/*Returns est to the state od_mv_est_alloc() leaves it in, for the current
+   frame size of its encoder, while keeping its buffers.
+  The frame must not be larger than the one est was allocated for.*/
+void od_mv_est_reset(od_mv_est_ctx *est) {
+  od_mv_est_ctx bufs;
+  int nhmvbs;
+  int nvmvbs;
+  int log_mvb_sz;
+  bufs = *est;
+  OD_CLEAR(est, 1);
+  est->enc = bufs.enc;
+  OD_COPY(est->sad_cache, bufs.sad_cache, OD_LOG_MVB_DELTA0);
+  est->mvs = bufs.mvs;
+  est->refine_grid = bufs.refine_grid;
+  est->dp_nodes = bufs.dp_nodes;
+  est->dec_heap = bufs.dec_heap;
+  est->row_counts = bufs.row_counts;
+  est->col_counts = bufs.col_counts;
+  OD_COPY(est->hash, bufs.hash, OD_FRAME_MAX);
+  nhmvbs = est->enc->state.nhmvbs;
+  nvmvbs = est->enc->state.nvmvbs;
+  /*Lay the arrays out as od_mv_est_alloc() would for this frame size.
+    The sub-pel refinement reads past the end of a row of refine_grid into
+     the next one, so a wider row stride would change its decisions.*/
+  for (log_mvb_sz = 0; log_mvb_sz < OD_LOG_MVB_DELTA0; log_mvb_sz++) {
+    od_relayout_2d((void **)est->sad_cache[log_mvb_sz], nvmvbs >> log_mvb_sz,
+     nhmvbs >> log_mvb_sz, sizeof(est->sad_cache[log_mvb_sz][0][0]));
+  }
+  od_relayout_2d((void **)est->mvs, nvmvbs + 1, nhmvbs + 1,
+   sizeof(est->mvs[0][0]));
+  od_relayout_2d((void **)est->refine_grid, nvmvbs + 1, nhmvbs + 1,
+   sizeof(est->refine_grid[0][0]));
+  OD_CLEAR(est->mvs[0], (nvmvbs + 1)*(nhmvbs + 1));
+  od_mv_est_init_grid(est);
+}
+
 void od_mv_est_reset_rd_block_state(od_mv_est_ctx *est,
  int vx, int vy, int log_mvb_sz) {
   od_state *state;
@@ -6328,11 +6710,14 @@ void od_mv_subpel_refine(od_mv_est_ctx *est, int cost_thresh) {
   const int *pattern_nsites;
   const od_pattern *pattern;
   int mv_res;
+  int mv_res_min;
   int best_mv_res;
   state = &est->enc->state;
   nhmvbs = state->nhmvbs;
   nvmvbs = state->nvmvbs;
-  complexity = est->enc->complexity;
+  complexity = est->enc->rt.level;
+  /*Screen content moves by whole pixels, so finer MVs only cost rate.*/
+  mv_res_min = est->enc->screen_content ? 2 : est->mv_res_min;
   if (complexity >= OD_MC_SQUARE_SUBPEL_REFINEMENT_COMPLEXITY) {
     pattern_nsites = OD_SQUARE_NSITES;
     pattern = OD_SQUARE_SITES;
@@ -6345,8 +6730,10 @@ void od_mv_subpel_refine(od_mv_est_ctx *est, int cost_thresh) {
   do {
     dcost = od_mv_est_refine(est, 2, 2, pattern_nsites, pattern);
   }
-  while (dcost < cost_thresh);
-  for (best_mv_res = mv_res = 2; mv_res-- > est->mv_res_min;) {
+  while (dcost < cost_thresh && !OD_RT_CHECK(est->enc, OD_RT_MV, 3, 4));
+  for (best_mv_res = mv_res = 2; mv_res-- > mv_res_min;) {
+    /*Each finer resolution is at least one more pass over the whole frame.*/
+    if (OD_RT_CHECK(est->enc, OD_RT_MV, 3, 4)) break;
     subpel_cost = od_mv_est_update_mv_rates(est, mv_res)*est->lambda;
     /*If the rate penalty for refining is small, bump the termination threshold
        down to make sure we actually get a decent improvement.
@@ -6361,7 +6748,7 @@ void od_mv_subpel_refine(od_mv_est_ctx *est, int cost_thresh) {
        pattern_nsites, pattern);
       subpel_cost += dcost;
     }
-    while (dcost < cost_thresh);
+    while (dcost < cost_thresh && !OD_RT_CHECK(est->enc, OD_RT_MV, 3, 4));
     if (subpel_cost >= 0) {
       OD_LOG((OD_LOG_MOTION_ESTIMATION, OD_LOG_INFO,
        "1/%i refinement FAILED:    dopt %7i", 1 << (3 - mv_res), subpel_cost));
@@ -6395,6 +6782,7 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
   int i;
   int j;
   int frame_type;
+  int64_t prof_t0;
   use_satd = est->enc->use_satd;
   state = &est->enc->state;
   nhmvbs = state->nhmvbs;
@@ -6417,14 +6805,21 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
     }
   }
   /*Rate estimations. Note that this does not depend on the previous frame: at
-     this point, the probabilities have been reset by od_adapt_ctx_reset.*/
-  for (i = 0; i < 5; i++) {
-    for (j = 0; j < 16; j++) {
-      est->mv_small_rate_est[i][j] = (int)((1 << OD_BITRES)
-       *(OD_LOG2(est->enc->state.adapt.mv_small_cdf[i][15])
-       - (OD_LOG2(est->enc->state.adapt.mv_small_cdf[i][j]
-       - (j > 0 ? est->enc->state.adapt.mv_small_cdf[i][j - 1] : 0)))) + 0.5);
+     this point, the probabilities have been reset by od_adapt_ctx_reset, so
+     we only need to recompute them when those initial CDFs change.*/
+  if (memcmp(est->mv_small_rate_cdf, est->enc->state.adapt.mv_small_cdf,
+   sizeof(est->mv_small_rate_cdf)) != 0) {
+    for (i = 0; i < 5; i++) {
+      for (j = 0; j < 16; j++) {
+        est->mv_small_rate_est[i][j] = (int)((1 << OD_BITRES)
+         *(OD_LOG2(est->enc->state.adapt.mv_small_cdf[i][15])
+         - (OD_LOG2(est->enc->state.adapt.mv_small_cdf[i][j]
+         - (j > 0 ? est->enc->state.adapt.mv_small_cdf[i][j - 1] : 0))))
+         + 0.5);
+      }
     }
+    OD_COPY(&est->mv_small_rate_cdf[0][0],
+     &est->enc->state.adapt.mv_small_cdf[0][0], 5*16);
   }
   /*If the luma plane is decimated for some reason, then our distortions will
      be smaller, so scale lambda appropriately.*/
@@ -6468,6 +6863,7 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
 #endif
   /*Use SAD for stages here after.*/
   est->compute_distortion = od_enc_sad;
+  prof_t0 = OD_ENC_PROF_BEGIN(est->enc);
   od_mv_est_init_mvs(est, OD_FRAME_PREV, 1);
   if (est->enc->state.frame_type == OD_P_FRAME) {
     /*At very high lambdas, the signaling overhead of multiref is too high.*/
@@ -6483,8 +6879,15 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
       od_mv_est_init_mvs(est, OD_FRAME_NEXT, 0);
     }
   }
+  OD_ENC_PROF_END(est->enc, OD_PROF_MV_INIT, prof_t0);
+  prof_t0 = OD_ENC_PROF_BEGIN(est->enc);
   od_mv_est_decimate(est);
-  complexity = est->enc->complexity;
+  OD_ENC_PROF_END(est->enc, OD_PROF_MV_DECIMATE, prof_t0);
+  /*The initial search is about half of the work at the default complexity.
+    If it already took longer than that, this lowers the level used for the
+     refinement.*/
+  (void)OD_RT_CHECK(est->enc, OD_RT_MV, 1, 2);
+  complexity = est->enc->rt.level;
   if (complexity >= OD_MC_REFINEMENT_COMPLEXITY) {
     /*This threshold is somewhat arbitrary.
       Chen and Willson use 6000 (with SSD as an error metric).
@@ -6505,6 +6908,7 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
       pattern_nsites = OD_DIAMOND_NSITES;
       pattern = OD_DIAMOND_SITES;
     }
+    prof_t0 = OD_ENC_PROF_BEGIN(est->enc);
     do {
       dcost = 0;
       /*Logarithmic (telescoping) search.
@@ -6516,7 +6920,9 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
       }
       dcost += od_mv_est_refine(est, 3, 2, pattern_nsites, pattern);
     }
-    while (dcost < cost_thresh);
+    while (dcost < cost_thresh && !OD_RT_CHECK(est->enc, OD_RT_MV, 2, 4));
+    OD_ENC_PROF_END(est->enc, OD_PROF_MV_REFINE, prof_t0);
+    prof_t0 = OD_ENC_PROF_BEGIN(est->enc);
     if (use_satd) {
       /*The two #defines below apply to sub-pel ME only.*/
       /*1.0 means the same as SAD.*/
@@ -6539,9 +6945,17 @@ void od_mv_est(od_mv_est_ctx *est, int lambda, int num_refs) {
       }
     }
     od_mv_subpel_refine(est, cost_thresh);
+    OD_ENC_PROF_END(est->enc, OD_PROF_MV_SUBPEL, prof_t0);
     /*We only need to do this when refinement runs.
       Otherwise they remain unchanged since od_mv_est_init_mv().*/
     if (frame_type == OD_P_FRAME) od_mv_est_update_bma_mvs(est);
   }
+  else {
+    /*The initial search finds half-pel vectors.
+      This also resets the MV rate adaptation, as the decoder does for every
+       frame.*/
+    od_state_set_mv_res(state, 2);
+  }
+  (void)OD_RT_CHECK(est->enc, OD_RT_MV, 1, 1);
   od_restore_fpu(state);
 }
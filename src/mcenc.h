@@ -32,10 +32,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
    size.*/
 #define OD_MC_SEARCH_RANGE (128)
 
+/*The number of bits used to index the buckets of the screen-content block
+   hash table.*/
+#define OD_MV_HASH_BITS (16)
+/*The size of the blocks hashed for screen-content exact-match detection.*/
+#define OD_LOG_MV_HASH_BSIZE (3)
+/*The maximum number of hash matches verified for each block.*/
+#define OD_MV_HASH_MAX_CANDS (16)
+
 typedef struct od_mv_limits od_mv_limits;
 typedef struct od_mv_node od_mv_node;
 typedef struct od_mv_dp_state od_mv_dp_state;
 typedef struct od_mv_dp_node od_mv_dp_node;
+typedef struct od_mv_rate_pred od_mv_rate_pred;
+typedef struct od_mv_hash od_mv_hash;
 
 # include "mc.h"
 # include "encint.h"
@@ -90,6 +100,25 @@ struct od_mv_node {
   int heapi;
 };
 
+/*A hash table of the 8x8 luma blocks at every full-pel position of a
+   reference frame.
+  This is only built in screen-content mode, where it is used to find blocks
+   that were copied unchanged from somewhere else in the reference.*/
+struct od_mv_hash {
+  /*The hash of the block with its upper-left corner at each position, in
+     raster order.*/
+  uint32_t *hashes;
+  /*The next position in the same bucket, or -1 at the end of the chain.*/
+  int32_t *next;
+  /*The first position in each bucket, or -1 if the bucket is empty.*/
+  int32_t *heads;
+  /*The number of hashed positions in each row and column.*/
+  int nhpos;
+  int nvpos;
+  /*The number of positions the arrays were allocated for.*/
+  size_t npos_max;
+};
+
 /*The square pattern, the largest we use, has 9 states.*/
 # define OD_DP_NSTATES_MAX (9)
 /*Up to 8 blocks can be influenced by this MV and the previous MV.*/
@@ -100,6 +129,18 @@ struct od_mv_node {
 /*At most 8 of them can be changed by a subsequent MV on the DP path.*/
 # define OD_DP_NCHANGEABLE_MAX (8)
 
+/*The predictor state needed to estimate the rate of an MV.*/
+struct od_mv_rate_pred {
+  /*The predicted MV, at the current MV resolution.*/
+  int pred[2];
+  /*The number of equal neighboring MVs (the rate context).*/
+  int equal_mvs;
+  /*The predicted reference frame.*/
+  int ref_pred;
+  /*Whether or not this entry has been filled in.*/
+  int valid;
+};
+
 /*One of the trellis states in the dynamic program.*/
 struct od_mv_dp_state {
   /*The MV to install for this state.*/
@@ -145,6 +186,11 @@ struct od_mv_dp_node {
   int original_mv_rates[OD_DP_NCHANGEABLE_MAX];
   /*The last node we save/restore in order to perform prediction.*/
   od_mv_dp_node *min_predictor_node;
+  /*The rate predictor of this MV for each state of the previous node, offset
+     by one so that index 0 is used at the start of the path.
+    An MV's predictor does not depend on its own value, so one entry is shared
+     by all the states of this node and only needs to be computed once.*/
+  od_mv_rate_pred rate_preds[OD_DP_NSTATES_MAX + 1];
   /*The set of trellis states.*/
   od_mv_dp_state states[OD_DP_NSTATES_MAX];
   /*The blocks influenced by this MV and the previous MV.*/
@@ -197,6 +243,13 @@ struct od_mv_est_ctx {
   int lambda;
   /*Rate estimations (in units of OD_BITRES).*/
   int mv_small_rate_est[5][16];
+  /*The CDFs mv_small_rate_est was computed from.
+    The estimates are only recomputed when these change.*/
+  uint16_t mv_small_rate_cdf[5][16];
+  /*The exact-match hash tables of each reference frame, only used in
+     screen-content mode.
+    Indexed by reference type.*/
+  od_mv_hash hash[OD_FRAME_MAX];
   /*Configuration.*/
   /*The flags indicating which feature to use.*/
   int flags;
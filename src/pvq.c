@@ -299,6 +299,9 @@ void od_adapt_pvq_ctx_reset(od_pvq_adapt_ctx *state, int is_keyframe) {
   OD_CDFS_INIT(state->pvq_skip_dir_cdf, state->pvq_skip_dir_increment >> 2);
   ctx->pvq_split_increment = 128;
   OD_CDFS_INIT(ctx->pvq_split_cdf, ctx->pvq_split_increment >> 1);
+  ctx->pvq_run_increment = 128;
+  OD_CDFS_INIT(ctx->pvq_run_cdf, ctx->pvq_run_increment >> 1);
+  OD_CDFS_INIT(ctx->pvq_mag_cdf, ctx->pvq_run_increment >> 1);
 }
 
 /* QMs are arranged from smallest to largest blocksizes, first for
@@ -380,6 +383,27 @@ void od_init_qm(int16_t *x, int16_t *x_inv, const int *qm) {
   }
 }
 
+/*The QMs for OD_FLAT_QM and OD_HVS_QM and their inverses, shared by every
+   encoder and decoder in the process.*/
+static int16_t od_qm_tables[2][OD_QM_BUFFER_SIZE];
+static int16_t od_qm_inv_tables[2][OD_QM_BUFFER_SIZE];
+static od_once_flag od_qm_tables_once[2];
+
+/*Returns the QM for qm_type (OD_FLAT_QM or OD_HVS_QM) and stores its inverse
+   in *qm_inv.
+  The tables are built the first time each type is requested and are
+   read-only afterwards; this is safe to call from several threads.*/
+const int16_t *od_qm_get(const int16_t **qm_inv, int qm_type) {
+  OD_ASSERT(qm_type == OD_FLAT_QM || qm_type == OD_HVS_QM);
+  if (od_once_begin(od_qm_tables_once + qm_type)) {
+    od_init_qm(od_qm_tables[qm_type], od_qm_inv_tables[qm_type],
+     qm_type == OD_HVS_QM ? OD_QM8_Q4_HVS : OD_QM8_Q4_FLAT);
+    od_once_end(od_qm_tables_once + qm_type);
+  }
+  *qm_inv = od_qm_inv_tables[qm_type];
+  return od_qm_tables[qm_type];
+}
+
 /* Maps each possible size (n) in the split k-tokenizer to a different value.
    Possible values of n are:
    2, 3, 4, 7, 8, 14, 15, 16, 31, 32, 63, 64, 127, 128
@@ -404,6 +428,30 @@ int od_pvq_k1_ctx(int n, int orig_length) {
   else return od_pvq_size_ctx(n);
 }
 
+/* Maps the n positions and k pulses (0 < k < n) left in a codeword to a
+   context for the run coder. With a single pulse left, the run can take any
+   length up to n - 1, so we use the length; otherwise we use the density of
+   the pulses. */
+int od_pvq_run_ctx(int n, int k) {
+  OD_ASSERT(k > 0 && k < n);
+  if (k == 1) return OD_MINI(OD_ILOG(n) - 2, 4);
+  return 5 + OD_MINI(OD_ILOG(n/k) - 1, 4);
+}
+
+/* Maps the n positions and k pulses (k >= n) left in a codeword to a context
+   for the magnitude coder. */
+int od_pvq_mag_ctx(int n, int k) {
+  OD_ASSERT(k >= n && n > 0);
+  return OD_MINI(OD_ILOG(k/n) - 1, 2);
+}
+
+/* Number of low bits of each magnitude that the magnitude coder sends raw,
+   so that the average of the rest stays below 4. */
+int od_pvq_mag_shift(int n, int k) {
+  OD_ASSERT(k >= n && n > 0);
+  return OD_MAXI(0, OD_ILOG(k/n) - 2);
+}
+
 /* Indexing for the packed quantization matrices. */
 int od_qm_get_index(int bs, int band) {
   /* The -band/3 term is due to the fact that we force corresponding horizontal
@@ -996,7 +1044,7 @@ static int16_t od_rsqrt_norm(int16_t t)
   return (int16_t)ret;
 }
 
-static int16_t od_rsqrt(int32_t x, int *rsqrt_shift)
+int16_t od_rsqrt(int32_t x, int *rsqrt_shift)
 {
    int k;
    int s;
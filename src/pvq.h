@@ -119,6 +119,11 @@ extern const uint16_t LAPLACE_OFFSET[];
 
 # define OD_ADAPT_NO_VALUE (-2147483647-1)
 
+/* Contexts of the run coder (OD_STREAM_VERSION_MINOR_PVQ_RUNS): the first
+   five for a single pulse left, the rest by pulse density. */
+# define OD_PVQ_RUN_CTXS (10)
+# define OD_PVQ_MAG_CTXS (3)
+
 typedef struct od_pvq_adapt_ctx  od_pvq_adapt_ctx;
 typedef struct od_pvq_codeword_ctx od_pvq_codeword_ctx;
 
@@ -129,6 +134,12 @@ struct od_pvq_codeword_ctx {
   uint16_t            pvq_k1_cdf[12][16];
   uint16_t            pvq_split_cdf[14*7][8];
   int                 pvq_split_increment;
+  /* Whether codewords are coded as runs instead of splits. This comes from
+     the stream version and is not reset with the adaptation state. */
+  int                 pvq_runs;
+  int                 pvq_run_increment;
+  uint16_t            pvq_run_cdf[OD_PVQ_RUN_CTXS][16];
+  uint16_t            pvq_mag_cdf[OD_PVQ_MAG_CTXS][16];
 };
 
 struct od_pvq_adapt_ctx {
@@ -145,11 +156,15 @@ struct od_pvq_adapt_ctx {
 void od_adapt_pvq_ctx_reset(od_pvq_adapt_ctx *state, int is_keyframe);
 int od_pvq_size_ctx(int n);
 int od_pvq_k1_ctx(int n, int orig_size);
+int od_pvq_run_ctx(int n, int k);
+int od_pvq_mag_ctx(int n, int k);
+int od_pvq_mag_shift(int n, int k);
 
 od_val16 od_pvq_sin(od_val32 x);
 od_val16 od_pvq_cos(od_val32 x);
 #if !defined(OD_FLOAT_PVQ)
 int od_vector_log_mag(const od_coeff *x, int n);
+int16_t od_rsqrt(int32_t x, int *rsqrt_shift);
 #endif
 
 int od_qm_get_index(int bs, int band);
@@ -157,6 +172,7 @@ int od_qm_get_index(int bs, int band);
 extern const od_val16 *const OD_PVQ_BETA[2][OD_NPLANES_MAX][OD_NBSIZES + 1];
 
 void od_init_qm(int16_t *x, int16_t *x_inv, const int *qm);
+const int16_t *od_qm_get(const int16_t **qm_inv, int qm_type);
 int od_compute_householder(od_val16 *r, int n, od_val32 gr, int *sign,
  int shift);
 void od_apply_householder(od_val16 *out, const od_val16 *x, const od_val16 *r,
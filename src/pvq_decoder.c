@@ -35,12 +35,32 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include "pvq_decoder.h"
 #include "partition.h"
 
+/*The most signs read with a single od_ec_dec_bits() call.*/
+#define OD_PVQ_SIGN_BATCH (24)
+
 static void od_decode_pvq_codeword(od_ec_dec *ec, od_pvq_codeword_ctx *ctx,
  od_coeff *y, int n, int k) {
+  uint32_t signs;
+  int nsigns;
+  int nleft;
   int i;
-  od_decode_band_pvq_splits(ec, ctx, y, n, k, 0);
+  if (ctx->pvq_runs) od_decode_band_pvq_runs(ec, ctx, y, n, k);
+  else od_decode_band_pvq_splits(ec, ctx, y, n, k, 0);
+  nleft = 0;
+  for (i = 0; i < n; i++) nleft += y[i] != 0;
+  signs = 0;
+  nsigns = 0;
   for (i = 0; i < n; i++) {
-    if (y[i] && od_ec_dec_bits(ec, 1, "pvq:sign")) y[i] = -y[i];
+    if (y[i]) {
+      if (nsigns == 0) {
+        nsigns = OD_MINI(nleft, OD_PVQ_SIGN_BATCH);
+        nleft -= nsigns;
+        signs = od_ec_dec_bits(ec, nsigns, OD_ACCT_ID_PVQ_SIGN);
+      }
+      if (signs & 1) y[i] = -y[i];
+      signs >>= 1;
+      nsigns--;
+    }
   }
 }
 
@@ -179,7 +199,7 @@ static void pvq_decode_partition(od_ec_dec *ec,
        it depends on max_theta, which depends on the gain. */
     id = od_decode_cdf_adapt(ec, &adapt->pvq.pvq_gaintheta_cdf[cdf_ctx][0],
      8 + 7*has_skip, adapt->pvq.pvq_gaintheta_increment,
-     "pvq:gaintheta");
+     OD_ACCT_ID_PVQ_GAINTHETA);
     if (!is_keyframe && id >= 10) id++;
     if (is_keyframe && id >= 8) id++;
     if (id >= 8) {
@@ -193,7 +213,7 @@ static void pvq_decode_partition(od_ec_dec *ec,
   /* The CfL flip bit is only decoded on the first band that has noref=0. */
   if (cfl->allow_flip && !*noref) {
     int flip;
-    flip = od_ec_dec_bits(ec, 1, "cfl:flip");
+    flip = od_ec_dec_bits(ec, 1, OD_ACCT_ID_CFL_FLIP);
     if (flip) {
       for (i = 0; i < cfl->nb_coeffs; i++) cfl->ref[i] = -cfl->ref[i];
     }
@@ -202,7 +222,8 @@ static void pvq_decode_partition(od_ec_dec *ec,
   if (qg > 0) {
     int tmp;
     tmp = *exg;
-    qg = 1 + generic_decode(ec, &model[!*noref], -1, &tmp, 2, "pvq:gain");
+    qg = 1 + generic_decode(ec, &model[!*noref], -1, &tmp, 2,
+     OD_ACCT_ID_PVQ_GAIN);
     OD_IIR_DIADIC(*exg, qg << 16, 2);
   }
   *skip = 0;
@@ -249,7 +270,7 @@ static void pvq_decode_partition(od_ec_dec *ec,
       int tmp;
       tmp = *ext;
       itheta = 2 + generic_decode(ec, &model[2], nodesync ? -1 : max_theta - 3,
-       &tmp, 2, "pvq:theta");
+       &tmp, 2, OD_ACCT_ID_PVQ_THETA);
       OD_IIR_DIADIC(*ext, itheta << 16, 2);
     }
     theta = od_pvq_compute_theta(itheta, max_theta);
@@ -360,7 +381,7 @@ void od_pvq_decode(daala_dec_ctx *dec,
         int j;
         skip_dir = od_decode_cdf_adapt(&dec->ec,
          &dec->state.adapt.pvq.pvq_skip_dir_cdf[(pli != 0) + 2*(bs - 1)][0], 7,
-         dec->state.adapt.pvq.pvq_skip_dir_increment, "pvq:skiprest");
+         dec->state.adapt.pvq.pvq_skip_dir_increment, OD_ACCT_ID_PVQ_SKIPREST);
         for (j = 0; j < 3; j++) skip_rest[j] = !!(skip_dir & (1 << j));
       }
     }
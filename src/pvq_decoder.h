@@ -32,22 +32,24 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 
 void od_decode_band_pvq_splits(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
  od_coeff *y, int n, int k, int level);
+void od_decode_band_pvq_runs(od_ec_dec *ec, od_pvq_codeword_ctx *adapt,
+ od_coeff *y, int n, int k);
 
 #if OD_ACCOUNTING
-# define laplace_decode_special(dec, decay, max, str) laplace_decode_special_(dec, decay, max, str)
-# define laplace_decode(dec, ex_q8, k, str) laplace_decode_(dec, ex_q8, k, str)
-#define laplace_decode_vector(dec, y, n, k, curr, means, str) laplace_decode_vector_(dec, y, n, k, curr, means, str)
+# define laplace_decode_special(dec, decay, max, acc_id) laplace_decode_special_(dec, decay, max, acc_id)
+# define laplace_decode(dec, ex_q8, k, acc_id) laplace_decode_(dec, ex_q8, k, acc_id)
+#define laplace_decode_vector(dec, y, n, k, curr, means, acc_id) laplace_decode_vector_(dec, y, n, k, curr, means, acc_id)
 #else
-# define laplace_decode_special(dec, decay, max, str) laplace_decode_special_(dec, decay, max)
-# define laplace_decode(dec, ex_q8, k, str) laplace_decode_(dec, ex_q8, k)
-#define laplace_decode_vector(dec, y, n, k, curr, means, str) laplace_decode_vector_(dec, y, n, k, curr, means)
+# define laplace_decode_special(dec, decay, max, acc_id) laplace_decode_special_(dec, decay, max)
+# define laplace_decode(dec, ex_q8, k, acc_id) laplace_decode_(dec, ex_q8, k)
+#define laplace_decode_vector(dec, y, n, k, curr, means, acc_id) laplace_decode_vector_(dec, y, n, k, curr, means)
 #endif
 
-int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_STR);
-int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_STR);
+int laplace_decode_special_(od_ec_dec *dec, unsigned decay, int max OD_ACC_ID);
+int laplace_decode_(od_ec_dec *dec, unsigned ex_q8, int k OD_ACC_ID);
 void laplace_decode_vector_(od_ec_dec *dec, od_coeff *y, int n, int k,
                                   int32_t *curr, const int32_t *means
-                                  OD_ACC_STR);
+                                  OD_ACC_ID);
 
 
 void od_pvq_decode(daala_dec_ctx *dec, od_coeff *ref, od_coeff *out, int q0,
@@ -41,13 +41,34 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
    dot-product of the 1st band of chroma with the luma ref doesn't overflow.*/
 #define OD_CFL_FLIP_SHIFT (OD_LIMIT_BSIZE_MAX + 0)
 
+/*The most signs written with a single od_ec_enc_bits() call.*/
+#define OD_PVQ_SIGN_BATCH (24)
+
 static void od_encode_pvq_codeword(od_ec_enc *ec, od_pvq_codeword_ctx *adapt,
  const od_coeff *in, int n, int k) {
+  uint32_t signs;
+  int nsigns;
   int i;
-  od_encode_band_pvq_splits(ec, adapt, in, n, k, 0);
-  for (i = 0; i < n; i++) if (in[i]) od_ec_enc_bits(ec, in[i] < 0, 1);
+  if (adapt->pvq_runs) od_encode_band_pvq_runs(ec, adapt, in, n, k);
+  else od_encode_band_pvq_splits(ec, adapt, in, n, k, 0);
+  /*Raw bits are packed in the order they are written, so batching the signs
+     produces the same stream as writing them one at a time.*/
+  signs = 0;
+  nsigns = 0;
+  for (i = 0; i < n; i++) {
+    if (in[i]) {
+      signs |= (uint32_t)(in[i] < 0) << nsigns;
+      if (++nsigns == OD_PVQ_SIGN_BATCH) {
+        od_ec_enc_bits(ec, signs, nsigns);
+        signs = 0;
+        nsigns = 0;
+      }
+    }
+  }
+  if (nsigns > 0) od_ec_enc_bits(ec, signs, nsigns);
 }
 
+#if defined(OD_FLOAT_PVQ)
 /* Computes 1/sqrt(i) using a table for small values. */
 static double od_rsqrt_table(int i) {
   static double table[16] = {
@@ -76,8 +97,10 @@ static void od_fill_dynamic_rsqrt_table(double *table, const int table_size,
 }
 
 /** Find the codepoint on the given PSphere closest to the desired
- * vector. Double-precision PVQ search just to make sure our tests
- * aren't limited by numerical accuracy.
+ * vector. The fixed-point search keeps all of its per-pulse state in
+ * integers; only the rate scale and the returned cosine distance are
+ * converted from/to floating point, once per search. The OD_FLOAT_PVQ
+ * build uses a double-precision search instead.
  *
  * @param [in]      xcoeff  input vector to quantize (x in the math doc)
  * @param [in]      n       number of dimensions
@@ -88,16 +111,15 @@ static void od_fill_dynamic_rsqrt_table(double *table, const int table_size,
  * @param [in] pvq_norm_lambda enc->pvq_norm_lambda for quantized RDO
  * @param [in]      prev_k  number of pulses already in ypulse that we should
  *                          reuse for the search (or 0 for a new search)
+ * @param [out]     x       work buffer of at least n values
  * @return                  cosine distance between x and y (between 0 and 1)
  */
-static double pvq_search_rdo_double(const od_val16 *xcoeff, int n, int k,
- od_coeff *ypulse, double g2, double pvq_norm_lambda, int prev_k) {
+static double pvq_search_rdo(const od_val16 *xcoeff, int n, int k,
+ od_coeff *ypulse, double g2, double pvq_norm_lambda, int prev_k,
+ od_val16 *x) {
   int i, j;
   double xy;
   double yy;
-  /* TODO - This blows our 8kB stack space budget and should be fixed when
-   converting PVQ to fixed point. */
-  double x[MAXN];
   double xx;
   double lambda;
   double norm_1;
@@ -206,6 +228,151 @@ static double pvq_search_rdo_double(const od_val16 *xcoeff, int n, int k,
   }
   return xy/(1e-100 + sqrt(xx*yy));
 }
+#else
+/*Number of fractional bits in the fixed-point RDO cost.*/
+# define OD_PVQ_SEARCH_COST_SHIFT (8)
+
+/** Find the codepoint on the given PSphere closest to the desired
+ * vector. The fixed-point search keeps all of its per-pulse state in
+ * integers; only the rate scale and the returned cosine distance are
+ * converted from/to floating point, once per search. The OD_FLOAT_PVQ
+ * build uses a double-precision search instead.
+ *
+ * @param [in]      xcoeff  input vector to quantize (x in the math doc)
+ * @param [in]      n       number of dimensions
+ * @param [in]      k       number of pulses
+ * @param [out]     ypulse  optimal codevector found (y in the math doc)
+ * @param [out]     g2      multiplier for the distortion (typically squared
+ *                          gain units)
+ * @param [in] pvq_norm_lambda enc->pvq_norm_lambda for quantized RDO
+ * @param [in]      prev_k  number of pulses already in ypulse that we should
+ *                          reuse for the search (or 0 for a new search)
+ * @param [out]     x       work buffer of at least n values
+ * @return                  cosine distance between x and y (between 0 and 1)
+ */
+static double pvq_search_rdo(const od_val16 *xcoeff, int n, int k,
+ od_coeff *ypulse, double g2, double pvq_norm_lambda, int prev_k,
+ od_val16 *x) {
+  int i;
+  int j;
+  int32_t xy;
+  int32_t yy;
+  int64_t xx;
+  int32_t xmax;
+  int64_t rate_scale;
+  int rdo_pulses;
+  xx = 0;
+  xy = yy = 0;
+  xmax = 0;
+  for (j = 0; j < n; j++) {
+    x[j] = (od_val16)OD_MINI(abs(xcoeff[j]), 32767);
+    xx += OD_MULT16_16(x[j], x[j]);
+    xmax = OD_MAXI(xmax, x[j]);
+  }
+  /*Scale of the rate term, in the same units as (x*y)/sqrt(y*y) (i.e. the
+     RDO cost below multiplied by sqrt(x*x)/2). The last position costs
+     about 3 bits more than the first.*/
+  rate_scale = (int64_t)floor(.5 + 1.5*(1 << OD_PVQ_SEARCH_COST_SHIFT)*
+   pvq_norm_lambda/(1e-30 + g2)*sqrt((double)xx)/n);
+  i = 0;
+  if (prev_k > 0 && prev_k <= k) {
+    /* We reuse pulses from a previous search so we don't have to search them
+       again. */
+    for (j = 0; j < n; j++) {
+      ypulse[j] = abs(ypulse[j]);
+      xy += x[j]*ypulse[j];
+      yy += ypulse[j]*ypulse[j];
+      i += ypulse[j];
+    }
+  }
+  else if (k > 2) {
+    int32_t l1_norm;
+    l1_norm = 0;
+    for (j = 0; j < n; j++) l1_norm += x[j];
+    for (j = 0; j < n; j++) {
+      ypulse[j] = l1_norm > 0 ? (od_coeff)((int64_t)k*x[j]/l1_norm) : 0;
+      xy += x[j]*ypulse[j];
+      yy += ypulse[j]*ypulse[j];
+      i += ypulse[j];
+    }
+  }
+  else OD_CLEAR(ypulse, n);
+  /* Only use RDO on the last few pulses. This not only saves CPU, but using
+     RDO on all pulses actually makes the results worse for reasons I don't
+     fully understand. */
+  rdo_pulses = 1 + k/4;
+  /* Search one pulse at a time */
+  for (; i < k - rdo_pulses; i++) {
+    int pos;
+    int rshift;
+    int32_t best_xy;
+    int32_t best_yy;
+    /*Shift so that (xy + x[j]) fits in 15 bits and its square in 30 bits.*/
+    rshift = OD_MAXI(0, OD_ILOG(xy + xmax) - 15);
+    pos = 0;
+    best_xy = 0;
+    best_yy = 1;
+    for (j = 0; j < n; j++) {
+      int32_t tmp_xy;
+      int32_t tmp_yy;
+      tmp_xy = (xy + x[j]) >> rshift;
+      tmp_yy = yy + 2*ypulse[j] + 1;
+      tmp_xy *= tmp_xy;
+      if (j == 0 || (int64_t)tmp_xy*best_yy > (int64_t)best_xy*tmp_yy) {
+        best_xy = tmp_xy;
+        best_yy = tmp_yy;
+        pos = j;
+      }
+    }
+    xy = xy + x[pos];
+    yy = yy + 2*ypulse[pos] + 1;
+    ypulse[pos]++;
+  }
+  /* Search last pulses with RDO. Distortion is D = (x-y)^2 = x^2 - 2*x*y + y^2
+     and since x^2 and y^2 are constant, we just maximize x*y, plus a
+     lambda*rate term. Since y isn't normalized here, we divide x*y by
+     sqrt(y^2), and scale the rate term by sqrt(x^2)/2 instead of normalizing
+     x. */
+  for (; i < k; i++) {
+    int16_t rsqrt_table[4];
+    int rsqrt_shift_table[4];
+    int rsqrt_table_size = 4;
+    int pos;
+    int64_t best_cost;
+    pos = 0;
+    best_cost = 0;
+    /*Fill the small rsqrt lookup table with
+       rsqrt(yy + 1), rsqrt(yy + 2 + 1) .. rsqrt(yy + 2*3 + 1).*/
+    for (j = 0; j < rsqrt_table_size; j++) {
+      rsqrt_table[j] = od_rsqrt(yy + 2*j + 1, &rsqrt_shift_table[j]);
+    }
+    for (j = 0; j < n; j++) {
+      int64_t tmp_xy;
+      int16_t rsqrt;
+      int rsqrt_shift;
+      /*Calculate rsqrt(yy + 2*ypulse[j] + 1), using the table when we can.*/
+      if (ypulse[j] < rsqrt_table_size) {
+        rsqrt = rsqrt_table[ypulse[j]];
+        rsqrt_shift = rsqrt_shift_table[ypulse[j]];
+      }
+      else rsqrt = od_rsqrt(yy + 2*ypulse[j] + 1, &rsqrt_shift);
+      tmp_xy = ((int64_t)(xy + x[j])*rsqrt >>
+       (rsqrt_shift - OD_PVQ_SEARCH_COST_SHIFT)) - j*rate_scale;
+      if (j == 0 || tmp_xy > best_cost) {
+        best_cost = tmp_xy;
+        pos = j;
+      }
+    }
+    xy = xy + x[pos];
+    yy = yy + 2*ypulse[pos] + 1;
+    ypulse[pos]++;
+  }
+  for (i = 0; i < n; i++) {
+    if (xcoeff[i] < 0) ypulse[i] = -ypulse[i];
+  }
+  return xy/(1e-100 + sqrt((double)xx*yy));
+}
+#endif
 
 /** Encodes the gain so that the return value increases with the
  * distance |x-ref|, so that we can encode a zero when x=ref. The
@@ -310,16 +477,18 @@ int items_compare(pvq_search_item *a, pvq_search_item *b) {
  * @param [in]     qm_inv    Inverse of QM with magnitude compensation
  * @param [in] pvq_norm_lambda enc->pvq_norm_lambda for quantized RDO
  * @param [in]     speed     Make search faster by making approximations
+ * @param [in,out] scratch   scratch arena for the search buffers
  * @return         gain      index of the quatized gain
 */
 static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
  int n, int q0, od_coeff *y, int *itheta, int *max_theta, int *vk,
  od_val16 beta, double *skip_diff, int robust, int is_keyframe, int pli,
  const od_adapt_ctx *adapt, const int16_t *qm,
- const int16_t *qm_inv, double pvq_norm_lambda, int speed) {
+ const int16_t *qm_inv, double pvq_norm_lambda, int speed,
+ od_scratch *scratch) {
   od_val32 g;
   od_val32 gr;
-  od_coeff y_tmp[MAXN];
+  od_coeff *y_tmp;
   int i;
   /* Number of pulses. */
   int k;
@@ -348,13 +517,20 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
   int cfl_enabled;
   int skip;
   double gain_weight;
-  od_val16 x16[MAXN];
-  od_val16 r16[MAXN];
+  od_val16 *x16;
+  od_val16 *r16;
+  od_val16 *search_buf;
   int xshift;
   int rshift;
+  size_t scratch_mark;
   /* Give more weight to gain error when calculating the total distortion. */
   gain_weight = 1.4;
   OD_ASSERT(n > 1);
+  scratch_mark = od_scratch_mark(scratch);
+  y_tmp = OD_SCRATCH_ALLOC(scratch, od_coeff, n);
+  x16 = OD_SCRATCH_ALLOC(scratch, od_val16, n);
+  r16 = OD_SCRATCH_ALLOC(scratch, od_val16, n);
+  search_buf = OD_SCRATCH_ALLOC(scratch, od_val16, n);
   corr = 0;
 #if !defined(OD_FLOAT_PVQ)
   /* Shift needed to make x fit in 16 bits even after rotation.
@@ -434,7 +610,7 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
   }
   dist0 = best_dist;
   if (n <= OD_MAX_PVQ_SIZE && !od_vector_is_null(r0, n) && corr > 0) {
-    od_val16 xr[MAXN];
+    od_val16 *xr;
     int gain_bound;
     int prev_k;
     pvq_search_item items[MAX_PVQ_ITEMS];
@@ -442,6 +618,7 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
     int nitems;
     double cos_dist;
     idx = 0;
+    xr = OD_SCRATCH_ALLOC(scratch, od_val16, n);
     gain_bound = OD_SHR(cg - gain_offset, OD_CGAIN_SHIFT);
     /* Perform theta search only if prediction is useful. */
     theta = OD_ROUND32(OD_THETA_SCALE*acos(corr));
@@ -521,8 +698,9 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
         OD_CLEAR(y_tmp, n-1);
       }
       else if (k != prev_k) {
-        cos_dist = pvq_search_rdo_double(xr, n - 1, k, y_tmp,
-         qcg*(double)cg*sin_prod*OD_CGAIN_SCALE_2, pvq_norm_lambda, prev_k);
+        cos_dist = pvq_search_rdo(xr, n - 1, k, y_tmp,
+         qcg*(double)cg*sin_prod*OD_CGAIN_SCALE_2, pvq_norm_lambda, prev_k,
+         search_buf);
       }
       prev_k = k;
       /* See Jmspeex' Journal of Dubious Theoretical Results. */
@@ -568,8 +746,8 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
       dist = gain_weight*(qcg - cg)*(qcg - cg);
       dist *= OD_CGAIN_SCALE_2;
       if (dist > dist0 && k != 0) continue;
-      cos_dist = pvq_search_rdo_double(x16, n, k, y_tmp,
-       qcg*(double)cg*OD_CGAIN_SCALE_2, pvq_norm_lambda, prev_k);
+      cos_dist = pvq_search_rdo(x16, n, k, y_tmp,
+       qcg*(double)cg*OD_CGAIN_SCALE_2, pvq_norm_lambda, prev_k, search_buf);
       prev_k = k;
       /* See Jmspeex' Journal of Dubious Theoretical Results. */
       dist = gain_weight*(qcg - cg)*(qcg - cg)
@@ -615,6 +793,7 @@ static int pvq_theta(od_coeff *out, const od_coeff *x0, const od_coeff *r0,
   }
   *vk = k;
   *skip_diff += skip_dist - best_dist;
+  od_scratch_release(scratch, scratch_mark);
   /* Encode gain differently depending on whether we use prediction or not.
      Special encoding on inter frames where qg=0 is allowed for noref=0
      but not noref=1.*/
@@ -788,7 +967,7 @@ int od_pvq_encode(daala_enc_ctx *enc,
   int max_theta[PVQ_MAX_PARTITIONS];
   int qg[PVQ_MAX_PARTITIONS];
   int k[PVQ_MAX_PARTITIONS];
-  od_coeff y[OD_BSIZE_MAX*OD_BSIZE_MAX];
+  od_coeff *y;
   int *exg;
   int *ext;
   int nb_bands;
@@ -808,11 +987,15 @@ int od_pvq_encode(daala_enc_ctx *enc,
   int skip_theta_value;
   const unsigned char *pvq_qm;
   double dc_rate;
+  size_t scratch_mark;
+  int ret;
 #if !OD_SIGNAL_Q_SCALING
   OD_UNUSED(q_scaling);
   OD_UNUSED(bx);
   OD_UNUSED(by);
 #endif
+  scratch_mark = od_scratch_mark(&enc->scratch);
+  y = OD_SCRATCH_ALLOC(&enc->scratch, od_coeff, 1 << (2*bs + 4));
   pvq_qm = &enc->state.pvq_qm_q4[pli][0];
   exg = &enc->state.adapt.pvq.pvq_exg[pli][bs][0];
   ext = enc->state.adapt.pvq.pvq_ext + bs*PVQ_MAX_PARTITIONS;
@@ -856,7 +1039,7 @@ int od_pvq_encode(daala_enc_ctx *enc,
      q, y + off[i], &theta[i], &max_theta[i],
      &k[i], beta[i], &skip_diff, robust, is_keyframe, pli,
      &enc->state.adapt, qm + off[i], qm_inv + off[i], enc->pvq_norm_lambda,
-     speed);
+     speed, &enc->scratch);
   }
   od_encode_checkpoint(enc, &buf);
   if (is_keyframe) out[0] = 0;
@@ -928,6 +1111,7 @@ int od_pvq_encode(daala_enc_ctx *enc,
     }
     tell -= (int)floor(.5+8*skip_rate);
   }
+  ret = 0;
   if (nb_bands == 0 || skip_diff <= enc->pvq_norm_lambda/8*tell) {
     if (is_keyframe) out[0] = 0;
     else {
@@ -953,7 +1137,8 @@ int od_pvq_encode(daala_enc_ctx *enc,
 #endif
     if (is_keyframe) for (i = 1; i < 1 << (2*bs + 4); i++) out[i] = 0;
     else for (i = 1; i < 1 << (2*bs + 4); i++) out[i] = ref[i];
-    if (out[0] == 0) return 1;
+    if (out[0] == 0) ret = 1;
   }
-  return 0;
+  od_scratch_release(&enc->scratch, scratch_mark);
+  return ret;
 }
@@ -0,0 +1,178 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <string.h>
+#include "../include/daala/daaladec.h"
+#include "internal.h"
+
+/*A serialized seek index is:
+   - The 4 byte magic OD_SEEK_INDEX_MAGIC and a version byte.
+   - The number of entries.
+   - For each entry, the increase in frame and offset from the previous
+      entry (or from 0 for the first one), and the skip count.
+  Every number is stored in as many bytes as it needs, 7 bits at a time,
+   least significant first, with the high bit set in all bytes but the
+   last.*/
+
+static const unsigned char OD_SEEK_INDEX_MAGIC[4] = { 'D', 'S', 'I', 'X' };
+#define OD_SEEK_INDEX_VERSION (0)
+
+/*The most bytes a number can take: enough for a non-negative int64_t.*/
+#define OD_SEEK_VARINT_MAX (9)
+
+/*Stores val at buf[pos], if it fits in buf_sz bytes.
+  Return: The position after it.*/
+static size_t od_seek_write_varint(unsigned char *buf, size_t buf_sz,
+ size_t pos, uint64_t val) {
+  do {
+    unsigned char byte;
+    byte = (unsigned char)(val & 0x7F);
+    val >>= 7;
+    if (val) byte |= 0x80;
+    if (buf != NULL && pos < buf_sz) buf[pos] = byte;
+    pos++;
+  }
+  while (val);
+  return pos;
+}
+
+/*Reads a number from buf[*pos], advancing *pos past it.
+  Return: The number, or -1 if it is truncated or too large.*/
+static int64_t od_seek_read_varint(const unsigned char *buf, size_t buf_sz,
+ size_t *pos) {
+  uint64_t val;
+  int shift;
+  int i;
+  val = 0;
+  shift = 0;
+  for (i = 0; i < OD_SEEK_VARINT_MAX; i++) {
+    unsigned char byte;
+    if (*pos >= buf_sz) return -1;
+    byte = buf[(*pos)++];
+    val |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+    if (!(byte & 0x80)) return (int64_t)val;
+  }
+  return -1;
+}
+
+int daala_seek_index_pack(unsigned char *buf, size_t buf_sz,
+ const daala_seek_point *points, int npoints) {
+  int64_t frame;
+  int64_t offset;
+  size_t pos;
+  int i;
+  OD_RETURN_CHECK(npoints >= 0, OD_EINVAL);
+  OD_RETURN_CHECK(points != NULL || npoints == 0, OD_EFAULT);
+  if (buf_sz < sizeof(OD_SEEK_INDEX_MAGIC) + 1) buf = NULL;
+  if (buf != NULL) {
+    OD_COPY(buf, OD_SEEK_INDEX_MAGIC, sizeof(OD_SEEK_INDEX_MAGIC));
+    buf[sizeof(OD_SEEK_INDEX_MAGIC)] = OD_SEEK_INDEX_VERSION;
+  }
+  pos = sizeof(OD_SEEK_INDEX_MAGIC) + 1;
+  pos = od_seek_write_varint(buf, buf_sz, pos, npoints);
+  frame = -1;
+  offset = 0;
+  for (i = 0; i < npoints; i++) {
+    OD_RETURN_CHECK(points[i].frame > frame, OD_EINVAL);
+    OD_RETURN_CHECK(points[i].offset >= offset, OD_EINVAL);
+    OD_RETURN_CHECK(points[i].skip >= 0, OD_EINVAL);
+    pos = od_seek_write_varint(buf, buf_sz, pos,
+     points[i].frame - (i > 0 ? frame : 0));
+    pos = od_seek_write_varint(buf, buf_sz, pos, points[i].offset - offset);
+    pos = od_seek_write_varint(buf, buf_sz, pos, points[i].skip);
+    frame = points[i].frame;
+    offset = points[i].offset;
+  }
+  OD_RETURN_CHECK(pos <= INT_MAX, OD_EINVAL);
+  return (int)pos;
+}
+
+int daala_seek_index_unpack(daala_seek_point *points, int npoints_max,
+ const unsigned char *buf, size_t buf_sz) {
+  int64_t npoints;
+  int64_t frame;
+  int64_t offset;
+  size_t pos;
+  int i;
+  OD_RETURN_CHECK(buf, OD_EFAULT);
+  if (buf_sz < sizeof(OD_SEEK_INDEX_MAGIC) + 1
+   || memcmp(buf, OD_SEEK_INDEX_MAGIC, sizeof(OD_SEEK_INDEX_MAGIC)) != 0) {
+    return OD_ENOTFORMAT;
+  }
+  if (buf[sizeof(OD_SEEK_INDEX_MAGIC)] != OD_SEEK_INDEX_VERSION) {
+    return OD_EVERSION;
+  }
+  pos = sizeof(OD_SEEK_INDEX_MAGIC) + 1;
+  npoints = od_seek_read_varint(buf, buf_sz, &pos);
+  /*Every entry takes at least 3 bytes.*/
+  if (npoints < 0 || npoints > INT_MAX
+   || npoints > (int64_t)(buf_sz - pos)/3) {
+    return OD_EBADHEADER;
+  }
+  frame = 0;
+  offset = 0;
+  for (i = 0; i < npoints; i++) {
+    int64_t dframe;
+    int64_t doffset;
+    int64_t skip;
+    dframe = od_seek_read_varint(buf, buf_sz, &pos);
+    doffset = od_seek_read_varint(buf, buf_sz, &pos);
+    skip = od_seek_read_varint(buf, buf_sz, &pos);
+    if (dframe < 0 || doffset < 0 || skip < 0 || skip > INT_MAX
+     || (i > 0 && dframe == 0) || dframe > INT64_MAX - frame
+     || doffset > INT64_MAX - offset) {
+      return OD_EBADHEADER;
+    }
+    frame += dframe;
+    offset += doffset;
+    if (points != NULL && i < npoints_max) {
+      points[i].frame = frame;
+      points[i].offset = offset;
+      points[i].skip = (int)skip;
+    }
+  }
+  return (int)npoints;
+}
+
+int daala_seek_index_find(const daala_seek_point *points, int npoints,
+ int64_t frame) {
+  int lo;
+  int hi;
+  if (points == NULL) return -1;
+  /*Find the first entry after frame.*/
+  lo = 0;
+  hi = npoints;
+  while (lo < hi) {
+    int mid;
+    mid = lo + ((hi - lo) >> 1);
+    if (points[mid].frame <= frame) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo - 1;
+}
@@ -228,50 +228,79 @@ void od_img_copy(daala_image* dst, daala_image* src) {
   }
 }
 
-/*Initializes the buffers used for reference frames.
-  These buffers are padded with 16 extra pixels on each side, to allow
-   (relatively) unrestricted motion vectors without special casing reading
-   outside the image boundary.
-  If chroma is decimated in either direction, the padding is reduced by an
-   appropriate factor on the appropriate sides.*/
-static int od_state_ref_imgs_init(od_state *state, int nrefs) {
-  daala_info *info;
-  daala_image *img;
-  daala_image_plane *iplane;
-  unsigned char *ref_img_data;
+/*Returns the number of bytes needed to hold one padded reference image.*/
+size_t od_state_ref_img_sz(const od_state *state) {
+  const daala_info *info;
   size_t data_sz;
   int frame_buf_width;
   int frame_buf_height;
+  int reference_bytes;
+  int pli;
+  info = &state->info;
+  reference_bytes = info->full_precision_references ? 2 : 1;
+  frame_buf_width = state->frame_width + (OD_BUFFER_PADDING << 1);
+  frame_buf_height = state->frame_height + (OD_BUFFER_PADDING << 1);
+  data_sz = 0;
+  for (pli = 0; pli < info->nplanes; pli++) {
+    data_sz += (size_t)(frame_buf_width >> info->plane_info[pli].xdec)*
+     (frame_buf_height >> info->plane_info[pli].ydec)*reference_bytes;
+  }
+  return data_sz;
+}
+
+/*Points the planes of a reference image into data, which must hold at least
+   od_state_ref_img_sz() bytes.
+  The planes are laid out one after another, each padded with
+   OD_BUFFER_PADDING pixels on every side (reduced by the decimation on the
+   decimated sides).*/
+void od_state_ref_img_setup(const od_state *state, daala_image *img,
+ unsigned char *data) {
+  const daala_info *info;
+  daala_image_plane *iplane;
+  int frame_buf_width;
+  int frame_buf_height;
   int plane_buf_width;
   int plane_buf_height;
   int reference_bytes;
   int reference_bits;
-  int imgi;
   int pli;
-  OD_ASSERT(nrefs == 4);
   info = &state->info;
-  data_sz = 0;
   /*Reference bit depth is constant over the lifetime of od_state, and by
     extension, an encode or decode ctx.*/
-  reference_bytes = state->info.full_precision_references ? 2 : 1;
-  reference_bits = state->info.full_precision_references ? 8 +
-   OD_COEFF_SHIFT : 8;
-  /*TODO: Check for overflow before allocating.*/
+  reference_bytes = info->full_precision_references ? 2 : 1;
+  reference_bits = info->full_precision_references ? 8 + OD_COEFF_SHIFT : 8;
   frame_buf_width = state->frame_width + (OD_BUFFER_PADDING << 1);
   frame_buf_height = state->frame_height + (OD_BUFFER_PADDING << 1);
-  /*Reserve space for the motion comp buffers.*/
-  data_sz += OD_MVBSIZE_MAX*OD_MVBSIZE_MAX*reference_bytes*5;
-  for (pli = 0; pli < info->nplanes; pli++) {
-    /*Reserve space for this plane in nrefs reference images.*/
-    plane_buf_width = frame_buf_width >> info->plane_info[pli].xdec;
-    plane_buf_height = frame_buf_height >> info->plane_info[pli].ydec;
-    data_sz += plane_buf_width*plane_buf_height*reference_bytes*nrefs;
-  }
-  state->ref_img_data = ref_img_data =
-    (unsigned char *)od_aligned_malloc(data_sz, 32);
-  if (OD_UNLIKELY(!ref_img_data)) {
-    return OD_EFAULT;
+  img->nplanes = info->nplanes;
+  img->width = state->frame_width;
+  img->height = state->frame_height;
+  for (pli = 0; pli < img->nplanes; pli++) {
+    iplane = img->planes + pli;
+    iplane->xdec = info->plane_info[pli].xdec;
+    iplane->ydec = info->plane_info[pli].ydec;
+    plane_buf_width = frame_buf_width >> iplane->xdec;
+    plane_buf_height = frame_buf_height >> iplane->ydec;
+    iplane->bitdepth = reference_bits;
+    iplane->xstride = reference_bytes;
+    iplane->ystride = plane_buf_width*reference_bytes;
+    iplane->data = data
+     + (OD_BUFFER_PADDING >> iplane->xdec)*iplane->xstride
+     + (OD_BUFFER_PADDING >> iplane->ydec)*iplane->ystride;
+    data += plane_buf_height*iplane->ystride;
   }
+}
+
+/*Lays out the motion comp buffers and nrefs reference images for the current
+   frame size in ref_img_data, and marks all of the reference images
+   available.*/
+static void od_state_ref_imgs_setup(od_state *state, int nrefs) {
+  unsigned char *ref_img_data;
+  size_t img_sz;
+  int reference_bytes;
+  int imgi;
+  reference_bytes = state->info.full_precision_references ? 2 : 1;
+  img_sz = od_state_ref_img_sz(state);
+  ref_img_data = state->ref_img_data;
   /*Fill in the motion comp buffers.*/
   for (imgi = 0; imgi < 5; imgi++) {
     state->mc_buf[imgi] = ref_img_data;
@@ -279,27 +308,37 @@ static int od_state_ref_imgs_init(od_state *state, int nrefs) {
   }
   /*Fill in the reference image structures.*/
   for (imgi = 0; imgi < nrefs; imgi++) {
-    img = state->ref_imgs + imgi;
-    img->nplanes = info->nplanes;
-    img->width = state->frame_width;
-    img->height = state->frame_height;
-    for (pli = 0; pli < img->nplanes; pli++) {
-      iplane = img->planes + pli;
-      iplane->xdec = info->plane_info[pli].xdec;
-      iplane->ydec = info->plane_info[pli].ydec;
-      plane_buf_width = frame_buf_width >> iplane->xdec;
-      plane_buf_height = frame_buf_height >> iplane->ydec;
-      iplane->bitdepth = reference_bits;
-      iplane->xstride = reference_bytes;
-      iplane->ystride = plane_buf_width*reference_bytes;
-      iplane->data = ref_img_data
-       + (OD_BUFFER_PADDING >> iplane->xdec)*iplane->xstride
-       + (OD_BUFFER_PADDING >> iplane->ydec)*iplane->ystride;
-      ref_img_data += plane_buf_height*iplane->ystride;
-    }
+    od_state_ref_img_setup(state, state->ref_imgs + imgi, ref_img_data);
+    ref_img_data += img_sz;
   }
   /*Mark all of the reference image buffers available.*/
   for (imgi = 0; imgi < nrefs; imgi++) state->ref_imgi[imgi] = -1;
+}
+
+/*Initializes the buffers used for reference frames.
+  These buffers are padded with 16 extra pixels on each side, to allow
+   (relatively) unrestricted motion vectors without special casing reading
+   outside the image boundary.
+  If chroma is decimated in either direction, the padding is reduced by an
+   appropriate factor on the appropriate sides.*/
+static int od_state_ref_imgs_init(od_state *state, int nrefs) {
+  unsigned char *ref_img_data;
+  size_t data_sz;
+  size_t img_sz;
+  int reference_bytes;
+  OD_ASSERT(nrefs == 4);
+  reference_bytes = state->info.full_precision_references ? 2 : 1;
+  /*TODO: Check for overflow before allocating.*/
+  img_sz = od_state_ref_img_sz(state);
+  /*Reserve space for the motion comp buffers and nrefs reference images.*/
+  data_sz = OD_MVBSIZE_MAX*OD_MVBSIZE_MAX*reference_bytes*5 + img_sz*nrefs;
+  state->ref_img_data_sz = data_sz;
+  state->ref_img_data = ref_img_data =
+    (unsigned char *)od_aligned_malloc(data_sz, 32);
+  if (OD_UNLIKELY(!ref_img_data)) {
+    return OD_EFAULT;
+  }
+  od_state_ref_imgs_setup(state, nrefs);
   return OD_SUCCESS;
 }
 
@@ -351,12 +390,48 @@ static void od_state_opt_vtbl_init(od_state *state) {
 #endif
 }
 
+/*Derives the frame size and the number of blocks from state->info.*/
+static void od_state_set_frame_size(od_state *state) {
+  /*Frame size is a multiple of a super block.*/
+  state->frame_width = (state->info.pic_width + (OD_BSIZE_MAX - 1)) &
+   ~(OD_BSIZE_MAX - 1);
+  state->frame_height = (state->info.pic_height + (OD_BSIZE_MAX - 1)) &
+   ~(OD_BSIZE_MAX - 1);
+  state->nhmvbs = state->frame_width >> OD_LOG_MVBSIZE_MIN;
+  state->nvmvbs = state->frame_height >> OD_LOG_MVBSIZE_MIN;
+  state->nhsb = state->frame_width >> OD_LOG_BSIZE_MAX;
+  state->nvsb = state->frame_height >> OD_LOG_BSIZE_MAX;
+}
+
+/*Sets the strides of the block size and skip arrays for the current frame
+   size, and points bsize past the top and left padding.
+  state->bsize must point at the start of its allocation.*/
+static void od_state_set_bstrides(od_state *state) {
+  state->bstride = (state->nhsb + 2)*OD_BSIZE_GRID;
+  state->bsize += OD_BSIZE_GRID*state->bstride + OD_BSIZE_GRID;
+  state->skip_stride = state->nhsb << (OD_NBSIZES - 1);
+}
+
+/*Checks that this library can code the stream version in info.*/
+static int od_state_check_version(const daala_info *info) {
+  OD_RETURN_CHECK(info->version_major == OD_VERSION_MAJOR, OD_EVERSION);
+  OD_RETURN_CHECK(info->version_minor <= OD_VERSION_MINOR, OD_EVERSION);
+  return OD_SUCCESS;
+}
+
+/*Selects the coding tools that depend on the stream version.*/
+static void od_state_set_version(od_state *state) {
+  state->adapt.pvq.pvq_codeword_ctx.pvq_runs =
+   state->info.version_minor >= OD_STREAM_VERSION_MINOR_PVQ_RUNS;
+}
+
 static int od_state_init_impl(od_state *state, const daala_info *info) {
   int nplanes;
   int pli;
   OD_CLEAR(state, 1);
   /*First validate the parameters.*/
   if (info == NULL) return OD_EFAULT;
+  if (od_state_check_version(info) < 0) return OD_EVERSION;
   nplanes = info->nplanes;
   if (nplanes <= 0 || nplanes > OD_NPLANES_MAX) return OD_EINVAL;
   /*The first plane (the luma plane) must not be subsampled.*/
@@ -372,13 +447,10 @@ static int od_state_init_impl(od_state *state, const daala_info *info) {
     return OD_EINVAL;
   }
   OD_COPY(&state->info, info, 1);
-  /*Frame size is a multiple of a super block.*/
-  state->frame_width = (info->pic_width + (OD_BSIZE_MAX - 1)) &
-   ~(OD_BSIZE_MAX - 1);
-  state->frame_height = (info->pic_height + (OD_BSIZE_MAX - 1)) &
-   ~(OD_BSIZE_MAX - 1);
-  state->nhmvbs = state->frame_width >> OD_LOG_MVBSIZE_MIN;
-  state->nvmvbs = state->frame_height >> OD_LOG_MVBSIZE_MIN;
+  od_state_set_version(state);
+  od_state_set_frame_size(state);
+  state->max_frame_width = state->frame_width;
+  state->max_frame_height = state->frame_height;
   od_state_opt_vtbl_init(state);
   if (OD_UNLIKELY(od_state_ref_imgs_init(state, OD_FRAME_MAX + 1))) {
     return OD_EFAULT;
@@ -386,8 +458,6 @@ static int od_state_init_impl(od_state *state, const daala_info *info) {
   if (OD_UNLIKELY(od_state_mvs_init(state))) {
     return OD_EFAULT;
   }
-  state->nhsb = state->frame_width >> OD_LOG_BSIZE_MAX;
-  state->nvsb = state->frame_height >> OD_LOG_BSIZE_MAX;
   for (pli = 0; pli < nplanes; pli++) {
     int xdec;
     int ydec;
@@ -448,15 +518,19 @@ static int od_state_init_impl(od_state *state, const daala_info *info) {
     if (OD_UNLIKELY(!state->bskip[pli])) {
       return OD_EFAULT;
     }
+    state->bskip_mask[pli] = (uint16_t *)malloc(
+     sizeof(*state->bskip_mask[pli])*state->nhsb*state->nvsb
+     *OD_BSKIP_MASK_ROWS);
+    if (OD_UNLIKELY(!state->bskip_mask[pli])) {
+      return OD_EFAULT;
+    }
   }
   state->bsize = (unsigned char *)malloc(sizeof(*state->bsize)*
    (state->nhsb + 2)*OD_BSIZE_GRID*(state->nvsb + 2)*OD_BSIZE_GRID);
   if (OD_UNLIKELY(!state->bsize)) {
     return OD_EFAULT;
   }
-  state->bstride = (state->nhsb + 2)*OD_BSIZE_GRID;
-  state->bsize += OD_BSIZE_GRID*state->bstride + OD_BSIZE_GRID;
-  state->skip_stride = state->nhsb << (OD_NBSIZES - 1);
+  od_state_set_bstrides(state);
 #if defined(OD_DUMP_IMAGES) || defined(OD_DUMP_RECONS)
   state->dump_tags = 0;
   state->dump_files = 0;
@@ -479,14 +553,6 @@ static int od_state_init_impl(od_state *state, const daala_info *info) {
   if (OD_UNLIKELY(!state->sb_q_scaling)) {
     return OD_EFAULT;
   }
-  state->qm = (int16_t *)malloc(OD_QM_BUFFER_SIZE*sizeof(state->qm[0]));
-  if (OD_UNLIKELY(!state->qm)) {
-    return OD_EFAULT;
-  }
-  state->qm_inv = (int16_t *)malloc(OD_QM_BUFFER_SIZE*sizeof(state->qm_inv[0]));
-  if (OD_UNLIKELY(!state->qm_inv)) {
-    return OD_EFAULT;
-  }
   return OD_SUCCESS;
 }
 
@@ -499,6 +565,62 @@ int od_state_init(od_state *state, const daala_info *info) {
   return ret;
 }
 
+/*Checks whether state can be re-targeted at the stream described by info with
+   od_state_reset().
+  The stream must use the same planes, bit depth and reference precision,
+   and its frame must fit in the one state was created for.*/
+int od_state_check_reset(const od_state *state, const daala_info *info) {
+  int frame_width;
+  int frame_height;
+  int pli;
+  OD_RETURN_CHECK(info, OD_EFAULT);
+  if (od_state_check_version(info) < 0) return OD_EVERSION;
+  OD_RETURN_CHECK(info->nplanes == state->info.nplanes, OD_EINVAL);
+  for (pli = 0; pli < info->nplanes; pli++) {
+    OD_RETURN_CHECK(info->plane_info[pli].xdec ==
+     state->info.plane_info[pli].xdec, OD_EINVAL);
+    OD_RETURN_CHECK(info->plane_info[pli].ydec ==
+     state->info.plane_info[pli].ydec, OD_EINVAL);
+  }
+  OD_RETURN_CHECK(info->bitdepth_mode == state->info.bitdepth_mode,
+   OD_EINVAL);
+  OD_RETURN_CHECK(info->full_precision_references ==
+   state->info.full_precision_references, OD_EINVAL);
+  frame_width = (info->pic_width + (OD_BSIZE_MAX - 1)) & ~(OD_BSIZE_MAX - 1);
+  frame_height = (info->pic_height + (OD_BSIZE_MAX - 1)) &
+   ~(OD_BSIZE_MAX - 1);
+  OD_RETURN_CHECK(frame_width > 0 && frame_width <= state->max_frame_width,
+   OD_EINVAL);
+  OD_RETURN_CHECK(frame_height > 0 && frame_height <= state->max_frame_height,
+   OD_EINVAL);
+  return OD_SUCCESS;
+}
+
+/*Re-targets state at the stream described by info without reallocating any
+   of its buffers, as though it had just been created with od_state_init().
+  Return: OD_EINVAL or OD_EVERSION if od_state_check_reset() fails, in which
+   case state is left untouched.*/
+int od_state_reset(od_state *state, const daala_info *info) {
+  int ret;
+  ret = od_state_check_reset(state, info);
+  if (ret < 0) return ret;
+  state->bsize -= OD_BSIZE_GRID*state->bstride + OD_BSIZE_GRID;
+  OD_COPY(&state->info, info, 1);
+  od_state_set_version(state);
+  od_state_set_frame_size(state);
+  od_state_set_bstrides(state);
+  od_state_ref_imgs_setup(state, OD_FRAME_MAX + 1);
+  /*Give the grid the same layout as a newly allocated one of this size.*/
+  od_relayout_2d((void **)state->mv_grid, state->nvmvbs + 1,
+   state->nhmvbs + 1, sizeof(state->mv_grid[0][0]));
+  OD_CLEAR(state->mv_grid[0], (state->nvmvbs + 1)*(state->nhmvbs + 1));
+  state->cur_time = 0;
+  state->out_buff_ptr = -1;
+  state->out_buff_head = 0;
+  state->frames_in_out_buff = 0;
+  return OD_SUCCESS;
+}
+
 void od_state_clear(od_state *state) {
   int pli;
 #if defined(OD_DUMP_IMAGES) || defined(OD_DUMP_RECONS)
@@ -525,11 +647,12 @@ void od_state_clear(od_state *state) {
     state->bsize -= OD_BSIZE_GRID*state->bstride + OD_BSIZE_GRID;
     free(state->bsize);
   }
-  for (pli = 0; pli < 3; pli++) free(state->bskip[pli]);
+  for (pli = 0; pli < 3; pli++) {
+    free(state->bskip[pli]);
+    free(state->bskip_mask[pli]);
+  }
   free(state->dering_level);
   free(state->sb_q_scaling);
-  free(state->qm);
-  free(state->qm_inv);
 }
 
 void od_adapt_ctx_reset(od_adapt_ctx *state, int is_keyframe) {
@@ -929,48 +1052,124 @@ int od_state_dump_img(od_state *state, daala_image *img, const char *tag) {
 }
 #endif
 
-void od_state_mc_predict(od_state *state, daala_image *img_dst) {
+/*Computes the motion-compensated prediction of a single superblock row.*/
+void od_state_mc_predict_sb_row(od_state *state, daala_image *img_dst,
+ int sby) {
   int nhmvbs;
-  int nvmvbs;
   int pli;
   int vx;
   int vy;
+  OD_ASSERT(OD_LOG_MVBSIZE_MAX == OD_LOG_BSIZE_MAX);
   nhmvbs = state->nhmvbs;
-  nvmvbs = state->nvmvbs;
-  for (vy = 0; vy < nvmvbs; vy += OD_MVB_DELTA0) {
-    for (vx = 0; vx < nhmvbs; vx += OD_MVB_DELTA0) {
-      for (pli = 0; pli < img_dst->nplanes; pli++) {
-        daala_image_plane *iplane_dst;
-        int blk_x;
-        int blk_y;
-        int xstride;
-        int ystride;
-        iplane_dst = img_dst->planes + pli;
-        blk_x = vx << OD_LOG_MVBSIZE_MIN >> iplane_dst->xdec;
-        blk_y = vy << OD_LOG_MVBSIZE_MIN >> iplane_dst->ydec;
-        xstride = iplane_dst->xstride;
-        ystride = iplane_dst->ystride;
-        od_state_pred_block(state,
-         iplane_dst->data + blk_y*ystride + blk_x*xstride,
-         ystride, xstride, pli, vx, vy, OD_LOG_MVB_DELTA0);
-      }
+  vy = sby << OD_LOG_MVB_DELTA0;
+  for (vx = 0; vx < nhmvbs; vx += OD_MVB_DELTA0) {
+    for (pli = 0; pli < img_dst->nplanes; pli++) {
+      daala_image_plane *iplane_dst;
+      int blk_x;
+      int blk_y;
+      int xstride;
+      int ystride;
+      iplane_dst = img_dst->planes + pli;
+      blk_x = vx << OD_LOG_MVBSIZE_MIN >> iplane_dst->xdec;
+      blk_y = vy << OD_LOG_MVBSIZE_MIN >> iplane_dst->ydec;
+      xstride = iplane_dst->xstride;
+      ystride = iplane_dst->ystride;
+      od_state_pred_block(state,
+       iplane_dst->data + blk_y*ystride + blk_x*xstride,
+       ystride, xstride, pli, vx, vy, OD_LOG_MVB_DELTA0);
     }
   }
 }
 
+void od_state_mc_predict(od_state *state, daala_image *img_dst) {
+  int nvmvbs;
+  int sby;
+  nvmvbs = state->nvmvbs;
+  for (sby = 0; sby << OD_LOG_MVB_DELTA0 < nvmvbs; sby++) {
+    od_state_mc_predict_sb_row(state, img_dst, sby);
+  }
+}
+
 /* Initialize superblock split decisions. */
 void od_state_init_superblock_split(od_state *state, unsigned char bsize) {
   int nhsb;
   int nvsb;
   int i;
-  int j;
   nhsb = state->nhsb;
   nvsb = state->nvsb;
   for (i = 0; i < OD_BSIZE_GRID*nvsb; i++) {
-    for (j = 0; j < OD_BSIZE_GRID*nhsb; j++) {
-      state->bsize[i*state->bstride + j] = bsize;
+    memset(state->bsize + i*state->bstride, bsize, OD_BSIZE_GRID*nhsb);
+  }
+}
+
+/*Marks the (1 << bs) by (1 << bs) square of 4x4 blocks at (bx << bs,
+   by << bs) in plane pli as skipped or not, in both bskip and bskip_mask.*/
+void od_state_set_bskip(od_state *state, int pli, int bx, int by, int bs,
+ int skip) {
+  unsigned char *bskip;
+  uint16_t *mask;
+  unsigned bits;
+  int xshift;
+  int yshift;
+  int n;
+  int x;
+  int y;
+  int i;
+  n = 1 << bs;
+  x = bx << bs;
+  y = by << bs;
+  bskip = state->bskip[pli] + y*state->skip_stride + x;
+  for (i = 0; i < n; i++) memset(bskip + i*state->skip_stride, skip, n);
+  /*The log of the number of 4x4 blocks across a superblock in this plane.*/
+  xshift = OD_LOG_BSIZE_MAX - OD_LOG_BSIZE0 - state->info.plane_info[pli].xdec;
+  yshift = OD_LOG_BSIZE_MAX - OD_LOG_BSIZE0 - state->info.plane_info[pli].ydec;
+  /*Blocks never straddle a superblock, so all of the bits are in the same
+     entry of each row.*/
+  mask = state->bskip_mask[pli] + ((y >> yshift)*state->nhsb
+   + (x >> xshift))*OD_BSKIP_MASK_ROWS + (y & ((1 << yshift) - 1));
+  bits = ((1U << n) - 1) << (x & ((1 << xshift) - 1));
+  for (i = 0; i < n; i++) {
+    if (skip) mask[i] |= bits;
+    else mask[i] &= ~bits;
+  }
+}
+
+/*Returns whether every 4x4 block of plane pli in superblock (sbx, sby) is
+   skipped.*/
+int od_state_sb_skipped(const od_state *state, int pli, int sbx, int sby) {
+  const uint16_t *mask;
+  unsigned all;
+  unsigned full;
+  int nrows;
+  int i;
+  mask = state->bskip_mask[pli]
+   + (sby*state->nhsb + sbx)*OD_BSKIP_MASK_ROWS;
+  nrows = OD_BSKIP_MASK_ROWS >> state->info.plane_info[pli].ydec;
+  full = (1U << (OD_BSKIP_MASK_ROWS >> state->info.plane_info[pli].xdec)) - 1;
+  all = full;
+  for (i = 0; i < nrows; i++) all &= mask[i];
+  return all == full;
+}
+
+/*Returns whether superblock (sbx, sby) and all of its neighbors are skipped
+   in every plane.
+  On inter frames coded with the lapped transform, the reconstruction of such
+   a superblock is exactly its motion-compensated prediction, since the
+   transforms and the lapping filters are reversible and none of the filters
+   that reach into it cross a coded block.*/
+int od_state_sb_static(const od_state *state, int sbx, int sby) {
+  int pli;
+  int x;
+  int y;
+  for (y = OD_MAXI(sby - 1, 0); y <= OD_MINI(sby + 1, state->nvsb - 1); y++) {
+    for (x = OD_MAXI(sbx - 1, 0); x <= OD_MINI(sbx + 1, state->nhsb - 1);
+     x++) {
+      for (pli = 0; pli < state->info.nplanes; pli++) {
+        if (!od_state_sb_skipped(state, pli, x, y)) return 0;
+      }
     }
   }
+  return 1;
 }
 
 /*To avoiding having to special-case superblocks on the edges of the image,
@@ -979,7 +1178,6 @@ void od_state_init_superblock_split(od_state *state, unsigned char bsize) {
   See the comment for the `bsize` member of `od_state` for more information
    about the data layout and meaning.*/
 void od_state_init_border(od_state *state) {
-  int i;
   int j;
   int nhsb;
   int nvsb;
@@ -989,21 +1187,19 @@ void od_state_init_border(od_state *state) {
   nvsb = state->nvsb;
   bsize = state->bsize;
   bstride = state->bstride;
-  for (i = -OD_BSIZE_GRID; i < (nhsb + 1)*OD_BSIZE_GRID; i++) {
-    for (j = -OD_BSIZE_GRID; j < 0; j++) {
-      bsize[(j*bstride) + i] = OD_LIMIT_BSIZE_MAX;
-    }
-    for (j = nvsb*OD_BSIZE_GRID; j < (nvsb + 1)*OD_BSIZE_GRID; j++) {
-      bsize[(j*bstride) + i] = OD_LIMIT_BSIZE_MAX;
-    }
+  for (j = -OD_BSIZE_GRID; j < 0; j++) {
+    memset(bsize + j*bstride - OD_BSIZE_GRID, OD_LIMIT_BSIZE_MAX,
+     (nhsb + 2)*OD_BSIZE_GRID);
   }
-  for (j = -OD_BSIZE_GRID; j < (nvsb + 1)*OD_BSIZE_GRID; j++) {
-    for (i = -OD_BSIZE_GRID; i < 0; i++) {
-      bsize[(j*bstride) + i] = OD_LIMIT_BSIZE_MAX;
-    }
-    for (i = nhsb*OD_BSIZE_GRID; i < (nhsb + 1)*OD_BSIZE_GRID; i++) {
-      bsize[(j*bstride) + i] = OD_LIMIT_BSIZE_MAX;
-    }
+  for (j = nvsb*OD_BSIZE_GRID; j < (nvsb + 1)*OD_BSIZE_GRID; j++) {
+    memset(bsize + j*bstride - OD_BSIZE_GRID, OD_LIMIT_BSIZE_MAX,
+     (nhsb + 2)*OD_BSIZE_GRID);
+  }
+  for (j = 0; j < nvsb*OD_BSIZE_GRID; j++) {
+    memset(bsize + j*bstride - OD_BSIZE_GRID, OD_LIMIT_BSIZE_MAX,
+     OD_BSIZE_GRID);
+    memset(bsize + j*bstride + nhsb*OD_BSIZE_GRID, OD_LIMIT_BSIZE_MAX,
+     OD_BSIZE_GRID);
   }
 }
 
@@ -1110,32 +1306,23 @@ void od_img_edge_ext(daala_image* src) {
   }
 }
 
-int od_output_queue_init(od_output_queue *out, od_state *state) {
+/* Empties the queue and lays out its images for the current frame size of
+    state, which must not be larger than the one it was created for. */
+void od_output_queue_reset(od_output_queue *out, od_state *state) {
   daala_info *info;
   int pli;
   int imgi;
-  size_t data_sz;
   int frame_width;
   int frame_height;
   unsigned char *output_img_data;
   int output_bits;
   int output_bytes;
   info = &state->info;
-  /* Compute the memory requirements for output frames. */
   output_bits = 8 + (info->bitdepth_mode - OD_BITDEPTH_MODE_8)*2;
   output_bytes = output_bits > 8 ? 2 : 1;
-  data_sz = 0;
   frame_width = state->frame_width;
   frame_height = state->frame_height;
-  for (pli = 0; pli < info->nplanes; pli++) {
-    data_sz += OD_MAX_REORDER*(frame_width >> info->plane_info[pli].xdec)*
-     (frame_height >> info->plane_info[pli].ydec)*output_bytes;
-  }
-  out->output_img_data = output_img_data =
-   (unsigned char *)od_aligned_malloc(data_sz, 32);
-  if (OD_UNLIKELY(!output_img_data)) {
-    return OD_EFAULT;
-  }
+  output_img_data = out->output_img_data;
   /* Fill in the output img structure. */
   for (imgi = 0; imgi < OD_MAX_REORDER; imgi++) {
     daala_image *img;
@@ -1155,14 +1342,43 @@ int od_output_queue_init(od_output_queue *out, od_state *state) {
       iplane->bitdepth = output_bits;
       iplane->xstride = output_bytes;
       iplane->ystride = plane_width*iplane->xstride;
+      /* The queue may not own any images (see od_output_queue_add_ref()). */
       iplane->data = output_img_data;
-      output_img_data += plane_height*iplane->ystride;
+      if (output_img_data != NULL) {
+        output_img_data += plane_height*iplane->ystride;
+      }
     }
     out->decode_used[imgi] = 0;
     out->output_used[imgi] = 0;
   }
   out->decode_index = 0;
   out->output_index = 0;
+}
+
+int od_output_queue_init(od_output_queue *out, od_state *state) {
+  daala_info *info;
+  int pli;
+  size_t data_sz;
+  int frame_width;
+  int frame_height;
+  int output_bits;
+  int output_bytes;
+  info = &state->info;
+  /* Compute the memory requirements for output frames. */
+  output_bits = 8 + (info->bitdepth_mode - OD_BITDEPTH_MODE_8)*2;
+  output_bytes = output_bits > 8 ? 2 : 1;
+  data_sz = 0;
+  frame_width = state->frame_width;
+  frame_height = state->frame_height;
+  for (pli = 0; pli < info->nplanes; pli++) {
+    data_sz += OD_MAX_REORDER*(frame_width >> info->plane_info[pli].xdec)*
+     (frame_height >> info->plane_info[pli].ydec)*output_bytes;
+  }
+  out->output_img_data = (unsigned char *)od_aligned_malloc(data_sz, 32);
+  if (OD_UNLIKELY(!out->output_img_data)) {
+    return OD_EFAULT;
+  }
+  od_output_queue_reset(out, state);
   return OD_SUCCESS;
 }
 
@@ -1170,7 +1386,8 @@ void od_output_queue_clear(od_output_queue *out) {
   od_aligned_free(out->output_img_data);
 }
 
-int od_output_queue_add(od_output_queue *out, daala_image *img, int number) {
+static int od_output_queue_insert(od_output_queue *out, daala_image *img,
+ int number, int id) {
   od_output_frame frame;
   int index;
   OD_RETURN_CHECK(out, OD_EFAULT);
@@ -1180,11 +1397,13 @@ int od_output_queue_add(od_output_queue *out, daala_image *img, int number) {
   index = out->decode_index;
   OD_ASSERT(!out->decode_used[index]);
   out->decode_used[index] = 1;
-  od_img_copy(&out->images[index], img);
+  if (id < 0) od_img_copy(&out->images[index], img);
+  else out->images[index] = *img;
   out->decode_index = OD_REORDER_INDEX(index + 1);
   /* Construct the od_output_frame struct. */
   frame.img = &out->images[index];
   frame.number = number;
+  frame.id = id;
   /* Insert it into the output queue in the correct order. */
   index = OD_REORDER_INDEX(number);
   OD_ASSERT(!out->output_used[index]);
@@ -1193,6 +1412,20 @@ int od_output_queue_add(od_output_queue *out, daala_image *img, int number) {
   return OD_SUCCESS;
 }
 
+/* Queues a copy of img for output. */
+int od_output_queue_add(od_output_queue *out, daala_image *img, int number) {
+  return od_output_queue_insert(out, img, number, -1);
+}
+
+/* Queues img itself for output, without copying its pixels.
+   The caller must keep the buffer id alive and unmodified until the frame has
+    been returned by od_output_queue_next() and consumed. */
+int od_output_queue_add_ref(od_output_queue *out, daala_image *img,
+ int number, int id) {
+  OD_RETURN_CHECK(id >= 0, OD_EINVAL);
+  return od_output_queue_insert(out, img, number, id);
+}
+
 od_output_frame *od_output_queue_next(od_output_queue *out) {
   OD_ASSERT(out);
   if (out->output_used[out->output_index]) {
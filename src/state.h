@@ -50,6 +50,32 @@ extern const int OD_HAAR_QM[2][OD_LOG_BSIZE_MAX];
 
 #define OD_MAX_CODED_REFS (2)
 
+/*The layout of the packed frame header of
+   OD_STREAM_VERSION_MINOR_PACKED_HEADER and later.
+  After the range-coded packet type and keyframe flags, the rest of the
+   header is a single run of raw bits, so it takes one read to parse.
+  These are the positions of its fields, from the least significant bit.
+  The last two are only present in inter frames.
+  The chunked flag is always 0 before OD_STREAM_VERSION_MINOR_CHUNKS.*/
+# define OD_FHDR_ACTIVITY_MASKING (0)
+# define OD_FHDR_QM (1)
+# define OD_FHDR_HAAR (2)
+# define OD_FHDR_GOLDEN (3)
+# define OD_FHDR_CHUNKED (4)
+# define OD_FHDR_FRAME_NUMBER (5)
+# define OD_FHDR_FRAME_NUMBER_BITS (4)
+# define OD_FHDR_INTRA_BITS (OD_FHDR_FRAME_NUMBER + OD_FHDR_FRAME_NUMBER_BITS)
+# define OD_FHDR_B_FRAME (OD_FHDR_INTRA_BITS)
+# define OD_FHDR_NUM_REFS (OD_FHDR_INTRA_BITS + 1)
+# define OD_FHDR_INTER_BITS (OD_FHDR_NUM_REFS + 1)
+
+# if OD_MAX_REORDER != 1 << OD_FHDR_FRAME_NUMBER_BITS || OD_MAX_CODED_REFS != 2
+#  error "OD_MAX_REORDER or OD_MAX_CODED_REFS do not fit the frame header."
+# endif
+
+/*The most bytes of a keyframe's QMs coded with one raw-bit call.*/
+# define OD_QM_BATCH (3)
+
 /*The golden reference frame.*/
 # define OD_FRAME_GOLD (0)
 /*The previous reference frame.*/
@@ -108,6 +134,10 @@ extern const int *const OD_VERT_SETUP_DY[4][4];
  ((OD_UMV_CLAMP + OD_RESAMPLE_PADDING + OD_PADDING_ALIGN - 1) \
  /OD_PADDING_ALIGN*OD_PADDING_ALIGN)
 
+/*The number of rows (and columns) of 4x4 blocks in a superblock.
+  Each row has one 16-bit entry in od_state.bskip_mask[].*/
+# define OD_BSKIP_MASK_ROWS (OD_BSIZE_MAX >> OD_LOG_BSIZE0)
+
 /*The shared (encoder and decoder) functions that have accelerated variants.*/
 struct od_state_opt_vtbl{
   void (*mc_predict1fmv)(od_state *state, unsigned char *_dst,
@@ -179,6 +209,9 @@ typedef struct od_output_frame od_output_frame;
 struct od_output_frame {
   daala_image *img;
   int number;
+  /* Caller-defined id of the buffer img points into, or -1 if img is one of
+      the queue's own copies. */
+  int id;
 };
 
 typedef struct od_output_queue od_output_queue;
@@ -199,7 +232,10 @@ struct od_output_queue {
 
 int od_output_queue_init(od_output_queue *out, od_state *state);
 void od_output_queue_clear(od_output_queue *out);
+void od_output_queue_reset(od_output_queue *out, od_state *state);
 int od_output_queue_add(od_output_queue *out, daala_image *img, int number);
+int od_output_queue_add_ref(od_output_queue *out, daala_image *img,
+ int number, int id);
 #define od_output_queue_has_next(out) \
  ((out)->output_used[(out)->output_index])
 od_output_frame *od_output_queue_next(od_output_queue *out);
@@ -212,6 +248,9 @@ struct od_state{
   uint32_t        cpu_flags;
   int32_t         frame_width;
   int32_t         frame_height;
+  /** The frame size the buffers were allocated for. */
+  int32_t         max_frame_width;
+  int32_t         max_frame_height;
   /** Buffer for the reference images. */
   int                 ref_imgi[OD_FRAME_MAX+1];
   /** Pointers to the ref images so one can move them around without coping
@@ -228,6 +267,8 @@ struct od_state{
   int frames_in_out_buff;
   /* ----------------------------------------------------- */
   unsigned char *ref_img_data;
+  /** Size of ref_img_data in bytes. */
+  size_t ref_img_data_sz;
   /** Increments by 1 for each frame. */
   int64_t         cur_time;
   od_mv_grid_pt **mv_grid;
@@ -259,6 +300,14 @@ struct od_state{
   int                 bstride;
   unsigned char *bskip[3];
   int                 skip_stride;
+  /** Bit-packed copies of bskip, one bit per 4x4 block, set for skipped
+      blocks.
+      Each superblock has OD_BSKIP_MASK_ROWS consecutive entries, one per row
+      of 4x4 blocks (of which only the first OD_BSKIP_MASK_ROWS >> ydec are
+      used), with the leftmost block in the least significant bit, and
+      superblocks are stored in raster order.
+      They are kept up to date by od_state_set_bskip(). */
+  uint16_t *bskip_mask[3];
   od_coeff           *(sb_dc_mem[OD_NPLANES_MAX]);
   int                 mv_res; /* 0: 1/8, 1:1/4, 2: 1/2 pel */
 # if defined(OD_DUMP_IMAGES) || defined(OD_DUMP_RECONS)
@@ -284,15 +333,21 @@ struct od_state{
   unsigned char *sb_q_scaling;
   /*Magnitude compensated quantization matrices and their inverses.
    1 per block-size and decimation factor (i.e. OD_NBSIZES*2*(OD_BSIZE_MAX^2)),
-   assuming 2 possible decimation values (see OD_BASIS_MAG).*/
-  int16_t *qm;
-  int16_t *qm_inv;
+   assuming 2 possible decimation values (see OD_BASIS_MAG).
+  These point to the process-wide tables returned by od_qm_get().*/
+  const int16_t *qm;
+  const int16_t *qm_inv;
 };
 
 void *od_aligned_malloc(size_t _sz,size_t _align);
 void od_aligned_free(void *_ptr);
 int od_state_init(od_state *_state, const daala_info *_info);
 void od_state_clear(od_state *_state);
+int od_state_check_reset(const od_state *state, const daala_info *info);
+int od_state_reset(od_state *state, const daala_info *info);
+size_t od_state_ref_img_sz(const od_state *state);
+void od_state_ref_img_setup(const od_state *state, daala_image *img,
+ unsigned char *data);
 
 void od_img_plane_copy(daala_image *dest, daala_image *src, int pli);
 void od_img_copy(daala_image *dest, daala_image *src);
@@ -302,8 +357,13 @@ void od_state_pred_block_from_setup(od_state *state, unsigned char *buf,
  int ystride, int pli, int vx, int vy, int c, int s, int log_mvb_sz);
 void od_state_pred_block(od_state *state, unsigned char *buf,
  int ystride, int xstride, int pli, int vx, int vy, int log_mvb_sz);
+void od_state_mc_predict_sb_row(od_state *state, daala_image *dst, int sby);
 void od_state_mc_predict(od_state *state, daala_image *dst);
 void od_state_init_border(od_state *state);
+void od_state_set_bskip(od_state *state, int pli, int bx, int by, int bs,
+ int skip);
+int od_state_sb_skipped(const od_state *state, int pli, int sbx, int sby);
+int od_state_sb_static(const od_state *state, int sbx, int sby);
 void od_state_init_superblock_split(od_state *state, unsigned char bsize);
 int od_state_dump_yuv(od_state *state, daala_image *img, const char *tag);
 void od_img_edge_ext(daala_image* src);
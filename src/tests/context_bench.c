@@ -0,0 +1,328 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+/*Benchmark of the per-clip cost of encoder and decoder contexts.
+  Short clips of alternating sizes are coded once with a fresh encoder and
+   decoder per clip (create, encode and decode a keyframe and an inter frame,
+   free), and once with a single pair of contexts re-targeted with
+   daala_encode_reset() and daala_decode_reset().
+  The packets and decoded frames of both runs must be identical.
+  Timings are reported in microseconds per clip for each phase.*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "daala/daalaenc.h"
+#include "daala/daaladec.h"
+
+/*The default number of clips coded by each method.*/
+#define OD_CTX_BENCH_NCLIPS (8)
+/*The number of frames in each clip.*/
+#define OD_CTX_BENCH_NFRAMES (2)
+
+/*The clip sizes, cycled through in order.
+  The first one is the largest, so that the reused contexts can hold them
+   all, and they grow and shrink in both directions.*/
+static const int OD_CTX_BENCH_SIZES[][2] = {
+  { 192, 128 }, { 64, 64 }, { 128, 128 }, { 176, 64 }
+};
+
+#define OD_CTX_BENCH_NSIZES \
+ ((int)(sizeof(OD_CTX_BENCH_SIZES)/sizeof(*OD_CTX_BENCH_SIZES)))
+
+/*The phases that are timed.*/
+#define OD_CTX_BENCH_SETUP (0)
+#define OD_CTX_BENCH_CODE (1)
+#define OD_CTX_BENCH_TEARDOWN (2)
+#define OD_CTX_BENCH_NPHASES (3)
+
+typedef struct {
+  daala_image img;
+  unsigned char *data;
+  /*A running hash of everything produced by the run.*/
+  uint32_t hash;
+  clock_t ticks[OD_CTX_BENCH_NPHASES];
+} od_ctx_bench;
+
+static uint32_t od_ctx_bench_hash(uint32_t h, const unsigned char *p,
+ int n) {
+  int i;
+  for (i = 0; i < n; i++) h = (h ^ p[i])*16777619U;
+  return h;
+}
+
+static void od_ctx_bench_info(daala_info *info, int w, int h) {
+  daala_info_init(info);
+  info->pic_width = w;
+  info->pic_height = h;
+  info->pixel_aspect_numerator = 1;
+  info->pixel_aspect_denominator = 1;
+  info->timebase_numerator = 30;
+  info->timebase_denominator = 1;
+  info->frame_duration = 1;
+  info->keyframe_rate = 256;
+  info->bitdepth_mode = OD_BITDEPTH_MODE_8;
+  info->nplanes = 3;
+  info->plane_info[0].xdec = 0;
+  info->plane_info[0].ydec = 0;
+  info->plane_info[1].xdec = 1;
+  info->plane_info[1].ydec = 1;
+  info->plane_info[2].xdec = 1;
+  info->plane_info[2].ydec = 1;
+}
+
+/*Fills the input image with a w by h picture that changes with the clip and
+   frame number.*/
+static void od_ctx_bench_fill(od_ctx_bench *b, int w, int h, int clip,
+ int frame) {
+  unsigned char *data;
+  int pli;
+  data = b->data;
+  b->img.nplanes = 3;
+  b->img.width = w;
+  b->img.height = h;
+  for (pli = 0; pli < 3; pli++) {
+    daala_image_plane *iplane;
+    int pw;
+    int ph;
+    int x;
+    int y;
+    iplane = b->img.planes + pli;
+    iplane->xdec = iplane->ydec = pli > 0;
+    pw = (w + iplane->xdec) >> iplane->xdec;
+    ph = (h + iplane->ydec) >> iplane->ydec;
+    iplane->bitdepth = 8;
+    iplane->xstride = 1;
+    iplane->ystride = pw;
+    iplane->data = data;
+    for (y = 0; y < ph; y++) {
+      for (x = 0; x < pw; x++) {
+        int v;
+        v = ((x + 3*clip + frame)*7 + y*3) % 61 + ((x*y + clip) % 13)
+         + (((x >> 4) + (y >> 4)) & 1)*60;
+        data[y*pw + x] = (unsigned char)(pli ? 128 + (v >> 3) : 64 + v);
+      }
+    }
+    data += pw*ph;
+  }
+}
+
+/*Codes one clip with enc and dec, which must be freshly created or reset for
+   its size, and adds everything they produce to the hash.*/
+static int od_ctx_bench_code(od_ctx_bench *b, daala_enc_ctx *enc,
+ daala_dec_ctx *dec, int w, int h, int clip) {
+  daala_packet dp;
+  int frame;
+  for (frame = 0; frame < OD_CTX_BENCH_NFRAMES; frame++) {
+    od_ctx_bench_fill(b, w, h, clip, frame);
+    if (daala_encode_img_in(enc, &b->img, 0) < 0) return EXIT_FAILURE;
+    while (daala_encode_packet_out(enc,
+     frame == OD_CTX_BENCH_NFRAMES - 1, &dp) > 0) {
+      daala_image out;
+      b->hash = od_ctx_bench_hash(b->hash, dp.packet, dp.bytes);
+      if (daala_decode_packet_in(dec, &dp) < 0) return EXIT_FAILURE;
+      while (daala_decode_img_out(dec, &out) > 0) {
+        int pli;
+        for (pli = 0; pli < out.nplanes; pli++) {
+          int pw;
+          int ph;
+          int y;
+          pw = (w + out.planes[pli].xdec) >> out.planes[pli].xdec;
+          ph = (h + out.planes[pli].ydec) >> out.planes[pli].ydec;
+          for (y = 0; y < ph; y++) {
+            b->hash = od_ctx_bench_hash(b->hash,
+             out.planes[pli].data + y*out.planes[pli].ystride, pw);
+          }
+        }
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/*Writes the headers with enc and reads them back into a daala_info for the
+   decoder.*/
+static int od_ctx_bench_headers(od_ctx_bench *b, daala_enc_ctx *enc,
+ daala_info *dinfo, daala_setup_info **ds) {
+  daala_comment dc;
+  daala_packet dp;
+  int ret;
+  daala_comment_init(&dc);
+  daala_info_init(dinfo);
+  while ((ret = daala_encode_flush_header(enc, &dc, &dp)) > 0) {
+    b->hash = od_ctx_bench_hash(b->hash, dp.packet, dp.bytes);
+    if (daala_decode_header_in(dinfo, &dc, ds, &dp) < 0) {
+      ret = -1;
+      break;
+    }
+  }
+  daala_comment_clear(&dc);
+  return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*Codes every clip with a newly created encoder and decoder.*/
+static int od_ctx_bench_fresh(od_ctx_bench *b, int nclips) {
+  int clip;
+  for (clip = 0; clip < nclips; clip++) {
+    daala_info info;
+    daala_info dinfo;
+    daala_setup_info *ds;
+    daala_enc_ctx *enc;
+    daala_dec_ctx *dec;
+    clock_t t0;
+    int w;
+    int h;
+    w = OD_CTX_BENCH_SIZES[clip % OD_CTX_BENCH_NSIZES][0];
+    h = OD_CTX_BENCH_SIZES[clip % OD_CTX_BENCH_NSIZES][1];
+    ds = NULL;
+    t0 = clock();
+    od_ctx_bench_info(&info, w, h);
+    enc = daala_encode_create(&info);
+    if (enc == NULL) return EXIT_FAILURE;
+    if (od_ctx_bench_headers(b, enc, &dinfo, &ds)) return EXIT_FAILURE;
+    dec = daala_decode_create(&dinfo, ds);
+    if (dec == NULL) return EXIT_FAILURE;
+    b->ticks[OD_CTX_BENCH_SETUP] += clock() - t0;
+    t0 = clock();
+    if (od_ctx_bench_code(b, enc, dec, w, h, clip)) return EXIT_FAILURE;
+    b->ticks[OD_CTX_BENCH_CODE] += clock() - t0;
+    t0 = clock();
+    daala_decode_free(dec);
+    daala_setup_free(ds);
+    daala_encode_free(enc);
+    b->ticks[OD_CTX_BENCH_TEARDOWN] += clock() - t0;
+  }
+  return EXIT_SUCCESS;
+}
+
+/*Codes every clip with one encoder and decoder, reset for each clip.*/
+static int od_ctx_bench_reuse(od_ctx_bench *b, int nclips) {
+  daala_info info;
+  daala_info dinfo;
+  daala_setup_info *ds;
+  daala_enc_ctx *enc;
+  daala_dec_ctx *dec;
+  clock_t t0;
+  int clip;
+  enc = NULL;
+  dec = NULL;
+  for (clip = 0; clip < nclips; clip++) {
+    int w;
+    int h;
+    w = OD_CTX_BENCH_SIZES[clip % OD_CTX_BENCH_NSIZES][0];
+    h = OD_CTX_BENCH_SIZES[clip % OD_CTX_BENCH_NSIZES][1];
+    ds = NULL;
+    t0 = clock();
+    od_ctx_bench_info(&info, w, h);
+    if (enc == NULL) enc = daala_encode_create(&info);
+    else if (daala_encode_reset(enc, &info) < 0) return EXIT_FAILURE;
+    if (enc == NULL) return EXIT_FAILURE;
+    if (od_ctx_bench_headers(b, enc, &dinfo, &ds)) return EXIT_FAILURE;
+    if (dec == NULL) dec = daala_decode_create(&dinfo, ds);
+    else if (daala_decode_reset(dec, &dinfo, ds) < 0) return EXIT_FAILURE;
+    if (dec == NULL) return EXIT_FAILURE;
+    daala_setup_free(ds);
+    b->ticks[OD_CTX_BENCH_SETUP] += clock() - t0;
+    t0 = clock();
+    if (od_ctx_bench_code(b, enc, dec, w, h, clip)) return EXIT_FAILURE;
+    b->ticks[OD_CTX_BENCH_CODE] += clock() - t0;
+  }
+  /*A larger frame than the contexts were created for must be refused.*/
+  od_ctx_bench_info(&info, OD_CTX_BENCH_SIZES[0][0] + 64,
+   OD_CTX_BENCH_SIZES[0][1]);
+  if (daala_encode_reset(enc, &info) != OD_EINVAL
+   || daala_decode_reset(dec, &info, NULL) != OD_EINVAL) {
+    fprintf(stderr, "Reset to a larger frame was not refused.\n");
+    return EXIT_FAILURE;
+  }
+  t0 = clock();
+  daala_decode_free(dec);
+  daala_encode_free(enc);
+  b->ticks[OD_CTX_BENCH_TEARDOWN] += clock() - t0;
+  return EXIT_SUCCESS;
+}
+
+static void od_ctx_bench_print(const char *name, const od_ctx_bench *b,
+ int nclips) {
+  double us[OD_CTX_BENCH_NPHASES];
+  int i;
+  for (i = 0; i < OD_CTX_BENCH_NPHASES; i++) {
+    us[i] = 1E6*b->ticks[i]/CLOCKS_PER_SEC/nclips;
+  }
+  printf("%-8s %12.1f %12.1f %12.1f %12.1f\n", name,
+   us[OD_CTX_BENCH_SETUP], us[OD_CTX_BENCH_CODE], us[OD_CTX_BENCH_TEARDOWN],
+   us[OD_CTX_BENCH_SETUP] + us[OD_CTX_BENCH_CODE]
+   + us[OD_CTX_BENCH_TEARDOWN]);
+}
+
+int main(int argc, char *argv[]) {
+  od_ctx_bench fresh;
+  od_ctx_bench reuse;
+  unsigned char *data;
+  int nclips;
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [<clips>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  nclips = argc > 1 ? atoi(argv[1]) : OD_CTX_BENCH_NCLIPS;
+  if (nclips <= 0) nclips = OD_CTX_BENCH_NCLIPS;
+  /*Room for the luma and two 4:2:0 chroma planes of the largest clip.*/
+  data = (unsigned char *)malloc(2*OD_CTX_BENCH_SIZES[0][0]
+   *OD_CTX_BENCH_SIZES[0][1]);
+  if (data == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  memset(&fresh, 0, sizeof(fresh));
+  memset(&reuse, 0, sizeof(reuse));
+  fresh.data = reuse.data = data;
+  fresh.hash = reuse.hash = 2166136261U;
+  if (od_ctx_bench_fresh(&fresh, nclips)) {
+    fprintf(stderr, "Coding with fresh contexts failed.\n");
+    return EXIT_FAILURE;
+  }
+  if (od_ctx_bench_reuse(&reuse, nclips)) {
+    fprintf(stderr, "Coding with reset contexts failed.\n");
+    return EXIT_FAILURE;
+  }
+  printf("Microseconds per %i-frame clip, %i clips.\n", OD_CTX_BENCH_NFRAMES,
+   nclips);
+  printf("%-8s %12s %12s %12s %12s\n", "", "setup", "code", "teardown",
+   "total");
+  od_ctx_bench_print("create", &fresh, nclips);
+  od_ctx_bench_print("reset", &reuse, nclips);
+  free(data);
+  if (fresh.hash != reuse.hash) {
+    fprintf(stderr, "Reset contexts produced different output "
+     "(%08lX != %08lX).\n", (unsigned long)reuse.hash,
+     (unsigned long)fresh.hash);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
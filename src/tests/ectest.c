@@ -51,7 +51,7 @@ int main(int argc, char **argv) {
       nbits = od_ec_enc_tell_frac(&enc);
       ptr = od_ec_enc_done(&enc, &ptr_sz);
       od_ec_dec_init(&dec, ptr, ptr_sz);
-      sym = od_ec_dec_uint(&dec, ft, "test");
+      sym = od_ec_dec_uint(&dec, ft, 0);
       if (sym != (unsigned)i) {
         fprintf(stderr,
          "Decoded %i instead of %i with ft of %i.\n", sym, i, ft);
@@ -85,7 +85,7 @@ int main(int argc, char **argv) {
         ret = EXIT_FAILURE;
       }
       od_ec_dec_init(&dec, ptr, ptr_sz);
-      sym = od_ec_dec_bits(&dec, ftb, "test");
+      sym = od_ec_dec_bits(&dec, ftb, 0);
       if (sym != (unsigned)i) {
         fprintf(stderr, "Decoded %i instead of %i with ftb of %i.\n",
          sym, i, ftb);
@@ -110,7 +110,7 @@ int main(int argc, char **argv) {
   for (i = 0; i < 256; i++) {
     ptr[ptr_sz - 1] = i;
     od_ec_dec_init(&dec, ptr, ptr_sz);
-    sym = od_ec_dec_uint(&dec, 129, "test");
+    sym = od_ec_dec_uint(&dec, 129, 0);
     if (i >= 228 && i != 240 && !dec.error) {
       fprintf(stderr, "Failed to detect uint error with %i.\n", i);
       ret = EXIT_FAILURE;
@@ -159,7 +159,7 @@ int main(int argc, char **argv) {
   od_ec_dec_init(&dec, ptr, ptr_sz);
   for (ft = 2; ft < 1024; ft++) {
     for (i = 0; i < ft; i++) {
-      sym = od_ec_dec_uint(&dec, ft, "test");
+      sym = od_ec_dec_uint(&dec, ft, 0);
       if (sym != (unsigned)i) {
         fprintf(stderr,
          "Decoded %i instead of %i with ft of %i.\n", sym, i, ft);
@@ -169,7 +169,7 @@ int main(int argc, char **argv) {
   }
   for (ftb = 1; ftb < 16; ftb++) {
     for (i = 0; i < (1 << ftb); i++) {
-      sym = od_ec_dec_bits(&dec, ftb, "test");
+      sym = od_ec_dec_bits(&dec, ftb, 0);
       if (sym != (unsigned)i) {
         fprintf(stderr,
          "Decoded %i instead of %i with ftb of %i.\n", sym, i, ftb);
@@ -236,7 +236,7 @@ int main(int argc, char **argv) {
       ret = EXIT_FAILURE;
     }
     for (j = 0; j < sz; j++) {
-      sym = od_ec_dec_uint(&dec, ft, "test");
+      sym = od_ec_dec_uint(&dec, ft, 0);
       if (sym != data[j]) {
         fprintf(stderr, "Decoded %i instead of %i with ft of %i "
          "at position %i of %i (Random seed: %u).\n",
@@ -351,7 +351,7 @@ int main(int argc, char **argv) {
           case 0: {
             int s;
             s = 15 - OD_ILOG_NZ(fts[j] - 1);
-            sym = od_ec_decode_bool(&dec, fz[j] << s, fts[j] << s, "test");
+            sym = od_ec_decode_bool(&dec, fz[j] << s, fts[j] << s, 0);
             break;
           }
           case 1: {
@@ -359,11 +359,11 @@ int main(int argc, char **argv) {
             cdf[0] = fz[j];
             cdf[1] = fts[j];
             if (fts[j] >= 16384 && (rand() & 1)) {
-              sym = od_ec_decode_cdf(&dec, cdf, 2, "test");
+              sym = od_ec_decode_cdf(&dec, cdf, 2, 0);
               dec_method++;
             }
             else {
-              sym = od_ec_decode_cdf_unscaled(&dec, cdf, 2, "test");
+              sym = od_ec_decode_cdf_unscaled(&dec, cdf, 2, 0);
             }
             break;
           }
@@ -373,7 +373,7 @@ int main(int argc, char **argv) {
         dec_method = 3 + (rand() & 1);
         switch (dec_method) {
           case 3: {
-            sym = od_ec_decode_bool_q15(&dec, fz[j] << (15 - fts[j]), "test");
+            sym = od_ec_decode_bool_q15(&dec, fz[j] << (15 - fts[j]), 0);
             break;
           }
           case 4: {
@@ -381,12 +381,12 @@ int main(int argc, char **argv) {
             cdf[0] = fz[j];
             cdf[1] = 1U << fts[j];
             if (fts[j] == 15 && (rand() & 1)) {
-              sym = od_ec_decode_cdf_q15(&dec, cdf, 2, "test");
+              sym = od_ec_decode_cdf_q15(&dec, cdf, 2, 0);
               dec_method++;
             }
             else {
               sym = od_ec_decode_cdf_unscaled_dyadic(&dec,
-               cdf, 2, fts[j], "test");
+               cdf, 2, fts[j], 0);
             }
             break;
           }
@@ -413,6 +413,95 @@ int main(int argc, char **argv) {
     free(fts);
     free(fz);
   }
+  fprintf(stderr, "Testing multi-symbol CDFs... Random seed: %u.\n", seed);
+  for (i = 0; i < 4096; i++) {
+    uint16_t (*cdfs)[16];
+    unsigned *data;
+    int *nsyms;
+    int *methods;
+    int j;
+    sz = rand()%256 + 1;
+    cdfs = (uint16_t (*)[16])malloc(sz*sizeof(*cdfs));
+    data = (unsigned *)malloc(sz*sizeof(*data));
+    nsyms = (int *)malloc(sz*sizeof(*nsyms));
+    methods = (int *)malloc(sz*sizeof(*methods));
+    od_ec_enc_reset(&enc);
+    for (j = 0; j < sz; j++) {
+      unsigned weights[16];
+      unsigned total;
+      unsigned sum;
+      unsigned acc;
+      int n;
+      int k;
+      n = nsyms[j] = rand()%15 + 2;
+      methods[j] = rand()%4;
+      ftb = 15;
+      if (methods[j] == 3) {
+        ftb = OD_ILOG_NZ(n - 1) + rand()%(16 - OD_ILOG_NZ(n - 1));
+      }
+      switch (methods[j]) {
+        case 0: total = 16384 + rand()%16385; break;
+        case 1: total = n + rand()%(32769 - n); break;
+        default: total = 1U << ftb; break;
+      }
+      /*Some symbols get a zero probability, but never all of them.*/
+      sum = 0;
+      for (k = 0; k < n; k++) {
+        weights[k] = rand()%4 == 0 ? 0 : rand()%1000 + 1;
+        sum += weights[k];
+      }
+      if (sum == 0) {
+        weights[rand()%n] = 1;
+        sum = 1;
+      }
+      acc = 0;
+      for (k = 0; k < n; k++) {
+        acc += weights[k];
+        cdfs[j][k] = (uint16_t)((uint64_t)total*acc/sum);
+      }
+      do data[j] = rand()%n;
+      while (cdfs[j][data[j]] == (data[j] > 0 ? cdfs[j][data[j] - 1] : 0));
+      switch (methods[j]) {
+        case 0: od_ec_encode_cdf(&enc, data[j], cdfs[j], n); break;
+        case 1: od_ec_encode_cdf_unscaled(&enc, data[j], cdfs[j], n); break;
+        case 2: od_ec_encode_cdf_q15(&enc, data[j], cdfs[j], n); break;
+        default: {
+          od_ec_encode_cdf_unscaled_dyadic(&enc, data[j], cdfs[j], n, ftb);
+          break;
+        }
+      }
+    }
+    ptr = od_ec_enc_done(&enc, &ptr_sz);
+    od_ec_dec_init(&dec, ptr, ptr_sz);
+    for (j = 0; j < sz; j++) {
+      int n;
+      n = nsyms[j];
+      switch (methods[j]) {
+        case 0: sym = od_ec_decode_cdf(&dec, cdfs[j], n, 0); break;
+        case 1: {
+          sym = od_ec_decode_cdf_unscaled(&dec, cdfs[j], n, 0);
+          break;
+        }
+        case 2: sym = od_ec_decode_cdf_q15(&dec, cdfs[j], n, 0); break;
+        default: {
+          sym = od_ec_decode_cdf_unscaled_dyadic(&dec, cdfs[j], n,
+           OD_ILOG_NZ(cdfs[j][n - 1]) - 1, 0);
+          break;
+        }
+      }
+      if (sym != data[j]) {
+        fprintf(stderr, "Decoded %i instead of %i with %i symbols and method "
+         "%i at position %i of %i (Random seed: %u).\n",
+         sym, data[j], n, methods[j], j, sz, seed);
+        ret = EXIT_FAILURE;
+        break;
+      }
+    }
+    free(methods);
+    free(nsyms);
+    free(data);
+    free(cdfs);
+  }
   od_ec_enc_reset(&enc);
   od_ec_encode_bool_q15(&enc, 0, 16384);
   od_ec_encode_bool_q15(&enc, 0, 16384);
@@ -446,6 +535,36 @@ int main(int argc, char **argv) {
      "Got %i when expecting 63 for od_ec_enc_patch_initial_bits().\n", ptr[0]);
     ret = EXIT_FAILURE;
   }
+  /*Testing coding into an external buffer, with and without room for the
+     whole packet.*/
+  for (i = 0; i < 2; i++) {
+    unsigned char ext_buf[512];
+    int j;
+    od_ec_enc_reset(&enc);
+    od_ec_enc_set_buffer(&enc, ext_buf, i ? 16 : sizeof(ext_buf));
+    for (j = 0; j < 200; j++) {
+      od_ec_enc_uint(&enc, j%37, 37);
+      od_ec_enc_bits(&enc, j & 3, 2);
+    }
+    ptr = od_ec_enc_done(&enc, &ptr_sz);
+    if (ptr == NULL || (ptr == ext_buf) != !i) {
+      fprintf(stderr, "od_ec_enc_done() returned the wrong buffer.\n");
+      ret = EXIT_FAILURE;
+      break;
+    }
+    od_ec_dec_init(&dec, ptr, ptr_sz);
+    for (j = 0; j < 200; j++) {
+      if (od_ec_dec_uint(&dec, 37, 0) != (uint32_t)(j%37)
+       || od_ec_dec_bits(&dec, 2, 0) != (uint32_t)(j & 3)) {
+        fprintf(stderr, "Decoding from an external buffer failed at "
+         "position %i.\n", j);
+        ret = EXIT_FAILURE;
+        break;
+      }
+    }
+    od_ec_enc_reset(&enc);
+    od_ec_enc_set_buffer(&enc, NULL, 0);
+  }
   od_ec_enc_clear(&enc);
   return ret;
 }
@@ -0,0 +1,640 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+/*Microbenchmark for the accelerated kernels reachable through
+   od_state_opt_vtbl and od_enc_opt_vtbl.
+  Every kernel is first run against its pure-C reference on random inputs to
+   verify that the accelerated version is bit-exact, and then timed in
+   isolation.
+  The timings are reported in ticks per pixel, where a tick is one TSC cycle
+   when rdtsc is available and one clock() tick otherwise.*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../encint.h"
+#include "../dct.h"
+#include "../dering.h"
+#include "../util.h"
+#if defined(OD_X86ASM)
+# include "../x86/cpu.h"
+# include "../x86/x86int.h"
+# include "../x86/x86enc.h"
+#endif
+
+/*The number of random inputs each accelerated kernel is checked against.*/
+#define OD_BENCH_NTRIALS (64)
+/*The default number of timed calls per kernel.*/
+#define OD_BENCH_NITERS (2000)
+
+/*Reference planes are OD_BENCH_PLANE_SZ pixels square, and blocks are read
+   from the middle so that motion vectors may point outside of them.*/
+#define OD_BENCH_PLANE_SZ (256)
+#define OD_BENCH_PLANE_OFFSET (96)
+#define OD_BENCH_OUT_SZ (OD_MVBSIZE_MAX*OD_MVBSIZE_MAX*sizeof(od_coeff))
+
+typedef void (*od_bench_fn)(void);
+
+typedef struct od_bench_data od_bench_data;
+
+/*Calls kernel fn on the inputs for the given trial, writing its output
+   into out.*/
+typedef void (*od_bench_call_func)(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out);
+
+struct od_bench_data {
+  od_state *state8;
+  od_state *state16;
+  unsigned char *img8;
+  unsigned char *img16;
+  unsigned char *cur8;
+  unsigned char *cur16;
+  od_coeff *coeffs;
+  int16_t *dering_in;
+  int16_t *dering_x;
+  unsigned char *blend8[4];
+  unsigned char *blend16[4];
+  unsigned char *out[2];
+  uint32_t seed;
+};
+
+#define OD_BENCH_NISAS (4)
+
+typedef struct {
+  const char *name;
+  uint32_t flag;
+} od_bench_isa;
+
+#if defined(OD_X86ASM)
+static const od_bench_isa OD_BENCH_ISAS[OD_BENCH_NISAS] = {
+  { "SSE", OD_CPU_X86_SSE },
+  { "SSE2", OD_CPU_X86_SSE2 },
+  { "SSE4.1", OD_CPU_X86_SSE4_1 },
+  { "AVX2", OD_CPU_X86_AVX2 }
+};
+#else
+static const od_bench_isa OD_BENCH_ISAS[OD_BENCH_NISAS] = {
+  { "SSE", 0 },
+  { "SSE2", 0 },
+  { "SSE4.1", 0 },
+  { "AVX2", 0 }
+};
+#endif
+
+/*These wrap the name of an accelerated kernel so that the table below only
+   references it when that kernel was actually built.*/
+#define OD_BENCH_C(f) ((od_bench_fn)(f))
+#if defined(OD_X86ASM) && defined(OD_GCC_INLINE_ASSEMBLY)
+# define OD_BENCH_ASM(f) ((od_bench_fn)(f))
+#else
+# define OD_BENCH_ASM(f) NULL
+#endif
+#if defined(OD_X86ASM) && defined(OD_SSE2_INTRINSICS)
+# define OD_BENCH_SSE2(f) ((od_bench_fn)(f))
+#else
+# define OD_BENCH_SSE2(f) NULL
+#endif
+#if defined(OD_X86ASM) && defined(OD_SSE41_INTRINSICS)
+# define OD_BENCH_SSE41(f) ((od_bench_fn)(f))
+#else
+# define OD_BENCH_SSE41(f) NULL
+#endif
+#if defined(OD_X86ASM) && defined(OD_AVX2_INTRINSICS)
+# define OD_BENCH_AVX2(f) ((od_bench_fn)(f))
+#else
+# define OD_BENCH_AVX2(f) NULL
+#endif
+
+typedef struct {
+  const char *name;
+  od_bench_call_func call;
+  /*The number of bytes of output per pixel, or 0 if the kernel returns a
+     single int32_t.*/
+  size_t px_sz;
+  /*The C reference for each block size, indexed by the log base 2 of the
+     block size minus OD_LOG_BSIZE0, or NULL for sizes it does not support.*/
+  od_bench_fn c[OD_NBSIZES];
+  /*Accelerated versions of each block size, indexed like OD_BENCH_ISAS.*/
+  od_bench_fn simd[OD_NBSIZES][OD_BENCH_NISAS];
+} od_bench_kernel;
+
+static uint32_t od_bench_rand(od_bench_data *d) {
+  d->seed = d->seed*1103515245 + 12345;
+  return d->seed >> 16;
+}
+
+/*Fills all of the kernel inputs with new random data.*/
+static void od_bench_fill(od_bench_data *d) {
+  int i;
+  int k;
+  for (i = 0; i < OD_BENCH_PLANE_SZ*OD_BENCH_PLANE_SZ; i++) {
+    int v;
+    v = od_bench_rand(d) & 0xFF;
+    d->img8[i] = (unsigned char)v;
+    d->cur8[i] = (unsigned char)(od_bench_rand(d) & 0xFF);
+    ((int16_t *)d->img16)[i] = (int16_t)(v << 4 | (od_bench_rand(d) & 0xF));
+    ((int16_t *)d->cur16)[i] = (int16_t)(od_bench_rand(d) & 0xFFF);
+  }
+  /*The first half of the coefficient buffer holds forward transform input,
+     the second half holds smaller values for the inverse transform so that
+     the reconstruction stays within its usual range.*/
+  for (i = 0; i < OD_MVBSIZE_MAX*OD_MVBSIZE_MAX; i++) {
+    d->coeffs[i] = (od_coeff)(od_bench_rand(d) % (2*4080 + 1)) - 4080;
+    d->coeffs[OD_MVBSIZE_MAX*OD_MVBSIZE_MAX + i] =
+     (od_coeff)(od_bench_rand(d) % (2*1020 + 1)) - 1020;
+  }
+  for (i = 0; i < OD_FILT_BSTRIDE*OD_FILT_BSTRIDE; i++) {
+    d->dering_in[i] = (int16_t)((od_bench_rand(d) & 0xFF) << 4);
+  }
+  for (i = 0; i < OD_BSIZE_MAX*OD_BSIZE_MAX; i++) {
+    d->dering_x[i] = (int16_t)((od_bench_rand(d) & 0xFF) << 4);
+  }
+  for (k = 0; k < 4; k++) {
+    for (i = 0; i < OD_MVBSIZE_MAX*OD_MVBSIZE_MAX; i++) {
+      d->blend8[k][i] = (unsigned char)(od_bench_rand(d) & 0xFF);
+      ((int16_t *)d->blend16[k])[i] = (int16_t)(od_bench_rand(d) & 0xFFF);
+    }
+  }
+}
+
+/*Motion vectors in 1/8th pel units, alternating between integer and
+   fractional positions.*/
+static int32_t od_bench_mv(int trial, int comp) {
+  int32_t mv;
+  mv = ((trial*(comp ? 37 : 53)) % 129) - 64;
+  return trial & 4 ? mv & ~7 : mv;
+}
+
+static void od_bench_call_fdct(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (void)trial;
+  (*(od_dct_func_2d)fn)((od_coeff *)out, 1 << ln, d->coeffs, 1 << ln);
+}
+
+static void od_bench_call_idct(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (void)trial;
+  (*(od_dct_func_2d)fn)((od_coeff *)out, 1 << ln,
+   d->coeffs + OD_MVBSIZE_MAX*OD_MVBSIZE_MAX, 1 << ln);
+}
+
+static void od_bench_call_copy8(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (*(od_copy_nxn_func)fn)(out, 1 << ln,
+   d->img8 + (trial & 15) + (trial >> 4 & 15)*OD_BENCH_PLANE_SZ,
+   OD_BENCH_PLANE_SZ);
+}
+
+static void od_bench_call_copy16(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (*(od_copy_nxn_func)fn)(out, 2 << ln,
+   d->img16 + 2*((trial & 15) + (trial >> 4 & 15)*OD_BENCH_PLANE_SZ),
+   2*OD_BENCH_PLANE_SZ);
+}
+
+typedef void (*od_bench_predict_func)(od_state *state, unsigned char *dst,
+ const unsigned char *src, int systride, int32_t mvx, int32_t mvy,
+ int log_xblk_sz, int log_yblk_sz);
+
+static void od_bench_call_predict8(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (*(od_bench_predict_func)fn)(d->state8, out,
+   d->img8 + OD_BENCH_PLANE_OFFSET*(OD_BENCH_PLANE_SZ + 1), OD_BENCH_PLANE_SZ,
+   od_bench_mv(trial, 0), od_bench_mv(trial, 1), ln, ln);
+}
+
+static void od_bench_call_predict16(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (*(od_bench_predict_func)fn)(d->state16, out,
+   d->img16 + 2*OD_BENCH_PLANE_OFFSET*(OD_BENCH_PLANE_SZ + 1),
+   2*OD_BENCH_PLANE_SZ, od_bench_mv(trial, 0), od_bench_mv(trial, 1), ln, ln);
+}
+
+typedef void (*od_bench_blend_func)(unsigned char *dst, int dystride,
+ const unsigned char *src[4], int log_xblk_sz, int log_yblk_sz);
+typedef void (*od_bench_blend_split_func)(unsigned char *dst, int dystride,
+ const unsigned char *src[4], int c, int s, int log_xblk_sz,
+ int log_yblk_sz);
+
+static void od_bench_blend_src(const unsigned char *src[4],
+ unsigned char *blk[4]) {
+  int k;
+  for (k = 0; k < 4; k++) src[k] = blk[k];
+}
+
+static void od_bench_call_blend8(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  const unsigned char *src[4];
+  (void)trial;
+  od_bench_blend_src(src, d->blend8);
+  (*(od_bench_blend_func)fn)(out, 1 << ln, src, ln, ln);
+}
+
+static void od_bench_call_blend16(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  const unsigned char *src[4];
+  (void)trial;
+  od_bench_blend_src(src, d->blend16);
+  (*(od_bench_blend_func)fn)(out, 2 << ln, src, ln, ln);
+}
+
+static void od_bench_call_blend_split8(od_bench_fn fn, od_bench_data *d,
+ int ln, int trial, unsigned char *out) {
+  const unsigned char *src[4];
+  od_bench_blend_src(src, d->blend8);
+  (*(od_bench_blend_split_func)fn)(out, 1 << ln, src, trial & 3,
+   trial >> 2 & 3, ln, ln);
+}
+
+static void od_bench_call_blend_split16(od_bench_fn fn, od_bench_data *d,
+ int ln, int trial, unsigned char *out) {
+  const unsigned char *src[4];
+  od_bench_blend_src(src, d->blend16);
+  (*(od_bench_blend_split_func)fn)(out, 2 << ln, src, trial & 3,
+   trial >> 2 & 3, ln, ln);
+}
+
+static void od_bench_call_dering_dir(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  (*(od_filter_dering_direction_func)fn)((int16_t *)out, 1 << ln,
+   d->dering_in + OD_FILT_BORDER*OD_FILT_BSTRIDE + OD_FILT_BORDER,
+   (trial*7 & 255) << 2, trial & 7);
+}
+
+static void od_bench_call_dering_orth(od_bench_fn fn, od_bench_data *d,
+ int ln, int trial, unsigned char *out) {
+  (*(od_filter_dering_orthogonal_func)fn)((int16_t *)out, 1 << ln,
+   d->dering_in + OD_FILT_BORDER*OD_FILT_BSTRIDE + OD_FILT_BORDER,
+   d->dering_x, OD_BSIZE_MAX, (trial*7 & 255) << 2, trial & 7);
+}
+
+typedef int32_t (*od_bench_dist_func)(const unsigned char *src, int systride,
+ const unsigned char *ref, int dystride);
+
+static void od_bench_call_dist8(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  int32_t dist;
+  (void)ln;
+  dist = (*(od_bench_dist_func)fn)(d->cur8 + (trial & 31), OD_BENCH_PLANE_SZ,
+   d->img8 + (trial >> 5 & 31), OD_BENCH_PLANE_SZ);
+  memcpy(out, &dist, sizeof(dist));
+}
+
+static void od_bench_call_dist16(od_bench_fn fn, od_bench_data *d, int ln,
+ int trial, unsigned char *out) {
+  int32_t dist;
+  (void)ln;
+  /*The 16-bit SATD kernels use aligned loads, so keep rows 16-byte aligned.*/
+  dist = (*(od_bench_dist_func)fn)(d->cur16 + 16*(trial & 7),
+   2*OD_BENCH_PLANE_SZ, d->img16 + 16*(trial >> 3 & 7), 2*OD_BENCH_PLANE_SZ);
+  memcpy(out, &dist, sizeof(dist));
+}
+
+#define OD_BENCH_PX(ln) ((size_t)1 << 2*(ln))
+
+/*Fills every block size with the same kernel, for kernels that take the
+   block size as a parameter.*/
+#if OD_NBSIZES != 5
+# error "Update OD_BENCH_EVERY_SIZE() for the new number of block sizes."
+#endif
+#define OD_BENCH_EVERY_SIZE(f) { f, f, f, f, f }
+#define OD_BENCH_SIMD_EVERY_SIZE(sse, sse2, sse41, avx2) \
+ { { sse, sse2, sse41, avx2 }, { sse, sse2, sse41, avx2 }, \
+ { sse, sse2, sse41, avx2 }, { sse, sse2, sse41, avx2 }, \
+ { sse, sse2, sse41, avx2 } }
+#define OD_BENCH_NO_SIMD OD_BENCH_SIMD_EVERY_SIZE(NULL, NULL, NULL, NULL)
+
+static const od_bench_kernel OD_BENCH_KERNELS[] = {
+  /*od_state_opt_vtbl.fdct_2d, idct_2d*/
+  { "fdct_2d", od_bench_call_fdct, sizeof(od_coeff),
+   { OD_BENCH_C(od_bin_fdct4x4), OD_BENCH_C(od_bin_fdct8x8),
+   OD_BENCH_C(od_bin_fdct16x16), OD_BENCH_C(od_bin_fdct32x32),
+   OD_BENCH_C(od_bin_fdct64x64) },
+   { { NULL, OD_BENCH_SSE2(od_bin_fdct4x4_sse2),
+   OD_BENCH_SSE41(od_bin_fdct4x4_sse41), NULL },
+   { NULL, OD_BENCH_SSE2(od_bin_fdct8x8_sse2),
+   OD_BENCH_SSE41(od_bin_fdct8x8_sse41), OD_BENCH_AVX2(od_bin_fdct8x8_avx2) },
+   { NULL, NULL, NULL, NULL }, { NULL, NULL, NULL, NULL },
+   { NULL, NULL, NULL, NULL } } },
+  { "idct_2d", od_bench_call_idct, sizeof(od_coeff),
+   { OD_BENCH_C(od_bin_idct4x4), OD_BENCH_C(od_bin_idct8x8),
+   OD_BENCH_C(od_bin_idct16x16), OD_BENCH_C(od_bin_idct32x32),
+   OD_BENCH_C(od_bin_idct64x64) },
+   { { NULL, OD_BENCH_SSE2(od_bin_idct4x4_sse2),
+   OD_BENCH_SSE41(od_bin_idct4x4_sse41), NULL },
+   { NULL, OD_BENCH_SSE2(od_bin_idct8x8_sse2),
+   OD_BENCH_SSE41(od_bin_idct8x8_sse41), OD_BENCH_AVX2(od_bin_idct8x8_avx2) },
+   { NULL, NULL, NULL, NULL }, { NULL, NULL, NULL, NULL },
+   { NULL, NULL, NULL, NULL } } },
+  /*od_state_opt_vtbl.mc_predict1fmv*/
+  { "mc_predict1fmv8", od_bench_call_predict8, 1,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_predict1fmv8_c)),
+   OD_BENCH_SIMD_EVERY_SIZE(NULL, OD_BENCH_SSE2(od_mc_predict1fmv8_sse2),
+   NULL, NULL) },
+  { "mc_predict1fmv16", od_bench_call_predict16, 2,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_predict1fmv16_c)),
+   OD_BENCH_SIMD_EVERY_SIZE(NULL, OD_BENCH_SSE2(od_mc_predict1fmv16_sse2),
+   NULL, NULL) },
+  /*od_state_opt_vtbl.mc_blend_full, mc_blend_full_split, mc_blend_multi,
+     mc_blend_multi_split.
+    The multiresolution blends only support blocks up to 16x16.*/
+  { "mc_blend_full8", od_bench_call_blend8, 1,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_blend_full8_c)),
+   OD_BENCH_SIMD_EVERY_SIZE(NULL, OD_BENCH_ASM(od_mc_blend_full8_sse2),
+   NULL, NULL) },
+  { "mc_blend_full_split8", od_bench_call_blend_split8, 1,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_blend_full_split8_c)),
+   { { NULL, OD_BENCH_ASM(od_mc_blend_full_split8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_blend_full_split8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_blend_full_split8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_blend_full_split8_sse2), NULL, NULL },
+   { NULL, NULL, NULL, NULL } } },
+  { "mc_blend_multi8", od_bench_call_blend8, 1,
+   { OD_BENCH_C(od_mc_blend_multi8_c), OD_BENCH_C(od_mc_blend_multi8_c),
+   OD_BENCH_C(od_mc_blend_multi8_c), NULL, NULL }, OD_BENCH_NO_SIMD },
+  { "mc_blend_multi_split8", od_bench_call_blend_split8, 1,
+   { OD_BENCH_C(od_mc_blend_multi_split8_c),
+   OD_BENCH_C(od_mc_blend_multi_split8_c),
+   OD_BENCH_C(od_mc_blend_multi_split8_c), NULL, NULL }, OD_BENCH_NO_SIMD },
+  { "mc_blend_full16", od_bench_call_blend16, 2,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_blend_full16_c)), OD_BENCH_NO_SIMD },
+  { "mc_blend_full_split16", od_bench_call_blend_split16, 2,
+   OD_BENCH_EVERY_SIZE(OD_BENCH_C(od_mc_blend_full_split16_c)),
+   OD_BENCH_NO_SIMD },
+  { "mc_blend_multi16", od_bench_call_blend16, 2,
+   { OD_BENCH_C(od_mc_blend_multi16_c), OD_BENCH_C(od_mc_blend_multi16_c),
+   OD_BENCH_C(od_mc_blend_multi16_c), NULL, NULL }, OD_BENCH_NO_SIMD },
+  { "mc_blend_multi_split16", od_bench_call_blend_split16, 2,
+   { OD_BENCH_C(od_mc_blend_multi_split16_c),
+   OD_BENCH_C(od_mc_blend_multi_split16_c),
+   OD_BENCH_C(od_mc_blend_multi_split16_c), NULL, NULL }, OD_BENCH_NO_SIMD },
+  /*od_state_opt_vtbl.od_copy_nxn*/
+  { "od_copy_nxn8", od_bench_call_copy8, 1,
+   { OD_BENCH_C(od_copy_4x4_8_c), OD_BENCH_C(od_copy_8x8_8_c),
+   OD_BENCH_C(od_copy_16x16_8_c), OD_BENCH_C(od_copy_32x32_8_c),
+   OD_BENCH_C(od_copy_64x64_8_c) },
+   { { NULL, NULL, NULL, NULL }, { NULL, NULL, NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_copy_16x16_8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_copy_32x32_8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_copy_64x64_8_sse2), NULL, NULL } } },
+  { "od_copy_nxn16", od_bench_call_copy16, 2,
+   { OD_BENCH_C(od_copy_4x4_16_c), OD_BENCH_C(od_copy_8x8_16_c),
+   OD_BENCH_C(od_copy_16x16_16_c), OD_BENCH_C(od_copy_32x32_16_c),
+   OD_BENCH_C(od_copy_64x64_16_c) }, OD_BENCH_NO_SIMD },
+  /*od_state_opt_vtbl.dering, which only has 4x4 and 8x8 kernels.*/
+  { "filter_dering_direction", od_bench_call_dering_dir, 2,
+   { OD_BENCH_C(od_filter_dering_direction_4x4_c),
+   OD_BENCH_C(od_filter_dering_direction_8x8_c), NULL, NULL, NULL },
+   { { NULL, OD_BENCH_SSE2(od_filter_dering_direction_4x4_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_filter_dering_direction_8x8_sse2), NULL, NULL },
+   { NULL, NULL, NULL, NULL }, { NULL, NULL, NULL, NULL },
+   { NULL, NULL, NULL, NULL } } },
+  { "filter_dering_orthogonal", od_bench_call_dering_orth, 2,
+   { OD_BENCH_C(od_filter_dering_orthogonal_4x4_c),
+   OD_BENCH_C(od_filter_dering_orthogonal_8x8_c), NULL, NULL, NULL },
+   { { NULL, OD_BENCH_SSE2(od_filter_dering_orthogonal_4x4_sse2), NULL,
+   NULL },
+   { NULL, OD_BENCH_SSE2(od_filter_dering_orthogonal_8x8_sse2), NULL,
+   NULL },
+   { NULL, NULL, NULL, NULL }, { NULL, NULL, NULL, NULL },
+   { NULL, NULL, NULL, NULL } } },
+  /*od_enc_opt_vtbl.mc_compute_sad_*, mc_compute_satd_*/
+  { "mc_compute_sad8", od_bench_call_dist8, 0,
+   { OD_BENCH_C(od_mc_compute_sad8_4x4_c),
+   OD_BENCH_C(od_mc_compute_sad8_8x8_c),
+   OD_BENCH_C(od_mc_compute_sad8_16x16_c),
+   OD_BENCH_C(od_mc_compute_sad8_32x32_c),
+   OD_BENCH_C(od_mc_compute_sad8_64x64_c) },
+   { { OD_BENCH_ASM(od_mc_compute_sad8_4x4_sse), NULL, NULL, NULL },
+   { OD_BENCH_ASM(od_mc_compute_sad8_8x8_sse), NULL, NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_compute_sad8_16x16_sse2), NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_compute_sad8_32x32_sse2), NULL, NULL },
+   { NULL, OD_BENCH_ASM(od_mc_compute_sad8_64x64_sse2), NULL, NULL } } },
+  { "mc_compute_satd8", od_bench_call_dist8, 0,
+   { OD_BENCH_C(od_mc_compute_satd8_4x4_c),
+   OD_BENCH_C(od_mc_compute_satd8_8x8_c),
+   OD_BENCH_C(od_mc_compute_satd8_16x16_c),
+   OD_BENCH_C(od_mc_compute_satd8_32x32_c),
+   OD_BENCH_C(od_mc_compute_satd8_64x64_c) },
+   { { NULL, OD_BENCH_SSE2(od_mc_compute_satd8_4x4_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd8_8x8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd8_16x16_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd8_32x32_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd8_64x64_sse2), NULL, NULL } } },
+  { "mc_compute_sad16", od_bench_call_dist16, 0,
+   { OD_BENCH_C(od_mc_compute_sad16_4x4_c),
+   OD_BENCH_C(od_mc_compute_sad16_8x8_c),
+   OD_BENCH_C(od_mc_compute_sad16_16x16_c),
+   OD_BENCH_C(od_mc_compute_sad16_32x32_c),
+   OD_BENCH_C(od_mc_compute_sad16_64x64_c) }, OD_BENCH_NO_SIMD },
+  { "mc_compute_satd16", od_bench_call_dist16, 0,
+   { OD_BENCH_C(od_mc_compute_satd16_4x4_c),
+   OD_BENCH_C(od_mc_compute_satd16_8x8_c),
+   OD_BENCH_C(od_mc_compute_satd16_16x16_c),
+   OD_BENCH_C(od_mc_compute_satd16_32x32_c),
+   OD_BENCH_C(od_mc_compute_satd16_64x64_c) },
+   { { NULL, OD_BENCH_SSE2(od_mc_compute_satd16_4x4_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd16_8x8_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd16_16x16_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd16_32x32_sse2), NULL, NULL },
+   { NULL, OD_BENCH_SSE2(od_mc_compute_satd16_64x64_sse2), NULL, NULL } } }
+};
+
+#define OD_BENCH_NKERNELS \
+ ((int)(sizeof(OD_BENCH_KERNELS)/sizeof(*OD_BENCH_KERNELS)))
+
+/*Returns the number of bytes of output kernel k writes for a block of size
+   1 << ln.*/
+static size_t od_bench_out_sz(const od_bench_kernel *k, int ln) {
+  return k->px_sz == 0 ? sizeof(int32_t) : k->px_sz*OD_BENCH_PX(ln);
+}
+
+/*Returns the number of trials for which fn disagreed with the C kernel.*/
+static int od_bench_verify(const od_bench_kernel *k, od_bench_fn c,
+ od_bench_fn fn, od_bench_data *d, int ln) {
+  int failures;
+  int trial;
+  failures = 0;
+  d->seed = 0x5EED;
+  for (trial = 0; trial < OD_BENCH_NTRIALS; trial++) {
+    od_bench_fill(d);
+    memset(d->out[0], 0, OD_BENCH_OUT_SZ);
+    memset(d->out[1], 0, OD_BENCH_OUT_SZ);
+    (*k->call)(c, d, ln, trial, d->out[0]);
+    (*k->call)(fn, d, ln, trial, d->out[1]);
+    if (memcmp(d->out[0], d->out[1], od_bench_out_sz(k, ln)) != 0) {
+      failures++;
+    }
+  }
+  return failures;
+}
+
+static double od_bench_time(const od_bench_kernel *k, od_bench_fn fn,
+ od_bench_data *d, int ln, int niters) {
+  int64_t t0;
+  int64_t t1;
+  int i;
+  /*Warm up the caches before timing.*/
+  for (i = 0; i < 16; i++) (*k->call)(fn, d, ln, i, d->out[0]);
+  t0 = od_enc_prof_ticks();
+  for (i = 0; i < niters; i++) (*k->call)(fn, d, ln, i, d->out[0]);
+  t1 = od_enc_prof_ticks();
+  return (double)(t1 - t0)/((double)niters*OD_BENCH_PX(ln));
+}
+
+int main(int argc, char *argv[]) {
+  od_bench_data d;
+  uint32_t cpu_flags;
+  int niters;
+  int failures;
+  int ki;
+  int i;
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [<iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  niters = argc > 1 ? atoi(argv[1]) : OD_BENCH_NITERS;
+  if (niters <= 0) niters = OD_BENCH_NITERS;
+#if defined(OD_X86ASM)
+  cpu_flags = od_cpu_flags_get();
+#else
+  cpu_flags = 0;
+#endif
+  OD_CLEAR(&d, 1);
+  d.state8 = (od_state *)calloc(1, sizeof(*d.state8));
+  d.state16 = (od_state *)calloc(1, sizeof(*d.state16));
+  d.img8 = (unsigned char *)od_aligned_malloc(
+   OD_BENCH_PLANE_SZ*OD_BENCH_PLANE_SZ, 32);
+  d.cur8 = (unsigned char *)od_aligned_malloc(
+   OD_BENCH_PLANE_SZ*OD_BENCH_PLANE_SZ, 32);
+  d.img16 = (unsigned char *)od_aligned_malloc(
+   2*OD_BENCH_PLANE_SZ*OD_BENCH_PLANE_SZ, 32);
+  d.cur16 = (unsigned char *)od_aligned_malloc(
+   2*OD_BENCH_PLANE_SZ*OD_BENCH_PLANE_SZ, 32);
+  d.coeffs = (od_coeff *)od_aligned_malloc(
+   2*OD_MVBSIZE_MAX*OD_MVBSIZE_MAX*sizeof(*d.coeffs), 32);
+  d.dering_in = (int16_t *)od_aligned_malloc(
+   OD_FILT_BSTRIDE*OD_FILT_BSTRIDE*sizeof(*d.dering_in), 32);
+  d.dering_x = (int16_t *)od_aligned_malloc(
+   OD_BSIZE_MAX*OD_BSIZE_MAX*sizeof(*d.dering_x), 32);
+  for (i = 0; i < 4; i++) {
+    d.blend8[i] = (unsigned char *)od_aligned_malloc(
+     OD_MVBSIZE_MAX*OD_MVBSIZE_MAX, 32);
+    d.blend16[i] = (unsigned char *)od_aligned_malloc(
+     2*OD_MVBSIZE_MAX*OD_MVBSIZE_MAX, 32);
+  }
+  d.out[0] = (unsigned char *)od_aligned_malloc(OD_BENCH_OUT_SZ, 32);
+  d.out[1] = (unsigned char *)od_aligned_malloc(OD_BENCH_OUT_SZ, 32);
+  if (d.state8 == NULL || d.state16 == NULL || d.img8 == NULL
+   || d.cur8 == NULL || d.img16 == NULL || d.cur16 == NULL
+   || d.coeffs == NULL || d.dering_in == NULL || d.dering_x == NULL
+   || d.out[0] == NULL || d.out[1] == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < 4; i++) {
+    if (d.blend8[i] == NULL || d.blend16[i] == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      return EXIT_FAILURE;
+    }
+  }
+  /*The integer-pel path of mc_predict1fmv goes through od_copy_nxn, so use
+     the C vtable to keep that part identical for every kernel.*/
+  od_state_opt_vtbl_init_c(d.state8);
+  d.state16->info.full_precision_references = 1;
+  od_state_opt_vtbl_init_c(d.state16);
+  d.seed = 0x5EED;
+  od_bench_fill(&d);
+#if defined(OD_X86ASM) && defined(OD_GCC_INLINE_ASSEMBLY)
+  printf("Timing in TSC cycles per pixel, %i iterations.\n", niters);
+#else
+  printf("Timing in clock() ticks per pixel, %i iterations.\n", niters);
+#endif
+#if defined(OD_CHECKASM)
+  printf("Warning: built with --enable-check-asm, accelerated timings "
+   "include the C reference.\n");
+#endif
+  failures = 0;
+  for (ki = 0; ki < OD_BENCH_NKERNELS; ki++) {
+    const od_bench_kernel *k;
+    int si;
+    k = OD_BENCH_KERNELS + ki;
+    for (si = 0; si < OD_NBSIZES; si++) {
+      char name[64];
+      double c_ticks;
+      int ln;
+      if (k->c[si] == NULL) continue;
+      ln = OD_LOG_BSIZE0 + si;
+      sprintf(name, "%s %ix%i", k->name, 1 << ln, 1 << ln);
+      d.seed = 0x5EED;
+      od_bench_fill(&d);
+      c_ticks = od_bench_time(k, k->c[si], &d, ln, niters);
+      printf("%-30s %-7s %10.3f\n", name, "C", c_ticks);
+      for (i = 0; i < OD_BENCH_NISAS; i++) {
+        double ticks;
+        int nbad;
+        if (k->simd[si][i] == NULL) continue;
+        if ((cpu_flags & OD_BENCH_ISAS[i].flag) != OD_BENCH_ISAS[i].flag
+         || OD_BENCH_ISAS[i].flag == 0) {
+          printf("%-30s %-7s    skipped (not supported by this CPU)\n",
+           name, OD_BENCH_ISAS[i].name);
+          continue;
+        }
+        nbad = od_bench_verify(k, k->c[si], k->simd[si][i], &d, ln);
+        d.seed = 0x5EED;
+        od_bench_fill(&d);
+        ticks = od_bench_time(k, k->simd[si][i], &d, ln, niters);
+        printf("%-30s %-7s %10.3f  %5.2fx  %s\n", name,
+         OD_BENCH_ISAS[i].name, ticks, ticks > 0 ? c_ticks/ticks : 0,
+         nbad ? "MISMATCH" : "bit-exact");
+        if (nbad) {
+          fprintf(stderr, "%s %s: %i of %i trials differ from C.\n", name,
+           OD_BENCH_ISAS[i].name, nbad, OD_BENCH_NTRIALS);
+          failures++;
+        }
+      }
+    }
+  }
+  od_aligned_free(d.out[1]);
+  od_aligned_free(d.out[0]);
+  for (i = 0; i < 4; i++) {
+    od_aligned_free(d.blend16[i]);
+    od_aligned_free(d.blend8[i]);
+  }
+  od_aligned_free(d.dering_x);
+  od_aligned_free(d.dering_in);
+  od_aligned_free(d.coeffs);
+  od_aligned_free(d.cur16);
+  od_aligned_free(d.img16);
+  od_aligned_free(d.cur8);
+  od_aligned_free(d.img8);
+  free(d.state16);
+  free(d.state8);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,580 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+/*Tests of seeking.
+  The seek index functions are checked on their own: entries whose numbers
+   sit on either side of each varint length boundary must survive a round
+   trip, truncated and malformed indexes must be refused, and lookups before
+   the first and after the last keyframe must give the documented results.
+  Then short clips are encoded, with and without B-frames and split into
+   several packets per frame (see OD_SET_CHUNK_ROWS), and decoded straight
+   through.
+  The same decoder is then restarted with OD_DECCTL_RESTART_AT_KEYFRAME at
+   every keyframe, as a player would after seeking with the clip's index, and
+   must produce the same images from there to the end.*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "daala/daalaenc.h"
+#include "daala/daaladec.h"
+
+#define OD_SEEK_TEST_WIDTH (128)
+#define OD_SEEK_TEST_HEIGHT (128)
+#define OD_SEEK_TEST_NFRAMES (12)
+/*Not a multiple of the B-frame group size, so that B-frames are coded right
+   after some keyframes and dropped when restarting there.*/
+#define OD_SEEK_TEST_KEYFRAME_RATE (5)
+/*Room for a few more frame packets than frames, plus the chunks.*/
+#define OD_SEEK_TEST_MAX_PACKETS (8*OD_SEEK_TEST_NFRAMES)
+
+typedef struct {
+  int version_minor;
+  int chunk_rows;
+  int b_frames;
+} od_seek_test_config;
+
+static const od_seek_test_config OD_SEEK_TEST_CONFIGS[] = {
+  { OD_STREAM_VERSION_MINOR_BASE, 0, 0 },
+  { OD_STREAM_VERSION_MINOR_BASE, 0, 2 },
+  { OD_STREAM_VERSION_MINOR_CHUNKS, 1, 0 },
+  { OD_STREAM_VERSION_MINOR_CHUNKS, 1, 2 }
+};
+
+#define OD_SEEK_TEST_NCONFIGS \
+ ((int)(sizeof(OD_SEEK_TEST_CONFIGS)/sizeof(*OD_SEEK_TEST_CONFIGS)))
+
+/*A frame of the coded stream, in coding order.*/
+typedef struct {
+  /*The index of its first packet.*/
+  int packeti;
+  int npackets;
+  int is_keyframe;
+  /*Its display number.*/
+  int64_t frame;
+} od_seek_test_frame;
+
+typedef struct {
+  unsigned char *packets[OD_SEEK_TEST_MAX_PACKETS];
+  long bytes[OD_SEEK_TEST_MAX_PACKETS];
+  int npackets;
+  od_seek_test_frame frames[OD_SEEK_TEST_NFRAMES];
+  int nframes;
+  /*The hash of each decoded image, in display order.*/
+  uint32_t hashes[OD_SEEK_TEST_NFRAMES];
+  int nhashes;
+} od_seek_test_stream;
+
+static uint32_t od_seek_test_hash(const daala_image *img) {
+  uint32_t h;
+  int pli;
+  h = 2166136261U;
+  for (pli = 0; pli < img->nplanes; pli++) {
+    const daala_image_plane *iplane;
+    int pw;
+    int ph;
+    int x;
+    int y;
+    iplane = img->planes + pli;
+    pw = (img->width + iplane->xdec) >> iplane->xdec;
+    ph = (img->height + iplane->ydec) >> iplane->ydec;
+    for (y = 0; y < ph; y++) {
+      for (x = 0; x < pw; x++) {
+        h = (h ^ iplane->data[y*iplane->ystride + x*iplane->xstride])
+         *16777619U;
+      }
+    }
+  }
+  return h;
+}
+
+static int od_seek_test_points_equal(const daala_seek_point *a,
+ const daala_seek_point *b, int npoints) {
+  int i;
+  for (i = 0; i < npoints; i++) {
+    if (a[i].frame != b[i].frame || a[i].offset != b[i].offset
+     || a[i].skip != b[i].skip) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*Checks a round trip of points through daala_seek_index_pack() and
+   daala_seek_index_unpack(), and the lookups with daala_seek_index_find().
+  Return: The number of failures.*/
+static int od_seek_test_index(const daala_seek_point *points, int npoints) {
+  daala_seek_point unpacked[16];
+  unsigned char buf[256];
+  int nerrors;
+  int size;
+  int ret;
+  int i;
+  nerrors = 0;
+  size = daala_seek_index_pack(NULL, 0, points, npoints);
+  if (size <= 0 || size > (int)sizeof(buf)
+   || daala_seek_index_pack(buf, sizeof(buf), points, npoints) != size
+   || daala_seek_index_pack(buf, size - 1, points, npoints) != size) {
+    fprintf(stderr, "Packing %i entries failed.\n", npoints);
+    return 1;
+  }
+  ret = daala_seek_index_unpack(unpacked, npoints, buf, size);
+  if (ret != npoints || !od_seek_test_points_equal(points, unpacked, ret)) {
+    fprintf(stderr, "Unpacking %i entries failed (%i).\n", npoints, ret);
+    nerrors++;
+  }
+  if (daala_seek_index_unpack(NULL, 0, buf, size) != npoints) {
+    fprintf(stderr, "Counting %i entries failed.\n", npoints);
+    nerrors++;
+  }
+  if (npoints > 1) {
+    /*Only as many entries as there is room for are stored.*/
+    memset(unpacked, 0, sizeof(unpacked));
+    if (daala_seek_index_unpack(unpacked, 1, buf, size) != npoints
+     || !od_seek_test_points_equal(points, unpacked, 1)
+     || unpacked[1].frame != 0) {
+      fprintf(stderr, "Unpacking 1 of %i entries failed.\n", npoints);
+      nerrors++;
+    }
+  }
+  for (i = 5; i < size; i++) {
+    if (daala_seek_index_unpack(unpacked, npoints, buf, i) != OD_EBADHEADER) {
+      fprintf(stderr, "Index truncated to %i of %i bytes was accepted.\n",
+       i, size);
+      nerrors++;
+    }
+  }
+  if (daala_seek_index_unpack(unpacked, npoints, buf, 4) != OD_ENOTFORMAT) {
+    nerrors++;
+  }
+  buf[4]++;
+  if (daala_seek_index_unpack(unpacked, npoints, buf, size) != OD_EVERSION) {
+    fprintf(stderr, "Index with a bad version was accepted.\n");
+    nerrors++;
+  }
+  buf[4]--;
+  buf[0]++;
+  if (daala_seek_index_unpack(unpacked, npoints, buf, size)
+   != OD_ENOTFORMAT) {
+    fprintf(stderr, "Index with a bad magic was accepted.\n");
+    nerrors++;
+  }
+  buf[0]--;
+  if (npoints > 0) {
+    if (daala_seek_index_find(points, npoints, points[0].frame - 1) != -1) {
+      fprintf(stderr, "Found an entry before the first keyframe.\n");
+      nerrors++;
+    }
+    if (daala_seek_index_find(points, npoints, INT64_MAX) != npoints - 1
+     || (points[npoints - 1].frame < INT64_MAX && daala_seek_index_find(
+     points, npoints, points[npoints - 1].frame + 1) != npoints - 1)) {
+      fprintf(stderr, "Lookup after the last keyframe failed.\n");
+      nerrors++;
+    }
+  }
+  for (i = 0; i < npoints; i++) {
+    if (daala_seek_index_find(points, npoints, points[i].frame) != i
+     || (i > 0 && daala_seek_index_find(points, npoints,
+     points[i].frame - 1) != i - 1)) {
+      fprintf(stderr, "Lookup of entry %i of %i failed.\n", i, npoints);
+      nerrors++;
+    }
+  }
+  return nerrors;
+}
+
+/*Checks the seek index functions with entries whose frame and offset
+   increments, and skip counts, are on both sides of the varint length
+   boundaries, up to the largest values allowed.
+  Return: The number of failures.*/
+static int od_seek_test_varints(void) {
+  static const int64_t DELTAS[] = {
+    0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456,
+    (int64_t)1 << 42
+  };
+  daala_seek_point points[16];
+  daala_seek_point bad[2];
+  int ndeltas;
+  int nerrors;
+  int i;
+  ndeltas = (int)(sizeof(DELTAS)/sizeof(*DELTAS));
+  nerrors = 0;
+  /*The first entry is stored as is, the others as increments.*/
+  for (i = 0; i < ndeltas; i++) {
+    points[i].frame = (i > 0 ? points[i - 1].frame : 0) + DELTAS[i];
+    points[i].offset = (i > 0 ? points[i - 1].offset : 0)
+     + DELTAS[ndeltas - 1 - i];
+    points[i].skip = DELTAS[i] > INT_MAX ? INT_MAX : (int)DELTAS[i];
+  }
+  points[ndeltas].frame = INT64_MAX;
+  points[ndeltas].offset = INT64_MAX;
+  points[ndeltas].skip = 0;
+  for (i = 0; i <= ndeltas + 1; i++) nerrors += od_seek_test_index(points, i);
+  /*An index starting after frame 0.*/
+  nerrors += od_seek_test_index(points + 3, ndeltas - 2);
+  bad[0] = points[1];
+  bad[1] = points[0];
+  if (daala_seek_index_pack(NULL, 0, bad, 2) != OD_EINVAL) {
+    fprintf(stderr, "Out of order entries were packed.\n");
+    nerrors++;
+  }
+  bad[1] = bad[0];
+  if (daala_seek_index_pack(NULL, 0, bad, 2) != OD_EINVAL) {
+    fprintf(stderr, "Entries for the same frame were packed.\n");
+    nerrors++;
+  }
+  if (daala_seek_index_find(NULL, 0, 0) != -1
+   || daala_seek_index_find(points, 0, 0) != -1) {
+    fprintf(stderr, "Lookup in an empty index failed.\n");
+    nerrors++;
+  }
+  return nerrors;
+}
+
+static void od_seek_test_info(daala_info *info, int version_minor) {
+  daala_info_init(info);
+  info->pic_width = OD_SEEK_TEST_WIDTH;
+  info->pic_height = OD_SEEK_TEST_HEIGHT;
+  info->pixel_aspect_numerator = 1;
+  info->pixel_aspect_denominator = 1;
+  info->timebase_numerator = 30;
+  info->timebase_denominator = 1;
+  info->frame_duration = 1;
+  info->keyframe_rate = OD_SEEK_TEST_KEYFRAME_RATE;
+  info->bitdepth_mode = OD_BITDEPTH_MODE_8;
+  info->version_minor = version_minor;
+  info->nplanes = 3;
+  info->plane_info[0].xdec = 0;
+  info->plane_info[0].ydec = 0;
+  info->plane_info[1].xdec = 1;
+  info->plane_info[1].ydec = 1;
+  info->plane_info[2].xdec = 1;
+  info->plane_info[2].ydec = 1;
+}
+
+/*Fills img, backed by data, with a moving picture.*/
+static void od_seek_test_fill(daala_image *img, unsigned char *data,
+ int frame) {
+  int pli;
+  img->nplanes = 3;
+  img->width = OD_SEEK_TEST_WIDTH;
+  img->height = OD_SEEK_TEST_HEIGHT;
+  for (pli = 0; pli < 3; pli++) {
+    daala_image_plane *iplane;
+    int pw;
+    int ph;
+    int x;
+    int y;
+    iplane = img->planes + pli;
+    iplane->xdec = iplane->ydec = pli > 0;
+    pw = (img->width + iplane->xdec) >> iplane->xdec;
+    ph = (img->height + iplane->ydec) >> iplane->ydec;
+    iplane->bitdepth = 8;
+    iplane->xstride = 1;
+    iplane->ystride = pw;
+    iplane->data = data;
+    for (y = 0; y < ph; y++) {
+      for (x = 0; x < pw; x++) {
+        int v;
+        v = ((x + 2*frame)*7 + (y + frame)*3) % 61 + ((x*y + frame) % 13)
+         + ((((x + 2*frame) >> 4) + (y >> 4)) & 1)*60;
+        data[y*pw + x] = (unsigned char)(pli ? 128 + (v >> 3) : 64 + v);
+      }
+    }
+    data += pw*ph;
+  }
+}
+
+/*Feeds packet packeti of s to dec.
+  Return: The return value of daala_decode_packet_in().*/
+static int od_seek_test_packet_in(daala_dec_ctx *dec,
+ const od_seek_test_stream *s, int packeti) {
+  daala_packet dp;
+  memset(&dp, 0, sizeof(dp));
+  dp.packet = s->packets[packeti];
+  dp.bytes = s->bytes[packeti];
+  dp.e_o_s = packeti == s->npackets - 1;
+  dp.packetno = packeti;
+  return daala_decode_packet_in(dec, &dp);
+}
+
+/*Encodes a clip with the given configuration into s and decodes it straight
+   through with the decoder it creates in *dec.*/
+static int od_seek_test_encode(od_seek_test_stream *s,
+ const od_seek_test_config *cfg, daala_info *dinfo, daala_dec_ctx **dec,
+ daala_setup_info **ds) {
+  daala_info info;
+  daala_comment dc;
+  daala_enc_ctx *enc;
+  daala_packet dp;
+  daala_image img;
+  unsigned char *data;
+  int quant;
+  int frame;
+  int ret;
+  od_seek_test_info(&info, cfg->version_minor);
+  enc = daala_encode_create(&info);
+  if (enc == NULL) return EXIT_FAILURE;
+  quant = 40;
+  if (daala_encode_ctl(enc, OD_SET_QUANT, &quant, sizeof(quant))
+   || daala_encode_ctl(enc, OD_SET_B_FRAMES, (void *)&cfg->b_frames,
+   sizeof(cfg->b_frames))
+   || (cfg->chunk_rows > 0 && daala_encode_ctl(enc, OD_SET_CHUNK_ROWS,
+   (void *)&cfg->chunk_rows, sizeof(cfg->chunk_rows)))) {
+    daala_encode_free(enc);
+    return EXIT_FAILURE;
+  }
+  daala_comment_init(&dc);
+  daala_info_init(dinfo);
+  while ((ret = daala_encode_flush_header(enc, &dc, &dp)) > 0) {
+    if (daala_decode_header_in(dinfo, &dc, ds, &dp) < 0) ret = -1;
+    if (ret < 0) break;
+  }
+  daala_comment_clear(&dc);
+  *dec = ret < 0 ? NULL : daala_decode_create(dinfo, *ds);
+  data = (unsigned char *)malloc(2*OD_SEEK_TEST_WIDTH*OD_SEEK_TEST_HEIGHT);
+  if (*dec == NULL || data == NULL) {
+    free(data);
+    daala_encode_free(enc);
+    return EXIT_FAILURE;
+  }
+  ret = 0;
+  for (frame = 0; frame < OD_SEEK_TEST_NFRAMES && ret >= 0; frame++) {
+    od_seek_test_fill(&img, data, frame);
+    ret = daala_encode_img_in(enc, &img, 0);
+    while (ret >= 0 && daala_encode_packet_out(enc,
+     frame == OD_SEEK_TEST_NFRAMES - 1, &dp) > 0) {
+      daala_image out;
+      if (s->npackets >= OD_SEEK_TEST_MAX_PACKETS) {
+        ret = -1;
+        break;
+      }
+      s->packets[s->npackets] = (unsigned char *)malloc(dp.bytes);
+      if (s->packets[s->npackets] == NULL) {
+        ret = -1;
+        break;
+      }
+      memcpy(s->packets[s->npackets], dp.packet, dp.bytes);
+      s->bytes[s->npackets++] = dp.bytes;
+      ret = daala_decode_packet_in(*dec, &dp);
+      while (ret >= 0 && daala_decode_img_out(*dec, &out) > 0) {
+        if (s->nhashes >= OD_SEEK_TEST_NFRAMES) ret = -1;
+        else s->hashes[s->nhashes++] = od_seek_test_hash(&out);
+      }
+    }
+  }
+  free(data);
+  daala_encode_free(enc);
+  return ret < 0 || s->nhashes != OD_SEEK_TEST_NFRAMES ?
+   EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*Splits the packets of s into frames with daala_decode_frame_header(), as
+   an indexing tool would, and works out their display numbers.*/
+static int od_seek_test_scan(od_seek_test_stream *s,
+ const daala_info *dinfo) {
+  int64_t last;
+  int packeti;
+  last = -1;
+  for (packeti = 0; packeti < s->npackets; ) {
+    daala_frame_header hdr;
+    od_seek_test_frame *f;
+    daala_packet dp;
+    int npackets;
+    int i;
+    memset(&dp, 0, sizeof(dp));
+    dp.packet = s->packets[packeti];
+    dp.bytes = s->bytes[packeti];
+    if (s->nframes >= OD_SEEK_TEST_NFRAMES
+     || daala_decode_frame_header(dinfo, &dp, &hdr) < 0
+     || hdr.npackets < 1 || packeti + hdr.npackets > s->npackets) {
+      fprintf(stderr, "Bad frame header in packet %i.\n", packeti);
+      return EXIT_FAILURE;
+    }
+    f = s->frames + s->nframes++;
+    f->packeti = packeti;
+    f->npackets = npackets = hdr.npackets;
+    f->is_keyframe = hdr.is_keyframe;
+    /*The other packets of a frame carry no frame header.*/
+    for (i = 1; i < npackets; i++) {
+      dp.packet = s->packets[packeti + i];
+      dp.bytes = s->bytes[packeti + i];
+      if (daala_decode_frame_header(dinfo, &dp, &hdr) != OD_EBADPACKET) {
+        fprintf(stderr, "Packet %i was read as a frame header.\n",
+         packeti + i);
+        return EXIT_FAILURE;
+      }
+    }
+    /*B-frames are displayed before the last frame coded without them.*/
+    if (hdr.is_b_frame) {
+      f->frame = last - ((last - hdr.frame_number - 1) & 15) - 1;
+    }
+    else {
+      f->frame = last + ((hdr.frame_number - last - 1) & 15) + 1;
+      last = f->frame;
+    }
+    packeti += npackets;
+  }
+  return s->nframes == OD_SEEK_TEST_NFRAMES ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*Restarts dec at the keyframe s->frames[framei] and decodes to the end.
+  Return: The number of failures.*/
+static int od_seek_test_restart(daala_dec_ctx *dec,
+ const od_seek_test_stream *s, int framei) {
+  const od_seek_test_frame *key;
+  int64_t frame;
+  int nerrors;
+  int packeti;
+  key = s->frames + framei;
+  nerrors = 0;
+  if (daala_decode_ctl(dec, OD_DECCTL_RESTART_AT_KEYFRAME, NULL, 0)) {
+    fprintf(stderr, "Restart failed.\n");
+    return 1;
+  }
+  if (framei > 0) {
+    const od_seek_test_frame *prev;
+    int ret;
+    /*Neither the start nor the rest of the frame coded before the keyframe
+       can be decoded.*/
+    prev = key - 1;
+    if (!prev->is_keyframe) {
+      ret = od_seek_test_packet_in(dec, s, prev->packeti);
+      if (ret != OD_EBADPACKET) {
+        fprintf(stderr, "Frame %i before the keyframe was accepted (%i).\n",
+         (int)prev->frame, ret);
+        nerrors++;
+      }
+    }
+    if (prev->npackets > 1) {
+      ret = od_seek_test_packet_in(dec, s, prev->packeti + 1);
+      if (ret != OD_EBADPACKET) {
+        fprintf(stderr, "A continuation packet of frame %i was accepted "
+         "while waiting for a keyframe (%i).\n", (int)prev->frame, ret);
+        nerrors++;
+      }
+    }
+  }
+  frame = key->frame;
+  for (packeti = key->packeti; packeti < s->npackets; packeti++) {
+    daala_image out;
+    if (od_seek_test_packet_in(dec, s, packeti) < 0) {
+      fprintf(stderr, "Packet %i was refused after restarting at frame %i.\n",
+       packeti, (int)key->frame);
+      return nerrors + 1;
+    }
+    while (daala_decode_img_out(dec, &out) > 0) {
+      if (frame >= s->nhashes || od_seek_test_hash(&out) != s->hashes[frame]) {
+        fprintf(stderr, "Frame %i differs after restarting at frame %i.\n",
+         (int)frame, (int)key->frame);
+        nerrors++;
+      }
+      frame++;
+    }
+  }
+  if (frame != s->nhashes) {
+    fprintf(stderr, "Restarting at frame %i output %i frames, not %i.\n",
+     (int)key->frame, (int)(frame - key->frame),
+     (int)(s->nhashes - key->frame));
+    nerrors++;
+  }
+  return nerrors;
+}
+
+/*Encodes and decodes a clip, indexes it, and restarts the decoder at each of
+   its keyframes.
+  Return: The number of failures.*/
+static int od_seek_test_clip(const od_seek_test_config *cfg) {
+  od_seek_test_stream *s;
+  daala_seek_point points[OD_SEEK_TEST_NFRAMES];
+  int keyframes[OD_SEEK_TEST_NFRAMES];
+  daala_setup_info *ds;
+  daala_dec_ctx *dec;
+  daala_info dinfo;
+  int nerrors;
+  int npoints;
+  int64_t frame;
+  int i;
+  s = (od_seek_test_stream *)calloc(1, sizeof(*s));
+  if (s == NULL) return 1;
+  ds = NULL;
+  dec = NULL;
+  nerrors = 0;
+  if (od_seek_test_encode(s, cfg, &dinfo, &dec, &ds)
+   || od_seek_test_scan(s, &dinfo)) {
+    fprintf(stderr, "Coding the clip failed.\n");
+    nerrors++;
+  }
+  else {
+    /*The packet number stands in for the page offset.*/
+    npoints = 0;
+    for (i = 0; i < s->nframes; i++) {
+      if (s->frames[i].is_keyframe) {
+        points[npoints].frame = s->frames[i].frame;
+        points[npoints].offset = s->frames[i].packeti;
+        points[npoints].skip = 0;
+        keyframes[npoints++] = i;
+      }
+    }
+    nerrors += od_seek_test_index(points, npoints);
+    /*Every frame must be reached from the last keyframe at or before it.*/
+    for (frame = 0; frame < s->nhashes; frame++) {
+      i = daala_seek_index_find(points, npoints, frame);
+      if (i < 0 || points[i].frame > frame
+       || (i + 1 < npoints && points[i + 1].frame <= frame)) {
+        fprintf(stderr, "Lookup of frame %i failed.\n", (int)frame);
+        nerrors++;
+      }
+    }
+    /*Restart the same decoder, which reached the end of the stream, from the
+       last keyframe back to the first.*/
+    for (i = npoints; i-- > 0; ) {
+      nerrors += od_seek_test_restart(dec, s, keyframes[i]);
+    }
+    printf("Version 0.%i, %i chunk rows, %i B-frames: %i packets, "
+     "%i keyframes, %i failures.\n", cfg->version_minor, cfg->chunk_rows,
+     cfg->b_frames, s->npackets, npoints, nerrors);
+  }
+  if (dec != NULL) daala_decode_free(dec);
+  daala_setup_free(ds);
+  for (i = 0; i < s->npackets; i++) free(s->packets[i]);
+  free(s);
+  return nerrors;
+}
+
+int main(void) {
+  int nerrors;
+  int i;
+  nerrors = od_seek_test_varints();
+  printf("Seek index: %i failures.\n", nerrors);
+  for (i = 0; i < OD_SEEK_TEST_NCONFIGS; i++) {
+    nerrors += od_seek_test_clip(OD_SEEK_TEST_CONFIGS + i);
+  }
+  return nerrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -124,7 +124,7 @@ void pvq_coder_bitstreams(int n, int type){
     adapt[OD_ADAPT_SUM_EX_Q8] = pvq_adapt.mean_sum_ex_q8;
     adapt[OD_ADAPT_COUNT_Q8] = pvq_adapt.mean_count_q8;
     adapt[OD_ADAPT_COUNT_EX_Q8] = pvq_adapt.mean_count_ex_q8;
-    laplace_decode_vector(&dec, y, n, k, adapt, adapt, "test");
+    laplace_decode_vector(&dec, y, n, k, adapt, adapt, 0);
     pvq_adapt.k = adapt[OD_ADAPT_K_Q8];
     pvq_adapt.sum_ex_q8 = adapt[OD_ADAPT_SUM_EX_Q8];
     pvq_adapt.count_q8 = adapt[OD_ADAPT_COUNT_Q8];
@@ -226,7 +226,7 @@ int run_pvq(od_coeff *X,int len,int N,int fuzz){
   {
     od_coeff y[MAXN];
     int K;
-    K=generic_decode(&dec, &model, -1, &EK, 4, "test");
+    K=generic_decode(&dec, &model, -1, &EK, 4, 0);
     if (!fuzz && K != Ki[i]) {
       fprintf(stderr, "mismatch for K of vector %d (N=%d)\n", i, N);
     }
@@ -234,7 +234,7 @@ int run_pvq(od_coeff *X,int len,int N,int fuzz){
     adapt[OD_ADAPT_SUM_EX_Q8] = pvq_adapt.mean_sum_ex_q8;
     adapt[OD_ADAPT_COUNT_Q8] = pvq_adapt.mean_count_q8;
     adapt[OD_ADAPT_COUNT_EX_Q8] = pvq_adapt.mean_count_ex_q8;
-    laplace_decode_vector(&dec, y, N, Ki[i], adapt, adapt, "test");
+    laplace_decode_vector(&dec, y, N, Ki[i], adapt, adapt, 0);
     pvq_adapt.k = adapt[OD_ADAPT_K_Q8];
     pvq_adapt.sum_ex_q8 = adapt[OD_ADAPT_SUM_EX_Q8];
     pvq_adapt.count_q8 = adapt[OD_ADAPT_COUNT_Q8];
@@ -371,6 +371,92 @@ void test_pvq_huge(int N) {
   free(X);
 }
 
+/* Round-trips random codewords through the run/magnitude coder used from
+   OD_STREAM_VERSION_MINOR_PVQ_RUNS on. The first two vectors are K=0 and a
+   single pulse at the last position; the rest range from one pulse to many
+   more pulses than positions so that both the run and magnitude modes (and
+   their escapes) get used. The coder only codes magnitudes. */
+void test_pvq_runs(int N, int len) {
+  od_pvq_codeword_ctx adapt;
+  od_ec_enc enc;
+  od_ec_dec dec;
+  unsigned char *buf;
+  uint32_t buf_sz;
+  int *X;
+  int *Ki;
+  int bits;
+  int i;
+  int j;
+  X = (int *)malloc(sizeof(*X)*N*len);
+  Ki = (int *)malloc(sizeof(*Ki)*len);
+  if (X == NULL || Ki == NULL) {
+    fprintf(stderr, "cannot allocate buffer\n");
+    abort();
+  }
+  for (i = 0; i < len; i++) {
+    int K;
+    for (j = 0; j < N; j++) X[i*N + j] = 0;
+    if (i == 0) K = 0;
+    else if (i == 1) {
+      K = 1 + rand()%64;
+      X[i*N + N - 1] = K;
+    }
+    else {
+      int npulses;
+      int p;
+      npulses = 1 + rand()%(rand() & 1 ? 4 : 4*N);
+      K = 0;
+      for (p = 0; p < npulses; p++) {
+        int m;
+        m = rand() & 7 ? 1 : 1 + rand()%40;
+        X[i*N + rand()%N] += m;
+        K += m;
+      }
+    }
+    Ki[i] = K;
+  }
+  adapt.pvq_run_increment = 128;
+  OD_CDFS_INIT(adapt.pvq_run_cdf, adapt.pvq_run_increment >> 1);
+  OD_CDFS_INIT(adapt.pvq_mag_cdf, adapt.pvq_run_increment >> 1);
+  od_ec_enc_init(&enc, EC_BUF_SIZE);
+  for (i = 0; i < len; i++) {
+    od_encode_band_pvq_runs(&enc, &adapt, &X[i*N], N, Ki[i]);
+    OD_ASSERT(!enc.error);
+  }
+  buf = od_ec_enc_done(&enc, &buf_sz);
+  bits = od_ec_enc_tell(&enc);
+  adapt.pvq_run_increment = 128;
+  OD_CDFS_INIT(adapt.pvq_run_cdf, adapt.pvq_run_increment >> 1);
+  OD_CDFS_INIT(adapt.pvq_mag_cdf, adapt.pvq_run_increment >> 1);
+  od_ec_dec_init(&dec, buf, buf_sz);
+  for (i = 0; i < len; i++) {
+    od_coeff y[MAXN];
+    od_decode_band_pvq_runs(&dec, &adapt, y, N, Ki[i]);
+    for (j = 0; j < N; j++) {
+      if (y[j] != X[i*N + j]) {
+        int k;
+        fprintf(stderr, "run coder mismatch for coef %d of vector %d "
+         "(N=%d, K=%d)\n", j, i, N, Ki[i]);
+        fprintf(stderr, "orig vector:\n");
+        for (k = 0; k < N; k++) fprintf(stderr, "%d ", X[i*N + k]);
+        fprintf(stderr, "\ndecoded vector:\n");
+        for (k = 0; k < N; k++) fprintf(stderr, "%d ", y[k]);
+        fprintf(stderr, "\n");
+        abort();
+      }
+    }
+  }
+  if (dec.error) {
+    fprintf(stderr, "run coder decoder error (N=%d)\n", N);
+    abort();
+  }
+  fprintf(stderr, "Coded %d dim with runs at %f bits/sample "
+   "(%1.4f bits/vector)\n", N, bits/(float)len/N, bits/(float)len);
+  od_ec_enc_clear(&enc);
+  free(Ki);
+  free(X);
+}
+
 int main(int argc, char **argv){
   if(argc==4){
     od_coeff *X;
@@ -434,6 +520,11 @@ int main(int argc, char **argv){
     test_pvq_sequence(10000,128,.03);
     test_pvq_sequence(10000,16,.03);
     test_pvq_sequence(10000,16,.1);
+    fprintf(stderr, "Testing the run coder\n");
+    for (i = 2; i < 18; i++) test_pvq_runs(i, 1000);
+    test_pvq_runs(64, 1000);
+    test_pvq_runs(128, 1000);
+    test_pvq_runs(MAXN, 200);
   }
   return 0;
 }
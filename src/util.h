@@ -30,6 +30,30 @@ typedef void (*od_copy_nxn_func)(unsigned char *_dst, int _dstride,
 
 extern const od_copy_nxn_func OD_COPY_NXN_8_C[OD_LOG_COPYBSIZE_MAX + 1];
 extern const od_copy_nxn_func OD_COPY_NXN_16_C[OD_LOG_COPYBSIZE_MAX + 1];
+void od_copy_2x2_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_4x4_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_8x8_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_16x16_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_32x32_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_64x64_8_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_2x2_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_4x4_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_8x8_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_16x16_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_32x32_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
+void od_copy_64x64_16_c(unsigned char *_dst, int _dstride,
+ const unsigned char *_src, int _sstride);
 void od_copy_nxm(unsigned char *_dst, int _dstride,
  const unsigned char *_src, int _sstride, int _log_n, int _log_m);
 #endif
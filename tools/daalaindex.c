@@ -0,0 +1,289 @@
+/*Daala video codec
+Copyright (c) 2016 Daala project contributors.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+
+/*Builds a keyframe seek index for the first Daala stream in an Ogg file.
+  See the seeking functions in daaladec.h for how a player uses it.*/
+
+#if !defined(_LARGEFILE_SOURCE)
+# define _LARGEFILE_SOURCE
+#endif
+#if !defined(_LARGEFILE64_SOURCE)
+# define _LARGEFILE64_SOURCE
+#endif
+#if !defined(_FILE_OFFSET_BITS)
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ogg/ogg.h>
+#include "../include/daala/codec.h"
+#include "../include/daala/daaladec.h"
+
+/*A page of the stream on which packets start that have not all been read
+   yet.*/
+typedef struct {
+  ogg_int64_t offset;
+  /*The number of packets that start on the page.*/
+  int starts;
+  /*The number of those already read.*/
+  int read;
+} index_page;
+
+/*Counts the packets that start on a page.*/
+static int page_packet_starts(const ogg_page *og) {
+  int nsegs;
+  int in_packet;
+  int starts;
+  int segi;
+  nsegs = og->header[26];
+  in_packet = ogg_page_continued(og);
+  starts = 0;
+  for (segi = 0; segi < nsegs; segi++) {
+    if (!in_packet) starts++;
+    in_packet = og->header[27 + segi] == 255;
+  }
+  return starts;
+}
+
+static int buffer_data(FILE *in, ogg_sync_state *oy) {
+  char *buffer;
+  size_t bytes;
+  buffer = ogg_sync_buffer(oy, 4096);
+  bytes = fread(buffer, 1, 4096, in);
+  ogg_sync_wrote(oy, (long)bytes);
+  return (int)bytes;
+}
+
+static void ogg_to_daala_packet(daala_packet *dp, const ogg_packet *op) {
+  dp->packet = op->packet;
+  dp->bytes = op->bytes;
+  dp->b_o_s = op->b_o_s;
+  dp->e_o_s = op->e_o_s;
+  dp->granulepos = op->granulepos;
+  dp->packetno = op->packetno;
+}
+
+int main(int argc, char **argv) {
+  FILE *in;
+  FILE *out;
+  ogg_sync_state oy;
+  ogg_stream_state to;
+  ogg_page og;
+  ogg_packet op;
+  daala_info di;
+  daala_comment dc;
+  daala_setup_info *ds;
+  daala_seek_point *points;
+  int npoints;
+  int cpoints;
+  index_page pages[2];
+  int npages;
+  ogg_int64_t offset;
+  ogg_int64_t max_frame;
+  ogg_int64_t nframes;
+  int have_stream;
+  int headers_left;
+  int frame_packets_left;
+  int done;
+  unsigned char *buf;
+  int buf_sz;
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <file.ogv> <index file>\n"
+     "Writes the keyframe seek index of the first Daala stream in "
+     "<file.ogv>.\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Unable to open '%s'.\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  ogg_sync_init(&oy);
+  daala_info_init(&di);
+  daala_comment_init(&dc);
+  ds = NULL;
+  points = NULL;
+  npoints = cpoints = 0;
+  npages = 0;
+  offset = 0;
+  max_frame = -1;
+  nframes = 0;
+  have_stream = 0;
+  headers_left = 1;
+  frame_packets_left = 0;
+  done = 0;
+  while (!done) {
+    long ret;
+    ret = ogg_sync_pageseek(&oy, &og);
+    if (ret == 0) {
+      if (buffer_data(in, &oy) == 0) break;
+      continue;
+    }
+    if (ret < 0) {
+      /*Skipped bytes that are not a page.*/
+      offset -= ret;
+      continue;
+    }
+    if (!have_stream) {
+      daala_info ti;
+      daala_comment tc;
+      daala_setup_info *ts;
+      if (!ogg_page_bos(&og)) {
+        fprintf(stderr, "No Daala stream found.\n");
+        return EXIT_FAILURE;
+      }
+      /*Identify the stream from its first packet, without consuming it.*/
+      ogg_stream_init(&to, ogg_page_serialno(&og));
+      ogg_stream_pagein(&to, &og);
+      if (ogg_stream_packetpeek(&to, &op) == 1) {
+        daala_packet dp;
+        daala_info_init(&ti);
+        daala_comment_init(&tc);
+        ts = NULL;
+        ogg_to_daala_packet(&dp, &op);
+        have_stream = daala_decode_header_in(&ti, &tc, &ts, &dp) >= 0;
+        daala_setup_free(ts);
+        daala_comment_clear(&tc);
+        daala_info_clear(&ti);
+      }
+      ogg_stream_reset(&to);
+      if (!have_stream) {
+        ogg_stream_clear(&to);
+        offset += ret;
+        continue;
+      }
+    }
+    if (ogg_stream_pagein(&to, &og) == 0) {
+      int starts;
+      starts = page_packet_starts(&og);
+      if (starts > 0) {
+        /*Packets are read as soon as they are complete, so at most the page
+           the last unfinished packet started on is left over.*/
+        if (npages >= 2) {
+          fprintf(stderr, "Invalid page structure.\n");
+          return EXIT_FAILURE;
+        }
+        pages[npages].offset = offset;
+        pages[npages].starts = starts;
+        pages[npages].read = 0;
+        npages++;
+      }
+      while (!done) {
+        daala_packet dp;
+        int pret;
+        pret = ogg_stream_packetout(&to, &op);
+        if (pret == 0) break;
+        if (pret < 0 || npages < 1) {
+          fprintf(stderr, "Missing data in the stream.\n");
+          return EXIT_FAILURE;
+        }
+        /*This packet started on the oldest page with unread packets.*/
+        pages[0].read++;
+        ogg_to_daala_packet(&dp, &op);
+        if (headers_left > 0) {
+          headers_left = daala_decode_header_in(&di, &dc, &ds, &dp);
+          if (headers_left < 0) {
+            fprintf(stderr, "Error parsing the Daala stream headers.\n");
+            return EXIT_FAILURE;
+          }
+        }
+        else if (frame_packets_left > 0) frame_packets_left--;
+        else {
+          daala_frame_header hdr;
+          ogg_int64_t frame;
+          if (daala_decode_frame_header(&di, &dp, &hdr) < 0) {
+            fprintf(stderr, "Invalid video packet %ld.\n", (long)op.packetno);
+            return EXIT_FAILURE;
+          }
+          frame_packets_left = hdr.npackets - 1;
+          /*Recover the display number from its low bits: reference frames
+             are displayed after every frame decoded so far, and B-frames
+             before the last reference frame.*/
+          if (hdr.is_b_frame) {
+            frame = max_frame - ((max_frame - hdr.frame_number - 1) & 15) - 1;
+          }
+          else {
+            frame = max_frame + ((hdr.frame_number - max_frame - 1) & 15) + 1;
+            max_frame = frame;
+          }
+          nframes++;
+          if (hdr.is_keyframe) {
+            if (npoints >= cpoints) {
+              cpoints = 2*cpoints + 16;
+              points = (daala_seek_point *)realloc(points,
+               cpoints*sizeof(*points));
+              if (points == NULL) {
+                fprintf(stderr, "Out of memory.\n");
+                return EXIT_FAILURE;
+              }
+            }
+            points[npoints].frame = frame;
+            points[npoints].offset = pages[0].offset;
+            points[npoints].skip = pages[0].read - 1;
+            npoints++;
+          }
+        }
+        if (pages[0].read == pages[0].starts) {
+          pages[0] = pages[1];
+          npages--;
+        }
+        done = op.e_o_s;
+      }
+    }
+    offset += ret;
+  }
+  fclose(in);
+  if (!have_stream) {
+    fprintf(stderr, "No Daala stream found.\n");
+    return EXIT_FAILURE;
+  }
+  buf_sz = daala_seek_index_pack(NULL, 0, points, npoints);
+  if (buf_sz < 0) {
+    fprintf(stderr, "Keyframes out of order.\n");
+    return EXIT_FAILURE;
+  }
+  buf = (unsigned char *)malloc(buf_sz);
+  if (buf == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  daala_seek_index_pack(buf, buf_sz, points, npoints);
+  out = fopen(argv[2], "wb");
+  if (out == NULL || fwrite(buf, 1, buf_sz, out) < (size_t)buf_sz) {
+    fprintf(stderr, "Unable to write '%s'.\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  fclose(out);
+  fprintf(stderr, "%ld frames, %d keyframes, %d byte index.\n",
+   (long)nframes, npoints, buf_sz);
+  free(buf);
+  free(points);
+  ogg_stream_clear(&to);
+  ogg_sync_clear(&oy);
+  daala_setup_free(ds);
+  daala_comment_clear(&dc);
+  daala_info_clear(&di);
+  return EXIT_SUCCESS;
+}